@@ -0,0 +1,531 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Adapters
+ *
+ * An adapter presents a variant of one type as a variant of another, related
+ * type, so readers can always use the type they expect, regardless of the
+ * version of the sender. Tuples and dict entries are matched by position:
+ * trailing members missing in the old type are read as their default value,
+ * trailing members missing in the new type are skipped. This applies
+ * recursively to the members of tuples, and the elements of arrays and
+ * maybes. Anything else must match exactly.
+ *
+ * The mapping between two types is compiled into a tree of nodes once, and
+ * cached for later use. Compiled mappings are immutable, and published in a
+ * fixed-size table without locks, so they can be shared between threads.
+ * They are never released.
+ *
+ * The adapted variant is assembled like a patched one (see
+ * c-variant-delta.c): it references the members taken from the old variant
+ * in place, and only the framing offsets, alignment padding and default
+ * values are generated. Members shorter than C_VARIANT_DELTA_MIN_COPY are
+ * copied, though, to keep the number of vectors low.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define C_VARIANT_ADAPT_CACHE (64)
+
+typedef struct CVariantAdapter CVariantAdapter;
+typedef struct CVariantAdaptNode CVariantAdaptNode;
+typedef struct CVariantAdaptState CVariantAdaptState;
+
+enum {
+        C_VARIANT_ADAPT_SAME,           /* identical types, referenced */
+        C_VARIANT_ADAPT_DEFAULT,        /* missing, default value */
+        C_VARIANT_ADAPT_TUPLE,          /* tuple or pair, by member */
+        C_VARIANT_ADAPT_ARRAY,          /* array, by element */
+        C_VARIANT_ADAPT_MAYBE,          /* maybe, by its child */
+};
+
+struct CVariantAdaptNode {
+        unsigned int kind;              /* C_VARIANT_ADAPT_* */
+        CVariantType info;              /* expected type */
+        CVariantType source;            /* type of the old variant, if any */
+        size_t n_source;                /* number of members taken */
+        size_t n_children;              /* number of children */
+        CVariantAdaptNode *children;    /* members, or element */
+};
+
+struct CVariantAdapter {
+        char *from;                     /* type of the old variant */
+        size_t n_from;                  /* length of @from */
+        char *to;                       /* expected type */
+        size_t n_to;                    /* length of @to */
+        CVariantAdaptNode root;         /* root node */
+};
+
+struct CVariantAdaptState {
+        CVariantDelta delta;            /* ops assembling the new variant */
+        size_t pos;                     /* size of the new variant so far */
+};
+
+static CVariantAdapter *c_variant_adapt_cache[C_VARIANT_ADAPT_CACHE];
+
+/*
+ * Compilation
+ * ===========
+ */
+
+static void c_variant_adapt_node_deinit(CVariantAdaptNode *node) {
+        size_t i;
+
+        for (i = 0; i < node->n_children; ++i)
+                c_variant_adapt_node_deinit(node->children + i);
+
+        free(node->children);
+}
+
+static int c_variant_adapt_compile(CVariantAdaptNode *node,
+                                   const CVariantType *to,
+                                   const CVariantType *from) {
+        CVariantType to_child, from_child;
+        size_t i, j, n_to, n_from;
+        bool has_from;
+        int r;
+
+        *node = (CVariantAdaptNode){ .info = *to };
+        if (from)
+                node->source = *from;
+
+        if (!from) {
+                /* only non-fixed tuples need to be generated member-wise */
+                if (to->size || (*to->type != C_VARIANT_TUPLE_OPEN && *to->type != C_VARIANT_PAIR_OPEN)) {
+                        node->kind = C_VARIANT_ADAPT_DEFAULT;
+                        return 0;
+                }
+        } else if (to->n_type == from->n_type && !strncmp(to->type, from->type, to->n_type)) {
+                node->kind = C_VARIANT_ADAPT_SAME;
+                return 0;
+        } else if (*to->type != *from->type) {
+                return -EBADRQC;
+        }
+
+        switch (*to->type) {
+        case C_VARIANT_TUPLE_OPEN:
+        case C_VARIANT_PAIR_OPEN:
+                for (i = 1, n_to = 0; i + 1 < to->n_type; i += to_child.n_type, ++n_to)
+                        c_variant_signature_next(to->type + i, to->n_type - 1 - i, &to_child);
+
+                n_from = 0;
+                if (from)
+                        for (i = 1; i + 1 < from->n_type; i += from_child.n_type, ++n_from)
+                                c_variant_signature_next(from->type + i, from->n_type - 1 - i, &from_child);
+
+                node->kind = C_VARIANT_ADAPT_TUPLE;
+                node->n_source = (n_from < n_to) ? n_from : n_to;
+                node->children = calloc(n_to ?: 1, sizeof(*node->children));
+                if (!node->children)
+                        return -ENOMEM;
+
+                for (i = 1, j = 1; node->n_children < n_to; ++node->n_children) {
+                        c_variant_signature_next(to->type + i, to->n_type - 1 - i, &to_child);
+                        i += to_child.n_type;
+
+                        has_from = (node->n_children < node->n_source);
+                        if (has_from) {
+                                c_variant_signature_next(from->type + j, from->n_type - 1 - j, &from_child);
+                                j += from_child.n_type;
+                        }
+
+                        r = c_variant_adapt_compile(node->children + node->n_children,
+                                                    &to_child,
+                                                    has_from ? &from_child : NULL);
+                        if (r < 0) {
+                                ++node->n_children;
+                                return r;
+                        }
+                }
+
+                return 0;
+        case C_VARIANT_ARRAY:
+        case C_VARIANT_MAYBE:
+                r = c_variant_signature_one(to->type + 1, to->n_type - 1, &to_child);
+                assert(!r);
+                r = c_variant_signature_one(from->type + 1, from->n_type - 1, &from_child);
+                assert(!r);
+
+                node->kind = (*to->type == C_VARIANT_ARRAY) ? C_VARIANT_ADAPT_ARRAY : C_VARIANT_ADAPT_MAYBE;
+                node->children = calloc(1, sizeof(*node->children));
+                if (!node->children)
+                        return -ENOMEM;
+
+                node->n_children = 1;
+                return c_variant_adapt_compile(node->children, &to_child, &from_child);
+        default:
+                return -EBADRQC;
+        }
+}
+
+static CVariantAdapter *c_variant_adapter_free(CVariantAdapter *adapter) {
+        if (!adapter)
+                return NULL;
+
+        c_variant_adapt_node_deinit(&adapter->root);
+        free(adapter->to);
+        free(adapter->from);
+        free(adapter);
+
+        return NULL;
+}
+
+static int c_variant_adapter_new(CVariantAdapter **adapterp,
+                                 const char *from,
+                                 size_t n_from,
+                                 const char *to,
+                                 size_t n_to) {
+        CVariantType from_info, to_info;
+        CVariantAdapter *adapter;
+        int r;
+
+        adapter = calloc(1, sizeof(*adapter));
+        if (!adapter)
+                return -ENOMEM;
+
+        adapter->from = strndup(from, n_from);
+        adapter->to = strndup(to, n_to);
+        if (!adapter->from || !adapter->to) {
+                c_variant_adapter_free(adapter);
+                return -ENOMEM;
+        }
+
+        adapter->n_from = n_from;
+        adapter->n_to = n_to;
+
+        r = c_variant_signature_one(adapter->from, n_from, &from_info);
+        assert(!r);
+        r = c_variant_signature_one(adapter->to, n_to, &to_info);
+        assert(!r);
+
+        r = c_variant_adapt_compile(&adapter->root, &to_info, &from_info);
+        if (r < 0) {
+                c_variant_adapter_free(adapter);
+                return r;
+        }
+
+        *adapterp = adapter;
+        return 0;
+}
+
+static bool c_variant_adapter_match(CVariantAdapter *adapter,
+                                    const char *from,
+                                    size_t n_from,
+                                    const char *to,
+                                    size_t n_to) {
+        return adapter->n_from == n_from && adapter->n_to == n_to &&
+               !memcmp(adapter->from, from, n_from) && !memcmp(adapter->to, to, n_to);
+}
+
+static int c_variant_adapter_get(CVariantAdapter **adapterp,
+                                 bool *cachedp,
+                                 const char *from,
+                                 size_t n_from,
+                                 const char *to,
+                                 size_t n_to) {
+        CVariantAdapter *adapter, *entry;
+        size_t i;
+        int r;
+
+        /*
+         * Look up the compiled mapping in the cache, or compile and insert it.
+         * Entries are only ever added, so a slot once set is stable. If the
+         * cache is full, the mapping is returned uncached, and the caller
+         * must release it.
+         */
+
+        for (i = 0; i < C_VARIANT_ADAPT_CACHE; ++i) {
+                entry = __atomic_load_n(&c_variant_adapt_cache[i], __ATOMIC_ACQUIRE);
+                if (!entry)
+                        break;
+
+                if (c_variant_adapter_match(entry, from, n_from, to, n_to)) {
+                        *adapterp = entry;
+                        *cachedp = true;
+                        return 0;
+                }
+        }
+
+        r = c_variant_adapter_new(&adapter, from, n_from, to, n_to);
+        if (r < 0)
+                return r;
+
+        for ( ; i < C_VARIANT_ADAPT_CACHE; ++i) {
+                entry = NULL;
+                if (__atomic_compare_exchange_n(&c_variant_adapt_cache[i], &entry, adapter,
+                                                false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                        *adapterp = adapter;
+                        *cachedp = true;
+                        return 0;
+                }
+
+                /* lost a race against another thread inserting the same mapping */
+                if (c_variant_adapter_match(entry, from, n_from, to, n_to)) {
+                        c_variant_adapter_free(adapter);
+                        *adapterp = entry;
+                        *cachedp = true;
+                        return 0;
+                }
+        }
+
+        *adapterp = adapter;
+        *cachedp = false;
+        return 0;
+}
+
+/*
+ * Assembly
+ * ========
+ */
+
+static int c_variant_adapt_bytes(CVariantAdaptState *state, const void *p, size_t n) {
+        int r;
+
+        r = c_variant_delta_bytes(&state->delta, p, n);
+        if (r < 0)
+                return r;
+
+        state->pos += n;
+        return 0;
+}
+
+static int c_variant_adapt_zero(CVariantAdaptState *state, size_t n) {
+        static const uint8_t zero[64];
+        size_t k;
+        int r;
+
+        for ( ; n > 0; n -= k) {
+                k = (n < sizeof(zero)) ? n : sizeof(zero);
+                r = c_variant_adapt_bytes(state, zero, k);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int c_variant_adapt_align(CVariantAdaptState *state, const CVariantType *info) {
+        return c_variant_adapt_zero(state, ALIGN_TO(state->pos, 1U << info->alignment) - state->pos);
+}
+
+static int c_variant_adapt_frames(CVariantAdaptState *state,
+                                  const size_t *frames,
+                                  size_t n_frames,
+                                  size_t len,
+                                  bool reverse) {
+        uint8_t word[8];
+        size_t i, j, wz;
+        int r;
+
+        wz = 1U << c_variant_word_size(len, n_frames);
+
+        for (i = 0; i < n_frames; ++i) {
+                for (j = 0; j < wz; ++j)
+                        word[j] = frames[reverse ? n_frames - i - 1 : i] >> (8 * j);
+
+                r = c_variant_adapt_bytes(state, word, wz);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int c_variant_adapt_default(CVariantAdaptState *state, const CVariantType *info) {
+        if (info->size)
+                return c_variant_adapt_zero(state, info->size);
+
+        switch (*info->type) {
+        case C_VARIANT_STRING:
+        case C_VARIANT_SIGNATURE:
+                return c_variant_adapt_bytes(state, "", 1);
+        case C_VARIANT_PATH:
+                return c_variant_adapt_bytes(state, "/", 2);
+        case C_VARIANT_VARIANT:
+                /* the unit value, a zero byte, and its type */
+                return c_variant_adapt_bytes(state, "\0\0()", 4);
+        default:
+                /* empty arrays and maybes */
+                return 0;
+        }
+}
+
+static int c_variant_adapt_node(CVariantAdaptState *state,
+                                const CVariantAdaptNode *node,
+                                size_t start,
+                                size_t end) {
+        CVariantDeltaChild *children = NULL;
+        const CVariantAdaptNode *child;
+        size_t i, base, n = 0, n_frames = 0, *frames = NULL;
+        int r;
+
+        switch (node->kind) {
+        case C_VARIANT_ADAPT_SAME:
+                r = c_variant_delta_copy(&state->delta, start, end - start);
+                if (r >= 0)
+                        state->pos += end - start;
+                return r;
+        case C_VARIANT_ADAPT_DEFAULT:
+                return c_variant_adapt_default(state, &node->info);
+        }
+
+        if (node->kind != C_VARIANT_ADAPT_TUPLE || node->n_source > 0) {
+                r = c_variant_delta_layout(state->delta.from, &node->source, start, end, &children, &n);
+                if (r < 0)
+                        return r;
+        }
+
+        if (node->kind == C_VARIANT_ADAPT_TUPLE)
+                n = node->n_children;
+
+        frames = malloc((n ?: 1) * sizeof(*frames));
+        if (!frames) {
+                r = -ENOMEM;
+                goto exit;
+        }
+
+        base = state->pos;
+
+        for (i = 0; i < n; ++i) {
+                child = node->children + ((node->kind == C_VARIANT_ADAPT_TUPLE) ? i : 0);
+
+                r = c_variant_adapt_align(state, &child->info);
+                if (r < 0)
+                        goto exit;
+
+                /* tuple members beyond the old type are generated */
+                if (node->kind == C_VARIANT_ADAPT_TUPLE && i >= node->n_source)
+                        r = c_variant_adapt_node(state, child, 0, 0);
+                else
+                        r = c_variant_adapt_node(state, child, children[i].start, children[i].end);
+                if (r < 0)
+                        goto exit;
+
+                /* tuples store no frame for their last member */
+                if (!child->info.size && (node->kind == C_VARIANT_ADAPT_ARRAY || i + 1 < n))
+                        frames[n_frames++] = state->pos - base;
+        }
+
+        switch (node->kind) {
+        case C_VARIANT_ADAPT_TUPLE:
+                if (node->info.size)
+                        r = c_variant_adapt_zero(state, base + node->info.size - state->pos);
+                else
+                        r = c_variant_adapt_frames(state, frames, n_frames, state->pos - base, true);
+                break;
+        case C_VARIANT_ADAPT_ARRAY:
+                r = c_variant_adapt_frames(state, frames, n_frames, state->pos - base, false);
+                break;
+        case C_VARIANT_ADAPT_MAYBE:
+                /* non-fixed children are followed by a zero byte */
+                r = (n && !node->children->info.size) ? c_variant_adapt_bytes(state, "", 1) : 0;
+                break;
+        default:
+                assert(0);
+                r = -EFAULT;
+                break;
+        }
+
+exit:
+        free(frames);
+        free(children);
+        return r;
+}
+
+/**
+ * c_variant_new_adapted() - adapt variant to expected type
+ * @cvp:        output variable for the new variant
+ * @type:       expected type
+ * @n_type:     length of @type
+ * @from:       sealed variant to adapt
+ *
+ * This returns a new, sealed variant of type @type, with the data of @from,
+ * which may be of a different, but related type. Tuples (and dict entries)
+ * are adapted member by member: members present in both types are taken
+ * over, members only present in @type get their default value (zero, an
+ * empty string or container, "/" for object paths, and the unit value for
+ * variants), and members only present in the type of @from are skipped. The
+ * elements of arrays and maybes are adapted the same way. All other types
+ * must match exactly.
+ *
+ * This allows readers to decode messages of older or newer versions of a
+ * protocol with the type they expect, as long as the protocol only ever
+ * appends members to its tuples.
+ *
+ * The mapping between the two types is computed once, and cached. The new
+ * variant references the members of @from, rather than copying them, so
+ * @from must stay accessible for the entire lifetime of the new variant.
+ * @from is rewound by this call.
+ *
+ * On success, the new variant is returned in @cvp. On failure, @cvp stays
+ * untouched.
+ *
+ * Return: 0 on success, -EBADRQC if the types cannot be adapted, -EBADMSG if
+ *         @from has invalid framing, negative error code on failure.
+ */
+_public_ int c_variant_new_adapted(CVariant **cvp, const char *type, size_t n_type, CVariant *from) {
+        CVariantAdaptState state = {};
+        CVariantAdapter *adapter;
+        void *free_data = NULL;
+        CVariantType info;
+        size_t n_data;
+        bool cached;
+        int r;
+
+        assert(from->sealed);
+
+        r = c_variant_signature_one(type, n_type, &info);
+        if (r < 0)
+                return r;
+
+        c_variant_rewind(from);
+
+        r = c_variant_adapter_get(&adapter, &cached, from->level.type, from->level.n_type, type, n_type);
+        if (r < 0)
+                return r;
+
+        r = c_variant_delta_flatten(from, &state.delta.from, &n_data, &free_data);
+        if (r < 0)
+                goto exit;
+
+        r = c_variant_adapt_node(&state, &adapter->root, 0, n_data);
+        if (r >= 0)
+                r = c_variant_delta_flush(&state.delta);
+        if (r >= 0)
+                r = c_variant_delta_assemble(from, type, n_type,
+                                             state.delta.ops, state.delta.n_ops,
+                                             state.delta.literal, state.delta.n_literal,
+                                             state.pos, cvp);
+
+exit:
+        free(state.delta.literal);
+        free(state.delta.ops);
+        free(free_data);
+        if (!cached)
+                c_variant_adapter_free(adapter);
+        return r;
+}
@@ -0,0 +1,345 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Checksums
+ *
+ * A variant can carry a checksum of its serialized data. Two algorithms are
+ * supported: CRC32C (hardware accelerated via the CPU dispatch table, see
+ * c-variant-cpu.c), and XXH64. Both are computed incrementally.
+ *
+ * For writers, the checksum is fused with serialization: The writer only ever
+ * appends to its front, and never modifies data behind it. Hence, the
+ * checksum state keeps a cursor into the iovec array, which trails the front.
+ * Every time the writer reserves new front space, everything between the
+ * cursor and the front is final, still hot in the cache, and is folded into
+ * the checksum. Sealing folds the remainder and finalizes the checksum, so no
+ * separate pass over the message is needed.
+ *
+ * For any other sealed variant, the checksum is computed in a single pass over
+ * its vectors, the same way c_variant_verify_checksum() verifies received data
+ * before it is parsed.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define C_VARIANT_XXH_PRIME1 UINT64_C(0x9e3779b185ebca87)
+#define C_VARIANT_XXH_PRIME2 UINT64_C(0xc2b2ae3d27d4eb4f)
+#define C_VARIANT_XXH_PRIME3 UINT64_C(0x165667b19e3779f9)
+#define C_VARIANT_XXH_PRIME4 UINT64_C(0x85ebca77c2b2ae63)
+#define C_VARIANT_XXH_PRIME5 UINT64_C(0x27d4eb2f165667c5)
+
+static uint64_t c_variant_xxh_rotl(uint64_t v, unsigned int n) {
+        return (v << n) | (v >> (64 - n));
+}
+
+static uint64_t c_variant_xxh_read64(const uint8_t *p) {
+        uint64_t v;
+
+        memcpy(&v, p, 8);
+        return le64toh(v);
+}
+
+static uint32_t c_variant_xxh_read32(const uint8_t *p) {
+        uint32_t v;
+
+        memcpy(&v, p, 4);
+        return le32toh(v);
+}
+
+static uint64_t c_variant_xxh_round(uint64_t acc, uint64_t v) {
+        acc += v * C_VARIANT_XXH_PRIME2;
+        acc = c_variant_xxh_rotl(acc, 31);
+        return acc * C_VARIANT_XXH_PRIME1;
+}
+
+static uint64_t c_variant_xxh_merge(uint64_t h, uint64_t acc) {
+        h ^= c_variant_xxh_round(0, acc);
+        return h * C_VARIANT_XXH_PRIME1 + C_VARIANT_XXH_PRIME4;
+}
+
+static void c_variant_xxh_stripe(uint64_t *acc, const uint8_t *p) {
+        acc[0] = c_variant_xxh_round(acc[0], c_variant_xxh_read64(p));
+        acc[1] = c_variant_xxh_round(acc[1], c_variant_xxh_read64(p + 8));
+        acc[2] = c_variant_xxh_round(acc[2], c_variant_xxh_read64(p + 16));
+        acc[3] = c_variant_xxh_round(acc[3], c_variant_xxh_read64(p + 24));
+}
+
+static void c_variant_sum_init(CVariantSum *sum, unsigned int kind) {
+        memset(sum, 0, sizeof(*sum));
+        sum->kind = kind;
+
+        switch (kind) {
+        case C_VARIANT_CHECKSUM_CRC32C:
+                sum->crc = UINT32_MAX;
+                break;
+        case C_VARIANT_CHECKSUM_XXH64:
+                sum->xxh.acc[0] = C_VARIANT_XXH_PRIME1 + C_VARIANT_XXH_PRIME2;
+                sum->xxh.acc[1] = C_VARIANT_XXH_PRIME2;
+                sum->xxh.acc[2] = 0;
+                sum->xxh.acc[3] = -C_VARIANT_XXH_PRIME1;
+                break;
+        default:
+                assert(0);
+                break;
+        }
+}
+
+static void c_variant_sum_update(CVariantSum *sum, const void *data, size_t n) {
+        const uint8_t *p = data;
+        size_t n_buf, k;
+
+        if (sum->kind == C_VARIANT_CHECKSUM_CRC32C) {
+                sum->crc = c_variant_cpu->crc32c(sum->crc, p, n);
+                sum->n_total += n;
+                return;
+        }
+
+        /* complete a partial stripe first, then consume full stripes */
+        n_buf = sum->n_total & 31;
+        sum->n_total += n;
+
+        if (n_buf) {
+                k = (n < 32 - n_buf) ? n : 32 - n_buf;
+                memcpy(sum->xxh.buf + n_buf, p, k);
+                p += k;
+                n -= k;
+
+                if (n_buf + k < 32)
+                        return;
+
+                c_variant_xxh_stripe(sum->xxh.acc, sum->xxh.buf);
+        }
+
+        for ( ; n >= 32; n -= 32, p += 32)
+                c_variant_xxh_stripe(sum->xxh.acc, p);
+
+        memcpy(sum->xxh.buf, p, n);
+}
+
+static void c_variant_sum_final(CVariantSum *sum) {
+        const uint8_t *p;
+        uint64_t h, *acc;
+        size_t n;
+
+        if (sum->kind == C_VARIANT_CHECKSUM_CRC32C) {
+                sum->result = ~sum->crc;
+                sum->final = true;
+                return;
+        }
+
+        acc = sum->xxh.acc;
+        if (sum->n_total >= 32) {
+                h = c_variant_xxh_rotl(acc[0], 1) +
+                    c_variant_xxh_rotl(acc[1], 7) +
+                    c_variant_xxh_rotl(acc[2], 12) +
+                    c_variant_xxh_rotl(acc[3], 18);
+                h = c_variant_xxh_merge(h, acc[0]);
+                h = c_variant_xxh_merge(h, acc[1]);
+                h = c_variant_xxh_merge(h, acc[2]);
+                h = c_variant_xxh_merge(h, acc[3]);
+        } else {
+                h = C_VARIANT_XXH_PRIME5;
+        }
+
+        h += sum->n_total;
+
+        p = sum->xxh.buf;
+        for (n = sum->n_total & 31; n >= 8; n -= 8, p += 8) {
+                h ^= c_variant_xxh_round(0, c_variant_xxh_read64(p));
+                h = c_variant_xxh_rotl(h, 27) * C_VARIANT_XXH_PRIME1 + C_VARIANT_XXH_PRIME4;
+        }
+        if (n >= 4) {
+                h ^= c_variant_xxh_read32(p) * C_VARIANT_XXH_PRIME1;
+                h = c_variant_xxh_rotl(h, 23) * C_VARIANT_XXH_PRIME2 + C_VARIANT_XXH_PRIME3;
+                n -= 4;
+                p += 4;
+        }
+        for ( ; n > 0; --n, ++p) {
+                h ^= *p * C_VARIANT_XXH_PRIME5;
+                h = c_variant_xxh_rotl(h, 11) * C_VARIANT_XXH_PRIME1;
+        }
+
+        h ^= h >> 33;
+        h *= C_VARIANT_XXH_PRIME2;
+        h ^= h >> 29;
+        h *= C_VARIANT_XXH_PRIME3;
+        h ^= h >> 32;
+
+        sum->result = h;
+        sum->final = true;
+}
+
+static void c_variant_sum_vecs(CVariantSum *sum, const struct iovec *vecs, size_t n_vecs) {
+        size_t i;
+
+        for (i = 0; i < n_vecs; ++i)
+                if (vecs[i].iov_len)
+                        c_variant_sum_update(sum, vecs[i].iov_base, vecs[i].iov_len);
+
+        c_variant_sum_final(sum);
+}
+
+int c_variant_sum_fold(CVariant *cv, bool final) {
+        CVariantLevel *level = &cv->level;
+        CVariantSum *sum = cv->sum;
+        struct iovec *v;
+        int r;
+
+        /*
+         * Fold everything between the checksum cursor and the current front
+         * into the checksum. Vectors behind the front are clipped to their
+         * final size, the front vector is only final up to @i_front. If
+         * @final is true, the writer is about to seal, and the checksum is
+         * finalized.
+         */
+
+        for ( ; sum->v_sum <= level->v_front; ++sum->v_sum, sum->i_sum = 0) {
+                v = cv->vecs + sum->v_sum;
+
+                if (sum->v_sum == level->v_front) {
+                        if (level->i_front > sum->i_sum)
+                                c_variant_sum_update(sum,
+                                                     (char *)v->iov_base + sum->i_sum,
+                                                     level->i_front - sum->i_sum);
+                        sum->i_sum = level->i_front;
+                        break;
+                }
+
+                if (v->iov_len > sum->i_sum) {
+                        if (_unlikely_(!v->iov_base)) {
+                                r = c_variant_file_map(cv, v);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        c_variant_sum_update(sum, (char *)v->iov_base + sum->i_sum, v->iov_len - sum->i_sum);
+                }
+        }
+
+        if (final)
+                c_variant_sum_final(sum);
+
+        return 0;
+}
+
+/**
+ * c_variant_set_checksum() - enable checksumming
+ * @cv:         variant to operate on
+ * @kind:       C_VARIANT_CHECKSUM_* algorithm
+ *
+ * This enables computation of a checksum of type @kind over the serialized
+ * data of @cv, which can be retrieved via c_variant_get_checksum() once @cv is
+ * sealed.
+ *
+ * If @cv is unsealed, the checksum is computed while @cv is written, and is
+ * finalized by c_variant_seal(). This can be enabled at any time before @cv is
+ * sealed, but is cheapest if done right after creation. If @cv is already
+ * sealed, the checksum is computed right away, in a single pass.
+ *
+ * If a checksum was already enabled, it is replaced.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_set_checksum(CVariant *cv, unsigned int kind) {
+        const struct iovec *vecs;
+        size_t n_vecs;
+        int r;
+
+        assert(kind == C_VARIANT_CHECKSUM_CRC32C || kind == C_VARIANT_CHECKSUM_XXH64);
+
+        if (!cv->sum) {
+                cv->sum = malloc(sizeof(*cv->sum));
+                if (!cv->sum)
+                        return c_variant_poison(cv, -ENOMEM);
+        }
+
+        c_variant_sum_init(cv->sum, kind);
+
+        if (cv->sealed) {
+                vecs = c_variant_get_vecs(cv, &n_vecs);
+                r = c_variant_return_poison(cv);
+                if (r < 0)
+                        return r;
+
+                c_variant_sum_vecs(cv->sum, vecs, n_vecs);
+        }
+
+        return 0;
+}
+
+/**
+ * c_variant_get_checksum() - retrieve checksum
+ * @cv:         variant to operate on
+ * @sump:       output storage for the checksum
+ *
+ * This returns the checksum enabled via c_variant_set_checksum(), in @sump.
+ * CRC32C checksums are returned in the low 32 bits.
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 on success, -ENODATA if no checksum was enabled, other negative
+ *         error code on failure.
+ */
+_public_ int c_variant_get_checksum(CVariant *cv, uint64_t *sump) {
+        int r;
+
+        assert(cv->sealed);
+
+        r = c_variant_return_poison(cv);
+        if (r < 0)
+                return r;
+
+        if (!cv->sum || !cv->sum->final)
+                return -ENODATA;
+
+        *sump = cv->sum->result;
+        return 0;
+}
+
+/**
+ * c_variant_verify_checksum() - verify checksum of serialized data
+ * @kind:       C_VARIANT_CHECKSUM_* algorithm
+ * @vecs:       data vectors
+ * @n_vecs:     number of vectors in @vecs
+ * @sum:        expected checksum
+ *
+ * This computes the checksum of type @kind over @vecs in a single pass, and
+ * compares it to @sum. It is meant to be used on received data, before it is
+ * passed to c_variant_new_from_vecs().
+ *
+ * Return: 0 if the checksum matches, -EBADMSG if not.
+ */
+_public_ int c_variant_verify_checksum(unsigned int kind, const struct iovec *vecs, size_t n_vecs, uint64_t sum) {
+        CVariantSum state;
+
+        assert(kind == C_VARIANT_CHECKSUM_CRC32C || kind == C_VARIANT_CHECKSUM_XXH64);
+
+        c_variant_sum_init(&state, kind);
+        c_variant_sum_vecs(&state, vecs, n_vecs);
+
+        return (state.result == sum) ? 0 : -EBADMSG;
+}
@@ -0,0 +1,698 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * CPU Dispatch
+ * ============
+ *
+ * The library is built for the baseline of its target architecture. However,
+ * some hot loops benefit from vector instructions that are only available on
+ * newer CPUs. Hence, each such kernel is provided in several implementations,
+ * which are collected in a CVariantCpu table. On library load, we select the
+ * best table supported by the running CPU. The selection can be overridden
+ * via the C_VARIANT_CPU environment variable, which is mostly useful for
+ * testing and benchmarking. If it names an unknown or unsupported
+ * implementation, it is ignored.
+ *
+ * All implementations must produce the exact same results as the scalar one.
+ * The vector implementations only handle full blocks and leave the remainder
+ * to the scalar implementation.
+ *
+ * Kernels:
+ *  - narrow_frames: Convert @n_frames framing offsets from their 64-bit native
+ *                   representation into little-endian words of size
+ *                   '1 << @wordsize', stored consecutively at @words. If
+ *                   @reverse is true, the frames are stored in reverse order.
+ *                   This is used by the writer to serialize the framing
+ *                   offsets of a completed container.
+ *  - crc32c: Continue the CRC32C (Castagnoli) register @crc over @n bytes at
+ *            @p. Pre- and post-conditioning is left to the caller. This is
+ *            used by checksums (see c-variant-checksum.c). There is no wider
+ *            implementation than SSE4.2, as every later level includes it.
+ *  - scan_signature: Classify @n_signature elements at @signature, and fold
+ *                    the result into @scan: whether any element is not valid
+ *                    in type strings (according to c_variant_elements),
+ *                    whether any bound container is used, and the bracket
+ *                    depth (opening brackets count +1, closing ones -1) at
+ *                    the end, as well as its extremes. This is used to
+ *                    reject untrusted types early, before they are parsed.
+ *  - copy_stream: Copy @n bytes from @src to @dst, bypassing the caches for
+ *                 the destination via non-temporal stores, if available. This
+ *                 is used to flatten large variants, which would otherwise
+ *                 evict the working set of the caller (see c_variant_flatten()).
+ *                 The copy is fenced before returning.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#  define C_VARIANT_CPU_X86 1
+#else
+#  define C_VARIANT_CPU_X86 0
+#endif
+
+/*
+ * Scalar
+ */
+
+static bool c_variant_cpu_supported_scalar(void) {
+        return true;
+}
+
+static void c_variant_cpu_narrow_frames_scalar(void *words,
+                                               const uint64_t *frames,
+                                               size_t n_frames,
+                                               size_t wordsize,
+                                               bool reverse) {
+        uint64_t frame;
+        size_t i;
+
+        for (i = 0; i < n_frames; ++i) {
+                frame = frames[reverse ? n_frames - i - 1 : i];
+
+                switch (wordsize) {
+                case 3: {
+                        uint64_t v = htole64(frame);
+                        memcpy((uint64_t *)words + i, &v, 8);
+                        break;
+                }
+                case 2: {
+                        uint32_t v = htole32((uint32_t)frame);
+                        memcpy((uint32_t *)words + i, &v, 4);
+                        break;
+                }
+                case 1: {
+                        uint16_t v = htole16((uint16_t)frame);
+                        memcpy((uint16_t *)words + i, &v, 2);
+                        break;
+                }
+                case 0:
+                        ((uint8_t *)words)[i] = (uint8_t)frame;
+                        break;
+                default:
+                        assert(0);
+                        return;
+                }
+        }
+}
+
+static const uint32_t c_variant_cpu_crc32c_table[256] = {
+        0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+        0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+        0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+        0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+        0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+        0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+        0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+        0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+        0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+        0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+        0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+        0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+        0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+        0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+        0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+        0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+        0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+        0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+        0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+        0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+        0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+        0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+        0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+        0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+        0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+        0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+        0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+        0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+        0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+        0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+        0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+        0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+        0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+        0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+        0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+        0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+        0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+        0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+        0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+        0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+        0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+        0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+        0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static uint32_t c_variant_cpu_crc32c_scalar(uint32_t crc, const void *p, size_t n) {
+        const uint8_t *b = p;
+
+        while (n--)
+                crc = c_variant_cpu_crc32c_table[(crc ^ *b++) & 0xff] ^ (crc >> 8);
+
+        return crc;
+}
+
+static void c_variant_cpu_scan_signature_scalar(const char *signature,
+                                                size_t n_signature,
+                                                CVariantSignatureScan *scan) {
+        size_t i;
+
+        for (i = 0; i < n_signature; ++i) {
+                switch (signature[i]) {
+                case C_VARIANT_TUPLE_OPEN:
+                case C_VARIANT_PAIR_OPEN:
+                        if (++scan->depth > scan->max_depth)
+                                scan->max_depth = scan->depth;
+                        break;
+                case C_VARIANT_TUPLE_CLOSE:
+                case C_VARIANT_PAIR_CLOSE:
+                        if (--scan->depth < scan->min_depth)
+                                scan->min_depth = scan->depth;
+                        break;
+                case C_VARIANT_ARRAY:
+                case C_VARIANT_MAYBE:
+                        scan->bound = true;
+                        break;
+                default:
+                        if (!c_variant_elements[(uint8_t)signature[i]].real)
+                                scan->invalid = true;
+                        break;
+                }
+        }
+}
+
+static void c_variant_cpu_copy_stream_scalar(void *dst, const void *src, size_t n) {
+        memcpy(dst, src, n);
+}
+
+#if C_VARIANT_CPU_X86
+
+/*
+ * Signatures are classified via a nibble lookup: both nibbles of each element
+ * are looked up in a table each, and the element is valid if the results
+ * share a bit. Every high nibble that occurs in valid elements has a bit
+ * assigned ('2', '6', '7'), and the low-nibble table has that bit set for
+ * each low nibble that forms a valid element with it. This must match the
+ * real entries of c_variant_elements. The bracket depth is computed as prefix
+ * sum of each block, offset by the depth before the block.
+ */
+
+static const int8_t c_variant_cpu_elements_lo[16] __attribute__((__aligned__(16))) = {
+        0, 6, 2, 4, 6, 4, 4, 2, 7, 7, 0, 4, 0, 6, 2, 2,
+};
+
+static const int8_t c_variant_cpu_elements_hi[16] __attribute__((__aligned__(16))) = {
+        0, 0, 1, 0, 0, 0, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+__attribute__((__target__("sse4.2")))
+static inline __m128i c_variant_cpu_classify_sse42(__m128i v, CVariantSignatureScan *scan) {
+        __m128i lo, hi, nibble, bound;
+
+        nibble = _mm_set1_epi8(0x0f);
+        lo = _mm_shuffle_epi8(_mm_load_si128((const __m128i *)c_variant_cpu_elements_lo),
+                              _mm_and_si128(v, nibble));
+        hi = _mm_shuffle_epi8(_mm_load_si128((const __m128i *)c_variant_cpu_elements_hi),
+                              _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())))
+                scan->invalid = true;
+
+        bound = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(C_VARIANT_ARRAY)),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8(C_VARIANT_MAYBE)));
+        if (_mm_movemask_epi8(bound))
+                scan->bound = true;
+
+        /* +1 for opening brackets, -1 for closing ones */
+        return _mm_sub_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(C_VARIANT_TUPLE_CLOSE)),
+                                         _mm_cmpeq_epi8(v, _mm_set1_epi8(C_VARIANT_PAIR_CLOSE))),
+                            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(C_VARIANT_TUPLE_OPEN)),
+                                         _mm_cmpeq_epi8(v, _mm_set1_epi8(C_VARIANT_PAIR_OPEN))));
+}
+
+__attribute__((__target__("sse4.2")))
+static inline void c_variant_cpu_depth_sse42(__m128i d, CVariantSignatureScan *scan) {
+        __m128i max, min;
+
+        /* prefix sum; the depth changes by at most 16, so 8 bits suffice */
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+        d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+
+        /* shifting in zeroes is fine, the initial depth is accounted already */
+        max = _mm_max_epi8(d, _mm_srli_si128(d, 8));
+        max = _mm_max_epi8(max, _mm_srli_si128(max, 4));
+        max = _mm_max_epi8(max, _mm_srli_si128(max, 2));
+        max = _mm_max_epi8(max, _mm_srli_si128(max, 1));
+        min = _mm_min_epi8(d, _mm_srli_si128(d, 8));
+        min = _mm_min_epi8(min, _mm_srli_si128(min, 4));
+        min = _mm_min_epi8(min, _mm_srli_si128(min, 2));
+        min = _mm_min_epi8(min, _mm_srli_si128(min, 1));
+
+        if (scan->depth + (int8_t)_mm_extract_epi8(max, 0) > scan->max_depth)
+                scan->max_depth = scan->depth + (int8_t)_mm_extract_epi8(max, 0);
+        if (scan->depth + (int8_t)_mm_extract_epi8(min, 0) < scan->min_depth)
+                scan->min_depth = scan->depth + (int8_t)_mm_extract_epi8(min, 0);
+
+        scan->depth += (int8_t)_mm_extract_epi8(d, 15);
+}
+
+/*
+ * SSE4.2
+ *
+ * Each block consists of 2 frames. They are narrowed via a byte-shuffle, which
+ * also reverses them, if requested.
+ */
+
+static const int8_t c_variant_cpu_masks_sse[3][2][16] __attribute__((__aligned__(16))) = {
+        {
+                { 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+                { 8, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        }, {
+                { 0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+                { 8, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        }, {
+                { 0, 1, 2, 3, 8, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1 },
+                { 8, 9, 10, 11, 0, 1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1 },
+        },
+};
+
+static bool c_variant_cpu_supported_sse42(void) {
+        return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((__target__("sse4.2")))
+static void c_variant_cpu_narrow_frames_sse42(void *words,
+                                              const uint64_t *frames,
+                                              size_t n_frames,
+                                              size_t wordsize,
+                                              bool reverse) {
+        size_t i, n_block;
+        __m128i v, mask;
+
+        if (wordsize > 2)
+                goto tail;
+
+        n_block = 2 << wordsize;
+        mask = _mm_load_si128((const __m128i *)c_variant_cpu_masks_sse[wordsize][reverse]);
+
+        for (i = 0; i + 2 <= n_frames; i += 2) {
+                v = _mm_loadu_si128((const __m128i *)(reverse ? frames + n_frames - i - 2 : frames + i));
+                v = _mm_shuffle_epi8(v, mask);
+                memcpy((char *)words + i * (1 << wordsize), &v, n_block);
+        }
+
+        words = (char *)words + i * (1 << wordsize);
+        if (!reverse)
+                frames += i;
+        n_frames -= i;
+
+tail:
+        c_variant_cpu_narrow_frames_scalar(words, frames, n_frames, wordsize, reverse);
+}
+
+__attribute__((__target__("sse4.2")))
+static uint32_t c_variant_cpu_crc32c_sse42(uint32_t crc, const void *p, size_t n) {
+        const uint8_t *b = p;
+        uint64_t c = crc, v;
+
+        for ( ; n >= 8; n -= 8, b += 8) {
+                memcpy(&v, b, 8);
+                c = _mm_crc32_u64(c, v);
+        }
+
+        for ( ; n > 0; --n)
+                c = _mm_crc32_u8(c, *b++);
+
+        return c;
+}
+
+__attribute__((__target__("sse4.2")))
+static void c_variant_cpu_scan_signature_sse42(const char *signature,
+                                               size_t n_signature,
+                                               CVariantSignatureScan *scan) {
+        __m128i v;
+        size_t i;
+
+        for (i = 0; i + 16 <= n_signature; i += 16) {
+                v = _mm_loadu_si128((const __m128i *)(signature + i));
+                v = c_variant_cpu_classify_sse42(v, scan);
+
+                /* skip the prefix sums, unless brackets are present */
+                if (!_mm_testz_si128(v, v))
+                        c_variant_cpu_depth_sse42(v, scan);
+        }
+
+        c_variant_cpu_scan_signature_scalar(signature + i, n_signature - i, scan);
+}
+
+__attribute__((__target__("sse4.2")))
+static void c_variant_cpu_copy_stream_sse42(void *dst, const void *src, size_t n) {
+        const char *s = src;
+        char *d = dst;
+        __m128i v[4];
+        size_t head;
+
+        /* streaming stores must be aligned; loads need not be */
+        head = -(uintptr_t)d & 15;
+        if (head > n)
+                head = n;
+
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+
+        for ( ; n >= 64; n -= 64, d += 64, s += 64) {
+                v[0] = _mm_loadu_si128((const __m128i *)s);
+                v[1] = _mm_loadu_si128((const __m128i *)s + 1);
+                v[2] = _mm_loadu_si128((const __m128i *)s + 2);
+                v[3] = _mm_loadu_si128((const __m128i *)s + 3);
+                _mm_stream_si128((__m128i *)d, v[0]);
+                _mm_stream_si128((__m128i *)d + 1, v[1]);
+                _mm_stream_si128((__m128i *)d + 2, v[2]);
+                _mm_stream_si128((__m128i *)d + 3, v[3]);
+        }
+
+        _mm_sfence();
+        memcpy(d, s, n);
+}
+
+/*
+ * AVX2
+ *
+ * Each block consists of 4 frames. Byte-shuffles operate on each 128-bit lane
+ * individually, so each lane places its narrowed frames at their final
+ * position with all other bytes cleared. Then both lanes are merged.
+ */
+
+static const int8_t c_variant_cpu_masks_avx2[3][2][32] __attribute__((__aligned__(32))) = {
+        {
+                { 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                  -1, -1, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+                { -1, -1, 8, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                  8, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        }, {
+                { 0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                  -1, -1, -1, -1, 0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1 },
+                { -1, -1, -1, -1, 8, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1,
+                  8, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        }, {
+                { 0, 1, 2, 3, 8, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1,
+                  -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 2, 3, 8, 9, 10, 11 },
+                { -1, -1, -1, -1, -1, -1, -1, -1, 8, 9, 10, 11, 0, 1, 2, 3,
+                  8, 9, 10, 11, 0, 1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1 },
+        },
+};
+
+static bool c_variant_cpu_supported_avx2(void) {
+        return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((__target__("avx2")))
+static void c_variant_cpu_narrow_frames_avx2(void *words,
+                                             const uint64_t *frames,
+                                             size_t n_frames,
+                                             size_t wordsize,
+                                             bool reverse) {
+        size_t i, n_block;
+        __m256i v, mask;
+        __m128i w;
+
+        if (wordsize > 2)
+                goto tail;
+
+        n_block = 4 << wordsize;
+        mask = _mm256_load_si256((const __m256i *)c_variant_cpu_masks_avx2[wordsize][reverse]);
+
+        for (i = 0; i + 4 <= n_frames; i += 4) {
+                v = _mm256_loadu_si256((const __m256i *)(reverse ? frames + n_frames - i - 4 : frames + i));
+                v = _mm256_shuffle_epi8(v, mask);
+                w = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+                memcpy((char *)words + i * (1 << wordsize), &w, n_block);
+        }
+
+        words = (char *)words + i * (1 << wordsize);
+        if (!reverse)
+                frames += i;
+        n_frames -= i;
+
+tail:
+        c_variant_cpu_narrow_frames_scalar(words, frames, n_frames, wordsize, reverse);
+}
+
+__attribute__((__target__("avx2")))
+static void c_variant_cpu_scan_signature_avx2(const char *signature,
+                                              size_t n_signature,
+                                              CVariantSignatureScan *scan) {
+        __m256i v, valid, lo, hi, nibble, bound, open, close;
+        size_t i;
+
+        /*
+         * Classify blocks of 32 elements at once. The byte-shuffles operate on
+         * each 128-bit lane individually, so the nibble tables are duplicated
+         * into both lanes. The prefix sums are built per lane, as well.
+         */
+
+        nibble = _mm256_set1_epi8(0x0f);
+        lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)c_variant_cpu_elements_lo));
+        hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)c_variant_cpu_elements_hi));
+
+        for (i = 0; i + 32 <= n_signature; i += 32) {
+                v = _mm256_loadu_si256((const __m256i *)(signature + i));
+
+                valid = _mm256_and_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+                                         _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4),
+                                                                                  nibble)));
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(valid, _mm256_setzero_si256())))
+                        scan->invalid = true;
+
+                bound = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(C_VARIANT_ARRAY)),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(C_VARIANT_MAYBE)));
+                if (_mm256_movemask_epi8(bound))
+                        scan->bound = true;
+
+                open = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(C_VARIANT_TUPLE_OPEN)),
+                                       _mm256_cmpeq_epi8(v, _mm256_set1_epi8(C_VARIANT_PAIR_OPEN)));
+                close = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(C_VARIANT_TUPLE_CLOSE)),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(C_VARIANT_PAIR_CLOSE)));
+
+                /* skip the prefix sums, unless brackets are present */
+                if (!_mm256_movemask_epi8(_mm256_or_si256(open, close)))
+                        continue;
+
+                v = _mm256_sub_epi8(close, open);
+                c_variant_cpu_depth_sse42(_mm256_castsi256_si128(v), scan);
+                c_variant_cpu_depth_sse42(_mm256_extracti128_si256(v, 1), scan);
+        }
+
+        c_variant_cpu_scan_signature_scalar(signature + i, n_signature - i, scan);
+}
+
+__attribute__((__target__("avx2")))
+static void c_variant_cpu_copy_stream_avx2(void *dst, const void *src, size_t n) {
+        const char *s = src;
+        char *d = dst;
+        __m256i v[4];
+        size_t head;
+
+        head = -(uintptr_t)d & 31;
+        if (head > n)
+                head = n;
+
+        memcpy(d, s, head);
+        d += head;
+        s += head;
+        n -= head;
+
+        for ( ; n >= 128; n -= 128, d += 128, s += 128) {
+                v[0] = _mm256_loadu_si256((const __m256i *)s);
+                v[1] = _mm256_loadu_si256((const __m256i *)s + 1);
+                v[2] = _mm256_loadu_si256((const __m256i *)s + 2);
+                v[3] = _mm256_loadu_si256((const __m256i *)s + 3);
+                _mm256_stream_si256((__m256i *)d, v[0]);
+                _mm256_stream_si256((__m256i *)d + 1, v[1]);
+                _mm256_stream_si256((__m256i *)d + 2, v[2]);
+                _mm256_stream_si256((__m256i *)d + 3, v[3]);
+        }
+
+        _mm_sfence();
+        memcpy(d, s, n);
+}
+
+/*
+ * AVX-512
+ *
+ * Each block consists of 8 frames. AVX-512F provides dedicated narrowing
+ * instructions, so only the reversal needs a permutation. The zero-masked
+ * variants are used, since the unmasked ones are built on undefined vectors
+ * and trigger false-positive -Wmaybe-uninitialized warnings with some
+ * compilers.
+ */
+
+static bool c_variant_cpu_supported_avx512(void) {
+        return __builtin_cpu_supports("avx512f");
+}
+
+__attribute__((__target__("avx512f")))
+static void c_variant_cpu_narrow_frames_avx512(void *words,
+                                               const uint64_t *frames,
+                                               size_t n_frames,
+                                               size_t wordsize,
+                                               bool reverse) {
+        __m512i v, order;
+        __m256i w32;
+        __m128i w16;
+        size_t i;
+
+        order = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+
+        for (i = 0; i + 8 <= n_frames; i += 8) {
+                v = _mm512_loadu_si512(reverse ? frames + n_frames - i - 8 : frames + i);
+                if (reverse)
+                        v = _mm512_maskz_permutexvar_epi64(0xff, order, v);
+
+                switch (wordsize) {
+                case 3:
+                        _mm512_storeu_si512((uint64_t *)words + i, v);
+                        break;
+                case 2:
+                        w32 = _mm512_maskz_cvtepi64_epi32(0xff, v);
+                        _mm256_storeu_si256((__m256i *)((uint32_t *)words + i), w32);
+                        break;
+                case 1:
+                        w16 = _mm512_maskz_cvtepi64_epi16(0xff, v);
+                        _mm_storeu_si128((__m128i *)((uint16_t *)words + i), w16);
+                        break;
+                case 0:
+                        w16 = _mm512_maskz_cvtepi64_epi8(0xff, v);
+                        _mm_storel_epi64((__m128i *)((uint8_t *)words + i), w16);
+                        break;
+                default:
+                        assert(0);
+                        return;
+                }
+        }
+
+        c_variant_cpu_narrow_frames_scalar((char *)words + i * (1 << wordsize),
+                                           reverse ? frames : frames + i,
+                                           n_frames - i,
+                                           wordsize,
+                                           reverse);
+}
+
+#endif /* C_VARIANT_CPU_X86 */
+
+/*
+ * Dispatch
+ */
+
+const CVariantCpu c_variant_cpus[] = {
+        {
+                .name = "scalar",
+                .supported = c_variant_cpu_supported_scalar,
+                .narrow_frames = c_variant_cpu_narrow_frames_scalar,
+                .crc32c = c_variant_cpu_crc32c_scalar,
+                .scan_signature = c_variant_cpu_scan_signature_scalar,
+                .copy_stream = c_variant_cpu_copy_stream_scalar,
+        },
+#if C_VARIANT_CPU_X86
+        {
+                .name = "sse4.2",
+                .supported = c_variant_cpu_supported_sse42,
+                .narrow_frames = c_variant_cpu_narrow_frames_sse42,
+                .crc32c = c_variant_cpu_crc32c_sse42,
+                .scan_signature = c_variant_cpu_scan_signature_sse42,
+                .copy_stream = c_variant_cpu_copy_stream_sse42,
+        },
+        {
+                .name = "avx2",
+                .supported = c_variant_cpu_supported_avx2,
+                .narrow_frames = c_variant_cpu_narrow_frames_avx2,
+                .crc32c = c_variant_cpu_crc32c_sse42,
+                .scan_signature = c_variant_cpu_scan_signature_avx2,
+                .copy_stream = c_variant_cpu_copy_stream_avx2,
+        },
+        {
+                .name = "avx512",
+                .supported = c_variant_cpu_supported_avx512,
+                .narrow_frames = c_variant_cpu_narrow_frames_avx512,
+                .crc32c = c_variant_cpu_crc32c_sse42,
+                .scan_signature = c_variant_cpu_scan_signature_avx2,
+                .copy_stream = c_variant_cpu_copy_stream_avx2,
+        },
+#endif
+};
+
+const size_t c_variant_n_cpus = sizeof(c_variant_cpus) / sizeof(*c_variant_cpus);
+
+/* scalar until selected on library load, in case constructors run late */
+const CVariantCpu *c_variant_cpu = c_variant_cpus;
+
+int c_variant_cpu_select(const char *name) {
+        size_t i;
+
+        /*
+         * Select the implementation called @name for all following
+         * operations. This is not thread-safe and should only be used for
+         * testing. Returns -ENOENT if @name is unknown, and -EOPNOTSUPP if the
+         * running CPU does not support it.
+         */
+
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                if (strcmp(c_variant_cpus[i].name, name))
+                        continue;
+                if (!c_variant_cpus[i].supported())
+                        return -EOPNOTSUPP;
+
+                c_variant_cpu = c_variant_cpus + i;
+                return 0;
+        }
+
+        return -ENOENT;
+}
+
+__attribute__((__constructor__))
+static void c_variant_cpu_init(void) {
+        const char *name;
+        size_t i;
+
+#if C_VARIANT_CPU_X86
+        /* required if called before the constructors of libgcc */
+        __builtin_cpu_init();
+#endif
+
+        name = secure_getenv("C_VARIANT_CPU");
+        if (name && c_variant_cpu_select(name) >= 0)
+                return;
+
+        /* the table is ordered by preference; pick the last supported entry */
+        for (i = c_variant_n_cpus; i-- > 0; ) {
+                if (c_variant_cpus[i].supported()) {
+                        c_variant_cpu = c_variant_cpus + i;
+                        break;
+                }
+        }
+}
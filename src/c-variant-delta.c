@@ -0,0 +1,1073 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Deltas
+ *
+ * A delta describes how to assemble the serialization of a variant from the
+ * serialization of another variant of the same type. It is a sequence of ops,
+ * each of which either copies a byte range of the old variant, or takes the
+ * next bytes of a literal blob carried in the delta. The delta is itself
+ * serialized as a GVariant of type C_VARIANT_DELTA_TYPE:
+ *
+ *     (
+ *       s          type of both variants
+ *       t          total size of the old variant
+ *       t          total size of the new variant
+ *       a(tt)      ops, as (offset, size), where an offset of
+ *                  C_VARIANT_DELTA_LITERAL takes literal bytes instead
+ *       ay         literal bytes, consumed in order
+ *     )
+ *
+ * Deltas are computed by walking both variants in parallel. Elements that are
+ * byte-wise identical are copied as a whole. Otherwise, containers are split
+ * into their members, which are paired and compared recursively: tuple and
+ * dict entry members by position, array elements by index, and dictionary
+ * entries by their key. Everything in between, that is alignment padding and
+ * framing offsets, is copied if it happens to be unchanged, and sent
+ * literally otherwise. Copies shorter than C_VARIANT_DELTA_MIN_COPY are sent
+ * as literals as well, since an op costs more than the bytes it saves.
+ *
+ * The layout is decoded by hand, rather than via the reader, since the reader
+ * does not expose where elements are located. Elements with invalid framing
+ * are not split, but sent literally.
+ *
+ * Patching assembles the new variant as a list of iovecs, which reference
+ * the unchanged ranges of the old variant, and only copies the literal bytes.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define C_VARIANT_DELTA_TYPE "(stta(tt)ay)"
+/*
+ * Layouts
+ * =======
+ */
+
+static size_t c_variant_delta_word(const uint8_t *data, size_t offset, size_t word) {
+        uint64_t v64;
+        uint32_t v32;
+        uint16_t v16;
+
+        switch (word) {
+        case 1:
+                return data[offset];
+        case 2:
+                memcpy(&v16, data + offset, sizeof(v16));
+                return le16toh(v16);
+        case 4:
+                memcpy(&v32, data + offset, sizeof(v32));
+                return le32toh(v32);
+        default:
+                memcpy(&v64, data + offset, sizeof(v64));
+                return le64toh(v64);
+        }
+}
+
+static int c_variant_delta_layout_tuple(const uint8_t *data,
+                                        const CVariantType *info,
+                                        size_t start,
+                                        size_t end,
+                                        CVariantDeltaChild *children,
+                                        size_t *n_childrenp) {
+        const char *inner = info->type + 1;
+        size_t n_inner = info->n_type - 2;
+        size_t i, n, len, pos, aligned, limit, mend, word = 0, n_frames;
+        CVariantType member;
+
+        len = end - start;
+
+        for (i = 0, n_frames = 0;
+             c_variant_signature_next(inner + i, n_inner - i, &member) > 0;
+             i += member.n_type)
+                if (!member.size && i + member.n_type < n_inner)
+                        ++n_frames;
+
+        if (info->size) {
+                if (len != info->size)
+                        return -EBADMSG;
+                limit = len;
+        } else {
+                word = 1U << c_variant_word_size(len, 0);
+                if (n_frames > len / word)
+                        return -EBADMSG;
+                limit = len - n_frames * word;
+        }
+
+        for (i = 0, n = 0, pos = 0, n_frames = 0;
+             c_variant_signature_next(inner + i, n_inner - i, &member) > 0;
+             i += member.n_type, ++n) {
+                aligned = ALIGN_TO(pos, 1U << member.alignment);
+
+                if (member.size)
+                        mend = aligned + member.size;
+                else if (i + member.n_type >= n_inner)
+                        mend = limit;
+                else
+                        mend = c_variant_delta_word(data, start + len - ++n_frames * word, word);
+
+                /* empty, non-fixed members need not be aligned */
+                if (!member.size && mend == pos)
+                        aligned = pos;
+                else if (aligned > mend || mend > limit)
+                        return -EBADMSG;
+
+                children[n] = (CVariantDeltaChild){ member.type, member.n_type, start + aligned, start + mend };
+                pos = mend;
+        }
+
+        *n_childrenp = n;
+        return 0;
+}
+
+static int c_variant_delta_layout_array(const uint8_t *data,
+                                        const CVariantType *info,
+                                        size_t start,
+                                        size_t end,
+                                        CVariantDeltaChild **childrenp,
+                                        size_t *n_childrenp) {
+        size_t i, n, len, pos, aligned, eend, frames = 0, word = 0;
+        CVariantDeltaChild *children;
+        CVariantType elem;
+        int r;
+
+        len = end - start;
+        r = c_variant_signature_one(info->type + 1, info->n_type - 1, &elem);
+        assert(!r);
+
+        if (elem.size) {
+                if (len % elem.size)
+                        return -EBADMSG;
+                n = len / elem.size;
+        } else if (len) {
+                word = 1U << c_variant_word_size(len, 0);
+                frames = len >= word ? c_variant_delta_word(data, end - word, word) : len + 1;
+                if (frames > len || (len - frames) % word)
+                        return -EBADMSG;
+                n = (len - frames) / word;
+        } else {
+                n = 0;
+        }
+
+        children = malloc((n ?: 1) * sizeof(*children));
+        if (!children)
+                return -ENOMEM;
+
+        for (i = 0, pos = 0; i < n; ++i) {
+                if (elem.size) {
+                        children[i] = (CVariantDeltaChild){ elem.type, elem.n_type,
+                                                            start + i * elem.size,
+                                                            start + (i + 1) * elem.size };
+                        continue;
+                }
+
+                eend = c_variant_delta_word(data, start + frames + i * word, word);
+                aligned = ALIGN_TO(pos, 1U << elem.alignment);
+
+                if (eend == pos) {
+                        aligned = pos;
+                } else if (aligned > eend || eend > frames) {
+                        free(children);
+                        return -EBADMSG;
+                }
+
+                children[i] = (CVariantDeltaChild){ elem.type, elem.n_type, start + aligned, start + eend };
+                pos = eend;
+        }
+
+        *childrenp = children;
+        *n_childrenp = n;
+        return 0;
+}
+
+int c_variant_delta_layout(const uint8_t *data,
+                           const CVariantType *info,
+                           size_t start,
+                           size_t end,
+                           CVariantDeltaChild **childrenp,
+                           size_t *n_childrenp) {
+        CVariantDeltaChild *children;
+        CVariantType child;
+        size_t i, n, len;
+        int r;
+
+        /*
+         * Split the element of type @info at [@start, @end) into its children,
+         * and return them in @childrenp, ordered by their position. Anything
+         * not covered by a child is padding or framing. Basic types have no
+         * children. If the framing is invalid, -EBADMSG is returned.
+         */
+
+        len = end - start;
+
+        switch (*info->type) {
+        case C_VARIANT_TUPLE_OPEN:
+        case C_VARIANT_PAIR_OPEN:
+                for (i = 1, n = 0; i + 1 < info->n_type; i += child.n_type, ++n) {
+                        r = c_variant_signature_next(info->type + i, info->n_type - 1 - i, &child);
+                        assert(r == 1);
+                }
+
+                children = malloc((n ?: 1) * sizeof(*children));
+                if (!children)
+                        return -ENOMEM;
+
+                r = c_variant_delta_layout_tuple(data, info, start, end, children, &n);
+                if (r < 0) {
+                        free(children);
+                        return r;
+                }
+                break;
+        case C_VARIANT_ARRAY:
+                return c_variant_delta_layout_array(data, info, start, end, childrenp, n_childrenp);
+        case C_VARIANT_MAYBE:
+                children = malloc(sizeof(*children));
+                if (!children)
+                        return -ENOMEM;
+
+                r = c_variant_signature_one(info->type + 1, info->n_type - 1, &child);
+                assert(!r);
+
+                if (!len) {
+                        n = 0;
+                } else if (child.size) {
+                        if (len != child.size) {
+                                free(children);
+                                return -EBADMSG;
+                        }
+                        children[0] = (CVariantDeltaChild){ child.type, child.n_type, start, end };
+                        n = 1;
+                } else {
+                        children[0] = (CVariantDeltaChild){ child.type, child.n_type, start, end - 1 };
+                        n = 1;
+                }
+                break;
+        case C_VARIANT_VARIANT:
+                for (i = len; i > 0; --i)
+                        if (!data[start + i - 1])
+                                break;
+
+                r = i ? c_variant_signature_one((const char *)data + start + i, len - i, &child) : -EBADMSG;
+                if (r < 0)
+                        return -EBADMSG;
+
+                children = malloc(sizeof(*children));
+                if (!children)
+                        return -ENOMEM;
+
+                children[0] = (CVariantDeltaChild){ child.type, child.n_type, start, start + i - 1 };
+                n = 1;
+                break;
+        default:
+                children = NULL;
+                n = 0;
+                break;
+        }
+
+        *childrenp = children;
+        *n_childrenp = n;
+        return 0;
+}
+
+/*
+ * Dictionaries
+ * ============
+ */
+
+static bool c_variant_delta_key(const uint8_t *data, const CVariantDeltaChild *entry, size_t *endp) {
+        CVariantType key;
+        size_t len, word;
+        int r;
+
+        /*
+         * Return the end of the key of the dict entry @entry in @endp. The key
+         * is always the first member, so it starts with the entry. Non-fixed
+         * keys are followed by other members, so their end is stored in the
+         * last framing offset of the entry.
+         */
+
+        r = c_variant_signature_next(entry->type + 1, entry->n_type - 2, &key);
+        assert(r == 1);
+
+        len = entry->end - entry->start;
+        if (key.size) {
+                *endp = entry->start + key.size;
+                return key.size <= len;
+        }
+
+        if (!len)
+                return false;
+
+        word = 1U << c_variant_word_size(len, 0);
+        if (word > len)
+                return false;
+
+        *endp = entry->start + c_variant_delta_word(data, entry->end - word, word);
+        return *endp <= entry->end - word;
+}
+
+static uint64_t c_variant_delta_hash(const uint8_t *p, size_t n) {
+        uint64_t hash = UINT64_C(14695981039346656037);
+
+        /* FNV-1a */
+        while (n--)
+                hash = (hash ^ *p++) * UINT64_C(1099511628211);
+
+        return hash;
+}
+
+static int c_variant_delta_pair_dict(CVariantDelta *d,
+                                     const CVariantDeltaChild *from,
+                                     size_t n_from,
+                                     const CVariantDeltaChild *to,
+                                     size_t n_to,
+                                     size_t *pairs) {
+        size_t i, j, mask, end, *table, *ends;
+        uint64_t hash;
+
+        /*
+         * Pair the dict entries of @to with the entries of @from with the
+         * same key, via a hash table of all keys of @from. Entries without
+         * valid key are never paired.
+         */
+
+        for (mask = 1; mask < n_from * 2; mask <<= 1)
+                ;
+
+        table = calloc(mask, sizeof(*table));
+        ends = malloc((n_from ?: 1) * sizeof(*ends));
+        if (!table || !ends) {
+                free(ends);
+                free(table);
+                return -ENOMEM;
+        }
+
+        --mask;
+
+        for (i = 0; i < n_from; ++i) {
+                if (!c_variant_delta_key(d->from, from + i, ends + i))
+                        continue;
+
+                hash = c_variant_delta_hash(d->from + from[i].start, ends[i] - from[i].start);
+                for (j = hash & mask; table[j]; j = (j + 1) & mask)
+                        ;
+                table[j] = i + 1;
+        }
+
+        for (i = 0; i < n_to; ++i) {
+                pairs[i] = SIZE_MAX;
+                if (!c_variant_delta_key(d->to, to + i, &end))
+                        continue;
+
+                hash = c_variant_delta_hash(d->to + to[i].start, end - to[i].start);
+                for (j = hash & mask; table[j]; j = (j + 1) & mask) {
+                        if (ends[table[j] - 1] - from[table[j] - 1].start == end - to[i].start &&
+                            !memcmp(d->from + from[table[j] - 1].start, d->to + to[i].start, end - to[i].start)) {
+                                pairs[i] = table[j] - 1;
+                                break;
+                        }
+                }
+        }
+
+        free(ends);
+        free(table);
+        return 0;
+}
+
+/*
+ * Diffing
+ * =======
+ */
+
+static int c_variant_delta_push(CVariantDelta *d, uint64_t offset, uint64_t size) {
+        CVariantDeltaOp *ops;
+        size_t n;
+
+        if (d->n_ops >= d->n_allocated_ops) {
+                n = d->n_allocated_ops ? d->n_allocated_ops * 2 : 64;
+                ops = realloc(d->ops, n * sizeof(*ops));
+                if (!ops)
+                        return -ENOMEM;
+
+                d->ops = ops;
+                d->n_allocated_ops = n;
+        }
+
+        d->ops[d->n_ops++] = (CVariantDeltaOp){ offset, size };
+        return 0;
+}
+
+static int c_variant_delta_push_literal(CVariantDelta *d, const uint8_t *p, size_t size) {
+        uint8_t *literal;
+        size_t n;
+        int r;
+
+        if (size > d->n_allocated_literal - d->n_literal) {
+                n = d->n_allocated_literal ? d->n_allocated_literal : 4096;
+                while (n - d->n_literal < size)
+                        n *= 2;
+
+                literal = realloc(d->literal, n);
+                if (!literal)
+                        return -ENOMEM;
+
+                d->literal = literal;
+                d->n_allocated_literal = n;
+        }
+
+        memcpy(d->literal + d->n_literal, p, size);
+        d->n_literal += size;
+
+        if (d->n_ops > 0 && d->ops[d->n_ops - 1].offset == C_VARIANT_DELTA_LITERAL) {
+                d->ops[d->n_ops - 1].size += size;
+                return 0;
+        }
+
+        r = c_variant_delta_push(d, C_VARIANT_DELTA_LITERAL, size);
+        if (r < 0)
+                d->n_literal -= size;
+        return r;
+}
+
+int c_variant_delta_flush(CVariantDelta *d) {
+        CVariantDeltaOp op = d->pending;
+
+        if (!op.size)
+                return 0;
+
+        d->pending.size = 0;
+
+        if (op.size < C_VARIANT_DELTA_MIN_COPY)
+                return c_variant_delta_push_literal(d, d->from + op.offset, op.size);
+
+        return c_variant_delta_push(d, op.offset, op.size);
+}
+
+int c_variant_delta_copy(CVariantDelta *d, size_t offset, size_t size) {
+        int r;
+
+        if (!size)
+                return 0;
+
+        /* extend the pending copy, if contiguous */
+        if (d->pending.size && d->pending.offset + d->pending.size == offset) {
+                d->pending.size += size;
+                return 0;
+        }
+
+        r = c_variant_delta_flush(d);
+        if (r < 0)
+                return r;
+
+        d->pending = (CVariantDeltaOp){ offset, size };
+        return 0;
+}
+
+int c_variant_delta_bytes(CVariantDelta *d, const void *p, size_t size) {
+        int r;
+
+        if (!size)
+                return 0;
+
+        r = c_variant_delta_flush(d);
+        if (r < 0)
+                return r;
+
+        return c_variant_delta_push_literal(d, p, size);
+}
+
+static int c_variant_delta_literal(CVariantDelta *d, size_t offset, size_t size) {
+        return c_variant_delta_bytes(d, d->to + offset, size);
+}
+
+static int c_variant_delta_range(CVariantDelta *d,
+                                 size_t from_start,
+                                 size_t from_end,
+                                 size_t to_start,
+                                 size_t to_end) {
+        size_t size = to_end - to_start;
+
+        if (from_start <= from_end &&
+            from_end - from_start == size &&
+            !memcmp(d->from + from_start, d->to + to_start, size))
+                return c_variant_delta_copy(d, from_start, size);
+
+        return c_variant_delta_literal(d, to_start, size);
+}
+
+static int c_variant_delta_node(CVariantDelta *d,
+                                const CVariantType *info,
+                                size_t from_start,
+                                size_t from_end,
+                                size_t to_start,
+                                size_t to_end,
+                                size_t depth) {
+        CVariantDeltaChild *from = NULL, *to = NULL;
+        size_t i, k, n_from, n_to, from_pos, to_pos, *pairs = NULL;
+        CVariantType child;
+        int r;
+
+        /* unchanged elements, and basic types, are never split */
+        if (from_end - from_start == to_end - to_start &&
+            !memcmp(d->from + from_start, d->to + to_start, to_end - to_start))
+                return c_variant_delta_range(d, from_start, from_end, to_start, to_end);
+        if (info->n_type == 1 && *info->type != C_VARIANT_VARIANT)
+                return c_variant_delta_literal(d, to_start, to_end - to_start);
+        if (depth >= C_VARIANT_MAX_LEVEL)
+                return c_variant_delta_literal(d, to_start, to_end - to_start);
+
+        r = c_variant_delta_layout(d->from, info, from_start, from_end, &from, &n_from);
+        if (r >= 0)
+                r = c_variant_delta_layout(d->to, info, to_start, to_end, &to, &n_to);
+        if (r == -EBADMSG) {
+                r = c_variant_delta_literal(d, to_start, to_end - to_start);
+                goto exit;
+        } else if (r < 0) {
+                goto exit;
+        }
+
+        pairs = malloc((n_to ?: 1) * sizeof(*pairs));
+        if (!pairs) {
+                r = -ENOMEM;
+                goto exit;
+        }
+
+        if (*info->type == C_VARIANT_ARRAY && info->type[1] == C_VARIANT_PAIR_OPEN) {
+                r = c_variant_delta_pair_dict(d, from, n_from, to, n_to, pairs);
+                if (r < 0)
+                        goto exit;
+        } else {
+                for (i = 0; i < n_to; ++i)
+                        pairs[i] = i < n_from ? i : SIZE_MAX;
+        }
+
+        /* variants can only be split if the type of their content matches */
+        if (*info->type == C_VARIANT_VARIANT &&
+            (to->n_type != from->n_type || strncmp(to->type, from->type, to->n_type)))
+                pairs[0] = SIZE_MAX;
+
+        from_pos = from_start;
+        to_pos = to_start;
+        for (i = 0; i < n_to; ++i) {
+                k = pairs[i];
+
+                if (k == SIZE_MAX) {
+                        r = c_variant_delta_literal(d, to_pos, to[i].end - to_pos);
+                        if (r < 0)
+                                goto exit;
+
+                        to_pos = to[i].end;
+                        continue;
+                }
+
+                /* padding before the child, compared to the padding in @from */
+                r = c_variant_delta_range(d, from_pos, from[k].start, to_pos, to[i].start);
+                if (r < 0)
+                        goto exit;
+
+                r = c_variant_signature_one(to[i].type, to[i].n_type, &child);
+                assert(!r);
+
+                r = c_variant_delta_node(d, &child,
+                                         from[k].start, from[k].end,
+                                         to[i].start, to[i].end,
+                                         depth + 1);
+                if (r < 0)
+                        goto exit;
+
+                from_pos = from[k].end;
+
+                to_pos = to[i].end;
+        }
+
+        /* trailing framing, compared to the framing in @from */
+        r = c_variant_delta_range(d, from_pos, from_end, to_pos, to_end);
+
+exit:
+        free(pairs);
+        free(to);
+        free(from);
+        return r;
+}
+
+int c_variant_delta_flatten(CVariant *cv, const uint8_t **datap, size_t *sizep, void **freep) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        uint8_t *data;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (!vecs)
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        *freep = NULL;
+
+        if (n_vecs == 1) {
+                *datap = vecs->iov_base;
+                *sizep = vecs->iov_len;
+                return 0;
+        }
+
+        for (i = 0, size = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size ?: 1);
+        if (!data)
+                return -ENOMEM;
+
+        for (i = 0, size = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        *datap = data;
+        *sizep = size;
+        *freep = data;
+        return 0;
+}
+
+/**
+ * c_variant_diff() - compute delta between two variants
+ * @from:       old variant
+ * @to:         new variant
+ * @deltap:     output variable for the delta
+ *
+ * This computes a delta, that turns the serialization of @from into the
+ * serialization of @to, when passed to c_variant_patch() together with @from.
+ * Both variants must be sealed, and of the same type. The delta is returned
+ * as a new, sealed variant of type "(stta(tt)ay)", which can be sent like any
+ * other variant.
+ *
+ * The delta is computed on element granularity. Elements that did not change
+ * are referenced as a whole, changed elements are split into their members,
+ * recursively. Dictionary entries are paired by their key, so insertions and
+ * removals only affect the entries involved (and the framing offsets of the
+ * dictionary).
+ *
+ * Both variants operate on their complete serialization, so both are rewound
+ * by this call.
+ *
+ * On success, the new delta is returned in @deltap. On failure, @deltap stays
+ * untouched.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_diff(CVariant *from, CVariant *to, CVariant **deltap) {
+        CVariantDelta d = {};
+        size_t i, n_from, n_to;
+        void *free_from = NULL, *free_to = NULL;
+        CVariantType info;
+        CVariant *delta;
+        char *type;
+        int r;
+
+        assert(from->sealed && to->sealed);
+
+        c_variant_rewind(from);
+        c_variant_rewind(to);
+
+        if (from->level.n_type != to->level.n_type ||
+            strncmp(from->level.type, to->level.type, to->level.n_type))
+                return -EBADRQC;
+
+        type = strndup(to->level.type, to->level.n_type);
+        if (!type)
+                return -ENOMEM;
+
+        r = c_variant_delta_flatten(from, &d.from, &n_from, &free_from);
+        if (r >= 0)
+                r = c_variant_delta_flatten(to, &d.to, &n_to, &free_to);
+        if (r < 0)
+                goto exit;
+
+        r = c_variant_signature_one(type, to->level.n_type, &info);
+        assert(!r);
+
+        r = c_variant_delta_node(&d, &info, 0, n_from, 0, n_to, 0);
+        if (r >= 0)
+                r = c_variant_delta_flush(&d);
+        if (r < 0)
+                goto exit;
+
+        r = c_variant_new(&delta, C_VARIANT_DELTA_TYPE, strlen(C_VARIANT_DELTA_TYPE));
+        if (r < 0)
+                goto exit;
+
+        c_variant_begin(delta, "(");
+        c_variant_write(delta, "stt", type, (uint64_t)n_from, (uint64_t)n_to);
+        c_variant_begin(delta, "a");
+        for (i = 0; i < d.n_ops; ++i)
+                c_variant_write(delta, "(tt)", d.ops[i].offset, d.ops[i].size);
+        c_variant_end(delta, "a");
+        c_variant_write_raw(delta, C_VARIANT_ARRAY, d.literal, d.n_literal);
+        c_variant_end(delta, ")");
+
+        r = c_variant_seal(delta);
+        if (r < 0) {
+                c_variant_free(delta);
+                goto exit;
+        }
+
+        *deltap = delta;
+        r = 0;
+
+exit:
+        free(d.literal);
+        free(d.ops);
+        free(free_to);
+        free(free_from);
+        free(type);
+        return r;
+}
+
+/*
+ * Patching
+ * ========
+ */
+
+static size_t c_variant_delta_map(const struct iovec *vecs,
+                                  const size_t *starts,
+                                  size_t n_vecs,
+                                  size_t offset,
+                                  size_t size,
+                                  struct iovec *out,
+                                  uint8_t *copy) {
+        size_t l = 0, r = n_vecs, n, len;
+        const uint8_t *p;
+
+        /*
+         * Map the range [@offset, @offset + @size) of the data in @vecs onto
+         * the vectors it spans, and store them in @out, if non-NULL. If @copy
+         * is non-NULL, the data is copied there as well. @starts has the
+         * offset of each vector. The number of vectors is returned.
+         */
+
+        /* find the last vector starting at, or before, @offset */
+        while (r - l > 1) {
+                if (starts[l + (r - l) / 2] <= offset)
+                        l += (r - l) / 2;
+                else
+                        r = l + (r - l) / 2;
+        }
+
+        for (n = 0; size > 0; ++l) {
+                len = starts[l + 1] - offset;
+                if (!len)
+                        continue;
+                if (len > size)
+                        len = size;
+
+                p = (const uint8_t *)vecs[l].iov_base + offset - starts[l];
+                if (out)
+                        out[n] = (struct iovec){ (void *)p, len };
+                if (copy) {
+                        memcpy(copy, p, len);
+                        copy += len;
+                }
+
+                ++n;
+                offset += len;
+                size -= len;
+        }
+
+        return n;
+}
+
+static int c_variant_delta_read(CVariant *delta,
+                                const char **typep,
+                                uint64_t *n_fromp,
+                                uint64_t *n_top,
+                                CVariantDeltaOp **opsp,
+                                size_t *n_opsp,
+                                const uint8_t **literalp,
+                                size_t *n_literalp,
+                                void **freep) {
+        CVariantDeltaOp *ops;
+        const void *literal = NULL;
+        uint8_t *buffer;
+        size_t i, n;
+        int r;
+
+        *freep = NULL;
+        *n_literalp = 0;
+
+        r = c_variant_enter(delta, "(");
+        if (r < 0)
+                return r;
+
+        c_variant_read(delta, "stt", typep, n_fromp, n_top);
+
+        r = c_variant_enter(delta, "a");
+        if (r < 0)
+                return r;
+
+        n = c_variant_peek_count(delta);
+        ops = malloc((n ?: 1) * sizeof(*ops));
+        if (!ops)
+                return -ENOMEM;
+
+        for (i = 0; i < n; ++i)
+                c_variant_read(delta, "(tt)", &ops[i].offset, &ops[i].size);
+
+        c_variant_exit(delta, "a");
+
+        /* the literal blob is used in place, unless it spans vectors */
+        r = c_variant_read_raw(delta, C_VARIANT_ARRAY, &literal, n_literalp);
+        if (r < 0) {
+                free(ops);
+                return r;
+        } else if (r == 0) {
+                c_variant_enter(delta, "a");
+                *n_literalp = c_variant_peek_count(delta);
+                buffer = malloc(*n_literalp ?: 1);
+                if (!buffer) {
+                        free(ops);
+                        return -ENOMEM;
+                }
+
+                for (i = 0; i < *n_literalp; ++i)
+                        c_variant_read(delta, "y", buffer + i);
+
+                c_variant_exit(delta, "a");
+                literal = buffer;
+                *freep = buffer;
+        }
+
+        c_variant_exit(delta, ")");
+
+        r = c_variant_return_poison(delta);
+        if (r < 0) {
+                free(*freep);
+                free(ops);
+                return r;
+        }
+
+        *opsp = ops;
+        *n_opsp = n;
+        *literalp = literal;
+        return 0;
+}
+
+int c_variant_delta_assemble(CVariant *from,
+                             const char *type,
+                             size_t n_type,
+                             const CVariantDeltaOp *ops,
+                             size_t n_ops,
+                             const uint8_t *literal,
+                             size_t n_literal,
+                             uint64_t n_to,
+                             CVariant **top) {
+        size_t i, n, pos, size, n_vecs, n_from_vecs, *starts;
+        const struct iovec *from_vecs;
+        uint64_t total;
+        uint8_t *extra;
+        CVariantType info;
+        bool linear;
+        CVariant *cv;
+        char *p_type;
+        int r;
+
+        /*
+         * Assemble a new variant of type @type from the ops in @ops, which
+         * reference the data of @from and @literal. The ops are verified
+         * first, -EBADMSG is returned if they do not add up.
+         */
+
+        from_vecs = c_variant_get_vecs(from, &n_from_vecs);
+        if (!from_vecs)
+                return c_variant_return_poison(from) ?: -EFAULT;
+
+        starts = malloc((n_from_vecs + 1) * sizeof(*starts));
+        if (!starts)
+                return -ENOMEM;
+
+        for (i = 0, starts[0] = 0; i < n_from_vecs; ++i)
+                starts[i + 1] = starts[i] + from_vecs[i].iov_len;
+
+        /* verify the ops, and count the vectors needed */
+        for (i = 0, total = 0, size = 0, n_vecs = 0; i < n_ops; ++i) {
+                if (ops[i].size > UINT64_MAX - total) {
+                        r = -EBADMSG;
+                        goto exit;
+                }
+
+                total += ops[i].size;
+
+                if (!ops[i].size)
+                        continue;
+
+                if (ops[i].offset == C_VARIANT_DELTA_LITERAL) {
+                        if (ops[i].size > n_literal - size) {
+                                r = -EBADMSG;
+                                goto exit;
+                        }
+
+                        size += ops[i].size;
+                        ++n_vecs;
+                } else {
+                        if (ops[i].offset > starts[n_from_vecs] ||
+                            ops[i].size > starts[n_from_vecs] - ops[i].offset) {
+                                r = -EBADMSG;
+                                goto exit;
+                        }
+
+                        n_vecs += c_variant_delta_map(from_vecs, starts, n_from_vecs,
+                                                      ops[i].offset, ops[i].size, NULL, NULL);
+                }
+        }
+
+        if (total != n_to || size != n_literal) {
+                r = -EBADMSG;
+                goto exit;
+        }
+
+        r = c_variant_signature_one(type, n_type, &info);
+        assert(!r);
+
+        /* fall back to a linear copy, if there are too many vectors */
+        linear = (n_vecs > C_VARIANT_MAX_VECS);
+        if (linear)
+                n_vecs = 1;
+
+        r = c_variant_alloc(&cv, &p_type, (void **)&extra, n_type,
+                            info.n_levels + 8, n_vecs, linear ? n_to : n_literal);
+        if (r < 0)
+                goto exit;
+
+        memcpy(p_type, type, n_type);
+        cv->sealed = true;
+
+        for (i = 0, n = 0, pos = 0, size = 0; i < n_ops; ++i) {
+                if (!ops[i].size)
+                        continue;
+
+                if (ops[i].offset == C_VARIANT_DELTA_LITERAL) {
+                        memcpy(extra + pos, literal + size, ops[i].size);
+                        if (!linear)
+                                cv->vecs[n++] = (struct iovec){ extra + pos, ops[i].size };
+                        pos += ops[i].size;
+                        size += ops[i].size;
+                } else if (linear) {
+                        c_variant_delta_map(from_vecs, starts, n_from_vecs,
+                                            ops[i].offset, ops[i].size, NULL, extra + pos);
+                        pos += ops[i].size;
+                } else {
+                        n += c_variant_delta_map(from_vecs, starts, n_from_vecs,
+                                                 ops[i].offset, ops[i].size, cv->vecs + n, NULL);
+                }
+        }
+
+        if (linear) {
+                cv->vecs[0] = (struct iovec){ extra, n_to };
+                n = 1;
+        }
+
+        assert(n == n_vecs);
+
+        c_variant_level_root(cv, n_to, p_type, n_type);
+        cv->linear = (n_vecs == 1);
+
+        *top = cv;
+        r = 0;
+
+exit:
+        free(starts);
+        return r;
+}
+
+/**
+ * c_variant_patch() - apply delta to variant
+ * @from:       old variant
+ * @delta:      delta, as returned by c_variant_diff()
+ * @top:        output variable for the new variant
+ *
+ * This applies @delta to @from, and returns the resulting variant as a new,
+ * sealed variant in @top. @from must be the same variant the delta was
+ * computed against, or at least one of the same type and size.
+ *
+ * The new variant references all unchanged byte ranges of @from, rather than
+ * copying them. Hence, @from must stay accessible for the entire lifetime of
+ * the new variant. Only the literal bytes of @delta are copied, so @delta can
+ * be released right away.
+ *
+ * @from and @delta are rewound by this call.
+ *
+ * On success, the new variant is returned in @top. On failure, @top stays
+ * untouched.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_patch(CVariant *from, CVariant *delta, CVariant **top) {
+        CVariantDeltaOp *ops = NULL;
+        const struct iovec *vecs;
+        size_t i, n_ops, n_vecs, n_literal;
+        const uint8_t *literal;
+        uint64_t n_from, n_to, size;
+        void *free_literal = NULL;
+        const char *type;
+        int r;
+
+        assert(from->sealed && delta->sealed);
+
+        c_variant_rewind(from);
+        c_variant_rewind(delta);
+
+        if (delta->level.n_type != strlen(C_VARIANT_DELTA_TYPE) ||
+            strncmp(delta->level.type, C_VARIANT_DELTA_TYPE, delta->level.n_type))
+                return -EBADRQC;
+
+        r = c_variant_delta_read(delta, &type, &n_from, &n_to,
+                                 &ops, &n_ops, &literal, &n_literal, &free_literal);
+        if (r < 0)
+                return r;
+
+        if (from->level.n_type != strlen(type) ||
+            strncmp(from->level.type, type, from->level.n_type)) {
+                r = -EBADRQC;
+                goto exit;
+        }
+
+        vecs = c_variant_get_vecs(from, &n_vecs);
+        if (!vecs) {
+                r = c_variant_return_poison(from) ?: -EFAULT;
+                goto exit;
+        }
+
+        for (i = 0, size = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        if (size != n_from) {
+                r = -EBADMSG;
+                goto exit;
+        }
+
+        r = c_variant_delta_assemble(from, type, strlen(type), ops, n_ops,
+                                     literal, n_literal, n_to, top);
+
+exit:
+        free(free_literal);
+        free(ops);
+        return r;
+}
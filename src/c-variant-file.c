@@ -0,0 +1,223 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * File Segments
+ *
+ * c_variant_insert_file() references a range of a file as serialized data,
+ * rather than memory. Such a segment occupies a single iovec, like any other
+ * inserted data, but its iov_base stays NULL until someone needs the data in
+ * memory. Its file descriptor, offset, and mapping are tracked in a
+ * CVariantFile, linked into @cv->files and keyed by the index of the iovec.
+ * Iovec indices never change once data was inserted, since the writer only
+ * ever reorders or inserts vectors behind the front.
+ *
+ * There are two ways to consume such variants:
+ *
+ *   - c_variant_transmit() writes memory data via writev(2) and file segments
+ *     via sendfile(2), so the kernel moves file data straight from the page
+ *     cache into the target, without user-space copies.
+ *
+ *   - The reader, and c_variant_get_vecs(), map file segments via mmap(2) on
+ *     demand, and then treat them like any other iovec.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static CVariantFile *c_variant_file_find(CVariant *cv, size_t idx) {
+        CVariantFile *file;
+
+        for (file = cv->files; file; file = file->next)
+                if (file->idx == idx)
+                        return file;
+
+        return NULL;
+}
+
+int c_variant_file_map(CVariant *cv, struct iovec *v) {
+        CVariantFile *file;
+        uint64_t start;
+        size_t n_page;
+        void *p;
+
+        /*
+         * Map the file segment backing @v and make @v point to it. Mappings
+         * must start on page boundaries, so we map from the start of the page
+         * containing the segment, and then skip the leading bytes.
+         */
+
+        file = c_variant_file_find(cv, v - cv->vecs);
+        if (_unlikely_(!file))
+                return c_variant_poison(cv, -EFAULT);
+
+        if (!file->map) {
+                n_page = sysconf(_SC_PAGESIZE);
+                start = file->offset & ~(uint64_t)(n_page - 1);
+
+                if (_unlikely_(v->iov_len + (file->offset - start) < v->iov_len))
+                        return c_variant_poison(cv, -EFBIG);
+
+                p = mmap(NULL, v->iov_len + (file->offset - start), PROT_READ, MAP_SHARED, file->fd, start);
+                if (p == MAP_FAILED)
+                        return c_variant_poison_internal(cv, -errno);
+
+                file->map = p;
+                file->n_map = v->iov_len + (file->offset - start);
+        }
+
+        v->iov_base = (char *)file->map + file->n_map - v->iov_len;
+        return 0;
+}
+
+int c_variant_file_map_all(CVariant *cv) {
+        CVariantFile *file;
+        int r;
+
+        for (file = cv->files; file; file = file->next) {
+                if (cv->vecs[file->idx].iov_base)
+                        continue;
+
+                r = c_variant_file_map(cv, cv->vecs + file->idx);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+void c_variant_file_free_all(CVariant *cv) {
+        CVariantFile *file;
+
+        while ((file = cv->files)) {
+                cv->files = file->next;
+
+                if (file->map)
+                        munmap(file->map, file->n_map);
+                close(file->fd);
+                free(file);
+        }
+}
+
+static ssize_t c_variant_file_send(int fd, CVariantFile *file, size_t skip, size_t n) {
+        off_t offset = file->offset + skip;
+
+        /* sendfile(2) transfers at most 0x7ffff000 bytes per call */
+        if (n > 0x7ffff000)
+                n = 0x7ffff000;
+
+        return sendfile(fd, file->fd, &offset, n);
+}
+
+/**
+ * c_variant_transmit() - write variant into file descriptor
+ * @cv:         variant to transmit, or NULL
+ * @fd:         target file descriptor
+ * @offsetp:    position in the serialized variant to continue at
+ *
+ * This writes the serialized variant @cv into @fd, starting at *@offsetp
+ * bytes into the serialized data. Memory data is written via writev(2), in
+ * as few calls as possible. File segments inserted via c_variant_insert_file()
+ * are transmitted via sendfile(2), so their content never enters user space.
+ * If sendfile(2) is not supported for @fd, the segment is mapped and written
+ * instead.
+ *
+ * On return, *@offsetp is advanced by the number of bytes written. If @fd is
+ * non-blocking and would block, -EAGAIN is returned, and the caller should
+ * call this again with the same offset once @fd is writable. The caller
+ * should start with an offset of 0.
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 if the variant was transmitted completely, negative error code on
+ *         failure.
+ */
+_public_ int c_variant_transmit(CVariant *cv, int fd, size_t *offsetp) {
+        struct iovec vecs[64];
+        size_t i, j, n, pos, skip;
+        CVariantFile *file;
+        ssize_t l;
+        int r;
+
+        if (_unlikely_(!cv))
+                return 0;
+
+        assert(cv->sealed);
+
+        for (;;) {
+                /* find the vector containing @offsetp */
+                for (i = 0, pos = 0; i < cv->n_vecs; pos += cv->vecs[i++].iov_len)
+                        if (*offsetp < pos + cv->vecs[i].iov_len)
+                                break;
+                if (i >= cv->n_vecs)
+                        return 0;
+
+                skip = *offsetp - pos;
+                file = cv->files ? c_variant_file_find(cv, i) : NULL;
+
+                if (file) {
+                        l = c_variant_file_send(fd, file, skip, cv->vecs[i].iov_len - skip);
+                        if (l < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                                /* fall back to writing a mapping */
+                                if (!cv->vecs[i].iov_base) {
+                                        r = c_variant_file_map(cv, cv->vecs + i);
+                                        if (r < 0)
+                                                return r;
+                                }
+
+                                l = write(fd,
+                                          (char *)cv->vecs[i].iov_base + skip,
+                                          cv->vecs[i].iov_len - skip);
+                        }
+                } else {
+                        /* gather memory vectors up to the next file segment */
+                        vecs[0].iov_base = (char *)cv->vecs[i].iov_base + skip;
+                        vecs[0].iov_len = cv->vecs[i].iov_len - skip;
+                        n = 1;
+
+                        for (j = i + 1; j < cv->n_vecs && n < sizeof(vecs) / sizeof(*vecs); ++j) {
+                                if (cv->files && c_variant_file_find(cv, j))
+                                        break;
+                                if (cv->vecs[j].iov_len)
+                                        vecs[n++] = cv->vecs[j];
+                        }
+
+                        l = writev(fd, vecs, n);
+                }
+
+                if (l < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -errno;
+                }
+                if (l == 0)
+                        return -EPIPE;
+
+                *offsetp += l;
+        }
+}
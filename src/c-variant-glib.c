@@ -0,0 +1,165 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * GLib Bridge
+ *
+ * GBytes supports custom free-functions, so a GBytes object can reference the
+ * single iovec of a CVariant and free the variant once its last reference is
+ * dropped. The other direction uses the release hook of CVariant, which is
+ * invoked on destruction, to drop a reference to the GBytes object backing a
+ * reader.
+ *
+ * This is built as a separate library, so libcvariant itself does not depend
+ * on GLib.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-variant.h"
+#include "c-variant-glib.h"
+#include "c-variant-private.h"
+
+static void c_variant_glib_free_variant(gpointer userdata) {
+        c_variant_free(userdata);
+}
+
+static void c_variant_glib_unref_bytes(void *userdata) {
+        g_bytes_unref(userdata);
+}
+
+/**
+ * c_variant_glib_to_bytes() - turn variant into GBytes
+ * @cv:         variant to convert
+ * @out:        output variable for new GBytes object
+ * @n_copiedp:  output variable for the number of copied bytes, or NULL
+ *
+ * This returns the serialized data of @cv as GBytes object. On success, the
+ * caller passes ownership of @cv to the GBytes object, and must no longer use
+ * @cv directly.
+ *
+ * If at most one iovec of @cv carries data, the GBytes object references that
+ * data directly and @cv is freed once the last reference to the GBytes object
+ * is dropped. Otherwise, the data is coalesced into a new buffer and @cv is
+ * freed immediately. The number of copied bytes is returned in @n_copiedp.
+ *
+ * If @cv was created from caller-provided data, that data must stay
+ * accessible until the GBytes object is released.
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_glib_to_bytes(CVariant *cv, GBytes **out, size_t *n_copiedp) {
+        const struct iovec *vecs, *vec = NULL;
+        size_t i, n_vecs, n_data = 0, n_nonempty = 0;
+        char *data;
+        int r;
+
+        assert(cv->sealed);
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (_unlikely_(!vecs))
+                return c_variant_return_poison(cv);
+
+        for (i = 0; i < n_vecs; ++i) {
+                if (vecs[i].iov_len) {
+                        vec = vecs + i;
+                        n_data += vecs[i].iov_len;
+                        ++n_nonempty;
+                }
+        }
+
+        if (n_nonempty <= 1) {
+                *out = g_bytes_new_with_free_func(vec ? vec->iov_base : NULL,
+                                                  n_data,
+                                                  c_variant_glib_free_variant,
+                                                  cv);
+                if (n_copiedp)
+                        *n_copiedp = 0;
+                return 0;
+        }
+
+        data = g_malloc(n_data);
+        r = c_variant_flatten(cv, 0, data, n_data, &n_data);
+        assert(!r);
+
+        c_variant_free(cv);
+        *out = g_bytes_new_take(data, n_data);
+        if (n_copiedp)
+                *n_copiedp = n_data;
+        return 0;
+}
+
+/**
+ * c_variant_glib_new_from_bytes() - create variant from GBytes
+ * @out:        output variable for new variant
+ * @type:       type string
+ * @n_type:     length of @type
+ * @bytes:      GBytes object carrying the serialized data
+ *
+ * This creates a new, sealed variant of type @type, reading the data in
+ * @bytes in place. The new variant holds a reference to @bytes until it is
+ * freed.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_glib_new_from_bytes(CVariant **out, const char *type, size_t n_type, GBytes *bytes) {
+        const void *data;
+        CVariant *cv;
+        gsize n_data;
+        int r;
+
+        data = g_bytes_get_data(bytes, &n_data);
+
+        r = c_variant_new_from_buffer(&cv, type, n_type, data, n_data);
+        if (r < 0)
+                return r;
+
+        cv->release_fn = c_variant_glib_unref_bytes;
+        cv->release_userdata = g_bytes_ref(bytes);
+
+        *out = cv;
+        return 0;
+}
+
+/**
+ * c_variant_glib_new_from_gvariant() - create variant from GVariant
+ * @out:        output variable for new variant
+ * @gv:         GVariant to read
+ *
+ * This creates a new, sealed variant with the type and data of @gv. The data
+ * is retrieved via g_variant_get_data_as_bytes(), which does not copy if @gv
+ * is already serialized, and read in place.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_glib_new_from_gvariant(CVariant **out, GVariant *gv) {
+        const char *type;
+        GBytes *bytes;
+        int r;
+
+        type = g_variant_get_type_string(gv);
+        bytes = g_variant_get_data_as_bytes(gv);
+
+        r = c_variant_glib_new_from_bytes(out, type, strlen(type), bytes);
+        g_bytes_unref(bytes);
+        return r;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <glib.h>
+#include <stdlib.h>
+#include "c-variant.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * GLib Bridge
+ *
+ * libcvariant-glib converts between CVariant and GLib's GBytes and GVariant
+ * without copying serialized data, whenever the layout permits it. Variants
+ * backed by a single iovec share their memory with the GBytes object, and the
+ * lifetime of either side is tied to the other one. Only variants spread
+ * across multiple iovecs need to be coalesced into a new buffer. All
+ * functions report the number of bytes they copied, so callers can verify
+ * their fast-path is taken.
+ */
+
+int c_variant_glib_to_bytes(CVariant *cv, GBytes **out, size_t *n_copiedp);
+int c_variant_glib_new_from_bytes(CVariant **out, const char *type, size_t n_type, GBytes *bytes);
+int c_variant_glib_new_from_gvariant(CVariant **out, GVariant *gv);
+
+#ifdef __cplusplus
+}
+#endif
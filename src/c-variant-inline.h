@@ -0,0 +1,236 @@
+#pragma once
+
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Inline Fast Paths
+ *
+ * The accessors in c-variant.h are all out-of-line, as they have to deal with
+ * scattered iovecs, default values and nested vararg signatures. For hot loops
+ * over fixed-size basic types, this is a lot of overhead compared to a plain
+ * load or store. This header provides static inline variants of those
+ * accessors, which directly operate on the current iterator level, as long as
+ * the element is fully covered by the current iovec. Anything else (vector
+ * boundaries, default values, poisoned variants, ...) is forwarded to the
+ * library.
+ *
+ * CAREFUL: These helpers access the internal layout of CVariant. They must only
+ *          be used when compiled against the same source tree as the library
+ *          you link to. That is, when linking libcvariant.a or embedding the
+ *          sources. Never use them with the shared library.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * c_variant_basic_size() - return size of a fixed-size basic type
+ * @basic:      basic element
+ *
+ * Return: Size of @basic in bytes, or 0 if it is not a fixed-size basic type.
+ */
+static inline size_t c_variant_basic_size(char basic) {
+        switch (basic) {
+        case C_VARIANT_BOOL:
+        case C_VARIANT_BYTE:
+                return 1;
+        case C_VARIANT_INT16:
+        case C_VARIANT_UINT16:
+                return 2;
+        case C_VARIANT_INT32:
+        case C_VARIANT_UINT32:
+        case C_VARIANT_HANDLE:
+                return 4;
+        case C_VARIANT_INT64:
+        case C_VARIANT_UINT64:
+        case C_VARIANT_DOUBLE:
+                return 8;
+        default:
+                return 0;
+        }
+}
+
+/**
+ * c_variant_inline_peek_count() - inline version of c_variant_peek_count()
+ * @cv:         variant to operate on, or NULL
+ *
+ * Return: Number of dynamic elements left to read.
+ */
+static inline size_t c_variant_inline_peek_count(CVariant *cv) {
+        CVariantLevel *level;
+
+        if (_unlikely_(!cv))
+                return 1; /* type: "()" */
+
+        level = &cv->level;
+        switch (level->enclosing) {
+        case C_VARIANT_ARRAY:
+        case C_VARIANT_MAYBE:
+                return level->index;
+        default:
+                return level->n_type > 0;
+        }
+}
+
+/**
+ * c_variant_inline_read() - inline version of c_variant_read()
+ * @cv:         variant to operate on, or NULL
+ * @basic:      basic element to read
+ * @arg:        output storage, or NULL
+ *
+ * This is equivalent to c_variant_read(cv, "<basic>", arg), but avoids the
+ * out-of-line call for fixed-size basic types that are fully covered by the
+ * current iovec. @arg must point to storage suitable for @basic, just like
+ * with c_variant_read().
+ *
+ * Combined with c_variant_inline_peek_count(), this allows iterating arrays of
+ * fixed-size types without leaving the caller:
+ *
+ *      r = c_variant_enter(cv, "a");
+ *      n = c_variant_inline_peek_count(cv);
+ *      for (i = 0; i < n; ++i)
+ *              c_variant_inline_read(cv, 'u', &array[i]);
+ *      r = c_variant_exit(cv, "a");
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static inline int c_variant_inline_read(CVariant *cv, char basic, void *arg) {
+        const char signature[2] = { basic, 0 };
+        CVariantLevel *level;
+        struct iovec *vec;
+        size_t n, offset;
+        char *p;
+
+        n = c_variant_basic_size(basic);
+        if (_likely_(n > 0 && cv && cv->sealed && !cv->poison)) {
+                level = &cv->level;
+                vec = cv->vecs + level->v_front;
+                offset = ALIGN_TO(level->offset, n);
+
+                if (_likely_(level->n_type > 0 &&
+                             *level->type == basic &&
+                             level->index > 0 &&
+                             offset >= level->offset &&
+                             offset + n <= level->size &&
+                             level->i_front < vec->iov_len &&
+                             offset - level->offset + n <= vec->iov_len - level->i_front)) {
+                        p = (char *)vec->iov_base + level->i_front + offset - level->offset;
+                        if (arg)
+                                memcpy(arg, p, n);
+
+                        level->i_front += offset - level->offset + n;
+                        level->offset = offset + n;
+
+                        if (level->enclosing == C_VARIANT_ARRAY ||
+                            level->enclosing == C_VARIANT_MAYBE) {
+                                --level->index;
+                        } else {
+                                ++level->type;
+                                --level->n_type;
+                        }
+
+                        return 0;
+                }
+        }
+
+        return c_variant_read(cv, signature, arg);
+}
+
+/**
+ * c_variant_inline_write() - inline version of c_variant_write()
+ * @cv:         variant to operate on, or NULL
+ * @basic:      basic element to write
+ * @arg:        pointer to the value to write
+ *
+ * This is equivalent to c_variant_write(cv, "<basic>", value), but avoids the
+ * out-of-line call for fixed-size basic types, as long as the current buffer
+ * has enough space left. Unlike c_variant_write(), the value is passed by
+ * reference. For string types, @arg must point to the 'const char *'.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static inline int c_variant_inline_write(CVariant *cv, char basic, const void *arg) {
+        const char signature[2] = { basic, 0 };
+        CVariantLevel *level;
+        struct iovec *vec;
+        size_t n, pad;
+        char *p;
+
+        n = c_variant_basic_size(basic);
+        if (_likely_(n > 0 && cv && !cv->sealed && !cv->poison)) {
+                level = &cv->level;
+                vec = cv->vecs + level->v_front;
+                pad = ALIGN_TO(level->offset, n) - level->offset;
+
+                if (_likely_(level->n_type > 0 &&
+                             *level->type == basic &&
+                             pad + n <= vec->iov_len - level->i_front)) {
+                        p = (char *)vec->iov_base + level->i_front;
+                        memset(p, 0, pad);
+                        memcpy(p + pad, arg, n);
+
+                        level->i_front += pad + n;
+                        level->offset += pad + n;
+
+                        if (level->enclosing != C_VARIANT_ARRAY) {
+                                ++level->type;
+                                --level->n_type;
+                        }
+
+                        return 0;
+                }
+        }
+
+        switch (basic) {
+        case C_VARIANT_BOOL:
+        case C_VARIANT_BYTE:
+                return c_variant_write(cv, signature, *(const uint8_t *)arg);
+        case C_VARIANT_INT16:
+        case C_VARIANT_UINT16:
+                return c_variant_write(cv, signature, *(const uint16_t *)arg);
+        case C_VARIANT_INT32:
+        case C_VARIANT_UINT32:
+        case C_VARIANT_HANDLE:
+                return c_variant_write(cv, signature, *(const uint32_t *)arg);
+        case C_VARIANT_INT64:
+        case C_VARIANT_UINT64:
+                return c_variant_write(cv, signature, *(const uint64_t *)arg);
+        case C_VARIANT_DOUBLE:
+                return c_variant_write(cv, signature, *(const double *)arg);
+        default:
+                return c_variant_write(cv, signature, *(const char * const *)arg);
+        }
+}
+
+#ifdef __cplusplus
+}
+#endif
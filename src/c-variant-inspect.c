@@ -0,0 +1,738 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Layout Inspector
+ * This reads a serialized variant of a given type from a file, or stdin, and
+ * shows where its bytes go. Every element is printed with its byte range, and
+ * each subtree is split into payload bytes, alignment padding, and framing
+ * bytes. Framing covers framing offsets, the trailing byte of non-fixed
+ * maybes, and the type strings of variants.
+ *
+ * Additionally, fixed-size tuples are checked for member orders that need
+ * less padding, weighted by the number of instances found in the data. With
+ * --bench, the input is instead read repeatedly via the library, to get a
+ * ballpark figure of its decoding throughput.
+ *
+ * The layout is decoded by hand, rather than via the reader, since the reader
+ * hides exactly the details we are interested in. Invalid framing is flagged,
+ * and the affected element is treated as empty.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+typedef struct Inspect Inspect;
+typedef struct InspectChild InspectChild;
+typedef struct InspectLayout InspectLayout;
+typedef struct InspectStats InspectStats;
+typedef struct InspectTuple InspectTuple;
+
+struct Inspect {
+        const uint8_t *data;
+        size_t n_data;
+        size_t max_depth;
+        size_t max_elements;
+        bool record;
+        InspectTuple *tuples;
+};
+
+struct InspectStats {
+        size_t payload;
+        size_t padding;
+        size_t framing;
+        size_t n_invalid;
+};
+
+struct InspectChild {
+        const char *type;
+        size_t n_type;
+        size_t start;
+        size_t end;
+};
+
+struct InspectLayout {
+        InspectChild *children;
+        size_t n_children;
+        size_t word;            /* size of framing offsets, or 0 if none */
+        InspectStats own;       /* bytes not covered by any child */
+};
+
+struct InspectTuple {
+        InspectTuple *next;
+        char *type;
+        size_t n_type;
+        size_t n_instances;
+};
+
+static size_t inspect_read_word(Inspect *in, size_t offset, size_t word) {
+        uint64_t v64;
+        uint32_t v32;
+        uint16_t v16;
+
+        switch (word) {
+        case 1:
+                return in->data[offset];
+        case 2:
+                memcpy(&v16, in->data + offset, sizeof(v16));
+                return le16toh(v16);
+        case 4:
+                memcpy(&v32, in->data + offset, sizeof(v32));
+                return le32toh(v32);
+        default:
+                memcpy(&v64, in->data + offset, sizeof(v64));
+                return le64toh(v64);
+        }
+}
+
+static void inspect_layout_add(InspectLayout *l, const char *type, size_t n_type, size_t start, size_t end) {
+        l->children[l->n_children++] = (InspectChild){ type, n_type, start, end };
+}
+
+static void inspect_layout_tuple(Inspect *in,
+                                 const CVariantType *info,
+                                 size_t start,
+                                 size_t end,
+                                 InspectLayout *l) {
+        const char *inner = info->type + 1;
+        size_t n_inner = info->n_type - 2;
+        size_t i, len, pos, aligned, limit, mend, n_members, n_frames;
+        CVariantType member;
+
+        len = end - start;
+
+        /* count members, and the framing offsets needed for them */
+        for (i = 0, n_members = 0, n_frames = 0;
+             c_variant_signature_next(inner + i, n_inner - i, &member) > 0;
+             i += member.n_type, ++n_members)
+                if (!member.size && i + member.n_type < n_inner)
+                        ++n_frames;
+
+        l->children = calloc(n_members ?: 1, sizeof(*l->children));
+        assert(l->children);
+
+        if (info->size) {
+                if (len != info->size)
+                        ++l->own.n_invalid;
+                limit = len;
+        } else {
+                l->word = 1U << c_variant_word_size(len, 0);
+                if (n_frames * l->word > len) {
+                        ++l->own.n_invalid;
+                        n_frames = len / l->word;
+                }
+                l->own.framing += n_frames * l->word;
+                limit = len - n_frames * l->word;
+        }
+
+        for (i = 0, pos = 0, n_frames = 0;
+             c_variant_signature_next(inner + i, n_inner - i, &member) > 0;
+             i += member.n_type) {
+                aligned = ALIGN_TO(pos, 1U << member.alignment);
+
+                if (member.size)
+                        mend = aligned + member.size;
+                else if (i + member.n_type >= n_inner)
+                        mend = limit;
+                else if (++n_frames * l->word <= len - limit)
+                        mend = inspect_read_word(in, start + len - n_frames * l->word, l->word);
+                else
+                        mend = 0;
+
+                /* empty, non-fixed members need not be aligned */
+                if (!member.size && mend == pos) {
+                        inspect_layout_add(l, member.type, member.n_type, start + pos, start + pos);
+                        continue;
+                }
+
+                if (aligned > mend || mend > limit) {
+                        ++l->own.n_invalid;
+                        inspect_layout_add(l, member.type, member.n_type, start + pos, start + pos);
+                        continue;
+                }
+
+                l->own.padding += aligned - pos;
+                inspect_layout_add(l, member.type, member.n_type, start + aligned, start + mend);
+                pos = mend;
+        }
+
+        /* trailing alignment of fixed tuples, or gaps before the framing */
+        l->own.padding += limit - pos;
+}
+
+static void inspect_layout_array(Inspect *in,
+                                 const CVariantType *info,
+                                 size_t start,
+                                 size_t end,
+                                 InspectLayout *l) {
+        size_t i, n, len, pos, aligned, eend, frames;
+        CVariantType elem;
+        int r;
+
+        len = end - start;
+        r = c_variant_signature_one(info->type + 1, info->n_type - 1, &elem);
+        assert(!r);
+
+        if (elem.size) {
+                n = len / elem.size;
+                if (len % elem.size) {
+                        ++l->own.n_invalid;
+                        l->own.padding += len % elem.size;
+                }
+
+                l->children = calloc(n ?: 1, sizeof(*l->children));
+                assert(l->children);
+
+                for (i = 0; i < n; ++i)
+                        inspect_layout_add(l, elem.type, elem.n_type,
+                                           start + i * elem.size,
+                                           start + (i + 1) * elem.size);
+                return;
+        }
+
+        l->children = calloc(1, sizeof(*l->children));
+        assert(l->children);
+
+        if (!len)
+                return;
+
+        l->word = 1U << c_variant_word_size(len, 0);
+        frames = len >= l->word ? inspect_read_word(in, start + len - l->word, l->word) : len + 1;
+        if (frames > len || (len - frames) % l->word) {
+                ++l->own.n_invalid;
+                l->own.framing += len;
+                return;
+        }
+
+        n = (len - frames) / l->word;
+        l->own.framing += len - frames;
+
+        free(l->children);
+        l->children = calloc(n ?: 1, sizeof(*l->children));
+        assert(l->children);
+
+        for (i = 0, pos = 0; i < n; ++i) {
+                eend = inspect_read_word(in, start + frames + i * l->word, l->word);
+                aligned = ALIGN_TO(pos, 1U << elem.alignment);
+
+                if (eend == pos) {
+                        inspect_layout_add(l, elem.type, elem.n_type, start + pos, start + pos);
+                        continue;
+                }
+
+                if (aligned > eend || eend > frames) {
+                        ++l->own.n_invalid;
+                        inspect_layout_add(l, elem.type, elem.n_type, start + pos, start + pos);
+                        continue;
+                }
+
+                l->own.padding += aligned - pos;
+                inspect_layout_add(l, elem.type, elem.n_type, start + aligned, start + eend);
+                pos = eend;
+        }
+
+        l->own.padding += frames - pos;
+}
+
+static void inspect_layout(Inspect *in,
+                           const CVariantType *info,
+                           size_t start,
+                           size_t end,
+                           size_t depth,
+                           InspectLayout *l) {
+        CVariantType child;
+        size_t i, len;
+        int r;
+
+        len = end - start;
+        *l = (InspectLayout){};
+
+        switch (info->type[0]) {
+        case C_VARIANT_STRING:
+        case C_VARIANT_PATH:
+        case C_VARIANT_SIGNATURE:
+                if (!len || in->data[end - 1])
+                        ++l->own.n_invalid;
+                l->own.payload += len;
+                break;
+        case C_VARIANT_VARIANT:
+                l->children = calloc(1, sizeof(*l->children));
+                assert(l->children);
+
+                for (i = len; i > 0; --i)
+                        if (!in->data[start + i - 1])
+                                break;
+
+                r = i ? c_variant_signature_one((const char *)in->data + start + i,
+                                                len - i,
+                                                &child) : -EINVAL;
+                if (r < 0 || depth + child.n_levels >= C_VARIANT_MAX_LEVEL) {
+                        ++l->own.n_invalid;
+                        l->own.framing += len;
+                        break;
+                }
+
+                l->own.framing += len - i + 1;
+                inspect_layout_add(l, child.type, child.n_type, start, start + i - 1);
+                break;
+        case C_VARIANT_MAYBE:
+                l->children = calloc(1, sizeof(*l->children));
+                assert(l->children);
+
+                if (!len)
+                        break;
+
+                r = c_variant_signature_one(info->type + 1, info->n_type - 1, &child);
+                assert(!r);
+
+                if (child.size) {
+                        if (len != child.size)
+                                ++l->own.n_invalid;
+                        inspect_layout_add(l, child.type, child.n_type, start, end);
+                } else {
+                        l->own.framing += 1;
+                        inspect_layout_add(l, child.type, child.n_type, start, end - 1);
+                }
+                break;
+        case C_VARIANT_ARRAY:
+                inspect_layout_array(in, info, start, end, l);
+                break;
+        case C_VARIANT_TUPLE_OPEN:
+        case C_VARIANT_PAIR_OPEN:
+                inspect_layout_tuple(in, info, start, end, l);
+                break;
+        default:
+                if (len != info->size)
+                        ++l->own.n_invalid;
+                l->own.payload += len;
+                break;
+        }
+}
+
+static void inspect_record_tuple(Inspect *in, const CVariantType *info) {
+        InspectTuple *t;
+
+        for (t = in->tuples; t; t = t->next)
+                if (t->n_type == info->n_type && !memcmp(t->type, info->type, info->n_type))
+                        break;
+
+        if (!t) {
+                t = calloc(1, sizeof(*t));
+                assert(t);
+                t->type = strndup(info->type, info->n_type);
+                assert(t->type);
+                t->n_type = info->n_type;
+                t->next = in->tuples;
+                in->tuples = t;
+        }
+
+        ++t->n_instances;
+}
+
+static void inspect_stats_add(InspectStats *to, const InspectStats *from) {
+        to->payload += from->payload;
+        to->padding += from->padding;
+        to->framing += from->framing;
+        to->n_invalid += from->n_invalid;
+}
+
+static void inspect_print(Inspect *in,
+                          const char *label,
+                          const char *type,
+                          size_t n_type,
+                          size_t start,
+                          size_t end,
+                          size_t word,
+                          const InspectStats *st,
+                          size_t depth) {
+        printf("%*s%s %.*s [%zu, %zu) %zu bytes %.1f%% payload:%zu padding:%zu framing:%zu",
+               (int)depth * 2, "", label,
+               (int)n_type, type,
+               start, end, end - start,
+               in->n_data ? 100.0 * (end - start) / in->n_data : 100.0,
+               st->payload, st->padding, st->framing);
+        if (word)
+                printf(" word:%zu", word);
+        if (st->n_invalid)
+                printf(" INVALID:%zu", st->n_invalid);
+        printf("\n");
+}
+
+static void inspect_node(Inspect *in,
+                         const char *label,
+                         const char *type,
+                         size_t n_type,
+                         size_t start,
+                         size_t end,
+                         size_t depth,
+                         InspectStats *st,
+                         bool print) {
+        InspectStats sub = {};
+        CVariantType info;
+        InspectLayout l;
+        char buf[32];
+        size_t i;
+        int r;
+
+        r = c_variant_signature_one(type, n_type, &info);
+        assert(!r);
+
+        if (print) {
+                /* collect the subtree totals first, so they precede it */
+                inspect_node(in, label, type, n_type, start, end, depth, &sub, false);
+                inspect_stats_add(st, &sub);
+        } else if (in->record && info.size && *type == C_VARIANT_TUPLE_OPEN) {
+                inspect_record_tuple(in, &info);
+        }
+
+        inspect_layout(in, &info, start, end, depth, &l);
+
+        if (print)
+                inspect_print(in, label, type, n_type, start, end, l.word, &sub, depth);
+        else
+                inspect_stats_add(st, &l.own);
+
+        for (i = 0; i < l.n_children; ++i) {
+                if (*type == C_VARIANT_ARRAY)
+                        snprintf(buf, sizeof(buf), "[%zu]", i);
+                else if (*type == C_VARIANT_TUPLE_OPEN || *type == C_VARIANT_PAIR_OPEN)
+                        snprintf(buf, sizeof(buf), "#%zu", i);
+                else
+                        snprintf(buf, sizeof(buf), "%c", *type);
+
+                if (!print) {
+                        inspect_node(in, buf, l.children[i].type, l.children[i].n_type,
+                                     l.children[i].start, l.children[i].end,
+                                     depth + 1, st, false);
+                } else if (depth + 1 < in->max_depth && i < in->max_elements) {
+                        inspect_node(in, buf, l.children[i].type, l.children[i].n_type,
+                                     l.children[i].start, l.children[i].end,
+                                     depth + 1, &sub, true);
+                }
+        }
+
+        if (print && depth + 1 < in->max_depth && l.n_children > in->max_elements)
+                printf("%*s... %zu more\n", (int)(depth + 1) * 2, "", l.n_children - in->max_elements);
+
+        free(l.children);
+}
+
+static size_t inspect_tuple_size(const CVariantType *members, size_t n_members, size_t alignment) {
+        size_t i, pos;
+
+        for (i = 0, pos = 0; i < n_members; ++i)
+                pos = ALIGN_TO(pos, 1U << members[i].alignment) + members[i].size;
+
+        return ALIGN_TO(pos, 1U << alignment);
+}
+
+static void inspect_suggest(Inspect *in) {
+        CVariantType info, *members, tmp;
+        size_t i, j, n, size;
+        InspectTuple *t;
+        bool any = false;
+        int r;
+
+        for (t = in->tuples; t; t = t->next) {
+                r = c_variant_signature_one(t->type, t->n_type, &info);
+                assert(!r);
+
+                members = calloc(t->n_type, sizeof(*members));
+                assert(members);
+
+                for (i = 1, n = 0;
+                     c_variant_signature_next(t->type + i, t->n_type - 1 - i, members + n) > 0;
+                     i += members[n++].n_type)
+                        /* empty */ ;
+
+                if (!n) {
+                        free(members);
+                        continue;
+                }
+
+                /* stable sort by alignment, largest first, removes all inner padding */
+                for (i = 1; i < n; ++i) {
+                        tmp = members[i];
+                        for (j = i; j > 0 && members[j - 1].alignment < tmp.alignment; --j)
+                                members[j] = members[j - 1];
+                        members[j] = tmp;
+                }
+
+                size = inspect_tuple_size(members, n, info.alignment);
+                if (size < info.size) {
+                        if (!any)
+                                printf("\nsuggested reorderings:\n");
+                        any = true;
+
+                        printf("  %.*s -> (", (int)t->n_type, t->type);
+                        for (i = 0; i < n; ++i)
+                                printf("%.*s", (int)members[i].n_type, members[i].type);
+                        printf(") saves %zu of %zu bytes, %zu instances, %zu bytes total\n",
+                               info.size - size, info.size, t->n_instances,
+                               (info.size - size) * t->n_instances);
+                }
+
+                free(members);
+        }
+
+        if (!any)
+                printf("\nno fixed-size tuple can be reordered to save space\n");
+}
+
+static uint64_t inspect_nsec(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static int inspect_read_all(CVariant *cv) {
+        union {
+                bool b;
+                uint8_t y;
+                uint16_t q;
+                uint32_t u;
+                uint64_t t;
+                double d;
+                const char *s;
+        } v;
+        CVariantVarg varg;
+        const char *type;
+        size_t n;
+        int c;
+
+        type = c_variant_peek_type(cv, &n);
+
+        for (c = c_variant_varg_init(&varg, type, n);
+             c;
+             c = c_variant_varg_next(&varg)) {
+                switch (c) {
+                case -1:
+                        c_variant_exit(cv, NULL);
+                        break;
+                case C_VARIANT_VARIANT:
+                        c_variant_enter(cv, "v");
+                        type = c_variant_peek_type(cv, &n);
+                        c_variant_varg_push(&varg, type, n, -1);
+                        break;
+                case C_VARIANT_MAYBE:
+                        c_variant_enter(cv, "m");
+                        c_variant_varg_enter_bound(&varg, cv, c_variant_peek_count(cv));
+                        break;
+                case C_VARIANT_ARRAY:
+                        c_variant_enter(cv, "a");
+                        c_variant_varg_enter_bound(&varg, cv, c_variant_peek_count(cv));
+                        break;
+                case C_VARIANT_TUPLE_OPEN:
+                        c_variant_enter(cv, "(");
+                        c_variant_varg_enter_unbound(&varg, cv, ')');
+                        break;
+                case C_VARIANT_PAIR_OPEN:
+                        c_variant_enter(cv, "{");
+                        c_variant_varg_enter_unbound(&varg, cv, '}');
+                        break;
+                default:
+                        c_variant_read(cv, (char [2]){ c, 0 }, &v);
+                        break;
+                }
+        }
+
+        return c_variant_return_poison(cv);
+}
+
+static int inspect_bench(const char *type, const void *data, size_t n_data, uint64_t times) {
+        uint64_t i, start_nsec = 0, end_nsec;
+        CVariant *cv;
+        int r;
+
+        for (i = 0; i <= times; ++i) {
+                /* the first run warms up caches and is not accounted */
+                if (i == 1)
+                        start_nsec = inspect_nsec();
+
+                r = c_variant_new_from_buffer(&cv, type, strlen(type), data, n_data);
+                if (r < 0)
+                        return r;
+
+                r = inspect_read_all(cv);
+                c_variant_free(cv);
+                if (r < 0)
+                        return r;
+        }
+        end_nsec = inspect_nsec();
+
+        printf("reads:%" PRIu64 " bytes:%zu nsec/read:%" PRIu64 " MiB/s:%.1f\n",
+               times, n_data,
+               (end_nsec - start_nsec) / times,
+               (double)n_data * times / (1024.0 * 1024.0) / ((end_nsec - start_nsec ?: 1) / 1e9));
+        return 0;
+}
+
+static void *inspect_load(FILE *f, size_t *sizep) {
+        size_t n = 0, n_alloc = 4096;
+        void *data, *p;
+
+        data = malloc(n_alloc);
+        if (!data)
+                return NULL;
+
+        for (;;) {
+                n += fread((char *)data + n, 1, n_alloc - n, f);
+                if (n < n_alloc)
+                        break;
+
+                p = realloc(data, n_alloc * 2);
+                if (!p) {
+                        free(data);
+                        return NULL;
+                }
+                data = p;
+                n_alloc *= 2;
+        }
+
+        if (ferror(f)) {
+                free(data);
+                return NULL;
+        }
+
+        *sizep = n;
+        return data;
+}
+
+static void inspect_help(void) {
+        printf("%s [OPTIONS...] TYPE [FILE]\n\n"
+               "Show the serialization layout of a variant of type TYPE, read from\n"
+               "FILE or stdin.\n\n"
+               "  -h --help               Show this help\n"
+               "  -d --depth=N            Print at most N levels of the tree\n"
+               "  -e --elements=N         Print at most N children per container\n"
+               "  -b --bench=N            Time N reads via the library instead\n",
+               program_invocation_short_name);
+}
+
+int main(int argc, char **argv) {
+        static const struct option options[] = {
+                { "help",       no_argument,            NULL,   'h' },
+                { "depth",      required_argument,      NULL,   'd' },
+                { "elements",   required_argument,      NULL,   'e' },
+                { "bench",      required_argument,      NULL,   'b' },
+                {}
+        };
+        Inspect in = { .max_depth = SIZE_MAX, .max_elements = 8 };
+        InspectStats st = {};
+        uint64_t bench = 0;
+        CVariantType info;
+        InspectTuple *t;
+        const char *type;
+        void *data;
+        FILE *f;
+        int r, c;
+
+        while ((c = getopt_long(argc, argv, "hd:e:b:", options, NULL)) >= 0) {
+                switch (c) {
+                case 'h':
+                        inspect_help();
+                        return 0;
+                case 'd':
+                        in.max_depth = strtoull(optarg, NULL, 0);
+                        break;
+                case 'e':
+                        in.max_elements = strtoull(optarg, NULL, 0);
+                        break;
+                case 'b':
+                        bench = strtoull(optarg, NULL, 0);
+                        break;
+                default:
+                        return 1;
+                }
+        }
+
+        if (optind >= argc || argc - optind > 2) {
+                fprintf(stderr, "%s: expected a type and an optional file\n", program_invocation_short_name);
+                return 1;
+        }
+
+        type = argv[optind];
+        r = c_variant_signature_one(type, strlen(type), &info);
+        if (r < 0) {
+                fprintf(stderr, "%s: invalid type '%s'\n", program_invocation_short_name, type);
+                return 1;
+        }
+
+        if (argc - optind > 1) {
+                f = fopen(argv[optind + 1], "re");
+                if (!f) {
+                        fprintf(stderr, "%s: cannot open '%s': %m\n", program_invocation_short_name, argv[optind + 1]);
+                        return 1;
+                }
+        } else {
+                f = stdin;
+        }
+
+        data = inspect_load(f, &in.n_data);
+        if (f != stdin)
+                fclose(f);
+        if (!data) {
+                fprintf(stderr, "%s: cannot read input\n", program_invocation_short_name);
+                return 1;
+        }
+
+        in.data = data;
+
+        if (bench) {
+                r = inspect_bench(type, data, in.n_data, bench);
+                if (r < 0)
+                        fprintf(stderr, "%s: cannot read variant: %s\n", program_invocation_short_name, strerror(-r));
+        } else {
+                /* one pass for the totals, one to print the tree */
+                in.record = true;
+                inspect_node(&in, "-", type, strlen(type), 0, in.n_data, 0, &st, false);
+                in.record = false;
+                if (in.max_depth)
+                        inspect_node(&in, "-", type, strlen(type), 0, in.n_data, 0, &(InspectStats){}, true);
+
+                printf("\ntotal:%zu payload:%zu (%.1f%%) padding:%zu (%.1f%%) framing:%zu (%.1f%%)\n",
+                       in.n_data,
+                       st.payload, in.n_data ? 100.0 * st.payload / in.n_data : 0.0,
+                       st.padding, in.n_data ? 100.0 * st.padding / in.n_data : 0.0,
+                       st.framing, in.n_data ? 100.0 * st.framing / in.n_data : 0.0);
+                if (st.n_invalid)
+                        printf("invalid framing in %zu places, affected elements read as empty\n", st.n_invalid);
+
+                inspect_suggest(&in);
+        }
+
+        while ((t = in.tuples)) {
+                in.tuples = t->next;
+                free(t->type);
+                free(t);
+        }
+        free(data);
+        return r < 0 ? 1 : 0;
+}
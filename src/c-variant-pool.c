@@ -0,0 +1,236 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Buffer Pools
+ *
+ * A buffer pool is a single, page-aligned memory region that writers allocate
+ * their buffer space from. The region is fixed for the lifetime of the pool,
+ * so it can be registered with the kernel once (e.g., as io_uring fixed
+ * buffer), and every variant serialized into it can then be transmitted
+ * without the kernel pinning and mapping the pages on each request.
+ *
+ * The region is split into chunks of C_VARIANT_POOL_CHUNK bytes. Allocations
+ * are runs of consecutive chunks, tracked in a bitmap, and searched for in
+ * next-fit order. The length of each run is stored at its first chunk, so it
+ * can be released without the caller remembering its size.
+ *
+ * Pools are not thread-safe. They are meant to be used per thread (or per
+ * ring), and the caller must synchronize access otherwise.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static bool c_variant_pool_test(CVariantPool *pool, size_t i) {
+        return pool->map[i / 64] & (UINT64_C(1) << (i % 64));
+}
+
+static void c_variant_pool_mark(CVariantPool *pool, size_t i, size_t n, bool set) {
+        for ( ; n > 0; --n, ++i) {
+                if (set)
+                        pool->map[i / 64] |= UINT64_C(1) << (i % 64);
+                else
+                        pool->map[i / 64] &= ~(UINT64_C(1) << (i % 64));
+        }
+}
+
+static size_t c_variant_pool_find(CVariantPool *pool, size_t start, size_t end, size_t n) {
+        size_t i, run;
+
+        /*
+         * Find @n consecutive free chunks in [@start, @end) and return the
+         * index of the first. If there is none, @end is returned. Fully
+         * allocated bitmap words are skipped as a whole.
+         */
+
+        run = 0;
+        for (i = start; i < end; ++i) {
+                if (!(i % 64) && pool->map[i / 64] == UINT64_MAX && i + 64 <= end) {
+                        run = 0;
+                        i += 63;
+                        continue;
+                }
+
+                if (c_variant_pool_test(pool, i)) {
+                        run = 0;
+                } else if (++run >= n) {
+                        return i + 1 - n;
+                }
+        }
+
+        return end;
+}
+
+void *c_variant_pool_alloc(CVariantPool *pool, size_t *np) {
+        size_t i, n, end;
+
+        /*
+         * Allocate at least *@np bytes from @pool. The allocation is rounded
+         * up to full chunks and the actual size is returned in @np. NULL is
+         * returned if the pool has no sufficient consecutive space left.
+         */
+
+        n = (*np + C_VARIANT_POOL_CHUNK - 1) / C_VARIANT_POOL_CHUNK;
+        if (_unlikely_(n < 1 || n > UINT32_MAX || n > pool->n_chunks - pool->n_allocated))
+                return NULL;
+
+        i = c_variant_pool_find(pool, pool->i_hint, pool->n_chunks, n);
+        if (i >= pool->n_chunks) {
+                /* wrap around; include runs crossing the hint */
+                end = pool->i_hint + n - 1;
+                end = (end < pool->n_chunks) ? end : pool->n_chunks;
+                i = c_variant_pool_find(pool, 0, end, n);
+                if (i >= end)
+                        return NULL;
+        }
+
+        c_variant_pool_mark(pool, i, n, true);
+        pool->runs[i] = n;
+        pool->n_allocated += n;
+        pool->i_hint = (i + n < pool->n_chunks) ? i + n : 0;
+
+        *np = n * C_VARIANT_POOL_CHUNK;
+        return (char *)pool->vec.iov_base + i * C_VARIANT_POOL_CHUNK;
+}
+
+void c_variant_pool_release(CVariantPool *pool, void *p) {
+        size_t i, n;
+
+        assert(c_variant_pool_owns(pool, p));
+        assert(!(((char *)p - (char *)pool->vec.iov_base) % C_VARIANT_POOL_CHUNK));
+
+        i = ((char *)p - (char *)pool->vec.iov_base) / C_VARIANT_POOL_CHUNK;
+        n = pool->runs[i];
+        assert(n > 0 && pool->n_allocated >= n);
+
+        c_variant_pool_mark(pool, i, n, false);
+        pool->runs[i] = 0;
+        pool->n_allocated -= n;
+}
+
+/**
+ * c_variant_pool_new() - create new buffer pool
+ * @poolp:      output variable for new pool
+ * @size:       size of the pool in bytes
+ * @index:      index of the pool in the registered buffer table
+ *
+ * This allocates a new buffer pool with a backing memory region of at least
+ * @size bytes. The region is page-aligned and stays valid for the entire
+ * lifetime of the pool. It can be queried via c_variant_pool_get_vec(), to
+ * register it with the kernel. The caller must pass the index it uses for
+ * the registration as @index. It is used as buffer index when preparing
+ * io_uring fixed-buffer requests for variants allocated from this pool.
+ *
+ * Variants can be created on top of a pool via c_variant_new_with_pool().
+ *
+ * On success, the new pool is returned in @poolp. On failure, @poolp stays
+ * untouched.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_pool_new(CVariantPool **poolp, size_t size, uint16_t index) {
+        CVariantPool *pool;
+        size_t n_chunks;
+        void *p;
+
+        n_chunks = size / C_VARIANT_POOL_CHUNK + !!(size % C_VARIANT_POOL_CHUNK);
+        if (n_chunks < 1)
+                n_chunks = 1;
+        if (_unlikely_(n_chunks > SIZE_MAX / C_VARIANT_POOL_CHUNK))
+                return -ENOMEM;
+
+        pool = calloc(1, sizeof(*pool));
+        if (!pool)
+                return -ENOMEM;
+
+        pool->n_chunks = n_chunks;
+        pool->index = index;
+        pool->runs = calloc(n_chunks, sizeof(*pool->runs));
+        pool->map = calloc((n_chunks + 63) / 64, sizeof(*pool->map));
+        if (!pool->runs || !pool->map)
+                goto error;
+
+        p = mmap(NULL,
+                 n_chunks * C_VARIANT_POOL_CHUNK,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                goto error;
+
+        pool->vec.iov_base = p;
+        pool->vec.iov_len = n_chunks * C_VARIANT_POOL_CHUNK;
+
+        *poolp = pool;
+        return 0;
+
+error:
+        free(pool->map);
+        free(pool->runs);
+        free(pool);
+        return -ENOMEM;
+}
+
+/**
+ * c_variant_pool_free() - destroy buffer pool
+ * @pool:       pool to destroy, or NULL
+ *
+ * This destroys the buffer pool @pool and releases its backing memory. It is
+ * a programming error to call this while there are still variants using the
+ * pool. If the memory was registered with the kernel, the caller must
+ * unregister it first.
+ *
+ * If NULL is passed, this is a no-op.
+ *
+ * Return: NULL is returned.
+ */
+_public_ CVariantPool *c_variant_pool_free(CVariantPool *pool) {
+        if (!pool)
+                return NULL;
+
+        assert(!pool->n_allocated);
+
+        munmap(pool->vec.iov_base, pool->vec.iov_len);
+        free(pool->map);
+        free(pool->runs);
+        free(pool);
+        return NULL;
+}
+
+/**
+ * c_variant_pool_get_vec() - query memory region of buffer pool
+ * @pool:       pool to query
+ *
+ * This returns the memory region backing @pool, suitable to be passed to
+ * io_uring_register(2) via IORING_REGISTER_BUFFERS. The region is fixed for
+ * the lifetime of the pool.
+ *
+ * Return: Pointer to the iovec describing the pool memory.
+ */
+_public_ const struct iovec *c_variant_pool_get_vec(CVariantPool *pool) {
+        return &pool->vec;
+}
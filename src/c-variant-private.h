@@ -22,14 +22,27 @@
 #include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/uio.h>
 #include "c-variant.h"
 
+typedef struct CVariantArenaBlock CVariantArenaBlock;
+typedef struct CVariantBatch CVariantBatch;
+typedef struct CVariantBatchMember CVariantBatchMember;
+typedef struct CVariantCpu CVariantCpu;
+typedef struct CVariantDelta CVariantDelta;
+typedef struct CVariantDeltaChild CVariantDeltaChild;
+typedef struct CVariantDeltaOp CVariantDeltaOp;
 typedef struct CVariantElement CVariantElement;
+typedef struct CVariantFile CVariantFile;
 typedef struct CVariantLevel CVariantLevel;
+typedef struct CVariantShmShared CVariantShmShared;
+typedef struct CVariantSum CVariantSum;
+typedef struct CVariantSignatureScan CVariantSignatureScan;
 typedef struct CVariantSignatureState CVariantSignatureState;
 typedef struct CVariantState CVariantState;
+typedef struct CVariantStructOp CVariantStructOp;
 typedef struct CVariantType CVariantType;
 typedef struct CVariantVarg CVariantVarg;
 typedef struct CVariantVargLevel CVariantVargLevel;
@@ -99,6 +112,8 @@ struct CVariantElement {
         uint8_t unused : 2;
 };
 
+extern const CVariantElement c_variant_elements[C_VARIANT_N];
+
 /*
  * Types
  */
@@ -131,6 +146,17 @@ struct CVariantSignatureState {
         uint8_t unused : 1;
 };
 
+#define C_VARIANT_SIGNATURE_SCAN (32)
+#define C_VARIANT_SIGNATURE_SCAN_BLOCK (256)
+
+struct CVariantSignatureScan {
+        int64_t depth;                  /* bracket depth after the scan */
+        int64_t max_depth;              /* maximum bracket depth reached */
+        int64_t min_depth;              /* minimum bracket depth reached */
+        bool bound : 1;                 /* bound containers were seen */
+        bool invalid : 1;               /* invalid elements were seen */
+};
+
 int c_variant_signature_next(const char *signature, size_t n_signature, CVariantType *infop);
 int c_variant_signature_one(const char *signature, size_t n_signature, CVariantType *infop);
 
@@ -157,17 +183,270 @@ struct CVariantLevel {
 
 struct CVariantState {
         CVariantState *link;            /* parent/child state */
-        uint8_t i_levels;               /* current iterator level */
+        uint8_t i_levels;               /* number of saved parent levels */
         uint8_t n_levels;               /* number of allocated levels */
         CVariantLevel levels[0];        /* level array */
 };
 
-void c_variant_level_root(CVariantLevel *level, size_t size, const char *type, size_t n_type);
+void c_variant_level_root(CVariant *cv, size_t size, const char *type, size_t n_type);
 bool c_variant_on_root_level(CVariant *cv);
 int c_variant_ensure_level(CVariant *cv);
 void c_variant_push_level(CVariant *cv);
 void c_variant_pop_level(CVariant *cv);
 
+/*
+ * CPU Dispatch
+ */
+
+struct CVariantCpu {
+        const char *name;
+        bool (*supported) (void);
+        void (*narrow_frames) (void *words,
+                               const uint64_t *frames,
+                               size_t n_frames,
+                               size_t wordsize,
+                               bool reverse);
+        uint32_t (*crc32c) (uint32_t crc, const void *p, size_t n);
+        void (*scan_signature) (const char *signature,
+                                size_t n_signature,
+                                CVariantSignatureScan *scan);
+        void (*copy_stream) (void *dst, const void *src, size_t n);
+};
+
+extern const CVariantCpu c_variant_cpus[];
+extern const size_t c_variant_n_cpus;
+extern const CVariantCpu *c_variant_cpu;
+
+int c_variant_cpu_select(const char *name);
+
+/*
+ * Buffer Pools
+ */
+
+#define C_VARIANT_POOL_CHUNK (4096)
+
+struct CVariantPool {
+        struct iovec vec;       /* mapped region */
+        size_t n_chunks;        /* number of chunks in @vec */
+        size_t n_allocated;     /* number of allocated chunks */
+        size_t i_hint;          /* chunk to start the next search at */
+        uint32_t *runs;         /* allocation length, per starting chunk */
+        uint64_t *map;          /* allocation bitmap */
+        uint16_t index;         /* registered buffer index */
+};
+
+void *c_variant_pool_alloc(CVariantPool *pool, size_t *np);
+void c_variant_pool_release(CVariantPool *pool, void *p);
+
+static inline bool c_variant_pool_owns(CVariantPool *pool, const void *p) {
+        return pool &&
+               (const char *)p >= (const char *)pool->vec.iov_base &&
+               (const char *)p < (const char *)pool->vec.iov_base + pool->vec.iov_len;
+}
+
+/*
+ * Checksums
+ */
+
+#define C_VARIANT_SUM_BATCH (512)
+
+struct CVariantSum {
+        unsigned int kind;              /* C_VARIANT_CHECKSUM_* */
+        bool final : 1;                 /* is @result valid? */
+        size_t v_sum;                   /* writer: iovec folded up to */
+        size_t i_sum;                   /* writer: offset into @v_sum */
+        uint64_t n_total;               /* number of bytes summed */
+        uint64_t result;                /* final checksum */
+
+        union {
+                uint32_t crc;           /* CRC32C register */
+                struct {
+                        uint64_t acc[4];        /* XXH64 lanes */
+                        uint8_t buf[32];        /* XXH64 partial stripe */
+                } xxh;
+        };
+};
+
+int c_variant_sum_fold(CVariant *cv, bool final);
+
+/*
+ * Flattening
+ */
+
+#define C_VARIANT_STREAM_MIN (16U << 20)
+#define C_VARIANT_STREAM_RUN (4096)
+
+/*
+ * File Segments
+ */
+
+struct CVariantFile {
+        CVariantFile *next;             /* next segment of the variant */
+        size_t idx;                     /* index of the backing iovec */
+        uint64_t offset;                /* start of the segment in @fd */
+        int fd;                         /* private duplicate of the file */
+        void *map;                      /* page-aligned mapping, or NULL */
+        size_t n_map;                   /* size of @map */
+};
+
+int c_variant_file_map(CVariant *cv, struct iovec *v);
+int c_variant_file_map_all(CVariant *cv);
+void c_variant_file_free_all(CVariant *cv);
+
+/*
+ * Struct Descriptors
+ */
+
+#define C_VARIANT_ARENA_BLOCK (4096)
+
+struct CVariantArenaBlock {
+        CVariantArenaBlock *next;       /* next older block */
+        size_t size;                    /* size of @data */
+        size_t used;                    /* allocated bytes of @data */
+        max_align_t data[];             /* backing memory */
+};
+
+struct CVariantArena {
+        CVariantArenaBlock *blocks;     /* blocks, newest first */
+        size_t size;                    /* size of the initial block */
+};
+
+enum {
+        C_VARIANT_STRUCT_OP_BASIC,      /* fixed-size basic type */
+        C_VARIANT_STRUCT_OP_STRING,     /* string-like basic type */
+        C_VARIANT_STRUCT_OP_STRUCT,     /* tuple or pair */
+        C_VARIANT_STRUCT_OP_ARRAY,      /* array, as CVariantArray */
+};
+
+struct CVariantStructOp {
+        uint8_t kind;                   /* C_VARIANT_STRUCT_OP_* */
+        char element;                   /* leading element of the type */
+        bool copy : 1;                  /* serialization matches C layout */
+        bool dense : 1;                 /* ...and has no padding */
+        uint8_t alignment : 2;          /* serialized alignment (in power of 2) */
+        size_t offset;                  /* offset in enclosing C object */
+        size_t size;                    /* C size of value, or array element */
+        size_t n_fixed;                 /* serialized size, if fixed-size */
+        size_t n_ops;                   /* number of ops of the body */
+};
+
+struct CVariantStruct {
+        char *type;                     /* type string of the root */
+        size_t n_type;                  /* length of @type */
+        size_t size;                    /* C size of the root */
+        bool has_arrays : 1;            /* does it need an arena? */
+        size_t n_ops;                   /* number of ops */
+        CVariantStructOp ops[];         /* ops, in pre-order */
+};
+
+#define C_VARIANT_BATCH_MAX_MEMBERS (64)
+
+struct CVariantBatchMember {
+        const CVariantStructOp *op;     /* op of the member */
+        uint8_t alignment;              /* alignment (in power of 2) */
+        bool framed : 1;                /* is its end stored in a frame? */
+};
+
+struct CVariantBatch {
+        size_t n_fixed;                 /* serialized size, if fixed-size */
+        size_t n_frames;                /* number of framed members */
+        bool copy : 1;                  /* root matches C layout */
+        size_t n_members;               /* number of members */
+        CVariantBatchMember members[C_VARIANT_BATCH_MAX_MEMBERS];
+};
+
+void *c_variant_arena_alloc(CVariantArena *arena, size_t n);
+
+/*
+ * Deltas
+ */
+
+#define C_VARIANT_DELTA_LITERAL (UINT64_MAX)
+#define C_VARIANT_DELTA_MIN_COPY (32)
+
+struct CVariantDeltaOp {
+        uint64_t offset;                /* offset in old data, or LITERAL */
+        uint64_t size;                  /* number of bytes */
+};
+
+struct CVariantDeltaChild {
+        const char *type;               /* type of the child */
+        size_t n_type;                  /* length of @type */
+        size_t start;                   /* offset of first byte */
+        size_t end;                     /* offset past last byte */
+};
+
+struct CVariantDelta {
+        const uint8_t *from;            /* old data */
+        const uint8_t *to;              /* new data, if any */
+
+        CVariantDeltaOp pending;        /* copy not yet committed */
+        CVariantDeltaOp *ops;
+        size_t n_ops;
+        size_t n_allocated_ops;
+        uint8_t *literal;
+        size_t n_literal;
+        size_t n_allocated_literal;
+};
+
+int c_variant_delta_layout(const uint8_t *data,
+                           const CVariantType *info,
+                           size_t start,
+                           size_t end,
+                           CVariantDeltaChild **childrenp,
+                           size_t *n_childrenp);
+int c_variant_delta_flatten(CVariant *cv, const uint8_t **datap, size_t *sizep, void **freep);
+int c_variant_delta_flush(CVariantDelta *d);
+int c_variant_delta_copy(CVariantDelta *d, size_t offset, size_t size);
+int c_variant_delta_bytes(CVariantDelta *d, const void *p, size_t size);
+int c_variant_delta_assemble(CVariant *from,
+                             const char *type,
+                             size_t n_type,
+                             const CVariantDeltaOp *ops,
+                             size_t n_ops,
+                             const uint8_t *literal,
+                             size_t n_literal,
+                             uint64_t n_to,
+                             CVariant **top);
+
+/*
+ * Shared Memory Rings
+ */
+
+#define C_VARIANT_SHM_MAGIC (UINT64_C(0x676e697274726176)) /* "vartring" */
+#define C_VARIANT_SHM_MAX (UINT64_C(1) << 31)
+
+struct CVariantShmShared {
+        /* static */
+        uint64_t magic;                 /* C_VARIANT_SHM_MAGIC */
+        uint64_t size;                  /* size of the data area */
+        uint64_t header;                /* size of this header (page aligned) */
+        uint32_t flags;                 /* C_VARIANT_SHM_* flags */
+
+        /* producer side */
+        uint64_t reserve __attribute__((__aligned__(64))); /* reserved end (MPSC only) */
+        uint64_t tail;                  /* published end */
+        uint32_t n_tail_waiters;        /* consumers waiting on @tail */
+
+        /* consumer side */
+        uint64_t head __attribute__((__aligned__(64))); /* released start */
+        uint32_t n_head_waiters;        /* producers waiting on @head */
+};
+
+struct CVariantShm {
+        CVariantShmShared *shared;      /* shared header */
+        char *data;                     /* shared data area (mirrored) */
+        size_t header;                  /* size of @shared (page aligned) */
+        size_t size;                    /* size of @data (power of 2) */
+        bool mpsc : 1;                  /* multi-producer protocol? */
+        bool dirty : 1;                 /* unpublished messages? */
+
+        uint64_t tail;                  /* producer: local end */
+        uint64_t head;                  /* producer: cached @shared->head */
+        uint64_t read;                  /* consumer: local start */
+        uint64_t avail;                 /* consumer: cached @shared->tail */
+};
+
 /*
  * Variants
  */
@@ -187,6 +466,14 @@ struct CVariant {
         uint8_t a_vecs : 6;             /* number of allocated vectors */
         bool sealed : 1;                /* is it sealed? */
         bool allocated_vecs : 1;        /* are vectors allocated? */
+        bool linear : 1;                /* backed by a single iovec? */
+
+        CVariantPool *pool;             /* buffer pool, or NULL */
+        CVariantFile *files;            /* file segments, or NULL */
+        CVariantSum *sum;               /* checksum state, or NULL */
+        void (*release_fn)(void *);     /* releases foreign data, or NULL */
+        void *release_userdata;         /* argument to @release_fn */
+        CVariantLevel level;            /* current iterator level */
 };
 
 int c_variant_alloc(CVariant **cvp,
@@ -197,7 +484,11 @@ int c_variant_alloc(CVariant **cvp,
                     size_t n_vecs,
                     size_t n_extra);
 void c_variant_dealloc(CVariant *cv);
+void *c_variant_buffer_alloc(CVariant *cv, size_t *np, size_t min);
+void c_variant_buffer_free(CVariant *cv, void *p);
 int c_variant_poison_internal(CVariant *cv, int poison);
+int c_variant_read_raw(CVariant *cv, char element, const void **datap, size_t *sizep);
+int c_variant_write_raw(CVariant *cv, char element, const void *data, size_t n_data);
 
 #define c_variant_poison(_cv, _poison)                          \
         ({                                                      \
@@ -89,6 +89,10 @@ static size_t c_variant_word_fetch(const void *addr, size_t wordsize) {
  * set of levels must be allocated. This is handled by the CVariant management
  * code, though. The CVariantLevel code only deas with each level individually.
  *
+ * Only the current level is kept in the CVariant itself. Parent levels are
+ * saved on the state stack when entering a container, and restored when
+ * exiting it.
+ *
  * The state on each level consists of a set of static fields:
  *  - size: size in bytes available to this level
  *  - i_end, v_end: offset into data vectors, pointing *after* the last byte
@@ -132,15 +136,26 @@ static size_t c_variant_word_fetch(const void *addr, size_t wordsize) {
  * data offset into the iovec array. We also support the reverse operation
  * 'unfolding', which is very handy if iterators are dereferenced with
  * temporary offsets all the time.
+ *
+ * However, most variants are parsed from a single, linear buffer. In that case,
+ * folding and unfolding are pointless, as the vector index is always 0 and the
+ * data offset is a plain byte offset into the buffer. Hence, if a variant is
+ * backed by a single iovec, we mark it as 'linear' and use specialized
+ * versions of the level accessors, which just use pointer arithmetic. They
+ * must yield the exact same results as their generic counterparts.
  */
 
-void c_variant_level_root(CVariantLevel *level, size_t size, const char *type, size_t n_type) {
+void c_variant_level_root(CVariant *cv, size_t size, const char *type, size_t n_type) {
+        CVariantLevel *level = &cv->level;
+
         /*
          * Initialize the root-level to occupy @size bytes of the available
          * space. The caller should usually have calculated it based on the set
          * of iovecs available.
          */
 
+        assert(c_variant_on_root_level(cv));
+
         level->size = size;
         level->i_tail = size;
         level->v_tail = 0;
@@ -161,9 +176,25 @@ void c_variant_level_root(CVariantLevel *level, size_t size, const char *type, s
         level->index = 1;
 }
 
+static void c_variant_level_jump_linear(CVariantLevel *level, size_t offset) {
+        /*
+         * Linear version of c_variant_level_jump(). @i_front is the absolute
+         * position in the only iovec, so any jump is a simple addition. As
+         * the container never starts before the buffer, this cannot wrap
+         * around for negative jumps.
+         */
+        level->i_front = level->i_front - level->offset + offset;
+        level->offset = offset;
+}
+
 static void c_variant_level_jump(CVariant *cv, CVariantLevel *level, size_t offset) {
         size_t diff;
 
+        if (_likely_(cv->linear)) {
+                c_variant_level_jump_linear(level, offset);
+                return;
+        }
+
         /*
          * This moves the current front-iterator to the specified offset,
          * relative to the start of the container.
@@ -194,10 +225,35 @@ static void c_variant_level_jump(CVariant *cv, CVariantLevel *level, size_t offs
         level->offset = offset;
 }
 
+static void *c_variant_level_front_linear(CVariant *cv, CVariantLevel *level, size_t *sizep) {
+        size_t size = 0;
+        void *p = NULL;
+
+        /*
+         * Linear version of c_variant_level_front(). There is nothing to
+         * fold, @i_front always points into the only iovec, if the current
+         * position is inside the container.
+         */
+
+        if (level->offset < level->size) {
+                size = cv->vecs->iov_len - level->i_front;
+                if (size > level->size - level->offset)
+                        size = level->size - level->offset;
+
+                p = (char *)cv->vecs->iov_base + level->i_front;
+        }
+
+        *sizep = size;
+        return p;
+}
+
 static void *c_variant_level_front(CVariant *cv, CVariantLevel *level, size_t *sizep) {
         size_t size = 0;
         void *p = NULL;
 
+        if (_likely_(cv->linear))
+                return c_variant_level_front_linear(cv, level, sizep);
+
         /*
          * This folds @v_front[@i_front] onto the existing vecs of @cv and then
          * returns a pointer to the current location, together with the maximum
@@ -218,6 +274,10 @@ static void *c_variant_level_front(CVariant *cv, CVariantLevel *level, size_t *s
                         ++v;
                 }
 
+                /* map file segments lazily, on first access */
+                if (_unlikely_(!v->iov_base) && c_variant_file_map(cv, v) < 0)
+                        goto out;
+
                 size = v->iov_len - level->i_front;
                 if (size > level->size - level->offset)
                         size = level->size - level->offset;
@@ -225,6 +285,27 @@ static void *c_variant_level_front(CVariant *cv, CVariantLevel *level, size_t *s
                 p = (char *)v->iov_base + level->i_front;
         }
 
+out:
+        *sizep = size;
+        return p;
+}
+
+static void *c_variant_level_tail_linear(CVariant *cv, CVariantLevel *level, size_t skip, size_t *sizep) {
+        size_t size = 0;
+        void *p = NULL;
+
+        /*
+         * Linear version of c_variant_level_tail(). @i_tail is the absolute
+         * end position of the level in the only iovec, and is always bigger
+         * than, or equal to, the level size. Hence, there is nothing to fold
+         * or unfold.
+         */
+
+        if (skip < level->size) {
+                size = level->size - skip;
+                p = (char *)cv->vecs->iov_base + level->i_tail - level->size;
+        }
+
         *sizep = size;
         return p;
 }
@@ -234,6 +315,9 @@ static void *c_variant_level_tail(CVariant *cv, CVariantLevel *level, size_t ski
         size_t size = 0;
         void *p = NULL;
 
+        if (_likely_(cv->linear))
+                return c_variant_level_tail_linear(cv, level, skip, sizep);
+
         /*
          * This is similar to c_variant_level_front(), but maps the tail of
          * this level. Furthermore, since the tail is fixed and cannot be
@@ -268,6 +352,9 @@ static void *c_variant_level_tail(CVariant *cv, CVariantLevel *level, size_t ski
                         ++v;
                 }
 
+                if (_unlikely_(!v->iov_base) && c_variant_file_map(cv, v) < 0)
+                        goto out;
+
                 if (level->size < level->i_tail)
                         size = level->size - skip;
                 else
@@ -276,6 +363,7 @@ static void *c_variant_level_tail(CVariant *cv, CVariantLevel *level, size_t ski
                 p = (char *)v->iov_base + level->i_tail - skip - size;
         }
 
+out:
         *sizep = size;
         return p;
 }
@@ -293,7 +381,7 @@ static int c_variant_peek(CVariant *cv,
                           size_t *sizep,
                           size_t *endp,
                           void **frontp) {
-        CVariantLevel *level = cv->state->levels + cv->state->i_levels;
+        CVariantLevel *level = &cv->level;
         size_t offset;
         int r;
 
@@ -418,9 +506,10 @@ static void c_variant_advance(CVariant *cv, CVariantLevel *level, CVariantType *
 }
 
 static int c_variant_enter_one(CVariant *cv, char container) {
+        size_t size, end, i_front, v_front;
         CVariantLevel *next, *level;
         CVariantType info;
-        size_t size, end;
+        const char *type;
         int r;
 
         r = c_variant_ensure_level(cv);
@@ -431,21 +520,31 @@ static int c_variant_enter_one(CVariant *cv, char container) {
         if (r < 0)
                 return r;
 
-        level = cv->state->levels + cv->state->i_levels;
+        /*
+         * The new level is initialized in place of its parent. Hence, remember
+         * the start position of the container, then advance the parent past
+         * the container and save it, before overwriting it.
+         */
+        level = &cv->level;
+        i_front = level->i_front;
+        v_front = level->v_front;
+        type = level->type;
+
+        c_variant_advance(cv, level, &info, end);
         c_variant_push_level(cv);
-        next = cv->state->levels + cv->state->i_levels;
+        next = &cv->level;
 
         next->size = size;
-        next->i_tail = level->i_front + size;
-        next->v_tail = level->v_front;
+        next->i_tail = i_front + size;
+        next->v_tail = v_front;
         next->wordsize = c_variant_word_size(size, 0);
         next->enclosing = container;
         next->n_type = info.n_type - 1;
-        next->v_front = level->v_front;
-        next->i_front = level->i_front;
+        next->v_front = v_front;
+        next->i_front = i_front;
         next->index = 0;
         next->offset = 0;
-        next->type = level->type + 1;
+        next->type = type + 1;
 
         switch (container) {
         case C_VARIANT_VARIANT: {
@@ -506,7 +605,6 @@ static int c_variant_enter_one(CVariant *cv, char container) {
                 break;
         }
 
-        c_variant_advance(cv, level, &info, end);
         return 0;
 }
 
@@ -523,7 +621,7 @@ static int c_variant_exit_one(CVariant *cv) {
 }
 
 static int c_variant_exit_try(CVariant *cv, char container) {
-        if (container != cv->state->levels[cv->state->i_levels].enclosing)
+        if (container != cv->level.enclosing)
                 return c_variant_poison(cv, -EBADRQC);
 
         return c_variant_exit_one(cv);
@@ -568,10 +666,44 @@ static int c_variant_read_one(CVariant *cv, char basic, void *arg) {
                 return c_variant_poison(cv, -EFAULT);
         }
 
-        c_variant_advance(cv, cv->state->levels + cv->state->i_levels, &info, end);
+        c_variant_advance(cv, &cv->level, &info, end);
         return 0;
 }
 
+int c_variant_read_raw(CVariant *cv, char element, const void **datap, size_t *sizep) {
+        CVariantType info;
+        size_t size, end;
+        void *front;
+        int r;
+
+        /*
+         * Read the next element, which must be of type @element, and return
+         * its serialized data in @datap and @sizep. If the element is
+         * truncated, @sizep is 0 and the default value should be used. Basic
+         * types that are not accessible in linear memory are treated the
+         * same, like c_variant_read_one() does. Containers that are not
+         * accessible in linear memory are left in place, and 0 is returned,
+         * so the caller can enter them instead. Otherwise, the iterator is
+         * advanced past the element and 1 is returned.
+         */
+
+        r = c_variant_peek(cv, element, &info, &size, &end, &front);
+        if (r < 0)
+                return r;
+
+        if (!front && size > 0) {
+                if (info.n_type > 1)
+                        return 0;
+
+                size = 0;
+        }
+
+        *datap = front;
+        *sizep = size;
+        c_variant_advance(cv, &cv->level, &info, end);
+        return 1;
+}
+
 /**
  * c_variant_new_from_vecs() - create new variant from given type and blob
  * @cvp:        output variable for new variant
@@ -652,7 +784,8 @@ _public_ int c_variant_new_from_vecs(CVariant **cvp,
          * error-handling of GVariant, just as if it was a child of a
          * dynamic-sized object. Hence, we accept any size here.
          */
-        c_variant_level_root(cv->state->levels + cv->state->i_levels, size, p_type, n_type);
+        c_variant_level_root(cv, size, p_type, n_type);
+        cv->linear = (n_vecs == 1);
 
         *cvp = cv;
         return 0;
@@ -692,7 +825,7 @@ _public_ size_t c_variant_peek_count(CVariant *cv) {
 
         assert(cv->sealed);
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
         switch (level->enclosing) {
         case C_VARIANT_ARRAY:
                 return level->index;
@@ -730,11 +863,345 @@ _public_ const char *c_variant_peek_type(CVariant *cv, size_t *sizep) {
 
         assert(cv->sealed);
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
         *sizep = level->n_type;
         return level->type;
 }
 
+/**
+ * c_variant_peek_fixed() - read fixed-size element in place
+ * @cv:         variant to operate on, or NULL
+ * @type:       type of the element, must be fixed-size
+ * @datap:      output variable to store pointer to the element
+ * @buffer:     buffer of the size of @type, used as fallback
+ *
+ * This reads the next element, which must be of the fixed-size type @type, and
+ * returns a pointer to its serialization in @datap. The serialization of
+ * fixed-size types equals the layout of the equivalent, naturally aligned C
+ * struct, so the pointer can be cast to such a struct, instead of reading each
+ * member separately.
+ *
+ * If the element is accessible in linear memory, and properly aligned for
+ * @type, the returned pointer points right into the data of @cv, and is valid
+ * as long as @cv is. Otherwise, the element is copied into @buffer, and
+ * @buffer is returned. The caller must not rely on either.
+ *
+ * Like c_variant_read(), this moves the iterator past the element. If the
+ * element is truncated, or does not match @type, @buffer is zeroed and
+ * returned, so @datap always points to *some* valid data, unless @type itself
+ * is invalid.
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_peek_fixed(CVariant *cv, const char *type, const void **datap, void *buffer) {
+        size_t n_type, size, end, n, n_front;
+        CVariantLevel *level;
+        CVariantType info;
+        void *front;
+        int r;
+
+        n_type = strlen(type);
+        r = c_variant_signature_one(type, n_type, &info);
+        if (r < 0)
+                return r;
+        if (_unlikely_(info.size < 1))
+                return -EMEDIUMTYPE;
+
+        *datap = buffer;
+
+        if (_unlikely_(!cv)) {
+                memset(buffer, 0, info.size);
+                return strcmp(type, "()") ? -EBADRQC : 0;
+        }
+
+        assert(cv->sealed);
+
+        level = &cv->level;
+        if (_unlikely_(level->n_type < n_type || strncmp(level->type, type, n_type))) {
+                memset(buffer, 0, info.size);
+                return c_variant_poison(cv, -EBADRQC);
+        }
+
+        r = c_variant_peek(cv, *type, &info, &size, &end, &front);
+        if (r < 0) {
+                memset(buffer, 0, info.size);
+                return r;
+        }
+
+        if (size != info.size) {
+                memset(buffer, 0, info.size);
+        } else if (front && !((unsigned long)front & ((1 << info.alignment) - 1))) {
+                *datap = front;
+        } else if (front) {
+                memcpy(buffer, front, size);
+        } else {
+                /* gather the element from the vectors it spans */
+                for (n = 0; n < size; n += n_front) {
+                        front = c_variant_level_front(cv, level, &n_front);
+                        if (!n_front) {
+                                memset(buffer, 0, info.size);
+                                break;
+                        }
+
+                        if (n_front > size - n)
+                                n_front = size - n;
+
+                        memcpy((char *)buffer + n, front, n_front);
+                        c_variant_level_jump(cv, level, level->offset + n_front);
+                }
+        }
+
+        c_variant_advance(cv, level, &info, end);
+        return 0;
+}
+
+static const char *c_variant_root_type(CVariant *cv) {
+        CVariantState *state;
+        const char *end;
+
+        /*
+         * The root type is the tail of the type of the root level. The root
+         * level is the first level saved in the oldest state, unless it is the
+         * current level.
+         */
+
+        if (c_variant_on_root_level(cv)) {
+                end = cv->level.type + cv->level.n_type;
+        } else {
+                for (state = cv->state; state->link; state = state->link)
+                        /* empty */ ;
+
+                end = state->levels[0].type + state->levels[0].n_type;
+        }
+
+        return end - cv->n_type;
+}
+
+static void c_variant_copy_runs(void *dst, const struct iovec *vecs, size_t n_vecs, size_t size) {
+        bool stream = size >= C_VARIANT_STREAM_MIN;
+        const char *run;
+        size_t i, n_run;
+        char *p = dst;
+
+        /*
+         * Copy @vecs to @dst, merging adjacent vectors into a single run, so
+         * variants built from many small pieces of the same buffer need not
+         * be copied piece by piece. Copies of large variants bypass the
+         * caches, as they would only evict the working set of the caller.
+         */
+
+        for (i = 0; i < n_vecs; ) {
+                run = vecs[i].iov_base;
+                n_run = vecs[i].iov_len;
+                for (++i; i < n_vecs && vecs[i].iov_base == run + n_run; ++i)
+                        n_run += vecs[i].iov_len;
+
+                if (stream && n_run >= C_VARIANT_STREAM_RUN)
+                        c_variant_cpu->copy_stream(p, run, n_run);
+                else if (n_run)
+                        memcpy(p, run, n_run);
+
+                p += n_run;
+        }
+}
+
+static int c_variant_flatten_peek(CVariant *cv,
+                                  unsigned int flags,
+                                  CVariantType *infop,
+                                  size_t *sizep,
+                                  size_t *endp,
+                                  void **frontp) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+
+        /*
+         * Measure the serialization to flatten. For elements, this also
+         * returns their type in @infop. For whole variants, @infop is left
+         * untouched, as most callers do not need the type.
+         */
+
+        assert(cv->sealed);
+
+        if (flags & C_VARIANT_FLATTEN_ELEMENT) {
+                if (_unlikely_(cv->level.n_type < 1))
+                        return c_variant_poison(cv, -EBADRQC);
+
+                return c_variant_peek(cv, *cv->level.type, infop, sizep, endp, frontp);
+        }
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (_unlikely_(!vecs))
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        for (i = 0, size = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        *sizep = size;
+        *endp = 0;
+        *frontp = NULL;
+        return 0;
+}
+
+static void c_variant_flatten_copy(CVariant *cv,
+                                   unsigned int flags,
+                                   CVariantType *info,
+                                   size_t size,
+                                   size_t end,
+                                   void *front,
+                                   void *dst) {
+        CVariantLevel *level = &cv->level;
+        struct iovec vec;
+        size_t n, n_front;
+
+        if (!(flags & C_VARIANT_FLATTEN_ELEMENT)) {
+                c_variant_copy_runs(dst, cv->vecs, cv->n_vecs, size);
+                return;
+        }
+
+        if (front) {
+                vec = (struct iovec){ front, size };
+                c_variant_copy_runs(dst, &vec, 1, size);
+        } else {
+                /* gather the element from the vectors it spans */
+                for (n = 0; n < size; n += n_front) {
+                        front = c_variant_level_front(cv, level, &n_front);
+                        if (!n_front) {
+                                memset((char *)dst + n, 0, size - n);
+                                break;
+                        }
+
+                        if (n_front > size - n)
+                                n_front = size - n;
+
+                        vec = (struct iovec){ front, n_front };
+                        c_variant_copy_runs((char *)dst + n, &vec, 1, size);
+                        c_variant_level_jump(cv, level, level->offset + n_front);
+                }
+        }
+
+        c_variant_advance(cv, level, info, end);
+}
+
+/**
+ * c_variant_flatten() - copy variant into contiguous memory
+ * @cv:         variant to operate on, or NULL
+ * @flags:      C_VARIANT_FLATTEN_* flags
+ * @dst:        destination buffer, or NULL
+ * @n_dst:      size of @dst
+ * @sizep:      output variable for the size of the serialization
+ *
+ * This copies the serialization of @cv into @dst, as a single contiguous
+ * blob, regardless how many vectors back @cv. Adjacent vectors are copied in
+ * a single run. Very large variants are copied via non-temporal stores, if
+ * supported by the CPU, so they do not evict the caches.
+ *
+ * If C_VARIANT_FLATTEN_ELEMENT is passed in @flags, only the next element at
+ * the current iterator position is copied, and the iterator is moved past it,
+ * like c_variant_read() does. Otherwise, the whole variant is copied, and the
+ * iterator is left untouched. Elements are self-contained, hence their copy
+ * is a valid serialization of their type, as returned by
+ * c_variant_peek_type(). Truncated elements have an empty serialization,
+ * which is read as the default value of the type.
+ *
+ * The size of the serialization is always returned in @sizep. If @n_dst is
+ * smaller than that, nothing is copied, the iterator is not moved, and
+ * -ENOBUFS is returned. Hence, passing a NULL buffer queries the required
+ * size.
+ *
+ * If @cv is NULL, it is treated as the unit '()'. Like the writer does for
+ * the unit, its serialization is empty in both modes.
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_flatten(CVariant *cv, unsigned int flags, void *dst, size_t n_dst, size_t *sizep) {
+        CVariantType info;
+        size_t size, end;
+        void *front;
+        int r;
+
+        if (_unlikely_(!cv)) {
+                *sizep = 0;
+                return 0;
+        }
+
+        r = c_variant_flatten_peek(cv, flags, &info, &size, &end, &front);
+        if (r < 0)
+                return r;
+
+        *sizep = size;
+        if (n_dst < size)
+                return -ENOBUFS;
+
+        c_variant_flatten_copy(cv, flags, &info, size, end, front, dst);
+        return 0;
+}
+
+/**
+ * c_variant_dup() - duplicate variant into contiguous memory
+ * @cv:         variant to operate on, or NULL
+ * @flags:      C_VARIANT_FLATTEN_* flags
+ * @copyp:      output variable for the copy
+ *
+ * This creates a new, sealed variant with a copy of the serialization of @cv,
+ * like c_variant_flatten() produces it. The variant and its data are
+ * allocated as a single object of the exact size needed, with the data
+ * starting 8-byte aligned. The copy is independent of @cv, and can outlive
+ * it.
+ *
+ * If C_VARIANT_FLATTEN_ELEMENT is passed in @flags, only the next element at
+ * the current iterator position is copied, the copy is of the type of that
+ * element, and the iterator of @cv is moved past it. Otherwise, the whole
+ * variant is copied, and the iterator is left untouched.
+ *
+ * On success, the copy is returned in @copyp. On failure, @copyp stays
+ * untouched. If @cv is NULL, the unit '()', the copy is NULL as well.
+ *
+ * It is an programming error to call this on an unsealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_dup(CVariant *cv, unsigned int flags, CVariant **copyp) {
+        CVariantType info;
+        size_t size, end;
+        CVariant *copy;
+        void *front, *data;
+        char *p_type;
+        int r;
+
+        if (_unlikely_(!cv)) {
+                *copyp = NULL;
+                return 0;
+        }
+
+        r = c_variant_flatten_peek(cv, flags, &info, &size, &end, &front);
+        if (r < 0)
+                return r;
+
+        if (!(flags & C_VARIANT_FLATTEN_ELEMENT)) {
+                r = c_variant_signature_one(c_variant_root_type(cv), cv->n_type, &info);
+                assert(!r);
+        }
+
+        r = c_variant_alloc(&copy, &p_type, &data, info.n_type, info.n_levels + 8, 1, size);
+        if (r < 0)
+                return r;
+
+        memcpy(p_type, info.type, info.n_type);
+        c_variant_flatten_copy(cv, flags, &info, size, end, front, data);
+
+        copy->vecs[0] = (struct iovec){ data, size };
+        copy->sealed = true;
+        copy->linear = true;
+        c_variant_level_root(copy, size, p_type, info.n_type);
+
+        *copyp = copy;
+        return 0;
+}
+
 /**
  * c_variant_enter() - enter container
  * @cv:         variant to operate on, or NULL
@@ -787,7 +1254,7 @@ _public_ int c_variant_enter(CVariant *cv, const char *containers) {
                         }
                 }
         } else {
-                level = cv->state->levels + cv->state->i_levels;
+                level = &cv->level;
                 if (level->n_type < 1)
                         return c_variant_poison(cv, -EBADRQC);
 
@@ -1124,8 +1591,8 @@ _public_ void c_variant_rewind(CVariant *cv) {
         while (!c_variant_on_root_level(cv))
                 c_variant_exit_internal(cv);
 
-        level = cv->state->levels + cv->state->i_levels;
-        c_variant_level_root(level,
+        level = &cv->level;
+        c_variant_level_root(cv,
                              level->size,
                              level->type + level->n_type - cv->n_type,
                              cv->n_type);
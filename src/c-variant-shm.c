@@ -0,0 +1,546 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Shared Memory Rings
+ *
+ * A shared memory ring transports serialized variants between processes via
+ * a shared file (usually a memfd). The file starts with a header
+ * (CVariantShmShared), padded to the page size, followed by the data area,
+ * which is a power of 2 in size, and at least a page. The header size is
+ * stored in the header itself, so all parties agree on the layout. Every
+ * party maps the file and operates on its own CVariantShm handle.
+ *
+ * Positions are 64-bit counters that are never wrapped, only masked when
+ * accessing the data area. The consumer side owns @head (everything before it
+ * was released and may be overwritten), the producer side owns @tail
+ * (everything before it is committed and may be read). Each message is stored
+ * as an 8-byte native length field, followed by the serialized data, padded
+ * to 8 bytes. Hence, length fields never wrap, but message data might. To
+ * avoid splitting such messages, every party maps the data area twice, back
+ * to back, so any message is linear in memory. The reader requires every
+ * element to be linear, and this also lets it use its linear fast paths.
+ *
+ * Producers copy a sealed variant into the ring with a single gather
+ * operation. Consumers never copy; they get variants that point directly into
+ * the ring, which stay valid until c_variant_shm_release() is called.
+ *
+ * Two protocols are supported, selected when the ring is created:
+ *
+ *   - SPSC: A single producer commits messages to a local tail, and publishes
+ *     it only on c_variant_shm_flush(). This batches publication and keeps
+ *     the shared cache line cold.
+ *
+ *   - MPSC: Producers reserve space by a compare-and-swap on @reserve, copy
+ *     their message, and then commit in reservation order, by waiting for
+ *     @tail to reach the start of their reservation before advancing it.
+ *     This keeps the consumer side identical to SPSC, at the cost of a
+ *     producer waiting for a preempted predecessor.
+ *
+ * The consumer releases consumed space in batches via c_variant_shm_release().
+ *
+ * Both sides can sleep via futexes on the low 32 bits of @tail and @head, if
+ * the ring is empty or full, respectively. Sleepers announce themselves in
+ * @n_tail_waiters and @n_head_waiters, so the fast paths never enter the
+ * kernel unless someone is waiting. Since a party can only sleep on a counter
+ * the other side cannot advance by more than the ring size (at most 2^31),
+ * the low 32 bits are sufficient to detect changes.
+ *
+ * Note that a ring does not protect against a misbehaving peer. The consumer
+ * validates message lengths against the committed range, so it never accesses
+ * memory outside of the ring, but message content is only as trustworthy as
+ * the producers.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static uint64_t c_variant_shm_now(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static uint64_t c_variant_shm_deadline(int64_t timeout_nsec) {
+        if (timeout_nsec < 0)
+                return UINT64_MAX;
+
+        return c_variant_shm_now() + timeout_nsec;
+}
+
+static uint32_t *c_variant_shm_futex(uint64_t *word) {
+        /* futexes are 32-bit; use the half with the low-order bits */
+        return (uint32_t *)word + (__BYTE_ORDER == __BIG_ENDIAN);
+}
+
+static int c_variant_shm_futex_wait(uint64_t *word, uint64_t value, uint64_t deadline) {
+        struct timespec ts, *timeout = NULL;
+        uint64_t now;
+        long r;
+
+        if (deadline != UINT64_MAX) {
+                now = c_variant_shm_now();
+                if (now >= deadline)
+                        return -ETIMEDOUT;
+
+                ts.tv_sec = (deadline - now) / UINT64_C(1000000000);
+                ts.tv_nsec = (deadline - now) % UINT64_C(1000000000);
+                timeout = &ts;
+        }
+
+        r = syscall(SYS_futex, c_variant_shm_futex(word), FUTEX_WAIT, (uint32_t)value, timeout, NULL, 0);
+        if (r < 0 && errno == ETIMEDOUT)
+                return -ETIMEDOUT;
+
+        /* spurious wakeups, signals, and value changes are all fine */
+        return 0;
+}
+
+static void c_variant_shm_futex_wake(uint64_t *word) {
+        syscall(SYS_futex, c_variant_shm_futex(word), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static size_t c_variant_shm_page(void) {
+        long n_page;
+
+        n_page = sysconf(_SC_PAGESIZE);
+        return (n_page > 0) ? n_page : 4096;
+}
+
+static void *c_variant_shm_map(int fd, size_t header, size_t size) {
+        char *p, *q;
+
+        /*
+         * Reserve a range for the header and two copies of the data area,
+         * then map the file over the first part, and the data area once more
+         * over the second. Both data mappings start on page boundaries, as
+         * the header is padded to a full page and the data size is a multiple
+         * of it.
+         */
+
+        p = mmap(NULL, header + 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return MAP_FAILED;
+
+        q = mmap(p, header + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        if (q == MAP_FAILED)
+                goto error;
+
+        q = mmap(p + header + size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, header);
+        if (q == MAP_FAILED)
+                goto error;
+
+        return p;
+
+error:
+        munmap(p, header + 2 * size);
+        return MAP_FAILED;
+}
+
+static bool c_variant_shm_fits(CVariantShm *shm, uint64_t pos, size_t n) {
+        /* check against the cached head first, only then reload it */
+        if (pos + n - shm->head <= shm->size)
+                return true;
+
+        shm->head = __atomic_load_n(&shm->shared->head, __ATOMIC_ACQUIRE);
+        return pos + n - shm->head <= shm->size;
+}
+
+/**
+ * c_variant_shm_new() - create new shared memory ring handle
+ * @shmp:       output variable for new handle
+ * @fd:         file backing the ring
+ * @size:       size of the data area to create, or 0 to attach
+ * @flags:      C_VARIANT_SHM_* flags, if @size is non-zero
+ *
+ * This maps the ring stored in @fd and returns a new handle for it. If @size
+ * is non-zero, the file is resized and initialized as a new, empty ring with
+ * a data area of @size bytes, which must be a power of 2 of at most 2^31. It
+ * is rounded up to the page size, if smaller. Otherwise, an existing ring is
+ * attached to, and @flags is ignored. Rings created on a machine with a
+ * different page size can only be attached to if their layout is compatible
+ * with the local page size.
+ *
+ * If C_VARIANT_SHM_MPSC is given, the ring is set up for any number of
+ * concurrent producers. Otherwise, there must only be a single one.
+ *
+ * A handle is meant to be used either as producer or consumer, and must not
+ * be shared between threads. Instead, every thread should create its own
+ * handle. @fd is not consumed and can be closed by the caller at any time.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_shm_new(CVariantShm **shmp, int fd, size_t size, unsigned int flags) {
+        CVariantShmShared header;
+        size_t n_page, n_header;
+        CVariantShm *shm;
+        struct stat st;
+        bool create;
+        ssize_t l;
+        void *p;
+        int r;
+
+        n_page = c_variant_shm_page();
+
+        create = !!size;
+        if (create) {
+                assert(size <= C_VARIANT_SHM_MAX);
+                assert(!(size & (size - 1)));
+
+                /* both are powers of 2, so the result is one as well */
+                if (size < n_page)
+                        size = n_page;
+                n_header = ALIGN_TO(sizeof(CVariantShmShared), n_page);
+
+                r = ftruncate(fd, n_header + size);
+                if (r < 0)
+                        return -errno;
+        } else {
+                l = pread(fd, &header, sizeof(header), 0);
+                if (l < 0)
+                        return -errno;
+                if (l != sizeof(header) ||
+                    header.magic != C_VARIANT_SHM_MAGIC ||
+                    header.size < n_page ||
+                    header.size > C_VARIANT_SHM_MAX ||
+                    (header.size & (header.size - 1)) ||
+                    header.header < sizeof(CVariantShmShared) ||
+                    header.header > C_VARIANT_SHM_MAX ||
+                    (header.header & (n_page - 1)))
+                        return -EBADMSG;
+
+                r = fstat(fd, &st);
+                if (r < 0)
+                        return -errno;
+                if ((uint64_t)st.st_size < header.header + header.size)
+                        return -EBADMSG;
+
+                n_header = header.header;
+                size = header.size;
+                flags = header.flags;
+        }
+
+        shm = calloc(1, sizeof(*shm));
+        if (!shm)
+                return -ENOMEM;
+
+        p = c_variant_shm_map(fd, n_header, size);
+        if (p == MAP_FAILED) {
+                r = -errno;
+                free(shm);
+                return r;
+        }
+
+        shm->shared = p;
+        shm->data = (char *)p + n_header;
+        shm->header = n_header;
+        shm->size = size;
+        shm->mpsc = !!(flags & C_VARIANT_SHM_MPSC);
+
+        if (create) {
+                /* fresh ring; publish the magic last */
+                memset(shm->shared, 0, sizeof(*shm->shared));
+                shm->shared->size = size;
+                shm->shared->header = n_header;
+                shm->shared->flags = flags;
+                __atomic_store_n(&shm->shared->magic, C_VARIANT_SHM_MAGIC, __ATOMIC_RELEASE);
+        }
+
+        shm->tail = __atomic_load_n(&shm->shared->tail, __ATOMIC_ACQUIRE);
+        shm->head = __atomic_load_n(&shm->shared->head, __ATOMIC_ACQUIRE);
+        shm->read = shm->head;
+        shm->avail = shm->tail;
+
+        *shmp = shm;
+        return 0;
+}
+
+/**
+ * c_variant_shm_free() - destroy shared memory ring handle
+ * @shm:        handle to destroy, or NULL
+ *
+ * This unmaps the ring and destroys the handle. Unpublished messages of a
+ * producer are flushed first. Any variant returned by c_variant_shm_read()
+ * must have been destroyed before.
+ *
+ * If NULL is passed, this is a no-op.
+ *
+ * Return: NULL is returned.
+ */
+_public_ CVariantShm *c_variant_shm_free(CVariantShm *shm) {
+        if (!shm)
+                return NULL;
+
+        if (shm->dirty)
+                c_variant_shm_flush(shm);
+
+        munmap(shm->shared, shm->header + 2 * shm->size);
+        free(shm);
+        return NULL;
+}
+
+/**
+ * c_variant_shm_write() - write variant into shared memory ring
+ * @shm:        producer handle
+ * @cv:         sealed variant to write
+ *
+ * This copies the serialized data of @cv into the ring. With the SPSC
+ * protocol, the message is only visible to the consumer once
+ * c_variant_shm_flush() is called. With the MPSC protocol, the message is
+ * visible right away, but a sleeping consumer is only woken up by
+ * c_variant_shm_flush(). In both cases, the caller should batch as many
+ * messages as possible before flushing.
+ *
+ * If the ring does not have enough free space, -EAGAIN is returned. Use
+ * c_variant_shm_wait_writable() to wait for space.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_shm_write(CVariantShm *shm, CVariant *cv) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size, n;
+        uint64_t pos, frame;
+        char *p;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (!vecs)
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        if (_unlikely_(size > shm->size - 8))
+                return -EMSGSIZE;
+
+        n = 8 + ALIGN_TO(size, (size_t)8);
+
+        if (!shm->mpsc) {
+                pos = shm->tail;
+                if (!c_variant_shm_fits(shm, pos, n))
+                        return -EAGAIN;
+        } else {
+                pos = __atomic_load_n(&shm->shared->reserve, __ATOMIC_RELAXED);
+                do {
+                        if (!c_variant_shm_fits(shm, pos, n))
+                                return -EAGAIN;
+                } while (!__atomic_compare_exchange_n(&shm->shared->reserve,
+                                                      &pos,
+                                                      pos + n,
+                                                      true,
+                                                      __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED));
+        }
+
+        frame = size;
+        memcpy(shm->data + (pos & (shm->size - 1)), &frame, 8);
+
+        for (i = 0, p = shm->data + (pos & (shm->size - 1)) + 8; i < n_vecs; p += vecs[i++].iov_len)
+                memcpy(p, vecs[i].iov_base, vecs[i].iov_len);
+
+        if (!shm->mpsc) {
+                shm->tail = pos + n;
+                shm->dirty = true;
+        } else {
+                /* commit in reservation order */
+                while (__atomic_load_n(&shm->shared->tail, __ATOMIC_ACQUIRE) != pos)
+                        sched_yield();
+
+                __atomic_store_n(&shm->shared->tail, pos + n, __ATOMIC_RELEASE);
+        }
+
+        return 0;
+}
+
+/**
+ * c_variant_shm_flush() - publish written messages
+ * @shm:        producer handle
+ *
+ * This publishes all messages written via @shm to the consumer, and wakes it
+ * up if it is sleeping.
+ */
+_public_ void c_variant_shm_flush(CVariantShm *shm) {
+        if (shm->dirty) {
+                __atomic_store_n(&shm->shared->tail, shm->tail, __ATOMIC_RELEASE);
+                shm->dirty = false;
+        }
+
+        /* pairs with the fence in c_variant_shm_wait_readable() */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&shm->shared->n_tail_waiters, __ATOMIC_RELAXED))
+                c_variant_shm_futex_wake(&shm->shared->tail);
+}
+
+/**
+ * c_variant_shm_wait_writable() - wait for free space in shared memory ring
+ * @shm:                producer handle
+ * @size:               size of the serialized message to write
+ * @timeout_nsec:       timeout in nanoseconds, or negative for infinity
+ *
+ * This waits until a message of @size bytes fits into the ring. Unpublished
+ * messages are flushed before sleeping. Note that with the MPSC protocol,
+ * other producers might take the space before the caller gets to write.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_shm_wait_writable(CVariantShm *shm, size_t size, int64_t timeout_nsec) {
+        uint64_t deadline, pos, head;
+        size_t n;
+        int r = 0;
+
+        if (_unlikely_(size > shm->size - 8))
+                return -EMSGSIZE;
+
+        n = 8 + ALIGN_TO(size, (size_t)8);
+        deadline = c_variant_shm_deadline(timeout_nsec);
+
+        c_variant_shm_flush(shm);
+
+        for (;;) {
+                pos = shm->mpsc ? __atomic_load_n(&shm->shared->reserve, __ATOMIC_RELAXED) : shm->tail;
+                if (c_variant_shm_fits(shm, pos, n))
+                        return 0;
+                if (r < 0)
+                        return r;
+
+                __atomic_add_fetch(&shm->shared->n_head_waiters, 1, __ATOMIC_SEQ_CST);
+
+                head = __atomic_load_n(&shm->shared->head, __ATOMIC_SEQ_CST);
+                if (head == shm->head)
+                        r = c_variant_shm_futex_wait(&shm->shared->head, head, deadline);
+
+                __atomic_sub_fetch(&shm->shared->n_head_waiters, 1, __ATOMIC_SEQ_CST);
+        }
+}
+
+/**
+ * c_variant_shm_read() - read variant from shared memory ring
+ * @shm:        consumer handle
+ * @cvp:        output variable for new variant
+ * @type:       type string
+ * @n_type:     length of @type
+ *
+ * This returns the next message of the ring as new, sealed variant of type
+ * @type. The variant points directly into the ring. It must be destroyed
+ * before the message is released via c_variant_shm_release().
+ *
+ * If the ring is empty, -EAGAIN is returned. Use
+ * c_variant_shm_wait_readable() to wait for messages.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_shm_read(CVariantShm *shm, CVariant **cvp, const char *type, size_t n_type) {
+        uint64_t frame;
+        char *p;
+        int r;
+
+        if (shm->read == shm->avail) {
+                shm->avail = __atomic_load_n(&shm->shared->tail, __ATOMIC_ACQUIRE);
+                if (shm->read == shm->avail)
+                        return -EAGAIN;
+        }
+
+        if (_unlikely_(shm->avail - shm->read < 8 || shm->avail - shm->read > shm->size))
+                return -EBADMSG;
+
+        p = shm->data + (shm->read & (shm->size - 1));
+        memcpy(&frame, p, 8);
+        if (_unlikely_(frame > shm->avail - shm->read - 8))
+                return -EBADMSG;
+
+        r = c_variant_new_from_buffer(cvp, type, n_type, p + 8, frame);
+        if (r < 0)
+                return r;
+
+        shm->read += 8 + ALIGN_TO(frame, (uint64_t)8);
+        return 0;
+}
+
+/**
+ * c_variant_shm_release() - release read messages
+ * @shm:        consumer handle
+ *
+ * This releases all messages read via @shm so far, making their space
+ * available to producers, and wakes up sleeping producers. Any variant
+ * returned by c_variant_shm_read() must have been destroyed before.
+ */
+_public_ void c_variant_shm_release(CVariantShm *shm) {
+        __atomic_store_n(&shm->shared->head, shm->read, __ATOMIC_RELEASE);
+
+        /* pairs with the fence in c_variant_shm_wait_writable() */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&shm->shared->n_head_waiters, __ATOMIC_RELAXED))
+                c_variant_shm_futex_wake(&shm->shared->head);
+}
+
+/**
+ * c_variant_shm_wait_readable() - wait for messages in shared memory ring
+ * @shm:                consumer handle
+ * @timeout_nsec:       timeout in nanoseconds, or negative for infinity
+ *
+ * This waits until the ring has messages that were not read via @shm, yet.
+ * All read messages are released before sleeping, so the caller must have
+ * destroyed all variants returned by c_variant_shm_read().
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_shm_wait_readable(CVariantShm *shm, int64_t timeout_nsec) {
+        uint64_t deadline;
+        int r = 0;
+
+        if (shm->read != shm->avail)
+                return 0;
+
+        deadline = c_variant_shm_deadline(timeout_nsec);
+
+        c_variant_shm_release(shm);
+
+        for (;;) {
+                shm->avail = __atomic_load_n(&shm->shared->tail, __ATOMIC_ACQUIRE);
+                if (shm->read != shm->avail)
+                        return 0;
+                if (r < 0)
+                        return r;
+
+                __atomic_add_fetch(&shm->shared->n_tail_waiters, 1, __ATOMIC_SEQ_CST);
+
+                if (__atomic_load_n(&shm->shared->tail, __ATOMIC_SEQ_CST) == shm->read)
+                        r = c_variant_shm_futex_wait(&shm->shared->tail, shm->read, deadline);
+
+                __atomic_sub_fetch(&shm->shared->n_tail_waiters, 1, __ATOMIC_SEQ_CST);
+        }
+}
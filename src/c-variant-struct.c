@@ -0,0 +1,1037 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Struct Descriptors
+ *
+ * A struct descriptor maps the members of a tuple (or dict entry) to the
+ * fields of a native C struct, so a whole message can be decoded or encoded
+ * in a single call, rather than passing every field through the vararg API.
+ *
+ * Descriptors are compiled once, when registered via c_variant_struct_new().
+ * This validates the caller-provided field table against the type, and
+ * flattens it into an array of ops in pre-order, where every container op is
+ * followed by the ops of its body. Compilation also determines for every
+ * fixed-size tuple whether its serialization matches the C layout, that is,
+ * every member is at the same offset in both. Such tuples, and arrays of
+ * them (or of fixed-size basic types), are copied with a single memcpy() when
+ * decoding. If the serialization has no padding either, the same is done when
+ * encoding. Bools are never copied, since the serialization might contain
+ * values other than 0 and 1.
+ *
+ * Strings are decoded as zero-copy pointers into the variant, so they are
+ * only valid as long as the variant is. Arrays are decoded into memory
+ * allocated from an arena, which is released as a whole, once the decoded
+ * struct is no longer needed. Invalid or truncated data is decoded as the
+ * default value, just like the reader does.
+ *
+ * Batches of small messages of the same type are decoded without a variant
+ * per message, if the type is simple enough. The framing of each message is
+ * then resolved directly, with the member layout computed once per batch.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+typedef struct CVariantStructBuilder {
+        CVariantStructOp *ops;
+        size_t n_ops;
+        size_t n_allocated;
+        bool has_arrays;
+} CVariantStructBuilder;
+
+/*
+ * Arenas
+ * ======
+ */
+
+void *c_variant_arena_alloc(CVariantArena *arena, size_t n) {
+        CVariantArenaBlock *block;
+        size_t size;
+        void *p;
+
+        /*
+         * Allocate @n bytes from @arena, aligned like malloc() would. If the
+         * newest block has no space left, a new block is allocated, twice as
+         * big as the previous one, or big enough to hold @n.
+         */
+
+        if (_unlikely_(n > SIZE_MAX / 2))
+                return NULL;
+
+        n = ALIGN_TO(n, __alignof(max_align_t));
+        block = arena->blocks;
+
+        if (!block || n > block->size - block->used) {
+                size = block ? block->size * 2 : arena->size;
+                if (size < n)
+                        size = n;
+
+                block = malloc(sizeof(*block) + size);
+                if (!block)
+                        return NULL;
+
+                block->next = arena->blocks;
+                block->size = size;
+                block->used = 0;
+                arena->blocks = block;
+        }
+
+        p = (char *)block->data + block->used;
+        block->used += n;
+        return p;
+}
+
+/**
+ * c_variant_arena_new() - create new arena
+ * @arenap:     output variable for new arena
+ * @size:       size of the initial block, or 0 for the default
+ *
+ * This creates a new, empty arena. Arenas provide the memory for arrays
+ * decoded via c_variant_decode_struct(). Memory is allocated in blocks of
+ * growing size, and only released as a whole, via c_variant_arena_reset() or
+ * c_variant_arena_free().
+ *
+ * Arenas are not thread-safe. They are meant to be used per thread, and the
+ * caller must synchronize access otherwise.
+ *
+ * On success, the new arena is returned in @arenap. On failure, @arenap stays
+ * untouched.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_arena_new(CVariantArena **arenap, size_t size) {
+        CVariantArena *arena;
+
+        arena = calloc(1, sizeof(*arena));
+        if (!arena)
+                return -ENOMEM;
+
+        arena->size = size ?: C_VARIANT_ARENA_BLOCK;
+
+        *arenap = arena;
+        return 0;
+}
+
+/**
+ * c_variant_arena_free() - destroy arena
+ * @arena:      arena to destroy, or NULL
+ *
+ * This destroys @arena and releases all memory allocated from it. Any arrays
+ * decoded into it become invalid.
+ *
+ * If NULL is passed, this is a no-op.
+ *
+ * Return: NULL is returned.
+ */
+_public_ CVariantArena *c_variant_arena_free(CVariantArena *arena) {
+        if (!arena)
+                return NULL;
+
+        c_variant_arena_reset(arena);
+        free(arena->blocks);
+        free(arena);
+        return NULL;
+}
+
+/**
+ * c_variant_arena_reset() - release all allocations of arena
+ * @arena:      arena to reset
+ *
+ * This releases all memory allocated from @arena, so it can be reused to
+ * decode further messages. Any arrays decoded into it become invalid. Only
+ * the newest, and largest, block is kept, so an arena that is reset after
+ * every message quickly stops allocating altogether.
+ */
+_public_ void c_variant_arena_reset(CVariantArena *arena) {
+        CVariantArenaBlock *block;
+
+        if (!arena->blocks)
+                return;
+
+        while ((block = arena->blocks->next)) {
+                arena->blocks->next = block->next;
+                free(block);
+        }
+
+        arena->blocks->used = 0;
+}
+
+/*
+ * Compilation
+ * ===========
+ */
+
+static int c_variant_struct_push(CVariantStructBuilder *b, size_t *idxp) {
+        CVariantStructOp *ops;
+        size_t n;
+
+        if (b->n_ops >= b->n_allocated) {
+                n = b->n_allocated ? b->n_allocated * 2 : 16;
+                ops = realloc(b->ops, n * sizeof(*ops));
+                if (!ops)
+                        return -ENOMEM;
+
+                b->ops = ops;
+                b->n_allocated = n;
+        }
+
+        memset(b->ops + b->n_ops, 0, sizeof(*b->ops));
+        *idxp = b->n_ops++;
+        return 0;
+}
+
+static int c_variant_struct_match(const CVariantField *field, const CVariantType *info) {
+        if (!field->type ||
+            strlen(field->type) != info->n_type ||
+            strncmp(field->type, info->type, info->n_type))
+                return -EBADRQC;
+
+        return 0;
+}
+
+static bool c_variant_struct_fits(size_t offset, size_t size, size_t alignment, size_t limit) {
+        return offset <= limit && size <= limit - offset && !(offset % alignment);
+}
+
+static int c_variant_struct_compile(CVariantStructBuilder *b,
+                                    const CVariantType *info,
+                                    size_t offset,
+                                    size_t size,
+                                    const CVariantField *fields,
+                                    size_t n_fields,
+                                    size_t limit) {
+        bool copy = false, dense = false;
+        size_t idx, first, i, pos, n_type;
+        CVariantType child;
+        const char *type;
+        uint8_t kind;
+        int r;
+
+        r = c_variant_struct_push(b, &idx);
+        if (r < 0)
+                return r;
+
+        switch (*info->type) {
+        case C_VARIANT_BOOL:
+        case C_VARIANT_BYTE:
+        case C_VARIANT_INT16:
+        case C_VARIANT_UINT16:
+        case C_VARIANT_INT32:
+        case C_VARIANT_UINT32:
+        case C_VARIANT_INT64:
+        case C_VARIANT_UINT64:
+        case C_VARIANT_HANDLE:
+        case C_VARIANT_DOUBLE:
+                /* native types match the serialization, and are self-aligned */
+                if (!c_variant_struct_fits(offset, info->size, info->size, limit))
+                        return -EINVAL;
+
+                kind = C_VARIANT_STRUCT_OP_BASIC;
+                size = info->size;
+                copy = (*info->type != C_VARIANT_BOOL);
+                dense = true;
+                break;
+
+        case C_VARIANT_STRING:
+        case C_VARIANT_PATH:
+        case C_VARIANT_SIGNATURE:
+                if (!c_variant_struct_fits(offset, sizeof(const char *), __alignof(const char *), limit))
+                        return -EINVAL;
+
+                kind = C_VARIANT_STRUCT_OP_STRING;
+                size = sizeof(const char *);
+                break;
+
+        case C_VARIANT_TUPLE_OPEN:
+        case C_VARIANT_PAIR_OPEN:
+                if (!c_variant_struct_fits(offset, size, 1, limit))
+                        return -EINVAL;
+
+                kind = C_VARIANT_STRUCT_OP_STRUCT;
+                copy = (info->size > 0 && size >= info->size);
+                dense = copy;
+
+                type = info->type + 1;
+                n_type = info->n_type - 2;
+                for (i = 0, pos = 0; n_type > 0; ++i) {
+                        r = c_variant_signature_next(type, n_type, &child);
+                        assert(r == 1);
+
+                        if (i >= n_fields)
+                                return -EBADRQC;
+
+                        r = c_variant_struct_match(fields + i, &child);
+                        if (r < 0)
+                                return r;
+
+                        first = b->n_ops;
+                        r = c_variant_struct_compile(b,
+                                                     &child,
+                                                     fields[i].offset,
+                                                     fields[i].size,
+                                                     fields[i].fields,
+                                                     fields[i].n_fields,
+                                                     size);
+                        if (r < 0)
+                                return r;
+
+                        /* compare the serialized layout to the C layout */
+                        if (ALIGN_TO(pos, 1 << child.alignment) != pos)
+                                dense = false;
+                        pos = ALIGN_TO(pos, 1 << child.alignment);
+                        if (!b->ops[first].copy || b->ops[first].offset != pos)
+                                copy = false;
+                        if (!b->ops[first].dense || b->ops[first].offset != pos)
+                                dense = false;
+                        pos += child.size;
+
+                        type += child.n_type;
+                        n_type -= child.n_type;
+                }
+
+                if (i != n_fields)
+                        return -EBADRQC;
+
+                dense = dense && pos == info->size;
+                break;
+
+        case C_VARIANT_ARRAY:
+                if (!c_variant_struct_fits(offset, sizeof(CVariantArray), __alignof(CVariantArray), limit) || size < 1)
+                        return -EINVAL;
+
+                r = c_variant_signature_next(info->type + 1, info->n_type - 1, &child);
+                assert(r == 1);
+
+                kind = C_VARIANT_STRUCT_OP_ARRAY;
+                b->has_arrays = true;
+
+                /* elements are described relative to their own start */
+                first = b->n_ops;
+                if (*child.type == C_VARIANT_ARRAY) {
+                        if (n_fields != 1)
+                                return -EBADRQC;
+
+                        r = c_variant_struct_match(fields, &child);
+                        if (r < 0)
+                                return r;
+
+                        r = c_variant_struct_compile(b,
+                                                     &child,
+                                                     fields->offset,
+                                                     fields->size,
+                                                     fields->fields,
+                                                     fields->n_fields,
+                                                     size);
+                } else {
+                        r = c_variant_struct_compile(b, &child, 0, size, fields, n_fields, size);
+                }
+                if (r < 0)
+                        return r;
+
+                copy = b->ops[first].copy && child.size == size;
+                dense = copy && b->ops[first].dense;
+                break;
+
+        default:
+                return -EMEDIUMTYPE;
+        }
+
+        b->ops[idx].kind = kind;
+        b->ops[idx].element = *info->type;
+        b->ops[idx].copy = copy;
+        b->ops[idx].dense = dense;
+        b->ops[idx].alignment = info->alignment;
+        b->ops[idx].offset = offset;
+        b->ops[idx].size = size;
+        b->ops[idx].n_fixed = info->size;
+        b->ops[idx].n_ops = b->n_ops - idx - 1;
+        return 0;
+}
+
+/**
+ * c_variant_struct_new() - compile struct descriptor
+ * @descp:      output variable for new descriptor
+ * @type:       type of the tuple or dict entry to describe
+ * @n_type:     length of @type
+ * @fields:     fields of the C struct, one for each member of @type
+ * @n_fields:   number of entries in @fields
+ * @size:       C size of the struct
+ *
+ * This compiles a descriptor of how the members of @type map to a C struct,
+ * as described in @fields (see CVariantField for the rules). The descriptor
+ * is validated against @type once: the types of all fields must match, and
+ * all fields must be properly aligned and lie within their enclosing struct
+ * or element. Hence, decoding and encoding via the descriptor does not need
+ * to verify anything but the type of the variant.
+ *
+ * @type and @fields are copied into the descriptor, and can be released by
+ * the caller.
+ *
+ * On success, the new descriptor is returned in @descp. On failure, @descp
+ * stays untouched.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_struct_new(CVariantStruct **descp,
+                                  const char *type,
+                                  size_t n_type,
+                                  const CVariantField *fields,
+                                  size_t n_fields,
+                                  size_t size) {
+        CVariantStructBuilder b = {};
+        CVariantStruct *desc;
+        CVariantType info;
+        int r;
+
+        r = c_variant_signature_one(type, n_type, &info);
+        if (r < 0)
+                return r;
+
+        if (*type != C_VARIANT_TUPLE_OPEN && *type != C_VARIANT_PAIR_OPEN)
+                return -EMEDIUMTYPE;
+
+        r = c_variant_struct_compile(&b, &info, 0, size, fields, n_fields, size);
+        if (r < 0)
+                goto exit;
+
+        desc = malloc(sizeof(*desc) + b.n_ops * sizeof(*b.ops) + n_type + 1);
+        if (!desc) {
+                r = -ENOMEM;
+                goto exit;
+        }
+
+        desc->type = (char *)(desc->ops + b.n_ops);
+        desc->n_type = n_type;
+        desc->size = size;
+        desc->has_arrays = b.has_arrays;
+        desc->n_ops = b.n_ops;
+        memcpy(desc->ops, b.ops, b.n_ops * sizeof(*b.ops));
+        memcpy(desc->type, type, n_type);
+        desc->type[n_type] = 0;
+
+        *descp = desc;
+        r = 0;
+
+exit:
+        free(b.ops);
+        return r;
+}
+
+/**
+ * c_variant_struct_free() - destroy struct descriptor
+ * @desc:       descriptor to destroy, or NULL
+ *
+ * If NULL is passed, this is a no-op.
+ *
+ * Return: NULL is returned.
+ */
+_public_ CVariantStruct *c_variant_struct_free(CVariantStruct *desc) {
+        free(desc);
+        return NULL;
+}
+
+/*
+ * Decoding
+ * ========
+ */
+
+static int c_variant_decode_op(CVariant *cv, const CVariantStructOp *op, char *base, CVariantArena *arena) {
+        const CVariantStructOp *child, *end;
+        CVariantArray *array;
+        char *p = base + op->offset;
+        const void *data;
+        size_t i, size;
+        int r;
+
+        switch (op->kind) {
+        case C_VARIANT_STRUCT_OP_BASIC:
+                r = c_variant_read_raw(cv, op->element, &data, &size);
+                if (r < 0)
+                        return r;
+
+                if (size != op->size)
+                        memset(p, 0, op->size);
+                else if (op->element == C_VARIANT_BOOL)
+                        *(bool *)p = !!*(const uint8_t *)data;
+                else
+                        memcpy(p, data, size);
+
+                return 0;
+
+        case C_VARIANT_STRUCT_OP_STRING:
+                r = c_variant_read_raw(cv, op->element, &data, &size);
+                if (r < 0)
+                        return r;
+
+                if (size == 0 || ((const char *)data)[size - 1])
+                        data = "";
+
+                *(const char **)p = data;
+                return 0;
+
+        case C_VARIANT_STRUCT_OP_STRUCT:
+                if (op->copy) {
+                        r = c_variant_read_raw(cv, op->element, &data, &size);
+                        if (r < 0)
+                                return r;
+
+                        if (r > 0) {
+                                if (size == op->n_fixed)
+                                        memcpy(p, data, size);
+                                else
+                                        memset(p, 0, op->n_fixed);
+                                return 0;
+                        }
+
+                        /* not linear, fall back to decoding the members */
+                }
+
+                r = c_variant_enter(cv, (const char[]){ op->element, 0 });
+                if (r < 0)
+                        return r;
+
+                for (child = op + 1, end = child + op->n_ops; child < end; child += 1 + child->n_ops) {
+                        r = c_variant_decode_op(cv, child, p, arena);
+                        if (r < 0)
+                                return r;
+                }
+
+                return c_variant_exit(cv, op->element == C_VARIANT_TUPLE_OPEN ? ")" : "}");
+
+        case C_VARIANT_STRUCT_OP_ARRAY:
+                array = (CVariantArray *)p;
+                array->elements = NULL;
+                array->n_elements = 0;
+
+                if (op->copy) {
+                        r = c_variant_read_raw(cv, op->element, &data, &size);
+                        if (r < 0)
+                                return r;
+
+                        if (r > 0) {
+                                /* like the reader, treat invalid sizes as empty */
+                                if (size == 0 || size % op->size)
+                                        return 0;
+
+                                array->elements = c_variant_arena_alloc(arena, size);
+                                if (!array->elements)
+                                        return c_variant_poison(cv, -ENOMEM);
+
+                                memcpy(array->elements, data, size);
+                                array->n_elements = size / op->size;
+                                return 0;
+                        }
+                }
+
+                r = c_variant_enter(cv, "a");
+                if (r < 0)
+                        return r;
+
+                array->n_elements = c_variant_peek_count(cv);
+                if (array->n_elements > 0) {
+                        if (array->n_elements > SIZE_MAX / op->size)
+                                return c_variant_poison(cv, -ENOMEM);
+
+                        array->elements = c_variant_arena_alloc(arena, array->n_elements * op->size);
+                        if (!array->elements)
+                                return c_variant_poison(cv, -ENOMEM);
+
+                        memset(array->elements, 0, array->n_elements * op->size);
+
+                        for (i = 0; i < array->n_elements; ++i) {
+                                r = c_variant_decode_op(cv, op + 1, (char *)array->elements + i * op->size, arena);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+
+                return c_variant_exit(cv, "a");
+
+        default:
+                assert(0);
+                return c_variant_poison(cv, -EFAULT);
+        }
+}
+
+/**
+ * c_variant_decode_struct() - decode tuple into C struct
+ * @cv:         variant to read from, or NULL
+ * @desc:       struct descriptor
+ * @out:        C struct to fill
+ * @arena:      arena to allocate arrays from, or NULL
+ *
+ * This reads the next element of @cv, which must be of the type @desc was
+ * compiled for, and stores its members in the C struct @out, as described by
+ * @desc. Fields of @out that are not described by @desc are left untouched,
+ * as is any padding.
+ *
+ * Strings point directly into @cv, and are only valid as long as @cv is.
+ * Arrays are allocated from @arena, and are only valid until @arena is reset
+ * or destroyed. If @desc contains arrays, @arena must not be NULL.
+ *
+ * Like the reader, invalid or truncated data is decoded as the default value
+ * of its type, rather than failing.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_decode_struct(CVariant *cv, const CVariantStruct *desc, void *out, CVariantArena *arena) {
+        if (_unlikely_(!cv))
+                return strcmp(desc->type, "()") ? -EBADRQC : 0;
+
+        if (_unlikely_(desc->has_arrays && !arena))
+                return -EINVAL;
+
+        assert(cv->sealed);
+
+        if (_unlikely_(cv->level.n_type < desc->n_type ||
+                       strncmp(cv->level.type, desc->type, desc->n_type)))
+                return c_variant_poison(cv, -EBADRQC);
+
+        return c_variant_decode_op(cv, desc->ops, out, arena);
+}
+
+/*
+ * Encoding
+ * ========
+ */
+
+static int c_variant_encode_op(CVariant *cv, const CVariantStructOp *op, const char *base) {
+        const CVariantStructOp *child, *end;
+        const char *p = base + op->offset, *s;
+        const CVariantArray *array;
+        uint8_t b;
+        size_t i;
+        int r;
+
+        switch (op->kind) {
+        case C_VARIANT_STRUCT_OP_BASIC:
+                if (op->element == C_VARIANT_BOOL) {
+                        b = *(const bool *)p;
+                        return c_variant_write_raw(cv, op->element, &b, sizeof(b));
+                }
+
+                return c_variant_write_raw(cv, op->element, p, op->size);
+
+        case C_VARIANT_STRUCT_OP_STRING:
+                s = *(const char *const *)p ?: "";
+                return c_variant_write_raw(cv, op->element, s, strlen(s) + 1);
+
+        case C_VARIANT_STRUCT_OP_STRUCT:
+                if (op->dense)
+                        return c_variant_write_raw(cv, op->element, p, op->n_fixed);
+
+                r = c_variant_begin(cv, (const char[]){ op->element, 0 });
+                if (r < 0)
+                        return r;
+
+                for (child = op + 1, end = child + op->n_ops; child < end; child += 1 + child->n_ops) {
+                        r = c_variant_encode_op(cv, child, p);
+                        if (r < 0)
+                                return r;
+                }
+
+                return c_variant_end(cv, op->element == C_VARIANT_TUPLE_OPEN ? ")" : "}");
+
+        case C_VARIANT_STRUCT_OP_ARRAY:
+                array = (const CVariantArray *)p;
+
+                if (op->dense)
+                        return c_variant_write_raw(cv, op->element, array->elements, array->n_elements * op->size);
+
+                r = c_variant_begin(cv, "a");
+                if (r < 0)
+                        return r;
+
+                for (i = 0; i < array->n_elements; ++i) {
+                        r = c_variant_encode_op(cv, op + 1, (const char *)array->elements + i * op->size);
+                        if (r < 0)
+                                return r;
+                }
+
+                return c_variant_end(cv, "a");
+
+        default:
+                assert(0);
+                return c_variant_poison(cv, -EFAULT);
+        }
+}
+
+/**
+ * c_variant_encode_struct() - encode C struct as tuple
+ * @cv:         variant to write to, or NULL
+ * @desc:       struct descriptor
+ * @in:         C struct to encode
+ *
+ * This is the inverse of c_variant_decode_struct(). It writes the members of
+ * the C struct @in, as described by @desc, as next element of @cv, which must
+ * be of the type @desc was compiled for. All data is copied into @cv. NULL
+ * strings are written as empty strings.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_encode_struct(CVariant *cv, const CVariantStruct *desc, const void *in) {
+        if (_unlikely_(!cv))
+                return strcmp(desc->type, "()") ? -EBADRQC : 0;
+
+        assert(!cv->sealed);
+
+        if (_unlikely_(cv->level.n_type < desc->n_type ||
+                       strncmp(cv->level.type, desc->type, desc->n_type)))
+                return c_variant_poison(cv, -EBADRQC);
+
+        return c_variant_encode_op(cv, desc->ops, in);
+}
+
+/*
+ * Batches
+ * =======
+ */
+
+static size_t c_variant_batch_word(const uint8_t *data, size_t word) {
+        uint64_t v64;
+        uint32_t v32;
+        uint16_t v16;
+
+        switch (word) {
+        case 1:
+                return *data;
+        case 2:
+                memcpy(&v16, data, sizeof(v16));
+                return le16toh(v16);
+        case 4:
+                memcpy(&v32, data, sizeof(v32));
+                return le32toh(v32);
+        default:
+                memcpy(&v64, data, sizeof(v64));
+                return le64toh(v64);
+        }
+}
+
+static bool c_variant_batch_compile(const CVariantStruct *desc, CVariantBatch *batch) {
+        const CVariantStructOp *root = desc->ops, *child, *end;
+        const char *type = desc->type + 1;
+        size_t n_type = desc->n_type - 2;
+        CVariantType member;
+        size_t n = 0;
+        int r;
+
+        /*
+         * The direct path decodes tuples whose members are fixed-size basic
+         * types, strings, or fixed-size tuples that match their C layout.
+         * Anything else needs the reader, and thus a variant per message.
+         */
+
+        for (child = root + 1, end = child + root->n_ops; child < end; child += 1 + child->n_ops) {
+                if (n >= C_VARIANT_BATCH_MAX_MEMBERS)
+                        return false;
+                if (child->kind == C_VARIANT_STRUCT_OP_ARRAY ||
+                    (child->kind == C_VARIANT_STRUCT_OP_STRUCT && !child->copy))
+                        return false;
+
+                r = c_variant_signature_next(type, n_type, &member);
+                assert(r == 1);
+
+                batch->members[n].op = child;
+                batch->members[n].alignment = member.alignment;
+                batch->members[n].framed = !member.size && member.n_type < n_type;
+                batch->n_frames += batch->members[n].framed;
+                ++n;
+
+                type += member.n_type;
+                n_type -= member.n_type;
+        }
+
+        batch->n_members = n;
+        batch->n_fixed = root->n_fixed;
+        batch->copy = root->copy;
+        return true;
+}
+
+static void c_variant_batch_clear(const CVariantBatch *batch, char *base) {
+        const CVariantStructOp *op;
+        size_t i;
+
+        for (i = 0; i < batch->n_members; ++i) {
+                op = batch->members[i].op;
+                if (op->kind == C_VARIANT_STRUCT_OP_STRING)
+                        *(const char **)(base + op->offset) = "";
+                else
+                        memset(base + op->offset, 0, op->kind == C_VARIANT_STRUCT_OP_BASIC ? op->size : op->n_fixed);
+        }
+}
+
+static int c_variant_batch_decode(const CVariantBatch *batch, const struct iovec *msg, char *base) {
+        const uint8_t *data = msg->iov_base;
+        size_t i, len = msg->iov_len, limit, word = 0, pos, aligned, end, n_frames;
+        const CVariantBatchMember *member;
+        const CVariantStructOp *op;
+
+        if (batch->n_fixed) {
+                if (len != batch->n_fixed)
+                        return -EBADMSG;
+
+                /* the whole tuple matches the C layout */
+                if (batch->copy) {
+                        memcpy(base, data, len);
+                        return 0;
+                }
+
+                limit = len;
+        } else {
+                word = 1U << c_variant_word_size(len, 0);
+                if (batch->n_frames > len / word)
+                        return -EBADMSG;
+
+                limit = len - batch->n_frames * word;
+        }
+
+        for (i = 0, pos = 0, n_frames = 0; i < batch->n_members; ++i) {
+                member = batch->members + i;
+                op = member->op;
+                aligned = ALIGN_TO(pos, 1U << member->alignment);
+
+                if (op->n_fixed)
+                        end = aligned + op->n_fixed;
+                else if (member->framed)
+                        end = c_variant_batch_word(data + len - ++n_frames * word, word);
+                else
+                        end = limit;
+
+                /* empty, non-fixed members need not be aligned */
+                if (!op->n_fixed && end == pos)
+                        aligned = pos;
+                else if (aligned > end || end > limit)
+                        return -EBADMSG;
+
+                switch (op->kind) {
+                case C_VARIANT_STRUCT_OP_BASIC:
+                        if (op->element == C_VARIANT_BOOL)
+                                *(bool *)(base + op->offset) = !!data[aligned];
+                        else
+                                memcpy(base + op->offset, data + aligned, op->size);
+                        break;
+                case C_VARIANT_STRUCT_OP_STRING:
+                        if (end == aligned || data[end - 1])
+                                return -EBADMSG;
+
+                        *(const char **)(base + op->offset) = (const char *)data + aligned;
+                        break;
+                default:
+                        memcpy(base + op->offset, data + aligned, op->n_fixed);
+                        break;
+                }
+
+                pos = end;
+        }
+
+        return 0;
+}
+
+static int c_variant_batch_validate(const CVariantStructOp *op, const uint8_t *data, size_t start, size_t end) {
+        size_t len = end - start, limit, word, frames, pos, aligned, mend, n_frames, i, n;
+        const CVariantStructOp *child, *stop;
+        int r;
+
+        /*
+         * Verify the framing of the element of @op at [@start, @end), the same
+         * way the direct path does: -EBADMSG is returned if any container has
+         * invalid framing, or any string is not terminated. Fixed-size
+         * elements contain neither, so only their size is checked.
+         */
+
+        switch (op->kind) {
+        case C_VARIANT_STRUCT_OP_STRING:
+                return (!len || data[end - 1]) ? -EBADMSG : 0;
+
+        case C_VARIANT_STRUCT_OP_STRUCT:
+                if (op->n_fixed)
+                        return (len != op->n_fixed) ? -EBADMSG : 0;
+
+                stop = op + 1 + op->n_ops;
+                for (child = op + 1, n_frames = 0; child < stop; child += 1 + child->n_ops)
+                        if (!child->n_fixed && child + 1 + child->n_ops < stop)
+                                ++n_frames;
+
+                word = 1U << c_variant_word_size(len, 0);
+                if (n_frames > len / word)
+                        return -EBADMSG;
+
+                limit = len - n_frames * word;
+
+                for (child = op + 1, pos = 0, n_frames = 0; child < stop; child += 1 + child->n_ops, pos = mend) {
+                        aligned = ALIGN_TO(pos, 1U << child->alignment);
+
+                        if (child->n_fixed)
+                                mend = aligned + child->n_fixed;
+                        else if (child + 1 + child->n_ops >= stop)
+                                mend = limit;
+                        else
+                                mend = c_variant_batch_word(data + end - ++n_frames * word, word);
+
+                        /* empty, non-fixed members need not be aligned */
+                        if (!child->n_fixed && mend == pos)
+                                aligned = pos;
+                        else if (aligned > mend || mend > limit)
+                                return -EBADMSG;
+
+                        if (!child->n_fixed) {
+                                r = c_variant_batch_validate(child, data, start + aligned, start + mend);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+
+                return 0;
+
+        case C_VARIANT_STRUCT_OP_ARRAY:
+                child = op + 1;
+                if (child->n_fixed)
+                        return (len % child->n_fixed) ? -EBADMSG : 0;
+                if (!len)
+                        return 0;
+
+                word = 1U << c_variant_word_size(len, 0);
+                frames = len >= word ? c_variant_batch_word(data + end - word, word) : len + 1;
+                if (frames > len || (len - frames) % word)
+                        return -EBADMSG;
+
+                for (i = 0, n = (len - frames) / word, pos = 0; i < n; ++i, pos = mend) {
+                        mend = c_variant_batch_word(data + start + frames + i * word, word);
+                        aligned = ALIGN_TO(pos, 1U << child->alignment);
+
+                        if (mend == pos)
+                                aligned = pos;
+                        else if (aligned > mend || mend > frames)
+                                return -EBADMSG;
+
+                        r = c_variant_batch_validate(child, data, start + aligned, start + mend);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+
+        default:
+                return 0;
+        }
+}
+
+/**
+ * c_variant_decode_batch() - decode many messages of the same type
+ * @desc:       struct descriptor
+ * @msgs:       messages to decode, one vector each
+ * @n_msgs:     number of messages in @msgs
+ * @out:        array of @n_msgs C structs to fill
+ * @arena:      arena to allocate arrays from, or NULL
+ * @statuses:   array of @n_msgs status codes to fill, or NULL
+ *
+ * This decodes each message in @msgs, which must be serialized variants of
+ * the type @desc was compiled for, into the C struct at the same index in
+ * @out, which is an array of structs of the size @desc was compiled for. It
+ * is equivalent to calling c_variant_new_from_vecs(),
+ * c_variant_decode_struct(), and c_variant_free() for every message, but the
+ * type is only checked once, for the whole batch.
+ *
+ * If @desc describes a tuple of fixed-size basic types, strings, and
+ * fixed-size tuples that match their C layout, messages are decoded directly
+ * from their data, without allocating anything. Fixed-size messages that
+ * match the C layout as a whole are copied with a single memcpy(). Other
+ * types fall back to creating a variant for every message.
+ *
+ * Strings point directly into the messages, and are only valid as long as
+ * the messages are. Arrays are allocated from @arena, which must not be NULL
+ * if @desc contains arrays.
+ *
+ * Unlike the reader, this does not silently decode messages with invalid
+ * framing as the default values of their type, but reports them as failed,
+ * with their status set to -EBADMSG, and their fields set to the defaults.
+ * This is the same for both, the direct path and the fallback. Otherwise, the
+ * status of a message is the result of c_variant_decode_struct() for it.
+ * Failures to allocate memory abort the whole batch.
+ *
+ * Return: Number of failed messages on success, -EINVAL if @desc contains
+ *         arrays but @arena is NULL, -E2BIG if @n_msgs exceeds INT_MAX,
+ *         negative error code if the batch could not be decoded at all.
+ */
+_public_ int c_variant_decode_batch(const CVariantStruct *desc,
+                                    const struct iovec *msgs,
+                                    size_t n_msgs,
+                                    void *out,
+                                    CVariantArena *arena,
+                                    int *statuses) {
+        CVariantBatch batch = {};
+        struct iovec msg;
+        char *base = out;
+        size_t i, n_failed = 0;
+        CVariant *cv;
+        int r, valid;
+
+        if (_unlikely_(desc->has_arrays && !arena))
+                return -EINVAL;
+        if (_unlikely_(n_msgs > INT_MAX))
+                return -E2BIG;
+
+        if (c_variant_batch_compile(desc, &batch)) {
+                for (i = 0; i < n_msgs; ++i, base += desc->size) {
+                        r = c_variant_batch_decode(&batch, msgs + i, base);
+                        if (r < 0) {
+                                c_variant_batch_clear(&batch, base);
+                                ++n_failed;
+                        }
+                        if (statuses)
+                                statuses[i] = r;
+                }
+
+                return n_failed;
+        }
+
+        for (i = 0; i < n_msgs; ++i, base += desc->size) {
+                /* like the direct path, report invalid framing, and decode defaults */
+                msg = msgs[i];
+                valid = c_variant_batch_validate(desc->ops, msg.iov_base, 0, msg.iov_len);
+                if (valid < 0)
+                        msg = (struct iovec){};
+
+                r = c_variant_new_from_vecs(&cv, desc->type, desc->n_type, &msg, 1);
+                if (r >= 0) {
+                        r = c_variant_decode_struct(cv, desc, base, arena);
+                        c_variant_free(cv);
+                }
+                if (r == -ENOMEM)
+                        return r;
+                if (r >= 0)
+                        r = valid;
+                if (r < 0)
+                        ++n_failed;
+                if (statuses)
+                        statuses[i] = r;
+        }
+
+        return n_failed;
+}
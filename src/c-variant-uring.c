@@ -0,0 +1,398 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * io_uring Helpers
+ *
+ * We do not own any io_uring instance, nor do we depend on liburing. Instead,
+ * these helpers fill caller-provided submission queue entries (SQEs) with
+ * requests transmitting a sealed variant, and construct variants from
+ * completion queue entries (CQEs). The SQE array can be taken straight from
+ * the submission ring, or be a scratch array the caller copies into the ring.
+ *
+ * The transmit helpers all follow the same scheme: If @sqes is NULL, nothing
+ * is prepared, but the number of required SQEs is returned. Otherwise, up to
+ * @n_sqes entries are prepared and their number is returned. All entries
+ * but the last are linked via IOSQE_IO_LINK, so a short transfer cancels the
+ * remainder of the chain. user_data is left 0 for the caller to fill in.
+ *
+ * The variant (and thus its buffers) must stay alive until all completions
+ * of the prepared chain have been reaped.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+
+static size_t c_variant_uring_count(const struct iovec *vecs, size_t n_vecs) {
+        size_t i, n;
+
+        /* number of SQEs needed to transmit @vecs one by one */
+        for (i = 0, n = 0; i < n_vecs; ++i)
+                n += !!vecs[i].iov_len;
+
+        return n;
+}
+
+static void c_variant_uring_prep(struct io_uring_sqe *sqe, uint8_t opcode, int fd, bool link) {
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->flags = link ? IOSQE_IO_LINK : 0;
+}
+
+/**
+ * c_variant_uring_prep_writev() - prepare io_uring writev requests
+ * @cv:         sealed variant to transmit, or NULL
+ * @sqes:       SQEs to prepare, or NULL
+ * @n_sqes:     number of SQEs in @sqes
+ * @fd:         file descriptor to write to
+ * @offset:     file offset to write at, or -1 for the current position
+ *
+ * This prepares IORING_OP_WRITEV requests transmitting the data of @cv to
+ * @fd. Each request carries at most IOV_MAX vectors, and requests are linked
+ * in order. The iovec array of @cv is referenced directly.
+ *
+ * Return: Number of required/prepared SQEs, or negative error code on failure.
+ */
+_public_ int c_variant_uring_prep_writev(CVariant *cv,
+                                         struct io_uring_sqe *sqes,
+                                         size_t n_sqes,
+                                         int fd,
+                                         uint64_t offset) {
+        const struct iovec *vecs;
+        size_t i, j, n, n_vecs, n_chunk;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (_unlikely_(!vecs && cv))
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        n = (n_vecs + IOV_MAX - 1) / IOV_MAX;
+        if (!sqes)
+                return n;
+        if (_unlikely_(n > n_sqes || n > INT_MAX))
+                return -ENOBUFS;
+
+        for (i = 0; i < n; ++i) {
+                n_chunk = (n_vecs - i * IOV_MAX < IOV_MAX) ? n_vecs - i * IOV_MAX : IOV_MAX;
+
+                c_variant_uring_prep(&sqes[i], IORING_OP_WRITEV, fd, i + 1 < n);
+                sqes[i].off = offset;
+                sqes[i].addr = (unsigned long)(vecs + i * IOV_MAX);
+                sqes[i].len = n_chunk;
+
+                if (offset != (uint64_t)-1)
+                        for (j = 0; j < n_chunk; ++j)
+                                offset += vecs[i * IOV_MAX + j].iov_len;
+        }
+
+        return n;
+}
+
+/**
+ * c_variant_uring_prep_sendmsg() - prepare io_uring sendmsg requests
+ * @cv:         sealed variant to transmit, or NULL
+ * @sqes:       SQEs to prepare, or NULL
+ * @msgs:       message headers to use, one per SQE
+ * @n_sqes:     number of SQEs in @sqes and @msgs
+ * @fd:         socket to send on
+ * @flags:      MSG_* flags to pass to the kernel
+ *
+ * This prepares IORING_OP_SENDMSG requests transmitting the data of @cv on
+ * @fd. Each request carries at most IOV_MAX vectors, described by the
+ * corresponding entry in @msgs, which must stay valid until the request was
+ * submitted. All but the last request carry MSG_MORE, so the kernel can
+ * coalesce the chain.
+ *
+ * Return: Number of required/prepared SQEs, or negative error code on failure.
+ */
+_public_ int c_variant_uring_prep_sendmsg(CVariant *cv,
+                                          struct io_uring_sqe *sqes,
+                                          struct msghdr *msgs,
+                                          size_t n_sqes,
+                                          int fd,
+                                          int flags) {
+        const struct iovec *vecs;
+        size_t i, n, n_vecs, n_chunk;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (_unlikely_(!vecs && cv))
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        n = (n_vecs + IOV_MAX - 1) / IOV_MAX;
+        if (!sqes)
+                return n;
+        if (_unlikely_(n > n_sqes || n > INT_MAX))
+                return -ENOBUFS;
+
+        assert(msgs);
+
+        for (i = 0; i < n; ++i) {
+                n_chunk = (n_vecs - i * IOV_MAX < IOV_MAX) ? n_vecs - i * IOV_MAX : IOV_MAX;
+
+                memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_iov = (struct iovec *)(vecs + i * IOV_MAX);
+                msgs[i].msg_iovlen = n_chunk;
+
+                c_variant_uring_prep(&sqes[i], IORING_OP_SENDMSG, fd, i + 1 < n);
+                sqes[i].addr = (unsigned long)&msgs[i];
+                sqes[i].len = 1;
+                sqes[i].msg_flags = flags | ((i + 1 < n) ? MSG_MORE : 0);
+        }
+
+        return n;
+}
+
+/**
+ * c_variant_uring_prep_write_fixed() - prepare io_uring fixed-buffer writes
+ * @cv:         sealed variant to transmit, or NULL
+ * @sqes:       SQEs to prepare, or NULL
+ * @n_sqes:     number of SQEs in @sqes
+ * @fd:         file descriptor to write to
+ * @offset:     file offset to write at, or -1 for the current position
+ *
+ * This prepares one request per non-empty vector of @cv, linked in order.
+ * Vectors allocated from the buffer pool of @cv (see
+ * c_variant_new_with_pool()) are written via IORING_OP_WRITE_FIXED, using the
+ * buffer index of the pool. Any other vector (e.g., data inserted via
+ * c_variant_insert(), or buffers allocated after the pool was exhausted) is
+ * written via plain IORING_OP_WRITE.
+ *
+ * Return: Number of required/prepared SQEs, or negative error code on failure.
+ */
+_public_ int c_variant_uring_prep_write_fixed(CVariant *cv,
+                                              struct io_uring_sqe *sqes,
+                                              size_t n_sqes,
+                                              int fd,
+                                              uint64_t offset) {
+        const struct iovec *vecs;
+        size_t i, j, n, n_vecs;
+        bool fixed;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (_unlikely_(!vecs && cv))
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        n = c_variant_uring_count(vecs, n_vecs);
+        if (!sqes)
+                return n;
+        if (_unlikely_(n > n_sqes || n > INT_MAX))
+                return -ENOBUFS;
+
+        for (i = 0, j = 0; i < n_vecs; ++i) {
+                if (!vecs[i].iov_len)
+                        continue;
+                if (_unlikely_(vecs[i].iov_len > UINT32_MAX))
+                        return -EFBIG;
+
+                fixed = c_variant_pool_owns(cv->pool, vecs[i].iov_base);
+
+                c_variant_uring_prep(&sqes[j],
+                                     fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+                                     fd,
+                                     j + 1 < n);
+                sqes[j].off = offset;
+                sqes[j].addr = (unsigned long)vecs[i].iov_base;
+                sqes[j].len = vecs[i].iov_len;
+                if (fixed)
+                        sqes[j].buf_index = cv->pool->index;
+
+                if (offset != (uint64_t)-1)
+                        offset += vecs[i].iov_len;
+                ++j;
+        }
+
+        return n;
+}
+
+/**
+ * c_variant_uring_prep_send_zc() - prepare io_uring zero-copy sends
+ * @cv:         sealed variant to transmit, or NULL
+ * @sqes:       SQEs to prepare, or NULL
+ * @n_sqes:     number of SQEs in @sqes
+ * @fd:         socket to send on
+ * @flags:      MSG_* flags to pass to the kernel
+ *
+ * This prepares one IORING_OP_SEND_ZC request per non-empty vector of @cv,
+ * linked in order. All but the last request carry MSG_MORE. Vectors allocated
+ * from the buffer pool of @cv are sent with IORING_RECVSEND_FIXED_BUF, using
+ * the buffer index of the pool.
+ *
+ * Note that each zero-copy request produces an additional notification
+ * completion (IORING_CQE_F_NOTIF). The variant must stay alive until all
+ * notifications have been received.
+ *
+ * Return: Number of required/prepared SQEs, or negative error code on failure.
+ */
+_public_ int c_variant_uring_prep_send_zc(CVariant *cv,
+                                          struct io_uring_sqe *sqes,
+                                          size_t n_sqes,
+                                          int fd,
+                                          int flags) {
+#ifdef IORING_RECVSEND_FIXED_BUF
+        const struct iovec *vecs;
+        size_t i, j, n, n_vecs;
+        bool fixed;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        if (_unlikely_(!vecs && cv))
+                return c_variant_return_poison(cv) ?: -EFAULT;
+
+        n = c_variant_uring_count(vecs, n_vecs);
+        if (!sqes)
+                return n;
+        if (_unlikely_(n > n_sqes || n > INT_MAX))
+                return -ENOBUFS;
+
+        for (i = 0, j = 0; i < n_vecs; ++i) {
+                if (!vecs[i].iov_len)
+                        continue;
+                if (_unlikely_(vecs[i].iov_len > UINT32_MAX))
+                        return -EFBIG;
+
+                fixed = c_variant_pool_owns(cv->pool, vecs[i].iov_base);
+
+                c_variant_uring_prep(&sqes[j], IORING_OP_SEND_ZC, fd, j + 1 < n);
+                sqes[j].addr = (unsigned long)vecs[i].iov_base;
+                sqes[j].len = vecs[i].iov_len;
+                sqes[j].msg_flags = flags | ((j + 1 < n) ? MSG_MORE : 0);
+                if (fixed) {
+                        sqes[j].ioprio = IORING_RECVSEND_FIXED_BUF;
+                        sqes[j].buf_index = cv->pool->index;
+                }
+
+                ++j;
+        }
+
+        return n;
+#else
+        return -EOPNOTSUPP;
+#endif
+}
+
+/**
+ * c_variant_new_from_uring() - create new variant from io_uring completion
+ * @cvp:        output variable for new variant
+ * @type:       type string
+ * @n_type:     length of @type
+ * @cqe:        completion of a receive request with buffer selection
+ * @buffers:    base address of the provided buffers
+ * @buffer_size: size of each provided buffer
+ * @bidp:       output variable for the buffer ID, or NULL
+ *
+ * This creates a new sealed variant of type @type on top of the buffer the
+ * kernel picked for the receive request completed by @cqe (see
+ * IOSQE_BUFFER_SELECT). The provided buffers are expected to be laid out
+ * consecutively at @buffers, each @buffer_size bytes in size, indexed by
+ * buffer ID. This is the layout used by both, IORING_OP_PROVIDE_BUFFERS and
+ * provided-buffer rings.
+ *
+ * The data is *NOT* copied. The caller must not recycle the buffer (its ID is
+ * returned in @bidp) before the variant was destroyed. If @cqe carries a
+ * buffer, its ID is returned in @bidp even if this fails, so the caller can
+ * recycle it right away.
+ *
+ * Return: 0 on success, -ENODATA if @cqe carries no buffer, -EBADMSG if @cqe
+ *         reports more data than fits into a buffer, negative error code on
+ *         failure.
+ */
+_public_ int c_variant_new_from_uring(CVariant **cvp,
+                                      const char *type,
+                                      size_t n_type,
+                                      const struct io_uring_cqe *cqe,
+                                      void *buffers,
+                                      size_t buffer_size,
+                                      uint16_t *bidp) {
+        uint16_t bid;
+
+        assert(cqe);
+
+        if (_unlikely_(cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)))
+                return -ENODATA;
+
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (bidp)
+                *bidp = bid;
+
+        if (_unlikely_((size_t)cqe->res > buffer_size))
+                return -EBADMSG;
+
+        return c_variant_new_from_buffer(cvp,
+                                         type,
+                                         n_type,
+                                         (char *)buffers + (size_t)bid * buffer_size,
+                                         cqe->res);
+}
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+_public_ int c_variant_uring_prep_writev(CVariant *cv,
+                                         struct io_uring_sqe *sqes,
+                                         size_t n_sqes,
+                                         int fd,
+                                         uint64_t offset) {
+        return -EOPNOTSUPP;
+}
+
+_public_ int c_variant_uring_prep_sendmsg(CVariant *cv,
+                                          struct io_uring_sqe *sqes,
+                                          struct msghdr *msgs,
+                                          size_t n_sqes,
+                                          int fd,
+                                          int flags) {
+        return -EOPNOTSUPP;
+}
+
+_public_ int c_variant_uring_prep_write_fixed(CVariant *cv,
+                                              struct io_uring_sqe *sqes,
+                                              size_t n_sqes,
+                                              int fd,
+                                              uint64_t offset) {
+        return -EOPNOTSUPP;
+}
+
+_public_ int c_variant_uring_prep_send_zc(CVariant *cv,
+                                          struct io_uring_sqe *sqes,
+                                          size_t n_sqes,
+                                          int fd,
+                                          int flags) {
+        return -EOPNOTSUPP;
+}
+
+_public_ int c_variant_new_from_uring(CVariant **cvp,
+                                      const char *type,
+                                      size_t n_type,
+                                      const struct io_uring_cqe *cqe,
+                                      void *buffers,
+                                      size_t buffer_size,
+                                      uint16_t *bidp) {
+        return -EOPNOTSUPP;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
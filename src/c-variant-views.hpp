@@ -0,0 +1,593 @@
+#pragma once
+
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * C++ Views
+ *
+ * These are C++20 views over arrays and dictionaries of a sealed variant. A
+ * view consumes the container from the reader, just like c_variant_read()
+ * would, but rather than decoding it, it remembers where the serialized
+ * container lives in memory. Elements are then decoded on access, straight
+ * from the framing offsets, without going through the reader:
+ *
+ *      cv::array_view<uint32_t> ids(cv);
+ *      for (uint32_t id : ids.span())
+ *              ...;
+ *
+ *      cv::array_view<std::string_view> names(cv);
+ *      std::string_view last = names[names.size() - 1];
+ *
+ *      for (auto [key, val] : cv::dict_view<std::string_view, cv::variant_ref>(cv))
+ *              ...;
+ *
+ * Fixed-size elements are a multiplication away, dynamic-size elements need
+ * two framing offset fetches. Neither allocates, nor parses signatures, nor
+ * enters containers. A cv::variant_ref references any serialized value by
+ * type and memory, and can itself be iterated via views. Elements with
+ * invalid framing read as default values, just like with the reader.
+ *
+ * If the container type does not match the view, the view is empty, the
+ * container is not consumed, and error() returns -EBADRQC. A view can only be
+ * created if the entire container resides in a single iovec, which is always
+ * the case for variants created from linear buffers. Otherwise, the container
+ * is skipped, the view is empty, and error() returns -EFAULT. Views reference
+ * the memory of the variant and must not outlive it.
+ *
+ * CAREFUL: Like c-variant-inline.h, this accesses the internal layout of
+ *          CVariant. It must only be used when linking libcvariant.a or
+ *          embedding the sources. Never use it with the shared library.
+ */
+
+#include <cerrno>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <endian.h>
+#include <iterator>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "c-variant.h"
+
+extern "C" {
+#include "c-variant-private.h"
+}
+
+namespace cv {
+
+class variant_ref;
+
+namespace detail {
+
+inline size_t fetch_word(const uint8_t *p, unsigned int wordsize) {
+        uint64_t v64;
+        uint32_t v32;
+        uint16_t v16;
+
+        switch (wordsize) {
+        case 0:
+                return *p;
+        case 1:
+                std::memcpy(&v16, p, sizeof(v16));
+                return le16toh(v16);
+        case 2:
+                std::memcpy(&v32, p, sizeof(v32));
+                return le32toh(v32);
+        default:
+                std::memcpy(&v64, p, sizeof(v64));
+                return le64toh(v64);
+        }
+}
+
+struct range {
+        const uint8_t *p;
+        size_t n;
+};
+
+/*
+ * A serialized array: @stride is the element size if fixed, otherwise the
+ * element ends are stored as framing offsets, starting at @frames.
+ */
+struct array {
+        const uint8_t *data = nullptr;
+        size_t count = 0;
+        size_t frames = 0;
+        size_t stride = 0;
+        size_t alignment = 1;
+        unsigned int wordsize = 0;
+
+        void init(const CVariantType &elem, const uint8_t *p, size_t n) {
+                size_t w, end;
+
+                data = p;
+                stride = elem.size;
+                alignment = size_t(1) << elem.alignment;
+
+                if (stride) {
+                        if (n % stride == 0)
+                                count = n / stride;
+                } else if (n > 0) {
+                        wordsize = c_variant_word_size(n, 0);
+                        w = size_t(1) << wordsize;
+                        if (w <= n) {
+                                end = fetch_word(p + n - w, wordsize);
+                                if (end < n && (n - end) % w == 0) {
+                                        frames = end;
+                                        count = (n - end) / w;
+                                }
+                        }
+                }
+        }
+
+        range at(size_t i) const {
+                size_t start, end;
+
+                if (stride)
+                        return { data + i * stride, stride };
+
+                end = fetch_word(data + frames + (i << wordsize), wordsize);
+                start = i ? fetch_word(data + frames + ((i - 1) << wordsize), wordsize) : 0;
+                start = ALIGN_TO(start, alignment);
+
+                if (start <= end && end <= frames)
+                        return { data + start, end - start };
+
+                return { data, 0 };
+        }
+};
+
+inline int parse(std::string_view type, CVariantType *info) {
+        return c_variant_signature_one(type.data(), type.size(), info);
+}
+
+/*
+ * Consume the array ahead in @cv and return its type and memory. The reader
+ * validated the framing of the array when entering it, we only need to find
+ * its position in the iovecs.
+ */
+inline int consume(CVariant *cv, std::string_view *elemp, const uint8_t **pp, size_t *np) {
+        const struct iovec *vec, *end;
+        CVariantLevel *level;
+        CVariantType info;
+        const char *type;
+        size_t n_type, i_front, size;
+        int r;
+
+        if (!cv)
+                return -EBADRQC;
+
+        type = c_variant_peek_type(cv, &n_type);
+        r = c_variant_signature_next(type, n_type, &info);
+        if (r != 1 || *type != C_VARIANT_ARRAY)
+                return -EBADRQC;
+
+        *elemp = std::string_view(type + 1, info.n_type - 1);
+
+        r = c_variant_enter(cv, "a");
+        if (r < 0)
+                return r;
+
+        level = &cv->level;
+        size = level->size;
+        vec = cv->vecs + level->v_front;
+        end = cv->vecs + cv->n_vecs;
+        i_front = level->i_front;
+
+        /* fold the front onto the iovec it points into */
+        while (vec + 1 < end && i_front >= vec->iov_len) {
+                i_front -= vec->iov_len;
+                ++vec;
+        }
+
+        if (size > 0 && !vec->iov_base && cv->files) {
+                r = c_variant_file_map(cv, cv->vecs + (vec - cv->vecs));
+                if (r < 0) {
+                        c_variant_exit(cv, "a");
+                        return r;
+                }
+        }
+
+        if (size > 0 && (i_front > vec->iov_len || size > vec->iov_len - i_front)) {
+                /* spread across iovecs; skip it, as the reader would */
+                r = c_variant_exit(cv, "a");
+                return r < 0 ? r : -EFAULT;
+        }
+
+        *pp = size ? (const uint8_t *)vec->iov_base + i_front : nullptr;
+        *np = size;
+
+        return c_variant_exit(cv, "a");
+}
+
+} /* namespace detail */
+
+/**
+ * element - decoder for serialized elements
+ *
+ * element<T> decodes serialized values of a GVariant type into T. It is
+ * specialized for all fixed-size basic types, std::string_view for all string
+ * types, and cv::variant_ref for any type.
+ */
+template<typename T>
+struct element;
+
+template<typename T, char C>
+struct element_basic {
+        static bool matches(std::string_view type) {
+                return type.size() == 1 && type[0] == C;
+        }
+
+        static T get(std::string_view, const uint8_t *p, size_t n) {
+                T v{};
+
+                if (n == sizeof(T))
+                        std::memcpy(&v, p, sizeof(T));
+                return v;
+        }
+};
+
+template<> struct element<uint8_t> : element_basic<uint8_t, C_VARIANT_BYTE> {};
+template<> struct element<int16_t> : element_basic<int16_t, C_VARIANT_INT16> {};
+template<> struct element<uint16_t> : element_basic<uint16_t, C_VARIANT_UINT16> {};
+template<> struct element<int32_t> : element_basic<int32_t, C_VARIANT_INT32> {};
+template<> struct element<uint32_t> : element_basic<uint32_t, C_VARIANT_UINT32> {};
+template<> struct element<int64_t> : element_basic<int64_t, C_VARIANT_INT64> {};
+template<> struct element<uint64_t> : element_basic<uint64_t, C_VARIANT_UINT64> {};
+template<> struct element<double> : element_basic<double, C_VARIANT_DOUBLE> {};
+
+template<>
+struct element<bool> {
+        static bool matches(std::string_view type) {
+                return type.size() == 1 && type[0] == C_VARIANT_BOOL;
+        }
+
+        static bool get(std::string_view, const uint8_t *p, size_t n) {
+                return n == 1 && *p;
+        }
+};
+
+template<>
+struct element<std::string_view> {
+        static bool matches(std::string_view type) {
+                return type.size() == 1 && (type[0] == C_VARIANT_STRING ||
+                                            type[0] == C_VARIANT_PATH ||
+                                            type[0] == C_VARIANT_SIGNATURE);
+        }
+
+        static std::string_view get(std::string_view, const uint8_t *p, size_t n) {
+                if (n == 0 || p[n - 1])
+                        return {};
+                return { (const char *)p, n - 1 };
+        }
+};
+
+/**
+ * variant_ref - reference to a serialized value
+ *
+ * This references a serialized value of any type, together with its type
+ * string. As element of a view, values of type "v" are unwrapped, that is, the
+ * reference points to the contained value and its type. References are cheap
+ * to copy and never own any memory.
+ */
+class variant_ref {
+public:
+        variant_ref() = default;
+        variant_ref(std::string_view type, const void *data, size_t size) :
+                type_(type), data_((const uint8_t *)data), size_(size) {}
+
+        std::string_view type() const { return type_; }
+        const void *data() const { return data_; }
+        size_t size() const { return size_; }
+
+        /* decode as T, or return the default value if the type differs */
+        template<typename T>
+        T get() const {
+                return element<T>::matches(type_) ? element<T>::get(type_, data_, size_) : T{};
+        }
+
+        /* create a reader for the value, which allocates a new variant */
+        int new_reader(CVariant **cvp) const {
+                return c_variant_new_from_buffer(cvp, type_.data(), type_.size(), data_, size_);
+        }
+
+private:
+        std::string_view type_ = "()";
+        const uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+};
+
+template<>
+struct element<variant_ref> {
+        static bool matches(std::string_view) {
+                return true;
+        }
+
+        static variant_ref get(std::string_view type, const uint8_t *p, size_t n) {
+                CVariantType info;
+                size_t i;
+
+                if (type != "v")
+                        return { type, p, n };
+
+                /* the type string follows the last zero byte */
+                for (i = n; i > 0; --i)
+                        if (!p[i - 1])
+                                break;
+                if (i == 0 || detail::parse({ (const char *)p + i, n - i }, &info) < 0)
+                        return {};
+
+                return { { (const char *)p + i, n - i }, p, i - 1 };
+        }
+};
+
+namespace detail {
+
+/*
+ * Random access iterator over the indices of a view, dereferencing to the
+ * decoded element by value.
+ */
+template<typename View>
+class iterator {
+public:
+        using iterator_concept = std::random_access_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = typename View::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+
+        iterator() = default;
+        iterator(const View *view, size_t i) : view_(view), i_(i) {}
+
+        value_type operator*() const { return (*view_)[i_]; }
+        value_type operator[](difference_type n) const { return (*view_)[i_ + n]; }
+
+        iterator &operator++() { ++i_; return *this; }
+        iterator &operator--() { --i_; return *this; }
+        iterator operator++(int) { return iterator(view_, i_++); }
+        iterator operator--(int) { return iterator(view_, i_--); }
+        iterator &operator+=(difference_type n) { i_ += n; return *this; }
+        iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(view_, i_ + n); }
+        iterator operator-(difference_type n) const { return iterator(view_, i_ - n); }
+        friend iterator operator+(difference_type n, const iterator &it) { return it + n; }
+        difference_type operator-(const iterator &other) const { return difference_type(i_ - other.i_); }
+
+        bool operator==(const iterator &other) const { return i_ == other.i_; }
+        auto operator<=>(const iterator &other) const { return i_ <=> other.i_; }
+
+private:
+        const View *view_ = nullptr;
+        size_t i_ = 0;
+};
+
+} /* namespace detail */
+
+/**
+ * array_view - view over an array
+ *
+ * This consumes an array of elements decoded as T from @cv, or views the array
+ * referenced by a variant_ref. For fixed-size arithmetic T, span() provides
+ * direct access to the serialized elements.
+ */
+template<typename T>
+class array_view {
+public:
+        using value_type = T;
+        using iterator = detail::iterator<array_view>;
+
+        explicit array_view(CVariant *cv) {
+                std::string_view elem;
+                CVariantType info;
+                const uint8_t *p;
+                size_t n;
+
+                if (!cv) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                /* check the type first, so mismatches are not consumed */
+                elem = peek(cv);
+                if (elem.empty() || !element<T>::matches(elem) || detail::parse(elem, &info) < 0) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                error_ = detail::consume(cv, &elem, &p, &n);
+                if (error_ >= 0)
+                        init(elem, info, p, n);
+        }
+
+        explicit array_view(const variant_ref &ref) {
+                std::string_view type = ref.type(), elem;
+                CVariantType info;
+
+                if (type.size() < 2 || type[0] != C_VARIANT_ARRAY) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                elem = type.substr(1);
+                if (!element<T>::matches(elem) || detail::parse(elem, &info) < 0) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                init(elem, info, (const uint8_t *)ref.data(), ref.size());
+        }
+
+        int error() const { return error_; }
+        size_t size() const { return array_.count; }
+        bool empty() const { return !array_.count; }
+
+        T operator[](size_t i) const {
+                detail::range r = array_.at(i);
+                return element<T>::get(elem_, r.p, r.n);
+        }
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end() const { return iterator(this, array_.count); }
+
+        /*
+         * Return the elements as span, rather than decoding them one by one.
+         * Serialized data is always suitably aligned if the buffer of the
+         * variant is, which is the case for all memory allocated by the
+         * library or malloc(3). Otherwise, an empty span is returned.
+         */
+        std::span<const T> span() const
+                requires (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+                if ((uintptr_t)array_.data % alignof(T))
+                        return {};
+                return { (const T *)array_.data, array_.count };
+        }
+
+private:
+        detail::array array_;
+        std::string_view elem_;
+        int error_ = 0;
+
+        static std::string_view peek(CVariant *cv) {
+                CVariantType info;
+                const char *type;
+                size_t n_type;
+
+                type = c_variant_peek_type(cv, &n_type);
+                if (c_variant_signature_next(type, n_type, &info) != 1 || *type != C_VARIANT_ARRAY)
+                        return {};
+                return { type + 1, info.n_type - 1 };
+        }
+
+        void init(std::string_view elem, const CVariantType &info, const uint8_t *p, size_t n) {
+                elem_ = elem;
+                array_.init(info, p, n);
+        }
+
+        template<typename, typename>
+        friend class dict_view;
+};
+
+/**
+ * dict_view - view over a dictionary
+ *
+ * This consumes an array of dictionary entries from @cv, or views one
+ * referenced by a variant_ref, decoding keys as K and values as V. Elements
+ * are std::pair<K, V>, so they can be used with structured bindings.
+ */
+template<typename K, typename V>
+class dict_view {
+public:
+        using value_type = std::pair<K, V>;
+        using iterator = detail::iterator<dict_view>;
+
+        explicit dict_view(CVariant *cv) {
+                std::string_view elem;
+                const uint8_t *p;
+                size_t n;
+
+                if (!cv) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                elem = array_view<variant_ref>::peek(cv);
+                if (!init_types(elem)) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                error_ = detail::consume(cv, &elem, &p, &n);
+                if (error_ >= 0)
+                        array_.init(entry_, p, n);
+        }
+
+        explicit dict_view(const variant_ref &ref) {
+                std::string_view type = ref.type();
+
+                if (type.size() < 2 || type[0] != C_VARIANT_ARRAY || !init_types(type.substr(1))) {
+                        error_ = -EBADRQC;
+                        return;
+                }
+
+                array_.init(entry_, (const uint8_t *)ref.data(), ref.size());
+        }
+
+        int error() const { return error_; }
+        size_t size() const { return array_.count; }
+        bool empty() const { return !array_.count; }
+
+        value_type operator[](size_t i) const {
+                detail::range r = array_.at(i);
+                size_t key_end, value_start, value_end, w;
+                unsigned int wordsize;
+
+                if (key_.size) {
+                        key_end = key_.size;
+                        value_end = r.n;
+                } else {
+                        /* dynamic keys end at the only framing offset */
+                        wordsize = c_variant_word_size(r.n, 0);
+                        w = size_t(1) << wordsize;
+                        if (r.n < w)
+                                return {};
+                        key_end = detail::fetch_word(r.p + r.n - w, wordsize);
+                        value_end = r.n - w;
+                }
+
+                value_start = ALIGN_TO(key_end, size_t(1) << value_.alignment);
+                if (value_.size)
+                        value_end = value_start + value_.size;
+                if (key_end > value_start || value_start > value_end || value_end > r.n)
+                        return {};
+
+                return {
+                        element<K>::get(key_type_, r.p, key_end),
+                        element<V>::get(value_type_, r.p + value_start, value_end - value_start),
+                };
+        }
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end() const { return iterator(this, array_.count); }
+
+private:
+        detail::array array_;
+        CVariantType entry_;
+        CVariantType key_;
+        CVariantType value_;
+        std::string_view key_type_;
+        std::string_view value_type_;
+        int error_ = 0;
+
+        bool init_types(std::string_view elem) {
+                if (elem.size() < 4 || elem[0] != C_VARIANT_PAIR_OPEN || detail::parse(elem, &entry_) < 0)
+                        return false;
+                if (c_variant_signature_next(elem.data() + 1, elem.size() - 2, &key_) != 1)
+                        return false;
+
+                key_type_ = elem.substr(1, key_.n_type);
+                value_type_ = elem.substr(1 + key_.n_type, elem.size() - 2 - key_.n_type);
+                if (detail::parse(value_type_, &value_) < 0)
+                        return false;
+
+                return element<K>::matches(key_type_) && element<V>::matches(value_type_);
+        }
+};
+
+} /* namespace cv */
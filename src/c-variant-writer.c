@@ -18,12 +18,14 @@
 #include <assert.h>
 #include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <unistd.h>
 #include "c-variant.h"
 #include "c-variant-private.h"
 
@@ -37,35 +39,13 @@
  *
  * Words are used exclusively to store framing-offsets. Any real data is always
  * properly aligned and sized.
+ *
+ * While building a container, framing offsets are stashed as native 64-bit
+ * values on the tail. Once the container is completed, they are narrowed into
+ * words in one batch, via the narrow_frames kernel of the selected CPU
+ * implementation (see c-variant-cpu.c).
  */
 
-static void c_variant_word_store(void *addr, size_t wordsize, size_t value) {
-        /* write one word of wordsize '1 << wordsize' to @addr */
-        switch (wordsize) {
-        case 3: {
-                uint64_t v = htole64((uint64_t)value);
-                memcpy(addr, &v, 8);
-                return;
-        }
-        case 2: {
-                uint32_t v = htole32((uint32_t)value);
-                memcpy(addr, &v, 4);
-                return;
-        }
-        case 1: {
-                uint16_t v = htole16((uint16_t)value);
-                memcpy(addr, &v, 2);
-                return;
-        }
-        case 0:
-                *(uint8_t *)addr = (uint8_t)value;
-                return;
-        default:
-                assert(0);
-                return;
-        }
-}
-
 /*
  * Vectors
  * =======
@@ -175,7 +155,20 @@ static int c_variant_reserve(CVariant *cv,
         /* both are mapped, hence cannot overflow size_t (with alignment) */
         assert(front_allocation + tail_allocation + 16 > front_allocation);
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
+
+        /*
+         * Everything before the front is final. If checksumming is enabled,
+         * fold it into the checksum while it is still hot, but batch small
+         * writes, unless the front moved to another vector.
+         */
+        if (_unlikely_(cv->sum) &&
+            (cv->sum->v_sum != level->v_front || level->i_front - cv->sum->i_sum >= C_VARIANT_SUM_BATCH)) {
+                r = c_variant_sum_fold(cv, false);
+                if (r < 0)
+                        return r;
+        }
+
         n_front = front_allocation + ALIGN_TO(level->offset, 1 << front_alignment) - level->offset;
         n_tail = tail_allocation + ALIGN_TO(level->i_tail, 1 << tail_alignment) - level->i_tail;
         vec_front = cv->vecs + level->v_front;
@@ -249,13 +242,9 @@ static int c_variant_reserve(CVariant *cv,
                 if (n < n_front + n_tail + 16)
                         n = n_front + n_tail + 16;
 
-                p = malloc(n);
-                if (!p) {
-                        n = n_front + n_tail + 16;
-                        p = malloc(n);
-                        if (!p)
-                                return c_variant_poison(cv, -ENOMEM);
-                }
+                p = c_variant_buffer_alloc(cv, &n, n_front + n_tail + 16);
+                if (!p)
+                        return c_variant_poison(cv, -ENOMEM);
 
                 /* count how often we allocated; protect against overflow */
                 if (++cv->a_vecs < 1)
@@ -264,7 +253,7 @@ static int c_variant_reserve(CVariant *cv,
                 if (n_front) {
                         ++vec_front;
                         if (((char *)(cv->vecs + cv->n_vecs))[vec_front - cv->vecs])
-                                free(vec_front->iov_base);
+                                c_variant_buffer_free(cv, vec_front->iov_base);
 
                         vec_front->iov_base = p;
                         vec_front->iov_len = n;
@@ -274,7 +263,7 @@ static int c_variant_reserve(CVariant *cv,
                 if (n_tail) {
                         --vec_tail;
                         if (((char *)(cv->vecs + cv->n_vecs))[vec_tail - cv->vecs])
-                                free(vec_tail->iov_base);
+                                c_variant_buffer_free(cv, vec_tail->iov_base);
 
                         vec_tail->iov_base = p;
                         vec_tail->iov_len = n;
@@ -354,7 +343,7 @@ static int c_variant_append(CVariant *cv,
                             void **frontp,
                             size_t n_unaccounted_tail,
                             void **tailp) {
-        CVariantLevel *level = cv->state->levels + cv->state->i_levels;
+        CVariantLevel *level = &cv->level;
         bool need_frame = false;
         void *tail;
         int r;
@@ -441,7 +430,7 @@ static int c_variant_begin_one(CVariant *cv, char container, const char *variant
         else
                 n_tail = 0;
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
         if (_unlikely_(level->n_type < 1))
                 return c_variant_poison(cv, -EBADRQC);
 
@@ -452,16 +441,17 @@ static int c_variant_begin_one(CVariant *cv, char container, const char *variant
         if (r < 0)
                 return r;
 
+        /*
+         * The new level is initialized in place of its parent, which is saved
+         * on the state stack. Both fronts and tails start at the position of
+         * the parent, so they are simply retained.
+         */
         c_variant_push_level(cv);
-        next = cv->state->levels + cv->state->i_levels;
+        next = &cv->level;
 
         next->size = info.size;
-        next->i_tail = level->i_tail;
-        next->v_tail = level->v_tail;
         /* wordsize is unused */
         next->enclosing = container;
-        next->v_front = level->v_front;
-        next->i_front = level->i_front;
         next->index = 0;
         next->offset = 0;
 
@@ -492,17 +482,18 @@ static int c_variant_begin_one(CVariant *cv, char container, const char *variant
 }
 
 static int c_variant_end_one(CVariant *cv) {
-        CVariantLevel *prev, *level;
-        size_t i, n, wz, rem;
+        CVariantLevel child, *prev, *level;
+        size_t i, k, n, wz, rem;
         void *front, *tail;
         struct iovec *v;
         uint64_t frame;
-        int r, step;
+        bool reverse;
+        int r;
 
         if (_unlikely_(c_variant_on_root_level(cv)))
                 return c_variant_poison(cv, -EBADRQC);
 
-        prev = cv->state->levels + cv->state->i_levels;
+        prev = &cv->level;
         wz = c_variant_word_size(prev->offset, prev->index);
 
         switch (prev->enclosing) {
@@ -548,8 +539,11 @@ static int c_variant_end_one(CVariant *cv) {
                 memset(front, 0, n);
         }
 
+        /* restore the parent level, but keep the child for finalization */
+        child = *prev;
+        prev = &child;
         c_variant_pop_level(cv);
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
 
         switch (prev->enclosing) {
         case C_VARIANT_VARIANT:
@@ -563,19 +557,19 @@ static int c_variant_end_one(CVariant *cv) {
         case C_VARIANT_ARRAY:
         case C_VARIANT_TUPLE_OPEN:
         case C_VARIANT_PAIR_OPEN:
-                /* backwards-iteration for arrays, to revert frame oder */
-                if (prev->enclosing == C_VARIANT_ARRAY) {
-                        i = prev->index - 1;
-                        step = -1;
-                } else {
-                        i = 0;
-                        step = 1;
-                }
+                /*
+                 * Frames are stacked on the tail, hence the last frame is
+                 * stored first. Each tail vector contains a consecutive run of
+                 * frames, which we narrow in one batch. Tuples need the order
+                 * reverted, arrays store their frames in reverse order anyway.
+                 */
+                reverse = (prev->enclosing != C_VARIANT_ARRAY);
+                i = reverse ? 0 : prev->index;
 
                 v = cv->vecs + cv->n_vecs - prev->v_tail - 1;
                 rem = prev->i_tail;
 
-                for (n = prev->index; n-- > 0; i += step) {
+                for (n = prev->index; n > 0; n -= k) {
                         while (_unlikely_(rem < 8)) {
                                 assert(rem == 0);
                                 ++v;
@@ -583,9 +577,20 @@ static int c_variant_end_one(CVariant *cv) {
                                 assert(!(rem & 7));
                         }
 
-                        rem -= 8;
-                        c_variant_word_store((char *)front + i * (1 << wz), wz,
-                                             *(uint64_t *)((char *)v->iov_base + rem));
+                        k = (rem / 8 < n) ? rem / 8 : n;
+                        rem -= 8 * k;
+
+                        if (!reverse)
+                                i -= k;
+
+                        c_variant_cpu->narrow_frames((char *)front + i * (1 << wz),
+                                                     (uint64_t *)((char *)v->iov_base + rem),
+                                                     k,
+                                                     wz,
+                                                     reverse);
+
+                        if (reverse)
+                                i += k;
                 }
 
                 break;
@@ -640,7 +645,7 @@ static int c_variant_end_one(CVariant *cv) {
 }
 
 static int c_variant_end_try(CVariant *cv, char container) {
-        if (container != cv->state->levels[cv->state->i_levels].enclosing)
+        if (container != cv->level.enclosing)
                 return c_variant_poison(cv, -EBADRQC);
 
         return c_variant_end_one(cv);
@@ -654,7 +659,7 @@ static int c_variant_write_one(CVariant *cv, char basic, const void *arg, size_t
 
         assert(n_arg > 0);
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
         if (_unlikely_(level->n_type < 1))
                 return c_variant_poison(cv, -EBADRQC);
 
@@ -669,6 +674,96 @@ static int c_variant_write_one(CVariant *cv, char basic, const void *arg, size_t
         return 0;
 }
 
+int c_variant_write_raw(CVariant *cv, char element, const void *data, size_t n_data) {
+        CVariantLevel *level;
+        CVariantType info;
+        void *front;
+        int r;
+
+        /*
+         * Append the next element, which must be of type @element, with
+         * @data as its serialization. Unlike c_variant_insert(), the data is
+         * copied, so the caller does not have to keep it around. The data
+         * must be serialized properly, no verification is done, except for
+         * the size of fixed-size types.
+         */
+
+        level = &cv->level;
+        if (_unlikely_(level->n_type < 1))
+                return c_variant_poison(cv, -EBADRQC);
+
+        r = c_variant_signature_next(level->type, level->n_type, &info);
+        assert(r == 1);
+
+        if (_unlikely_(info.size > 0 && n_data != info.size))
+                return c_variant_poison(cv, -EBADMSG);
+
+        r = c_variant_append(cv, element, &info, 0, n_data, &front, 0, NULL);
+        if (r < 0)
+                return r;
+
+        if (n_data > 0)
+                memcpy(front, data, n_data);
+        return 0;
+}
+
+static int c_variant_dict_append(CVariant *cv,
+                                 const char *key,
+                                 const char *type,
+                                 size_t n_type,
+                                 const struct iovec *vecs,
+                                 size_t n_vecs) {
+        size_t i, n_key, n_value, offset, wz;
+        CVariantLevel *level;
+        CVariantType info;
+        char *front;
+        int r;
+
+        /*
+         * Append a dict entry of type '{sv}' with the key @key, and a value of
+         * type @type, serialized in @vecs. The entry is serialized in a single
+         * reservation: the key, the variant aligned to 8 bytes (the alignment
+         * of the entry itself), consisting of the value, a zero byte and
+         * @type, and finally the framing offset of the key.
+         */
+
+        level = &cv->level;
+        if (_unlikely_(level->n_type < 4 || strncmp(level->type, "{sv}", 4)))
+                return c_variant_poison(cv, -EBADRQC);
+
+        n_key = strlen(key) + 1;
+        for (i = 0, n_value = 0; i < n_vecs; ++i)
+                n_value += vecs[i].iov_len;
+
+        offset = ALIGN_TO(n_key, 8) + n_value + 1 + n_type;
+        wz = c_variant_word_size(offset, 1);
+
+        r = c_variant_signature_next(level->type, level->n_type, &info);
+        assert(r == 1);
+
+        r = c_variant_append(cv, C_VARIANT_PAIR_OPEN, &info, 0, offset + (1 << wz), (void **)&front, 0, NULL);
+        if (r < 0)
+                return r;
+
+        memcpy(front, key, n_key);
+        memset(front + n_key, 0, ALIGN_TO(n_key, 8) - n_key);
+        front += ALIGN_TO(n_key, 8);
+
+        for (i = 0; i < n_vecs; ++i) {
+                memcpy(front, vecs[i].iov_base, vecs[i].iov_len);
+                front += vecs[i].iov_len;
+        }
+
+        *front++ = 0;
+        memcpy(front, type, n_type);
+        front += n_type;
+
+        for (i = 0; i < (1U << wz); ++i)
+                front[i] = n_key >> (8 * i);
+
+        return 0;
+}
+
 static int c_variant_insert_one(CVariant *cv, const char *type, const struct iovec *vecs, size_t n_vecs, size_t size) {
         CVariantLevel *level;
         CVariantType info;
@@ -677,7 +772,7 @@ static int c_variant_insert_one(CVariant *cv, const char *type, const struct iov
         uint64_t frame;
         int r;
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
         if (_unlikely_(level->n_type < 1))
                 return c_variant_poison(cv, -EBADRQC);
 
@@ -701,22 +796,26 @@ static int c_variant_insert_one(CVariant *cv, const char *type, const struct iov
         /*
          * Clip the current front and prepare the next vector with the
          * remaining buffer space. Then insert the requested vectors in between
-         * both and verify alignment restrictions.
+         * both and verify alignment restrictions. Any unused buffers in the
+         * overwritten vectors are released first, including the one taking
+         * the remaining space, as it must not claim ownership of it.
          */
-        v = cv->vecs + level->v_front;
-        v[n_vecs + 1].iov_base = (char *)v->iov_base + level->i_front;
-        v[n_vecs + 1].iov_len = v->iov_len - level->i_front;
-        v->iov_len = level->i_front;
-
-        for (i = 0; i < n_vecs; ++i) {
+        for (i = 0; i <= n_vecs; ++i) {
                 idx = level->v_front + i + 1;
                 if (((char *)(cv->vecs + cv->n_vecs))[idx]) {
                         ((char *)(cv->vecs + cv->n_vecs))[idx] = false;
-                        free((cv->vecs + idx)->iov_base);
+                        c_variant_buffer_free(cv, (cv->vecs + idx)->iov_base);
                 }
-                cv->vecs[idx] = vecs[i];
         }
 
+        v = cv->vecs + level->v_front;
+        v[n_vecs + 1].iov_base = (char *)v->iov_base + level->i_front;
+        v[n_vecs + 1].iov_len = v->iov_len - level->i_front;
+        v->iov_len = level->i_front;
+
+        for (i = 0; i < n_vecs; ++i)
+                cv->vecs[level->v_front + i + 1] = vecs[i];
+
         level->v_front += n_vecs + 1;
         level->i_front = 0;
         level->offset += size;
@@ -763,6 +862,26 @@ static int c_variant_insert_one(CVariant *cv, const char *type, const struct iov
  * Return: 0 on success, negative error code on failure.
  */
 _public_ int c_variant_new(CVariant **cvp, const char *type, size_t n_type) {
+        return c_variant_new_with_pool(cvp, type, n_type, NULL);
+}
+
+/**
+ * c_variant_new_with_pool() - create new variant backed by a buffer pool
+ * @cvp:        output variable for new variant
+ * @type:       type string
+ * @n_type:     length of @type
+ * @pool:       buffer pool to allocate from, or NULL
+ *
+ * This is the same as c_variant_new(), but all buffer space needed during
+ * serialization is allocated from @pool, if possible. If @pool is exhausted,
+ * the variant silently falls back to heap memory. If @pool is NULL, this is
+ * equivalent to c_variant_new().
+ *
+ * The caller must make sure @pool outlives the variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_new_with_pool(CVariant **cvp, const char *type, size_t n_type, CVariantPool *pool) {
         CVariantLevel *level;
         CVariantType info;
         CVariant *cv;
@@ -780,20 +899,32 @@ _public_ int c_variant_new(CVariant **cvp, const char *type, size_t n_type) {
         /* allocate 2k as initial buffer, except if fixed size */
         size = info.size ?: ALIGN_TO(2048, 8);
 
-        r = c_variant_alloc(&cv, &p_type, &extra, n_type, info.n_levels + 8, 4, size);
+        /* with a pool, the initial buffer is taken from it, if possible */
+        r = c_variant_alloc(&cv, &p_type, &extra, n_type, info.n_levels + 8, 4, pool ? 0 : size);
         if (r < 0)
                 return r;
 
         memcpy(p_type, type, n_type);
         memset(cv->vecs, 0, cv->n_vecs * sizeof(*cv->vecs));
 
+        if (pool) {
+                cv->pool = pool;
+                extra = c_variant_buffer_alloc(cv, &size, size);
+                if (!extra) {
+                        c_variant_dealloc(cv);
+                        return -ENOMEM;
+                }
+
+                ((char *)(cv->vecs + cv->n_vecs))[0] = true;
+        }
+
         /* split memory between front and tail */
         cv->vecs[0].iov_base = extra;
         cv->vecs[0].iov_len = ALIGN_TO(size * C_VARIANT_FRONT_SHARE / 100, 8);
         cv->vecs[cv->n_vecs - 1].iov_base = (char *)extra + cv->vecs[0].iov_len;
         cv->vecs[cv->n_vecs - 1].iov_len = size - cv->vecs[0].iov_len;
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
         level->size = info.size;
         level->i_tail = 0;
         level->v_tail = 0;
@@ -863,7 +994,7 @@ _public_ int c_variant_beginv(CVariant *cv, const char *containers, va_list args
                         }
                 }
         } else {
-                level = cv->state->levels + cv->state->i_levels;
+                level = &cv->level;
                 if (level->n_type < 1)
                         return c_variant_poison(cv, -EBADRQC);
 
@@ -1126,6 +1257,213 @@ _public_ int c_variant_insert(CVariant *cv, const char *type, const struct iovec
         return c_variant_insert_one(cv, type, vecs, n_vecs, size);
 }
 
+/**
+ * c_variant_insert_file() - insert file range
+ * @cv:         variant to operate on, or NULL
+ * @type:       type string
+ * @fd:         file to reference
+ * @offset:     start of the range in @fd
+ * @size:       size of the range in bytes
+ *
+ * This works like c_variant_insert(), but rather than memory, it references
+ * @size bytes of @fd, starting at @offset, as the serialized data of @type.
+ * The range is kept as a separate segment and is never read by the writer.
+ * Once sealed, c_variant_transmit() passes it to the kernel via sendfile(2),
+ * without ever copying it to user space. Only if the variant is accessed
+ * locally (via the reader, or c_variant_get_vecs()), the segment is mapped
+ * into memory on demand.
+ *
+ * @fd is duplicated, so the caller is free to close it. The file range must
+ * not be truncated or modified for the entire lifetime of the variant.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_insert_file(CVariant *cv, const char *type, int fd, uint64_t offset, size_t size) {
+        CVariantFile *file;
+        int r;
+
+        if (_unlikely_(!cv))
+                return c_variant_insert(NULL, type, &(struct iovec){ .iov_len = size }, 1);
+
+        if (_unlikely_(size < 1))
+                return c_variant_insert_one(cv, type, NULL, 0, 0);
+
+        if (_unlikely_(offset + size < offset || offset + size > INT64_MAX))
+                return c_variant_poison(cv, -EFBIG);
+
+        file = calloc(1, sizeof(*file));
+        if (!file)
+                return c_variant_poison(cv, -ENOMEM);
+
+        file->offset = offset;
+        file->fd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        if (file->fd < 0) {
+                r = -errno;
+                free(file);
+                return c_variant_poison_internal(cv, r);
+        }
+
+        r = c_variant_insert_one(cv, type, &(struct iovec){ .iov_len = size }, 1, size);
+        if (r < 0) {
+                close(file->fd);
+                free(file);
+                return r;
+        }
+
+        /* the segment is right before the new front vector */
+        file->idx = cv->level.v_front - 1;
+        file->next = cv->files;
+        cv->files = file;
+        return 0;
+}
+
+/**
+ * c_variant_dict_add_u32() - add dict entry with 'u' value
+ * @cv:         variant to operate on, or NULL
+ * @key:        key of the entry
+ * @value:      value of the entry
+ *
+ * This appends an entry to the 'a{sv}' dictionary the writer is currently
+ * in, with key @key and a value of type 'u'. It is equivalent to writing the
+ * entry via c_variant_begin(), c_variant_write(), and c_variant_end(), but
+ * serializes the whole entry at once.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_dict_add_u32(CVariant *cv, const char *key, uint32_t value) {
+        if (_unlikely_(!cv))
+                return -EBADRQC;
+
+        assert(!cv->sealed);
+
+        return c_variant_dict_append(cv, key, "u", 1,
+                                     &(struct iovec){ &value, sizeof(value) }, 1);
+}
+
+/**
+ * c_variant_dict_add_str() - add dict entry with 's' value
+ * @cv:         variant to operate on, or NULL
+ * @key:        key of the entry
+ * @value:      value of the entry
+ *
+ * This is like c_variant_dict_add_u32(), but adds a value of type 's'.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_dict_add_str(CVariant *cv, const char *key, const char *value) {
+        if (_unlikely_(!cv))
+                return -EBADRQC;
+
+        assert(!cv->sealed);
+
+        return c_variant_dict_append(cv, key, "s", 1,
+                                     &(struct iovec){ (void *)value, strlen(value) + 1 }, 1);
+}
+
+/**
+ * c_variant_dict_add_variant() - add dict entry with value of any type
+ * @cv:         variant to operate on, or NULL
+ * @key:        key of the entry
+ * @value:      sealed variant to use as value, or NULL
+ *
+ * This is like c_variant_dict_add_u32(), but copies the serialized variant
+ * @value as value of the entry, with the type of @value. NULL is added as
+ * value of type '()'. @value is rewound by this call.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_dict_add_variant(CVariant *cv, const char *key, CVariant *value) {
+        const struct iovec *vecs;
+        const char *type;
+        size_t n_vecs, n_type;
+
+        if (_unlikely_(!cv))
+                return -EBADRQC;
+
+        assert(!cv->sealed);
+
+        if (!value)
+                return c_variant_dict_append(cv, key, "()", 2, &(struct iovec){ (void *)"", 1 }, 1);
+
+        assert(value->sealed);
+
+        vecs = c_variant_get_vecs(value, &n_vecs);
+        if (_unlikely_(!vecs))
+                return c_variant_poison(cv, -ENOMEM);
+
+        c_variant_rewind(value);
+        type = c_variant_peek_type(value, &n_type);
+        return c_variant_dict_append(cv, key, type, n_type, vecs, n_vecs);
+}
+
+/**
+ * c_variant_dict_add_array() - add dict entries from parallel arrays
+ * @cv:         variant to operate on, or NULL
+ * @type:       type of all values, must be a basic type
+ * @keys:       array of keys
+ * @values:     array of values
+ * @n:          number of entries to add
+ *
+ * This adds @n entries to the 'a{sv}' dictionary the writer is currently in,
+ * like c_variant_dict_add_u32() does for each entry. The key of each entry is
+ * taken from @keys, its value from @values, at the same index. All values are
+ * of type @type, and @values is an array of their native C types, as passed
+ * to c_variant_write(). That is, for strings, object paths, and signatures,
+ * it is an array of 'const char *'. Booleans are passed as one byte each, and
+ * any non-zero byte is written as true.
+ *
+ * It is an programming error to call this on a sealed variant.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+_public_ int c_variant_dict_add_array(CVariant *cv,
+                                      const char *type,
+                                      const char *const *keys,
+                                      const void *values,
+                                      size_t n) {
+        const char *const *strings = values;
+        struct iovec vec;
+        CVariantType info;
+        uint8_t b;
+        size_t i;
+        int r;
+
+        if (_unlikely_(!cv))
+                return n ? -EBADRQC : 0;
+
+        assert(!cv->sealed);
+
+        r = c_variant_signature_one(type, strlen(type), &info);
+        if (r < 0 || info.n_type != 1 || strchr("vam({", *type))
+                return c_variant_poison(cv, -EMEDIUMTYPE);
+
+        for (i = 0; i < n; ++i) {
+                if (*type == C_VARIANT_BOOL) {
+                        /* normalize, booleans are serialized as 0 or 1 */
+                        b = !!((const uint8_t *)values)[i];
+                        vec = (struct iovec){ &b, sizeof(b) };
+                } else if (info.size) {
+                        vec = (struct iovec){ (char *)values + i * info.size, info.size };
+                } else {
+                        vec = (struct iovec){ (void *)strings[i], strlen(strings[i]) + 1 };
+                }
+
+                r = c_variant_dict_append(cv, keys[i], type, 1, &vec, 1);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 /**
  * c_variant_seal() - seal a container
  * @cv:         variant to operate on, or NULL
@@ -1156,7 +1494,13 @@ _public_ int c_variant_seal(CVariant *cv) {
                         return r;
         }
 
-        level = cv->state->levels + cv->state->i_levels;
+        level = &cv->level;
+
+        if (cv->sum) {
+                r = c_variant_sum_fold(cv, true);
+                if (r < 0)
+                        return r;
+        }
 
         /* clip trailing vector */
         cv->vecs[level->v_front].iov_len = level->i_front;
@@ -1164,14 +1508,14 @@ _public_ int c_variant_seal(CVariant *cv) {
         /* release all unused vectors */
         for (i = level->v_front + 1; i < cv->n_vecs; ++i)
                 if (((char *)(cv->vecs + cv->n_vecs))[i])
-                        free((void *)((unsigned long)cv->vecs[i].iov_base & ~7));
+                        c_variant_buffer_free(cv, cv->vecs[i].iov_base);
 
         /* move trailing state array up-front and shrink iovec array */
         memmove(&cv->vecs[level->v_front + 1], &cv->vecs[cv->n_vecs], level->v_front + 1);
         cv->n_vecs = level->v_front + 1;
 
         cv->sealed = true;
-        c_variant_level_root(level,
+        c_variant_level_root(cv,
                              level->offset,
                              level->type + level->n_type - cv->n_type,
                              cv->n_type);
@@ -56,7 +56,7 @@ static_assert(C_VARIANT_MAX + 1 == 1 << (sizeof(char) * 8),
 static_assert(sizeof(CVariantElement) == 1,
               "Invalid bitfield grouping");
 
-static const CVariantElement c_variant_elements[C_VARIANT_N] = {
+const CVariantElement c_variant_elements[C_VARIANT_N] = {
         /* invalid */
         [C_VARIANT_INVALID]     = { },
 
@@ -192,6 +192,11 @@ static const CVariantElement *c_variant_element(char element) {
         return &c_variant_elements[(uint8_t)element];
 }
 
+static bool c_variant_element_is_leaf(char element) {
+        /* basic types and variants are complete types on their own */
+        return c_variant_element(element)->basic || element == C_VARIANT_VARIANT;
+}
+
 /*
  * Signatures
  * ==========
@@ -244,6 +249,7 @@ static_assert(_C_VARIANT_SIGNATURE_STATE_N <= (1 << 2),
 int c_variant_signature_next(const char *signature, size_t n_signature, CVariantType *infop) {
         size_t i, t, max_level, size, level, known_level;
         CVariantSignatureState state, saved, *stack = NULL;
+        const CVariantElement *leaf;
         bool fixed_size, end_of_pair;
 
         /*
@@ -261,6 +267,22 @@ int c_variant_signature_next(const char *signature, size_t n_signature, CVariant
         if (_unlikely_(n_signature > C_VARIANT_MAX_SIGNATURE))
                 return -EMSGSIZE;
 
+        /*
+         * A leading basic type (or variant) is a complete type on its own.
+         * This is by far the most common case, so return it right away,
+         * without setting up the parser.
+         */
+        if (_likely_(n_signature > 0 && c_variant_element_is_leaf(*signature))) {
+                leaf = c_variant_element(*signature);
+                infop->alignment = leaf->alignment;
+                infop->size = leaf->fixed ? 1 << leaf->alignment : 0;
+                infop->bound_size = 0;
+                infop->n_levels = 0;
+                infop->n_type = 1;
+                infop->type = signature;
+                return 1;
+        }
+
         /*
          * Parsing a signature requires recursing into each nesting level. As
          * we want to avoid true recursion (no tail recursion is possible), we
@@ -518,9 +540,103 @@ int c_variant_signature_next(const char *signature, size_t n_signature, CVariant
         return 0;
 }
 
+static bool c_variant_signature_flat(const char *signature, size_t n_signature, CVariantType *infop) {
+        const CVariantElement *element;
+        size_t i, size, alignment;
+        bool fixed_size;
+
+        /*
+         * Tuples of basic types (and variants) are common enough to warrant a
+         * direct path, which needs no backtracking. If @signature is not such
+         * a tuple, false is returned and the caller must use the parser.
+         */
+
+        if (n_signature < 2 ||
+            signature[0] != C_VARIANT_TUPLE_OPEN ||
+            signature[n_signature - 1] != C_VARIANT_TUPLE_CLOSE)
+                return false;
+
+        size = 0;
+        alignment = 0;
+        fixed_size = true;
+
+        for (i = 1; i + 1 < n_signature; ++i) {
+                if (!c_variant_element_is_leaf(signature[i]))
+                        return false;
+
+                element = c_variant_element(signature[i]);
+
+                if (!element->fixed)
+                        fixed_size = false;
+                if (element->alignment > alignment)
+                        alignment = element->alignment;
+                if (fixed_size)
+                        size = ALIGN_TO(size, 1 << element->alignment) + (1 << element->alignment);
+        }
+
+        /* special case: unit type has fixed length of 1 */
+        if (n_signature == 2)
+                size = 1;
+
+        infop->alignment = alignment;
+        infop->size = fixed_size ? ALIGN_TO(size, 1 << alignment) : 0;
+        infop->bound_size = 0;
+        infop->n_levels = 1;
+        infop->n_type = n_signature;
+        infop->type = signature;
+        return true;
+}
+
+/**
+ * c_variant_signature_one() - parse signature of a single type
+ * @signature:          signature to parse
+ * @n_signature:        length of @signature
+ * @infop:              output for type information
+ *
+ * This is like c_variant_signature_next(), but requires @signature to consist
+ * of exactly one type. As this is used to verify types received from remote
+ * peers, long signatures are scanned first, block by block, via the
+ * scan_signature kernel of the selected CPU implementation. Invalid elements,
+ * unbalanced brackets, and excessive nesting are thus rejected without
+ * running the parser.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
 int c_variant_signature_one(const char *signature, size_t n_signature, CVariantType *infop) {
+        CVariantSignatureScan scan = {};
+        size_t i, n;
         int r;
 
+        if (_unlikely_(n_signature > C_VARIANT_MAX_SIGNATURE))
+                return -EMSGSIZE;
+
+        if (n_signature > 1) {
+                if (c_variant_signature_flat(signature, n_signature, infop))
+                        return 0;
+
+                /* a leading basic type is complete, nothing may follow */
+                if (_unlikely_(c_variant_element_is_leaf(*signature)))
+                        return -EMEDIUMTYPE;
+        }
+
+        if (n_signature >= C_VARIANT_SIGNATURE_SCAN) {
+                for (i = 0; i < n_signature; i += n) {
+                        n = n_signature - i;
+                        if (n > C_VARIANT_SIGNATURE_SCAN_BLOCK)
+                                n = C_VARIANT_SIGNATURE_SCAN_BLOCK;
+
+                        c_variant_cpu->scan_signature(signature + i, n, &scan);
+
+                        if (_unlikely_(scan.invalid || scan.min_depth < 0))
+                                return -EMEDIUMTYPE;
+                        if (_unlikely_(scan.max_depth > C_VARIANT_MAX_LEVEL))
+                                return -ELOOP;
+                }
+
+                if (_unlikely_(scan.depth != 0))
+                        return -EMEDIUMTYPE;
+        }
+
         r = c_variant_signature_next(signature, n_signature, infop);
         if (_unlikely_(r < 0))
                 return r;
@@ -545,7 +661,7 @@ static int c_variant_state_new(CVariantState **statep,
 
         static_assert(__alignof(CVariantState) <= 8, "Invalid CVariantState alignment");
 
-        /* state->levels[state->i_levels] better always works! */
+        /* always allocate at least one level, to simplify the state handling */
         n_hint_levels = (n_hint_levels < 1) ? 1 :
                         (n_hint_levels > C_VARIANT_MAX_INLINE_LEVELS) ?
                                         C_VARIANT_MAX_INLINE_LEVELS :
@@ -638,6 +754,12 @@ int c_variant_alloc(CVariant **cvp,
         cv->a_vecs = 0;
         cv->sealed = false;
         cv->allocated_vecs = false;
+        cv->linear = false;
+        cv->pool = NULL;
+        cv->files = NULL;
+        cv->sum = NULL;
+        cv->release_fn = NULL;
+        cv->release_userdata = NULL;
 
         /* mark all vecs as non-allocated */
         memset(cv->vecs + cv->n_vecs, 0, cv->n_vecs);
@@ -665,22 +787,80 @@ void c_variant_dealloc(CVariant *cv) {
                 cv->state = state;
         }
 
-        /*
-         * Free data, but align first as we might have screwed with the base
-         * pointers during allocation to fulfill alignment needs.
-         */
+        /* free data; c_variant_buffer_free() takes care of alignment */
         for (i = 0; i < cv->n_vecs; ++i)
                 if (((char *)(cv->vecs + cv->n_vecs))[i])
-                        free((void *)((unsigned long)cv->vecs[i].iov_base & ~7));
+                        c_variant_buffer_free(cv, cv->vecs[i].iov_base);
+
+        /* unmap and close file segments */
+        if (cv->files)
+                c_variant_file_free_all(cv);
+
+        free(cv->sum);
 
         /* free vector-array, if it was reallocated */
         if (cv->allocated_vecs)
                 free(cv->vecs);
 
+        /* drop whatever keeps foreign data alive */
+        if (cv->release_fn)
+                cv->release_fn(cv->release_userdata);
+
         /* @cv is embedded in the root-state @cv->state */
         free(cv->state);
 }
 
+void *c_variant_buffer_alloc(CVariant *cv, size_t *np, size_t min) {
+        size_t n;
+        void *p;
+
+        /*
+         * Allocate a new data buffer of *@np bytes for @cv. If that fails, a
+         * buffer of @min bytes is tried instead. If @cv has a buffer pool
+         * assigned, pool memory is preferred over heap memory, regardless of
+         * the size. Pools might round up the allocation, hence, the actual
+         * size of the buffer is returned in @np.
+         */
+
+        assert(min <= *np);
+
+        if (cv->pool) {
+                n = *np;
+                p = c_variant_pool_alloc(cv->pool, &n);
+                if (!p) {
+                        n = min;
+                        p = c_variant_pool_alloc(cv->pool, &n);
+                }
+                if (p) {
+                        *np = n;
+                        return p;
+                }
+        }
+
+        p = malloc(*np);
+        if (!p) {
+                *np = min;
+                p = malloc(*np);
+        }
+
+        return p;
+}
+
+void c_variant_buffer_free(CVariant *cv, void *p) {
+        /*
+         * Release a buffer allocated via c_variant_buffer_alloc(). We might
+         * have screwed with the base pointers during allocation to fulfill
+         * alignment needs, hence, @p is aligned to its allocation first.
+         */
+
+        p = (void *)((unsigned long)p & ~7);
+
+        if (c_variant_pool_owns(cv->pool, p))
+                c_variant_pool_release(cv->pool, p);
+        else
+                free(p);
+}
+
 int c_variant_poison_internal(CVariant *cv, int poison) {
         /*
          * Poison @cv with negative error-code @poison. If @cv was already
@@ -702,7 +882,7 @@ bool c_variant_on_root_level(CVariant *cv) {
 int c_variant_ensure_level(CVariant *cv) {
         int r;
 
-        if (_likely_(cv->state->i_levels + 1 < cv->state->n_levels || cv->unused))
+        if (_likely_(cv->state->i_levels < cv->state->n_levels || cv->unused))
                 return 0;
 
         /* allocate new state with fixed 16 levels */
@@ -717,15 +897,15 @@ void c_variant_push_level(CVariant *cv) {
         CVariantState *state;
 
         /*
-         * Enter a new level on top of the current one. The state of the new
-         * level is undefined and needs to be initialized by the caller. The
-         * caller must guarantee that there is at least one more level
-         * allocated. Use c_variant_ensure_level() to pre-allocate levels.
+         * Enter a new level on top of the current one. This saves the
+         * current level on the state stack, but leaves @cv->level untouched.
+         * The caller is expected to initialize the new level in place, which
+         * allows deriving it from its parent. The caller must guarantee that
+         * there is at least one more level allocated. Use
+         * c_variant_ensure_level() to pre-allocate levels.
          */
 
-        if (_likely_(cv->state->i_levels + 1 < cv->state->n_levels)) {
-                ++cv->state->i_levels;
-        } else {
+        if (_unlikely_(cv->state->i_levels >= cv->state->n_levels)) {
                 assert(cv->unused);
 
                 state = cv->unused;
@@ -736,6 +916,9 @@ void c_variant_push_level(CVariant *cv) {
                 /* reset state */
                 state->i_levels = 0;
         }
+
+        state = cv->state;
+        state->levels[state->i_levels++] = cv->level;
 }
 
 void c_variant_pop_level(CVariant *cv) {
@@ -743,12 +926,10 @@ void c_variant_pop_level(CVariant *cv) {
 
         /*
          * Exit the current level by discarding all its cached state and
-         * returning to the parent level.
+         * restoring the parent level from the state stack.
          */
 
-        if (_likely_(cv->state->i_levels > 0)) {
-                --cv->state->i_levels;
-        } else {
+        if (_unlikely_(cv->state->i_levels < 1)) {
                 assert(cv->state->link);
 
                 state = cv->state->link;
@@ -756,6 +937,9 @@ void c_variant_pop_level(CVariant *cv) {
                 cv->unused = cv->state;
                 cv->state = state;
         }
+
+        state = cv->state;
+        cv->level = state->levels[--state->i_levels];
 }
 
 /*
@@ -846,7 +1030,7 @@ void c_variant_varg_push(CVariantVarg *varg, const char *type, size_t n_type, si
 
 void c_variant_varg_enter_bound(CVariantVarg *varg, CVariant *cv, size_t n_array) {
         CVariantVargLevel *vlevel = &varg->levels[varg->i_levels];
-        CVariantLevel *level = cv->state->levels + cv->state->i_levels;
+        CVariantLevel *level = &cv->level;
 
         /* callers better know the type before accessing it */
         assert(vlevel->n_type >= level->n_type);
@@ -861,7 +1045,7 @@ void c_variant_varg_enter_bound(CVariantVarg *varg, CVariant *cv, size_t n_array
 
 void c_variant_varg_enter_unbound(CVariantVarg *varg, CVariant *cv, char closing) {
         CVariantVargLevel *vlevel = &varg->levels[varg->i_levels];
-        CVariantLevel *level = cv->state->levels + cv->state->i_levels;
+        CVariantLevel *level = &cv->level;
 
         /* callers better know the type before accessing it */
         assert(vlevel->n_type >= level->n_type + 1U);
@@ -962,6 +1146,11 @@ _public_ int c_variant_return_poison(CVariant *cv) {
  * This returns a pointer to the backing iovec array of the variant, and its
  * size via @n_vecsp.
  *
+ * Segments inserted via c_variant_insert_file() are mapped into memory first,
+ * if not already done. If that fails, the variant is poisoned, and NULL is
+ * returned with an array size of 0. Use c_variant_transmit() to send such
+ * variants without mapping them.
+ *
  * It is an programming error to call this on an unsealed variant.
  *
  * Return: Pointer to iovec array.
@@ -976,6 +1165,11 @@ _public_ const struct iovec *c_variant_get_vecs(CVariant *cv, size_t *n_vecsp) {
 
         assert(cv->sealed);
 
+        if (_unlikely_(cv->files) && c_variant_file_map_all(cv) < 0) {
+                *n_vecsp = 0;
+                return NULL;
+        }
+
         *n_vecsp = cv->n_vecs;
         return cv->vecs;
 }
@@ -29,6 +29,16 @@ extern "C" {
 #endif
 
 typedef struct CVariant CVariant;
+typedef struct CVariantArena CVariantArena;
+typedef struct CVariantArray CVariantArray;
+typedef struct CVariantField CVariantField;
+typedef struct CVariantPool CVariantPool;
+typedef struct CVariantShm CVariantShm;
+typedef struct CVariantStruct CVariantStruct;
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+struct msghdr;
 
 /**
  * Error Codes
@@ -40,16 +50,25 @@ typedef struct CVariant CVariant;
  * However, such validation is not always assumed necessary, hence, it is
  * perfectly valid to rely on the error codes.
  *
- * EBADMSG: Caller-provided GVariant serialization is invalid.
+ * E2BIG: Batch has more messages than its result can count.
+ * EAGAIN: Shared memory ring is empty (reading) or full (writing).
+ * EBADMSG: Caller-provided GVariant serialization, or shared memory ring
+ *          layout, is invalid.
  * EBADRQC: Specified type does not match type of variant.
- * EFBIG: Scatter-gather array larger than the address space.
+ * EFBIG: Scatter-gather array or file range larger than supported.
+ * EINVAL: Struct descriptor does not fit the C layout it describes, or an
+ *         arena is required but was not provided.
  * ELOOP: Nesting level of the GVariant type is higher than supported.
  * EMEDIUMTYPE: Invalid GVariant type/container specified.
  * EMSGSIZE: Message is larger than supported by this architecture. Very
  *           unlikely to happen, as you'd need type strings of large lengths.
- * ENOBUFS: Too many iovecs.
+ * ENOBUFS: Too many iovecs, or not enough space for io_uring submissions.
+ * ENODATA: io_uring completion does not carry a provided buffer, or no
+ *          checksum was enabled.
  * ENOMEM: Cannot allocate required backing memory.
  * ENOTUNIQ: Attempt to modify the NULL GVariant.
+ * EOPNOTSUPP: io_uring operation not supported by the build environment.
+ * ETIMEDOUT: Timeout expired while waiting on a shared memory ring.
  */
 
 /**
@@ -117,6 +136,49 @@ typedef struct CVariant CVariant;
  */
 #define C_VARIANT_MAX_VARG (16)
 
+/**
+ * CVariantField - struct descriptor field
+ * @type:       GVariant type of the field
+ * @offset:     offset of the field in its C struct, via offsetof()
+ * @size:       C size of the struct, for structs, or of one element, for
+ *              arrays; ignored for basic types
+ * @fields:     description of the container content, or NULL
+ * @n_fields:   number of entries in @fields
+ *
+ * A struct descriptor is an array of fields, one for each member of a tuple
+ * or dict entry, in order. It describes how the members map to a C struct,
+ * and is compiled once via c_variant_struct_new(). Members are stored in C as:
+ *
+ *   - fixed-size basic types as their native C types (bool, uint8_t,
+ *     int16_t, uint16_t, int32_t, uint32_t, int64_t, uint64_t, and double;
+ *     handles as int32_t)
+ *   - strings, object paths, and signatures as 'const char *'
+ *   - tuples and dict entries as nested C structs, described by @fields
+ *   - arrays as CVariantArray, with elements of @size bytes each; for
+ *     elements that are tuples or dict entries, @fields describes their
+ *     members; for elements that are arrays, @fields has a single entry
+ *     describing the element array at offset 0
+ *
+ * Maybes and variants are not supported.
+ */
+struct CVariantField {
+        const char *type;
+        size_t offset;
+        size_t size;
+        const CVariantField *fields;
+        size_t n_fields;
+};
+
+/**
+ * CVariantArray - decoded array
+ * @elements:   array of elements, or NULL if empty
+ * @n_elements: number of elements in @elements
+ */
+struct CVariantArray {
+        void *elements;
+        size_t n_elements;
+};
+
 /* management */
 
 int c_variant_new(CVariant **out, const char *type, size_t n_type);
@@ -127,10 +189,100 @@ bool c_variant_is_sealed(CVariant *cv);
 int c_variant_return_poison(CVariant *cv);
 const struct iovec *c_variant_get_vecs(CVariant *cv, size_t *n_vecsp);
 
+/* buffer pools */
+
+int c_variant_pool_new(CVariantPool **out, size_t size, uint16_t index);
+CVariantPool *c_variant_pool_free(CVariantPool *pool);
+const struct iovec *c_variant_pool_get_vec(CVariantPool *pool);
+
+int c_variant_new_with_pool(CVariant **out, const char *type, size_t n_type, CVariantPool *pool);
+
+/* io_uring */
+
+int c_variant_uring_prep_writev(CVariant *cv, struct io_uring_sqe *sqes, size_t n_sqes, int fd, uint64_t offset);
+int c_variant_uring_prep_sendmsg(CVariant *cv, struct io_uring_sqe *sqes, struct msghdr *msgs, size_t n_sqes, int fd, int flags);
+int c_variant_uring_prep_write_fixed(CVariant *cv, struct io_uring_sqe *sqes, size_t n_sqes, int fd, uint64_t offset);
+int c_variant_uring_prep_send_zc(CVariant *cv, struct io_uring_sqe *sqes, size_t n_sqes, int fd, int flags);
+int c_variant_new_from_uring(CVariant **out,
+                             const char *type,
+                             size_t n_type,
+                             const struct io_uring_cqe *cqe,
+                             void *buffers,
+                             size_t buffer_size,
+                             uint16_t *bidp);
+
+/* shared memory rings */
+
+#define C_VARIANT_SHM_MPSC (1U << 0)
+
+int c_variant_shm_new(CVariantShm **out, int fd, size_t size, unsigned int flags);
+CVariantShm *c_variant_shm_free(CVariantShm *shm);
+
+int c_variant_shm_write(CVariantShm *shm, CVariant *cv);
+void c_variant_shm_flush(CVariantShm *shm);
+int c_variant_shm_wait_writable(CVariantShm *shm, size_t size, int64_t timeout_nsec);
+
+int c_variant_shm_read(CVariantShm *shm, CVariant **out, const char *type, size_t n_type);
+void c_variant_shm_release(CVariantShm *shm);
+int c_variant_shm_wait_readable(CVariantShm *shm, int64_t timeout_nsec);
+
+/* checksums */
+
+#define C_VARIANT_CHECKSUM_CRC32C (1U)
+#define C_VARIANT_CHECKSUM_XXH64 (2U)
+
+int c_variant_set_checksum(CVariant *cv, unsigned int kind);
+int c_variant_get_checksum(CVariant *cv, uint64_t *sump);
+int c_variant_verify_checksum(unsigned int kind, const struct iovec *vecs, size_t n_vecs, uint64_t sum);
+
+/* file transmission */
+
+int c_variant_transmit(CVariant *cv, int fd, size_t *offsetp);
+
+/* struct descriptors */
+
+int c_variant_arena_new(CVariantArena **out, size_t size);
+CVariantArena *c_variant_arena_free(CVariantArena *arena);
+void c_variant_arena_reset(CVariantArena *arena);
+
+int c_variant_struct_new(CVariantStruct **out,
+                         const char *type,
+                         size_t n_type,
+                         const CVariantField *fields,
+                         size_t n_fields,
+                         size_t size);
+CVariantStruct *c_variant_struct_free(CVariantStruct *desc);
+
+int c_variant_decode_struct(CVariant *cv, const CVariantStruct *desc, void *out, CVariantArena *arena);
+int c_variant_decode_batch(const CVariantStruct *desc,
+                           const struct iovec *msgs,
+                           size_t n_msgs,
+                           void *out,
+                           CVariantArena *arena,
+                           int *statuses);
+int c_variant_encode_struct(CVariant *cv, const CVariantStruct *desc, const void *in);
+
+/* deltas */
+
+int c_variant_diff(CVariant *from, CVariant *to, CVariant **deltap);
+int c_variant_patch(CVariant *from, CVariant *delta, CVariant **top);
+
+/* adapters */
+
+int c_variant_new_adapted(CVariant **cvp, const char *type, size_t n_type, CVariant *from);
+
+/* flattening */
+
+#define C_VARIANT_FLATTEN_ELEMENT (1U << 0)
+
+int c_variant_flatten(CVariant *cv, unsigned int flags, void *dst, size_t n_dst, size_t *sizep);
+int c_variant_dup(CVariant *cv, unsigned int flags, CVariant **copyp);
+
 /* readers */
 
 size_t c_variant_peek_count(CVariant *cv);
 const char *c_variant_peek_type(CVariant *cv, size_t *sizep);
+int c_variant_peek_fixed(CVariant *cv, const char *type, const void **datap, void *buffer);
 
 int c_variant_enter(CVariant *cv, const char *containers);
 int c_variant_exit(CVariant *cv, const char *containers);
@@ -143,6 +295,15 @@ int c_variant_beginv(CVariant *cv, const char *containers, va_list args);
 int c_variant_end(CVariant *cv, const char *containers);
 int c_variant_writev(CVariant *cv, const char *signature, va_list args);
 int c_variant_insert(CVariant *cv, const char *type, const struct iovec *vecs, size_t n_vecs);
+int c_variant_insert_file(CVariant *cv, const char *type, int fd, uint64_t offset, size_t size);
+int c_variant_dict_add_u32(CVariant *cv, const char *key, uint32_t value);
+int c_variant_dict_add_str(CVariant *cv, const char *key, const char *value);
+int c_variant_dict_add_variant(CVariant *cv, const char *key, CVariant *value);
+int c_variant_dict_add_array(CVariant *cv,
+                             const char *type,
+                             const char *const *keys,
+                             const void *values,
+                             size_t n);
 int c_variant_seal(CVariant *cv);
 
 /* inline shortcuts */
@@ -17,6 +17,8 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,8 +26,15 @@
 #include <gmp.h>
 #include "generator.h"
 
+typedef struct GeneratorNumber GeneratorNumber;
 typedef struct GeneratorState GeneratorState;
 
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 GeneratorWord;
+#else
+typedef uint64_t GeneratorWord;
+#endif
+
 enum {
         GENERATOR_BASIC_b,
         GENERATOR_BASIC_y,
@@ -51,21 +60,185 @@ enum {
         _GENERATOR_COMPOUND_N,
 };
 
+struct GeneratorNumber {
+        bool big;
+        GeneratorWord word;
+        mpz_t mpz;
+};
+
 struct GeneratorState {
         GeneratorState *parent;
         unsigned int rule;
-        mpz_t seed;
+        GeneratorNumber seed;
 };
 
 struct Generator {
         GeneratorState *tip;
         GeneratorState *unused;
-        mpz_t seed;
+        GeneratorNumber seed;
         mpz_t root;
         mpz_t root_squared;
         mpz_t index;
 };
 
+/*
+ * Numbers
+ * =======
+ *
+ * Seeds are arbitrary precision integers. However, most seeds fit into a
+ * native integer, and every step of the generator makes them smaller. Hence,
+ * numbers are kept in a native word (128 bits, if supported by the compiler)
+ * and only promoted to GnuMP once an operation overflows. Operations that
+ * shrink numbers demote them again, once they fit.
+ */
+
+static void generator_number_init(GeneratorNumber *n) {
+        n->big = false;
+        n->word = 0;
+        mpz_init(n->mpz);
+}
+
+static void generator_number_deinit(GeneratorNumber *n) {
+        mpz_clear(n->mpz);
+}
+
+static void generator_number_promote(GeneratorNumber *n) {
+        if (!n->big) {
+                mpz_import(n->mpz, 1, -1, sizeof(n->word), 0, 0, &n->word);
+                n->big = true;
+        }
+}
+
+static void generator_number_demote(GeneratorNumber *n) {
+        if (n->big && mpz_sizeinbase(n->mpz, 2) <= sizeof(n->word) * 8) {
+                n->word = 0;
+                mpz_export(&n->word, NULL, -1, sizeof(n->word), 0, 0, n->mpz);
+                n->big = false;
+        }
+}
+
+static void generator_number_set(GeneratorNumber *n, GeneratorNumber *from) {
+        n->big = from->big;
+        if (n->big)
+                mpz_set(n->mpz, from->mpz);
+        else
+                n->word = from->word;
+}
+
+static void generator_number_set_ui(GeneratorNumber *n, unsigned long val) {
+        n->big = false;
+        n->word = val;
+}
+
+static void generator_number_get_mpz(GeneratorNumber *n, mpz_t to) {
+        if (n->big)
+                mpz_set(to, n->mpz);
+        else
+                mpz_import(to, 1, -1, sizeof(n->word), 0, 0, &n->word);
+}
+
+static int generator_number_cmp_ui(GeneratorNumber *n, unsigned long val) {
+        if (n->big)
+                return mpz_cmp_ui(n->mpz, val);
+
+        return (n->word > val) - (n->word < val);
+}
+
+static unsigned long generator_number_get_ui(GeneratorNumber *n) {
+        return n->big ? mpz_get_ui(n->mpz) : (unsigned long)n->word;
+}
+
+static void generator_number_sub_ui(GeneratorNumber *n, unsigned long val) {
+        if (n->big)
+                mpz_sub_ui(n->mpz, n->mpz, val);
+        else
+                n->word -= val;
+}
+
+static unsigned long generator_number_fdiv_q_ui(GeneratorNumber *n, unsigned long d) {
+        unsigned long r;
+
+        if (!n->big) {
+                r = n->word % d;
+                n->word /= d;
+                return r;
+        }
+
+        r = mpz_fdiv_q_ui(n->mpz, n->mpz, d);
+        generator_number_demote(n);
+        return r;
+}
+
+static void generator_number_mul_add_ui(GeneratorNumber *n, unsigned long m, unsigned long a) {
+        GeneratorWord v;
+
+        /* n = n * m + a */
+
+        if (!n->big &&
+            !__builtin_mul_overflow(n->word, m, &v) &&
+            !__builtin_add_overflow(v, a, &v)) {
+                n->word = v;
+                return;
+        }
+
+        generator_number_promote(n);
+        mpz_mul_ui(n->mpz, n->mpz, m);
+        mpz_add_ui(n->mpz, n->mpz, a);
+}
+
+static void generator_number_add(GeneratorNumber *n, GeneratorNumber *a, GeneratorNumber *b) {
+        GeneratorWord v;
+
+        /* CAREFUL: n/a/b may *overlap*! */
+
+        if (!a->big && !b->big && !__builtin_add_overflow(a->word, b->word, &v)) {
+                n->big = false;
+                n->word = v;
+                return;
+        }
+
+        generator_number_promote(a);
+        generator_number_promote(b);
+        generator_number_promote(n);
+        mpz_add(n->mpz, a->mpz, b->mpz);
+}
+
+static uint64_t generator_u64_sqrt(uint64_t v) {
+        uint64_t x, y;
+
+        if (v < 2)
+                return v;
+
+        /* Newton's method, starting with a power of two above the root */
+        x = UINT64_C(1) << ((64 - __builtin_clzll(v) + 1) / 2);
+        for (;;) {
+                y = (x + v / x) / 2;
+                if (y >= x)
+                        return x;
+                x = y;
+        }
+}
+
+static GeneratorWord generator_word_sqrt(GeneratorWord v) {
+#ifdef __SIZEOF_INT128__
+        GeneratorWord x, y;
+        unsigned int bits;
+
+        if (v >> 64) {
+                bits = 128 - __builtin_clzll((uint64_t)(v >> 64));
+                x = (GeneratorWord)1 << ((bits + 1) / 2);
+                for (;;) {
+                        y = (x + v / x) / 2;
+                        if (y >= x)
+                                return x;
+                        x = y;
+                }
+        }
+#endif
+
+        return generator_u64_sqrt(v);
+}
+
 /*
  * (Inverse) Pair
  * ==============
@@ -75,7 +248,8 @@ struct Generator {
  * calculate. The Cantor-pairing-function would have worked as well, though.
  */
 
-static void generator_pi(Generator *gen, mpz_t seed, mpz_t pi1, mpz_t pi2) {
+static void generator_pi(Generator *gen, GeneratorNumber *seed, GeneratorNumber *pi1, GeneratorNumber *pi2) {
+        GeneratorWord v;
         int res;
 
         /*
@@ -86,18 +260,42 @@ static void generator_pi(Generator *gen, mpz_t seed, mpz_t pi1, mpz_t pi2) {
 
         /* CAREFUL: pi1/pi2/seed may *overlap*! */
 
-        res = mpz_cmp(pi1, pi2);
+        if (!pi1->big && !pi2->big) {
+                if (pi1->word < pi2->word) {
+                        if (!__builtin_mul_overflow(pi2->word, pi2->word, &v) &&
+                            !__builtin_add_overflow(v, pi1->word, &v)) {
+                                seed->big = false;
+                                seed->word = v;
+                                return;
+                        }
+                } else {
+                        if (!__builtin_mul_overflow(pi1->word, pi1->word, &v) &&
+                            !__builtin_add_overflow(v, pi1->word, &v) &&
+                            !__builtin_add_overflow(v, pi2->word, &v)) {
+                                seed->big = false;
+                                seed->word = v;
+                                return;
+                        }
+                }
+        }
+
+        generator_number_promote(pi1);
+        generator_number_promote(pi2);
+        generator_number_promote(seed);
+
+        res = mpz_cmp(pi1->mpz, pi2->mpz);
         if (res < 0) {
-                mpz_pow_ui(gen->index, pi2, 2);
-                mpz_add(seed, gen->index, pi1);
+                mpz_pow_ui(gen->index, pi2->mpz, 2);
+                mpz_add(seed->mpz, gen->index, pi1->mpz);
         } else {
-                mpz_pow_ui(gen->index, pi1, 2);
-                mpz_add(gen->index, gen->index, pi1);
-                mpz_add(seed, gen->index, pi2);
+                mpz_pow_ui(gen->index, pi1->mpz, 2);
+                mpz_add(gen->index, gen->index, pi1->mpz);
+                mpz_add(seed->mpz, gen->index, pi2->mpz);
         }
 }
 
-static void generator_inverse_pi(Generator *gen, mpz_t pi1, mpz_t pi2, mpz_t seed) {
+static void generator_inverse_pi(Generator *gen, GeneratorNumber *pi1, GeneratorNumber *pi2, GeneratorNumber *seed) {
+        GeneratorWord root, index;
         int res;
 
         /*
@@ -108,19 +306,41 @@ static void generator_inverse_pi(Generator *gen, mpz_t pi1, mpz_t pi2, mpz_t see
 
         /* CAREFUL: pi1/pi2/seed may *overlap*! */
 
-        mpz_sqrt(gen->root, seed);
+        if (!seed->big) {
+                root = generator_word_sqrt(seed->word);
+                index = seed->word - root * root;
+
+                pi1->big = false;
+                pi2->big = false;
+                if (index < root) {
+                        pi1->word = index;
+                        pi2->word = root;
+                } else {
+                        pi2->word = index - root;
+                        pi1->word = root;
+                }
+                return;
+        }
+
+        mpz_sqrt(gen->root, seed->mpz);
         mpz_pow_ui(gen->root_squared, gen->root, 2);
-        mpz_sub(gen->index, seed, gen->root_squared);
+        mpz_sub(gen->index, seed->mpz, gen->root_squared);
+
+        pi1->big = true;
+        pi2->big = true;
 
         res = mpz_cmp(gen->index, gen->root);
         if (res < 0) {
-                mpz_sub(pi1, seed, gen->root_squared);
-                mpz_set(pi2, gen->root);
+                mpz_sub(pi1->mpz, seed->mpz, gen->root_squared);
+                mpz_set(pi2->mpz, gen->root);
         } else {
-                mpz_sub(gen->index, seed, gen->root_squared);
-                mpz_sub(pi2, gen->index, gen->root);
-                mpz_set(pi1, gen->root);
+                mpz_sub(gen->index, seed->mpz, gen->root_squared);
+                mpz_sub(pi2->mpz, gen->index, gen->root);
+                mpz_set(pi1->mpz, gen->root);
         }
+
+        generator_number_demote(pi1);
+        generator_number_demote(pi2);
 }
 
 /*
@@ -131,7 +351,7 @@ static void generator_inverse_pi(Generator *gen, mpz_t pi1, mpz_t pi2, mpz_t see
  * automata (PDA). It is very simple: We have a push-down stack of
  * GeneratorState objects. The top object is accessible via gen->tip. You can
  * push and pop states, according to your needs. We cache old states for later
- * reuse, which avoids reallocation of GnuMP objects.
+ * reuse, which avoids reallocation of states and their GnuMP objects.
  */
 
 static GeneratorState *generator_state_new(void) {
@@ -140,7 +360,7 @@ static GeneratorState *generator_state_new(void) {
         state = calloc(1, sizeof(*state));
         assert(state);
 
-        mpz_init(state->seed);
+        generator_number_init(&state->seed);
 
         return state;
 }
@@ -149,7 +369,7 @@ static GeneratorState *generator_state_free(GeneratorState *state) {
         if (!state)
                 return NULL;
 
-        mpz_clear(state->seed);
+        generator_number_deinit(&state->seed);
         free(state);
 
         return NULL;
@@ -280,12 +500,12 @@ static int generator_rule_TYPE(Generator *gen) {
          *          | '{' PAIR '}'
          */
 
-        res = mpz_cmp_ui(state->seed, _GENERATOR_BASIC_N + 2);
+        res = generator_number_cmp_ui(&state->seed, _GENERATOR_BASIC_N + 2);
         if (res < 0) {
                 /*
                  * TYPE ::= basic | 'v' | '(' ')'
                  */
-                val = mpz_get_ui(state->seed);
+                val = generator_number_get_ui(&state->seed);
                 switch (val) {
                 case _GENERATOR_BASIC_N + 0:
                         /*
@@ -310,8 +530,8 @@ static int generator_rule_TYPE(Generator *gen) {
                 /*
                  * TYPE ::= 'm' TYPE | 'a' TYPE | '(' TUPLE ')' | '{' PAIR '}'
                  */
-                mpz_sub_ui(state->seed, state->seed, _GENERATOR_BASIC_N + 2);
-                val = mpz_fdiv_q_ui(state->seed, state->seed, _GENERATOR_COMPOUND_N);
+                generator_number_sub_ui(&state->seed, _GENERATOR_BASIC_N + 2);
+                val = generator_number_fdiv_q_ui(&state->seed, _GENERATOR_COMPOUND_N);
                 switch (val) {
                 case GENERATOR_COMPOUND_m:
                         /*
@@ -332,7 +552,7 @@ static int generator_rule_TYPE(Generator *gen) {
                         state->rule = GENERATOR_RULE_TUPLE_CLOSE;
                         next = generator_push(gen);
                         next->rule = GENERATOR_RULE_TUPLE;
-                        mpz_set(next->seed, state->seed);
+                        generator_number_set(&next->seed, &state->seed);
                         return '(';
                 case GENERATOR_COMPOUND_e:
                         /*
@@ -341,7 +561,7 @@ static int generator_rule_TYPE(Generator *gen) {
                         state->rule = GENERATOR_RULE_PAIR_CLOSE;
                         next = generator_push(gen);
                         next->rule = GENERATOR_RULE_PAIR;
-                        mpz_set(next->seed, state->seed);
+                        generator_number_set(&next->seed, &state->seed);
                         return '{';
                 default:
                         assert(0);
@@ -358,7 +578,7 @@ static char generator_rule_TUPLE(Generator *gen) {
          * TUPLE ::= TYPE | TYPE TUPLE
          */
 
-        val = mpz_fdiv_q_ui(state->seed, state->seed, 2);
+        val = generator_number_fdiv_q_ui(&state->seed, 2);
         switch (val) {
         case 0:
                 state->rule = GENERATOR_RULE_TYPE;
@@ -366,7 +586,7 @@ static char generator_rule_TUPLE(Generator *gen) {
         case 1:
                 next = generator_push(gen);
                 next->rule = GENERATOR_RULE_TYPE;
-                generator_inverse_pi(gen, state->seed, next->seed, state->seed);
+                generator_inverse_pi(gen, &state->seed, &next->seed, &state->seed);
                 return generator_rule_TYPE(gen);
         default:
                 assert(0);
@@ -387,7 +607,7 @@ static char generator_rule_PAIR(Generator *gen) {
          * PAIR ::= basic TYPE
          */
 
-        val = mpz_fdiv_q_ui(state->seed, state->seed, _GENERATOR_BASIC_N);
+        val = generator_number_fdiv_q_ui(&state->seed, _GENERATOR_BASIC_N);
         state->rule = GENERATOR_RULE_TYPE;
         return generator_map_basic(val);
 }
@@ -457,23 +677,21 @@ static unsigned long generator_unmap_basic(char c) {
 static void generator_fold_MAYBE(Generator *gen) {
         GeneratorState *next, *state = gen->tip;
 
-        mpz_mul_ui(state->seed, state->seed, _GENERATOR_COMPOUND_N);
-        mpz_add_ui(state->seed, state->seed, GENERATOR_COMPOUND_m);
-        mpz_add_ui(state->seed, state->seed, _GENERATOR_BASIC_N + 2);
+        generator_number_mul_add_ui(&state->seed, _GENERATOR_COMPOUND_N,
+                                    GENERATOR_COMPOUND_m + _GENERATOR_BASIC_N + 2);
 
         next = generator_pop(gen);
-        mpz_set(next->seed, state->seed);
+        generator_number_set(&next->seed, &state->seed);
 }
 
 static void generator_fold_ARRAY(Generator *gen) {
         GeneratorState *next, *state = gen->tip;
 
-        mpz_mul_ui(state->seed, state->seed, _GENERATOR_COMPOUND_N);
-        mpz_add_ui(state->seed, state->seed, GENERATOR_COMPOUND_a);
-        mpz_add_ui(state->seed, state->seed, _GENERATOR_BASIC_N + 2);
+        generator_number_mul_add_ui(&state->seed, _GENERATOR_COMPOUND_N,
+                                    GENERATOR_COMPOUND_a + _GENERATOR_BASIC_N + 2);
 
         next = generator_pop(gen);
-        mpz_set(next->seed, state->seed);
+        generator_number_set(&next->seed, &state->seed);
 }
 
 static int generator_fold(Generator *gen) {
@@ -490,7 +708,7 @@ static int generator_fold(Generator *gen) {
                         break;
                 case GENERATOR_PARSER_TUPLE_CLOSE:
                         next = generator_pop(gen);
-                        mpz_set(next->seed, state->seed);
+                        generator_number_set(&next->seed, &state->seed);
                         break;
                 case GENERATOR_PARSER_TUPLE:
                         next = generator_push(gen);
@@ -509,11 +727,11 @@ static int generator_parser_TYPE(Generator *gen, char c) {
         val = generator_unmap_basic(c);
         if (val < _GENERATOR_BASIC_N) {
                 next = generator_pop(gen);
-                mpz_set_ui(next->seed, val);
+                generator_number_set_ui(&next->seed, val);
                 return generator_fold(gen);
         } else if (c == 'v') {
                 next = generator_pop(gen);
-                mpz_set_ui(next->seed, _GENERATOR_BASIC_N);
+                generator_number_set_ui(&next->seed, _GENERATOR_BASIC_N);
                 return generator_fold(gen);
         } else {
                 switch (c) {
@@ -557,26 +775,25 @@ static int generator_parser_TUPLE(Generator *gen, char c) {
 
         if (state->rule != GENERATOR_PARSER_TUPLE) {
                 /* unit type "()" */
-                mpz_set_ui(state->seed, _GENERATOR_BASIC_N + 1);
+                generator_number_set_ui(&state->seed, _GENERATOR_BASIC_N + 1);
                 return generator_fold(gen);
         }
 
         /* fold decision to end TUPLE */
-        mpz_mul_ui(state->seed, state->seed, 2);
+        generator_number_mul_add_ui(&state->seed, 2, 0);
 
         /* fold each decision to continue TUPLE */
         for (next = generator_pop(gen);
              next->rule == GENERATOR_PARSER_TUPLE;
              next = generator_pop(gen)) {
-                generator_pi(gen, state->seed, state->seed, next->seed);
-                mpz_mul_ui(state->seed, state->seed, 2);
-                mpz_add_ui(state->seed, state->seed, 1);
+                generator_pi(gen, &state->seed, &state->seed, &next->seed);
+                generator_number_mul_add_ui(&state->seed, 2, 1);
         }
 
         /* fold decision to use TUPLE */
-        mpz_mul_ui(state->seed, state->seed, _GENERATOR_COMPOUND_N);
-        mpz_add_ui(state->seed, state->seed, GENERATOR_COMPOUND_r);
-        mpz_add_ui(next->seed, state->seed, _GENERATOR_BASIC_N + 2);
+        generator_number_mul_add_ui(&state->seed, _GENERATOR_COMPOUND_N,
+                                    GENERATOR_COMPOUND_r + _GENERATOR_BASIC_N + 2);
+        generator_number_set(&next->seed, &state->seed);
 
         return generator_fold(gen);
 }
@@ -592,7 +809,7 @@ static int generator_parser_PAIR(Generator *gen, char c) {
         }
 
         next = generator_pop(gen);
-        mpz_set_ui(next->seed, val);
+        generator_number_set_ui(&next->seed, val);
         next = generator_push(gen);
         next->rule = GENERATOR_PARSER_PAIR_CLOSE;
         next = generator_push(gen);
@@ -611,13 +828,12 @@ static int generator_parser_PAIR_CLOSE(Generator *gen, char c) {
         next = generator_pop(gen);
 
         /* fold KEY and VALUE */
-        mpz_mul_ui(state->seed, state->seed, _GENERATOR_BASIC_N);
-        mpz_add(next->seed, next->seed, state->seed);
+        generator_number_mul_add_ui(&state->seed, _GENERATOR_BASIC_N, 0);
+        generator_number_add(&next->seed, &next->seed, &state->seed);
 
         /* fold decision to use PAIR */
-        mpz_mul_ui(next->seed, next->seed, _GENERATOR_COMPOUND_N);
-        mpz_add_ui(next->seed, next->seed, GENERATOR_COMPOUND_e);
-        mpz_add_ui(next->seed, next->seed, _GENERATOR_BASIC_N + 2);
+        generator_number_mul_add_ui(&next->seed, _GENERATOR_COMPOUND_N,
+                                    GENERATOR_COMPOUND_e + _GENERATOR_BASIC_N + 2);
 
         return generator_fold(gen);
 }
@@ -643,7 +859,7 @@ Generator *generator_new(void) {
         gen = calloc(1, sizeof(*gen));
         assert(gen);
 
-        mpz_init(gen->seed);
+        generator_number_init(&gen->seed);
         mpz_init(gen->root);
         mpz_init(gen->root_squared);
         mpz_init(gen->index);
@@ -679,7 +895,7 @@ Generator *generator_free(Generator *gen) {
         mpz_clear(gen->index);
         mpz_clear(gen->root_squared);
         mpz_clear(gen->root);
-        mpz_clear(gen->seed);
+        generator_number_deinit(&gen->seed);
         free(gen);
 
         return NULL;
@@ -710,7 +926,7 @@ void generator_reset(Generator *gen) {
  * this limits the possible range to the range of an uint32_t.
  */
 void generator_seed_u32(Generator *gen, uint32_t seed) {
-        mpz_set_ui(gen->seed, seed);
+        generator_number_set_ui(&gen->seed, seed);
 }
 
 /**
@@ -734,12 +950,15 @@ void generator_seed_u32(Generator *gen, uint32_t seed) {
 int generator_seed_str(Generator *gen, const char *str, int base) {
         int r;
 
-        r = mpz_set_str(gen->seed, str, base);
+        r = mpz_set_str(gen->seed.mpz, str, base);
         if (r < 0) {
                 generator_seed_u32(gen, *str);
                 return -EINVAL;
         }
 
+        gen->seed.big = true;
+        generator_number_demote(&gen->seed);
+
         return 0;
 }
 
@@ -769,7 +988,7 @@ char generator_step(Generator *gen) {
                 state->rule = GENERATOR_RULE_DONE;
                 state = generator_push(gen);
                 state->rule = GENERATOR_RULE_TYPE;
-                mpz_set(state->seed, gen->seed);
+                generator_number_set(&state->seed, &gen->seed);
         }
 
         switch (state->rule) {
@@ -856,8 +1075,10 @@ int generator_feed(Generator *gen, char c) {
 void generator_print(Generator *gen, FILE *f, int base) {
         GeneratorState *state = gen->tip;
 
-        if (state && state->rule == GENERATOR_PARSER_DONE)
-                mpz_out_str(f, base, state->seed);
-        else
+        if (state && state->rule == GENERATOR_PARSER_DONE) {
+                generator_number_get_mpz(&state->seed, gen->index);
+                mpz_out_str(f, base, gen->index);
+        } else {
                 fprintf(f, "<invalid>");
+        }
 }
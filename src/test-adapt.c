@@ -0,0 +1,313 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Adapters
+ * This verifies that adapting a variant to a related type produces the exact
+ * serialization the writer produces for the expected type, with members
+ * missing in the old type set to their defaults.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static CVariant *test_new(const char *type) {
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new(&cv, type, strlen(type));
+        assert(!r);
+        return cv;
+}
+
+static void test_seal(CVariant *cv) {
+        int r;
+
+        r = c_variant_seal(cv);
+        assert(!r);
+}
+
+static size_t test_flatten(CVariant *cv, char **datap) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        char *data;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0, size = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size ?: 1);
+        assert(data);
+
+        for (i = 0, size = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        *datap = data;
+        return size;
+}
+
+static void test_expect(CVariant *from, CVariant *expected) {
+        char *data, *reference;
+        size_t size, n_reference;
+        const char *type;
+        CVariant *cv;
+        size_t n_type;
+        int r;
+
+        /* adapting @from must result in @expected, byte by byte */
+        c_variant_rewind(expected);
+        type = c_variant_peek_type(expected, &n_type);
+
+        r = c_variant_new_adapted(&cv, type, n_type, from);
+        assert(!r);
+
+        size = test_flatten(cv, &data);
+        n_reference = test_flatten(expected, &reference);
+        assert(size == n_reference);
+        assert(!memcmp(data, reference, size));
+
+        free(reference);
+        free(data);
+        c_variant_free(cv);
+        c_variant_free(expected);
+        c_variant_free(from);
+}
+
+static void test_adapt_tuple(void) {
+        CVariant *from, *expected, *cv;
+        const char *s;
+        uint64_t t;
+        uint32_t u;
+        int r;
+
+        /* members are appended */
+        from = test_new("(us)");
+        c_variant_write(from, "(us)", 7, "foo");
+        test_seal(from);
+
+        expected = test_new("(ustas)");
+        c_variant_begin(expected, "(");
+        c_variant_write(expected, "ust", 7, "foo", (uint64_t)0);
+        c_variant_begin(expected, "a");
+        c_variant_end(expected, "a)");
+        test_seal(expected);
+
+        test_expect(from, expected);
+
+        /* members are removed */
+        from = test_new("(ustas)");
+        c_variant_begin(from, "(");
+        c_variant_write(from, "ust", 7, "foo", (uint64_t)9);
+        c_variant_begin(from, "a");
+        c_variant_write(from, "ss", "a", "b");
+        c_variant_end(from, "a)");
+        test_seal(from);
+
+        expected = test_new("(us)");
+        c_variant_write(expected, "(us)", 7, "foo");
+        test_seal(expected);
+
+        test_expect(from, expected);
+
+        /* readers can use the expected type directly */
+        from = test_new("(su)");
+        c_variant_write(from, "(su)", "foo", 7);
+        test_seal(from);
+
+        r = c_variant_new_adapted(&cv, "(sut)", 5, from);
+        assert(!r);
+        r = c_variant_read(cv, "(sut)", &s, &u, &t);
+        assert(!r);
+        assert(!strcmp(s, "foo") && u == 7 && t == 0);
+        c_variant_free(cv);
+        c_variant_free(from);
+}
+
+static void test_adapt_nested(void) {
+        CVariant *from, *expected;
+        char key[512];
+        unsigned int i;
+
+        /* arrays of tuples are adapted element by element */
+        from = test_new("a(us)");
+        c_variant_begin(from, "a");
+        for (i = 0; i < 300; ++i)
+                c_variant_write(from, "(us)", i, (i % 3) ? "foo" : "foobar");
+        c_variant_end(from, "a");
+        test_seal(from);
+
+        expected = test_new("a(usx)");
+        c_variant_begin(expected, "a");
+        for (i = 0; i < 300; ++i)
+                c_variant_write(expected, "(usx)", i, (i % 3) ? "foo" : "foobar", (int64_t)0);
+        c_variant_end(expected, "a");
+        test_seal(expected);
+
+        test_expect(from, expected);
+
+        /* maybes, both nothing and just */
+        from = test_new("m(us)");
+        c_variant_begin(from, "m", "(us)");
+        c_variant_write(from, "(us)", 7, "foo");
+        c_variant_end(from, "m");
+        test_seal(from);
+
+        expected = test_new("m(u)");
+        c_variant_begin(expected, "m", "(u)");
+        c_variant_write(expected, "(u)", 7);
+        c_variant_end(expected, "m");
+        test_seal(expected);
+
+        test_expect(from, expected);
+
+        from = test_new("m(us)");
+        c_variant_begin(from, "m", "");
+        c_variant_end(from, "m");
+        test_seal(from);
+
+        expected = test_new("m(u)");
+        c_variant_begin(expected, "m", "");
+        c_variant_end(expected, "m");
+        test_seal(expected);
+
+        test_expect(from, expected);
+
+        /* large members need wider framing offsets */
+        memset(key, 'k', sizeof(key) - 1);
+        key[sizeof(key) - 1] = 0;
+
+        from = test_new("(s(su)u)");
+        c_variant_write(from, "(s(su)u)", key, key, 1, 2);
+        test_seal(from);
+
+        expected = test_new("(s(sus)ua{sv})");
+        c_variant_begin(expected, "(");
+        c_variant_write(expected, "s(sus)u", key, key, 1, "", 2);
+        c_variant_begin(expected, "a");
+        c_variant_end(expected, "a)");
+        test_seal(expected);
+
+        test_expect(from, expected);
+}
+
+static void test_adapt_defaults(void) {
+        CVariant *from, *expected;
+
+        from = test_new("(u)");
+        c_variant_write(from, "(u)", 7);
+        test_seal(from);
+
+        expected = test_new("(uosgvaym(s)(ts)()(sa{sv}))");
+        c_variant_begin(expected, "(");
+        c_variant_write(expected, "uosg", 7, "/", "", "");
+        c_variant_begin(expected, "v(", "()");
+        c_variant_end(expected, ")v");
+        c_variant_begin(expected, "a");
+        c_variant_end(expected, "a");
+        c_variant_begin(expected, "m", "");
+        c_variant_end(expected, "m");
+        c_variant_write(expected, "(ts)", (uint64_t)0, "");
+        c_variant_begin(expected, "(");
+        c_variant_end(expected, ")");
+        c_variant_begin(expected, "(");
+        c_variant_write(expected, "s", "");
+        c_variant_begin(expected, "a");
+        c_variant_end(expected, "a))");
+        test_seal(expected);
+
+        test_expect(from, expected);
+}
+
+static void test_adapt_same(void) {
+        const struct iovec *vecs, *from_vecs;
+        size_t n_vecs, n_from_vecs;
+        CVariant *from, *cv;
+        char buffer[256];
+        int r;
+
+        /* identical types reference the old variant in place */
+        memset(buffer, 'x', sizeof(buffer) - 1);
+        buffer[sizeof(buffer) - 1] = 0;
+
+        from = test_new("(su)");
+        c_variant_write(from, "(su)", buffer, 7);
+        test_seal(from);
+
+        r = c_variant_new_adapted(&cv, "(su)", 4, from);
+        assert(!r);
+
+        from_vecs = c_variant_get_vecs(from, &n_from_vecs);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        assert(n_vecs == 1);
+        assert(vecs[0].iov_base == from_vecs[0].iov_base);
+
+        c_variant_free(cv);
+        c_variant_free(from);
+}
+
+static void test_adapt_errors(void) {
+        CVariant *from, *cv;
+        int r;
+
+        from = test_new("(sas)");
+        c_variant_begin(from, "(");
+        c_variant_write(from, "s", "foo");
+        c_variant_begin(from, "a");
+        c_variant_end(from, "a)");
+        test_seal(from);
+
+        /* types must be related */
+        r = c_variant_new_adapted(&cv, "(u)", 3, from);
+        assert(r == -EBADRQC);
+        r = c_variant_new_adapted(&cv, "(sau)", 5, from);
+        assert(r == -EBADRQC);
+        r = c_variant_new_adapted(&cv, "s", 1, from);
+        assert(r == -EBADRQC);
+
+        /* ...and valid */
+        r = c_variant_new_adapted(&cv, "(s", 2, from);
+        assert(r < 0);
+
+        /* failed mappings are not cached */
+        r = c_variant_new_adapted(&cv, "(u)", 3, from);
+        assert(r == -EBADRQC);
+
+        c_variant_free(from);
+}
+
+int main(int argc, char **argv) {
+        unsigned int i;
+
+        /* run twice, to use cached mappings on the second run */
+        for (i = 0; i < 2; ++i) {
+                test_adapt_tuple();
+                test_adapt_nested();
+                test_adapt_defaults();
+                test_adapt_same();
+                test_adapt_errors();
+        }
+
+        return 0;
+}
@@ -0,0 +1,199 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Checksums
+ * This verifies both algorithms against known values, and verifies that
+ * checksums computed while writing match the checksums of the final
+ * serialization.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static const unsigned int test_kinds[] = {
+        C_VARIANT_CHECKSUM_CRC32C,
+        C_VARIANT_CHECKSUM_XXH64,
+};
+
+static unsigned char test_data[1000];
+
+static void test_checksum_known(void) {
+        struct iovec vecs[8];
+        size_t i, j, n;
+        int r;
+
+        for (i = 0; i < sizeof(test_data); ++i)
+                test_data[i] = i * 7 + i / 256;
+
+        r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_CRC32C,
+                                      &(struct iovec){ (void *)"123456789", 9 }, 1,
+                                      UINT64_C(0xe3069283));
+        assert(!r);
+        r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_CRC32C,
+                                      &(struct iovec){ test_data, sizeof(test_data) }, 1,
+                                      UINT64_C(0x22c9a2b3));
+        assert(!r);
+        r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_XXH64, NULL, 0,
+                                      UINT64_C(0xef46db3751d8e999));
+        assert(!r);
+        r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_XXH64,
+                                      &(struct iovec){ (void *)"abc", 3 }, 1,
+                                      UINT64_C(0x44bc2cf5ad770999));
+        assert(!r);
+        r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_XXH64,
+                                      &(struct iovec){ test_data, sizeof(test_data) }, 1,
+                                      UINT64_C(0x698399d62f9c1695));
+        assert(!r);
+
+        /* mismatches are reported */
+        r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_XXH64,
+                                      &(struct iovec){ (void *)"abd", 3 }, 1,
+                                      UINT64_C(0x44bc2cf5ad770999));
+        assert(r == -EBADMSG);
+
+        /* results do not depend on how the data is split */
+        for (n = 1; n < 8; ++n) {
+                for (i = 0, j = 0; i < n; ++i) {
+                        vecs[i].iov_base = test_data + j;
+                        vecs[i].iov_len = (i + 1 < n) ? (i * 37 + 5) % 61 : sizeof(test_data) - j;
+                        j += vecs[i].iov_len;
+                }
+
+                r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_CRC32C, vecs, n, UINT64_C(0x22c9a2b3));
+                assert(!r);
+                r = c_variant_verify_checksum(C_VARIANT_CHECKSUM_XXH64, vecs, n, UINT64_C(0x698399d62f9c1695));
+                assert(!r);
+        }
+}
+
+static CVariant *test_message_new(unsigned int kind, size_t n_entries, int fd, bool late) {
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, "(sa(tsv)aytay)", 14);
+        assert(r >= 0);
+
+        if (kind && !late) {
+                r = c_variant_set_checksum(cv, kind);
+                assert(r >= 0);
+        }
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "s", "envelope");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n_entries; ++i) {
+                c_variant_begin(cv, "(");
+                c_variant_write(cv, "ts", (uint64_t)i, "some string of some length");
+                c_variant_begin(cv, "v", (i & 1) ? "u" : "s");
+                if (i & 1)
+                        c_variant_write(cv, "u", (uint32_t)i);
+                else
+                        c_variant_write(cv, "s", "variant");
+                c_variant_end(cv, "v");
+                c_variant_end(cv, ")");
+        }
+        c_variant_end(cv, "a");
+
+        /* enabling it halfway through folds everything written so far */
+        if (kind && late) {
+                r = c_variant_set_checksum(cv, kind);
+                assert(r >= 0);
+        }
+
+        r = c_variant_insert(cv, "ay", &(struct iovec){ test_data, n_entries % sizeof(test_data) }, 1);
+        assert(r >= 0);
+        c_variant_write(cv, "t", UINT64_C(0xdeadbeef));
+        if (fd >= 0)
+                r = c_variant_insert_file(cv, "ay", fd, 17, 333);
+        else
+                r = c_variant_insert(cv, "ay", &(struct iovec){ test_data + 17, 333 }, 1);
+        assert(r >= 0);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_checksum_writer(void) {
+        static const size_t sizes[] = { 0, 1, 7, 64, 1000, 20000 };
+        const struct iovec *vecs;
+        size_t i, j, late, n_vecs;
+        uint64_t sum, sum2;
+        CVariant *cv;
+        ssize_t l;
+        int r, fd;
+
+        fd = memfd_create("test-checksum", 0);
+        assert(fd >= 0);
+        l = write(fd, test_data, sizeof(test_data));
+        assert(l == (ssize_t)sizeof(test_data));
+
+        /* no checksum enabled */
+        cv = test_message_new(0, 1, -1, false);
+        r = c_variant_get_checksum(cv, &sum);
+        assert(r == -ENODATA);
+        c_variant_free(cv);
+
+        for (i = 0; i < sizeof(test_kinds) / sizeof(*test_kinds); ++i) {
+                for (j = 0; j < sizeof(sizes) / sizeof(*sizes); ++j) {
+                        for (late = 0; late < 2; ++late) {
+                                /* fused checksum must match a separate pass */
+                                cv = test_message_new(test_kinds[i], sizes[j], -1, late);
+                                r = c_variant_get_checksum(cv, &sum);
+                                assert(!r);
+
+                                vecs = c_variant_get_vecs(cv, &n_vecs);
+                                r = c_variant_verify_checksum(test_kinds[i], vecs, n_vecs, sum);
+                                assert(!r);
+
+                                /* enabling it on a sealed variant yields the same */
+                                r = c_variant_set_checksum(cv, test_kinds[i]);
+                                assert(!r);
+                                r = c_variant_get_checksum(cv, &sum2);
+                                assert(!r && sum2 == sum);
+                                c_variant_free(cv);
+
+                                /* file segments are folded as well */
+                                cv = test_message_new(test_kinds[i], sizes[j], fd, late);
+                                r = c_variant_get_checksum(cv, &sum2);
+                                assert(!r && sum2 == sum);
+                                c_variant_free(cv);
+                        }
+                }
+        }
+
+        close(fd);
+}
+
+int main(int argc, char **argv) {
+        test_checksum_known();
+        test_checksum_writer();
+        return 0;
+}
@@ -0,0 +1,182 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for CPU Dispatch
+ * This runs all CPU implementations supported on the running machine and
+ * verifies their kernels against the scalar implementation.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_MAX_FRAMES (67)
+#define TEST_CANARY (0xa5)
+
+static void test_cpu_select(void) {
+        const CVariantCpu *cpu;
+        size_t i;
+        int r;
+
+        cpu = c_variant_cpu;
+        assert(cpu);
+
+        r = c_variant_cpu_select("foobar");
+        assert(r == -ENOENT);
+        assert(c_variant_cpu == cpu);
+
+        /* the scalar implementation must always be available */
+        assert(!strcmp(c_variant_cpus[0].name, "scalar"));
+        assert(c_variant_cpus[0].supported());
+
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                r = c_variant_cpu_select(c_variant_cpus[i].name);
+                if (c_variant_cpus[i].supported()) {
+                        assert(r >= 0);
+                        assert(c_variant_cpu == &c_variant_cpus[i]);
+                } else {
+                        assert(r == -EOPNOTSUPP);
+                }
+        }
+
+        r = c_variant_cpu_select(cpu->name);
+        assert(r >= 0);
+}
+
+static void test_cpu_narrow_one(const CVariantCpu *cpu, size_t n, size_t wordsize, bool reverse, size_t offset) {
+        unsigned char words[TEST_MAX_FRAMES * 8 + 16], reference[TEST_MAX_FRAMES * 8 + 16];
+        uint64_t frames[TEST_MAX_FRAMES];
+        size_t i, size;
+
+        size = n << wordsize;
+
+        /* use frames with all bytes set, so truncation errors show up */
+        for (i = 0; i < n; ++i)
+                frames[i] = UINT64_C(0x0102030405060708) * (i + 1) + (i << 56);
+
+        memset(words, TEST_CANARY, sizeof(words));
+        memset(reference, TEST_CANARY, sizeof(reference));
+
+        c_variant_cpus[0].narrow_frames(reference + offset, frames, n, wordsize, reverse);
+        cpu->narrow_frames(words + offset, frames, n, wordsize, reverse);
+
+        assert(!memcmp(words, reference, sizeof(words)));
+
+        /* verify the reference itself, as well as the canaries */
+        for (i = 0; i < offset; ++i)
+                assert(words[i] == TEST_CANARY);
+        for (i = offset + size; i < sizeof(words); ++i)
+                assert(words[i] == TEST_CANARY);
+        for (i = 0; i < n; ++i) {
+                uint64_t v = 0;
+
+                memcpy(&v, words + offset + (i << wordsize), 1 << wordsize);
+                v = le64toh(v);
+                assert(v == (frames[reverse ? n - i - 1 : i] & (UINT64_MAX >> (64 - (8 << wordsize)))));
+        }
+}
+
+static void test_cpu_narrow(void) {
+        size_t i, n, wordsize, offset;
+        unsigned int reverse;
+
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                if (!c_variant_cpus[i].supported()) {
+                        fprintf(stderr, "Skipping unsupported CPU implementation: %s\n",
+                                c_variant_cpus[i].name);
+                        continue;
+                }
+
+                for (n = 0; n <= TEST_MAX_FRAMES; ++n)
+                        for (wordsize = 0; wordsize < 4; ++wordsize)
+                                for (reverse = 0; reverse < 2; ++reverse)
+                                        for (offset = 0; offset < 16; offset += 3)
+                                                test_cpu_narrow_one(&c_variant_cpus[i],
+                                                                    n,
+                                                                    wordsize,
+                                                                    reverse,
+                                                                    offset);
+        }
+}
+
+static void test_cpu_crc32c(void) {
+        unsigned char data[256];
+        uint32_t crc, reference;
+        size_t i, n, offset;
+
+        for (i = 0; i < sizeof(data); ++i)
+                data[i] = i * 13 + 7;
+
+        /* standard check value; the caller does pre- and post-conditioning */
+        crc = ~c_variant_cpus[0].crc32c(UINT32_MAX, "123456789", 9);
+        assert(crc == UINT32_C(0xe3069283));
+
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                if (!c_variant_cpus[i].supported())
+                        continue;
+
+                /* cover all head and tail lengths around the 8-byte blocks */
+                for (offset = 0; offset < 8; ++offset) {
+                        for (n = 0; n + offset <= sizeof(data); n += 5) {
+                                reference = c_variant_cpus[0].crc32c(UINT32_MAX, data + offset, n);
+                                crc = c_variant_cpus[i].crc32c(UINT32_MAX, data + offset, n);
+                                assert(crc == reference);
+                        }
+                }
+        }
+}
+
+static void test_cpu_copy_stream(void) {
+        unsigned char src[1024 + 8], dst[1024 + 64];
+        size_t i, n, offset;
+
+        for (i = 0; i < sizeof(src); ++i)
+                src[i] = i * 13 + 7;
+
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                if (!c_variant_cpus[i].supported())
+                        continue;
+
+                /* cover all destination alignments around the vector blocks */
+                for (offset = 0; offset < 64; offset += 3) {
+                        for (n = 0; n <= 1024; n += 7) {
+                                memset(dst, TEST_CANARY, sizeof(dst));
+                                c_variant_cpus[i].copy_stream(dst + offset, src + offset % 5, n);
+                                assert(!memcmp(dst + offset, src + offset % 5, n));
+                                if (offset)
+                                        assert(dst[offset - 1] == TEST_CANARY);
+                                if (offset + n < sizeof(dst))
+                                        assert(dst[offset + n] == TEST_CANARY);
+                        }
+                }
+        }
+}
+
+int main(int argc, char **argv) {
+        test_cpu_select();
+        test_cpu_narrow();
+        test_cpu_crc32c();
+        test_cpu_copy_stream();
+        return 0;
+}
@@ -0,0 +1,433 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Deltas
+ * This verifies that patching a variant with the delta to another variant
+ * reproduces the other variant byte by byte, that unchanged data is
+ * referenced rather than copied, and that deltas of small changes are small.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_TYPE "(ta{sv}a(uts)as)"
+#define TEST_ENTRIES (256)
+
+typedef struct TestSnapshot {
+        uint64_t serial;
+        size_t first_key;
+        size_t n_keys;
+        size_t changed_value;
+        size_t changed_struct;
+        size_t n_strings;
+} TestSnapshot;
+
+static CVariant *test_snapshot_new(const TestSnapshot *s) {
+        char key[64];
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, TEST_TYPE, strlen(TEST_TYPE));
+        assert(!r);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "t", s->serial);
+
+        c_variant_begin(cv, "a");
+        for (i = s->first_key; i < s->first_key + s->n_keys; ++i) {
+                sprintf(key, "org.example.key-%zu", i);
+                c_variant_begin(cv, "{");
+                c_variant_write(cv, "s", key);
+                if (i % 2) {
+                        c_variant_begin(cv, "v", "s");
+                        c_variant_write(cv, "s", i == s->changed_value ? "changed value" : "value");
+                } else {
+                        c_variant_begin(cv, "v", "t");
+                        c_variant_write(cv, "t", (uint64_t)(i == s->changed_value ? ~i : i));
+                }
+                c_variant_end(cv, "v}");
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < TEST_ENTRIES; ++i)
+                c_variant_write(cv, "(uts)", (uint32_t)i, (uint64_t)i * 7,
+                                i == s->changed_struct ? "changed" : "unchanged");
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < s->n_strings; ++i)
+                c_variant_write(cv, "s", "/org/example/object");
+        c_variant_end(cv, "a");
+
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(!r);
+
+        return cv;
+}
+
+static size_t test_flatten(CVariant *cv, char **datap) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        char *data;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0, size = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size ?: 1);
+        assert(data);
+
+        for (i = 0, size = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        *datap = data;
+        return size;
+}
+
+static bool test_references(CVariant *from, CVariant *cv) {
+        const struct iovec *from_vecs, *vecs;
+        size_t i, j, n_from_vecs, n_vecs;
+
+        from_vecs = c_variant_get_vecs(from, &n_from_vecs);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+
+        for (i = 0; i < n_vecs; ++i)
+                for (j = 0; j < n_from_vecs; ++j)
+                        if ((char *)vecs[i].iov_base >= (char *)from_vecs[j].iov_base &&
+                            (char *)vecs[i].iov_base < (char *)from_vecs[j].iov_base + from_vecs[j].iov_len)
+                                return true;
+
+        return false;
+}
+
+static size_t test_roundtrip(CVariant *from, CVariant *to) {
+        char *to_data, *patched_data;
+        size_t n_to, n_patched, n_delta;
+        CVariant *delta, *patched;
+        char *delta_data;
+        int r;
+
+        r = c_variant_diff(from, to, &delta);
+        assert(!r);
+
+        r = c_variant_patch(from, delta, &patched);
+        assert(!r);
+
+        /* the delta is independent of the patched variant */
+        n_delta = test_flatten(delta, &delta_data);
+        c_variant_free(delta);
+        free(delta_data);
+
+        n_to = test_flatten(to, &to_data);
+        n_patched = test_flatten(patched, &patched_data);
+        assert(n_to == n_patched);
+        assert(!memcmp(to_data, patched_data, n_to));
+
+        free(patched_data);
+        free(to_data);
+        c_variant_free(patched);
+        return n_delta;
+}
+
+static void test_delta_basic(void) {
+        TestSnapshot s = { 1, 0, TEST_ENTRIES, SIZE_MAX, SIZE_MAX, 16 };
+        CVariant *from, *to, *delta, *patched;
+        uint64_t n_from, n_to;
+        const char *type;
+        char *data;
+        size_t n;
+        int r;
+
+        from = test_snapshot_new(&s);
+        n = test_flatten(from, &data);
+        free(data);
+
+        /* identical variants are a single copy */
+        to = test_snapshot_new(&s);
+
+        r = c_variant_diff(from, to, &delta);
+        assert(!r);
+
+        r = c_variant_enter(delta, "(");
+        assert(!r);
+        r = c_variant_read(delta, "stt", &type, &n_from, &n_to);
+        assert(!r);
+        assert(!strcmp(type, TEST_TYPE));
+        assert(n_from == n && n_to == n);
+        r = c_variant_enter(delta, "a");
+        assert(!r);
+        assert(c_variant_peek_count(delta) == 1);
+
+        r = c_variant_patch(from, delta, &patched);
+        assert(!r);
+        assert(test_references(from, patched));
+        c_variant_free(patched);
+        c_variant_free(delta);
+        c_variant_free(to);
+
+        /* a few changed fields result in a small delta */
+        s.serial = 2;
+        s.changed_value = 17;
+        s.changed_struct = 100;
+        to = test_snapshot_new(&s);
+        assert(test_roundtrip(from, to) * 10 < n);
+
+        r = c_variant_diff(from, to, &delta);
+        assert(!r);
+        r = c_variant_patch(from, delta, &patched);
+        assert(!r);
+        assert(test_references(from, patched));
+        c_variant_free(patched);
+        c_variant_free(delta);
+        c_variant_free(to);
+
+        /* changed sizes are fine, as well */
+        s.changed_value = 18;
+        s.n_strings = 24;
+        to = test_snapshot_new(&s);
+        assert(test_roundtrip(from, to) * 4 < n);
+        assert(test_roundtrip(to, from) * 4 < n);
+        c_variant_free(to);
+
+        c_variant_free(from);
+}
+
+static void test_delta_dict(void) {
+        TestSnapshot s = { 1, 0, TEST_ENTRIES, SIZE_MAX, SIZE_MAX, 0 };
+        CVariant *from, *to;
+        char *data;
+        size_t n;
+
+        from = test_snapshot_new(&s);
+        n = test_flatten(from, &data);
+        free(data);
+
+        /* dictionary entries are paired by key, not by index */
+        s.first_key = 2;
+        to = test_snapshot_new(&s);
+        assert(test_roundtrip(from, to) * 4 < n);
+        assert(test_roundtrip(to, from) * 4 < n);
+        c_variant_free(to);
+
+        /* empty dictionaries on either side */
+        s.n_keys = 0;
+        to = test_snapshot_new(&s);
+        test_roundtrip(from, to);
+        test_roundtrip(to, from);
+        c_variant_free(to);
+
+        c_variant_free(from);
+}
+
+static void test_delta_vecs(void) {
+        TestSnapshot s = { 1, 0, TEST_ENTRIES, SIZE_MAX, SIZE_MAX, 16 };
+        CVariant *from, *chunked, *to, *delta, *patched;
+        struct iovec *vecs;
+        size_t i, n, n_vecs;
+        char *data;
+        int r;
+
+        /* old variants split across many vectors are referenced in place */
+        from = test_snapshot_new(&s);
+        n = test_flatten(from, &data);
+
+        n_vecs = (n + 6) / 7;
+        vecs = calloc(n_vecs, sizeof(*vecs));
+        assert(vecs);
+        for (i = 0; i < n_vecs; ++i)
+                vecs[i] = (struct iovec){ data + i * 7, i + 1 < n_vecs ? 7 : n - i * 7 };
+
+        r = c_variant_new_from_vecs(&chunked, TEST_TYPE, strlen(TEST_TYPE), vecs, n_vecs);
+        assert(!r);
+
+        s.changed_value = 3;
+        s.changed_struct = 5;
+        to = test_snapshot_new(&s);
+
+        test_roundtrip(chunked, to);
+        test_roundtrip(to, chunked);
+
+        r = c_variant_diff(chunked, to, &delta);
+        assert(!r);
+        r = c_variant_patch(chunked, delta, &patched);
+        assert(!r);
+        assert(test_references(chunked, patched));
+        assert(patched->n_vecs > 1);
+
+        c_variant_free(patched);
+        c_variant_free(delta);
+        c_variant_free(to);
+        c_variant_free(chunked);
+        free(vecs);
+        free(data);
+        c_variant_free(from);
+}
+
+static void test_delta_linear(void) {
+        CVariant *from, *delta, *patched;
+        size_t i, k, n_from, n_to, offset;
+        char *from_data, *to_data, *data;
+        struct iovec *vecs;
+        size_t n_vecs;
+        uint8_t c;
+        int r;
+
+        /*
+         * Deltas needing more than C_VARIANT_MAX_VECS vectors are assembled
+         * into linear memory. Use more ops than that, each spanning several
+         * vectors of the old variant, mixed with literals.
+         */
+        n_from = 70000;
+        from_data = malloc(n_from);
+        assert(from_data);
+        for (i = 0; i < n_from; ++i)
+                from_data[i] = i * 7;
+
+        n_vecs = (n_from + 6) / 7;
+        vecs = calloc(n_vecs, sizeof(*vecs));
+        assert(vecs);
+        for (i = 0; i < n_vecs; ++i)
+                vecs[i] = (struct iovec){ from_data + i * 7, i + 1 < n_vecs ? 7 : n_from - i * 7 };
+
+        r = c_variant_new_from_vecs(&from, "ay", strlen("ay"), vecs, n_vecs);
+        assert(!r);
+
+        n_to = C_VARIANT_MAX_VECS * 10;
+        to_data = malloc(n_to);
+        assert(to_data);
+
+        r = c_variant_new(&delta, "(stta(tt)ay)", strlen("(stta(tt)ay)"));
+        assert(!r);
+        c_variant_begin(delta, "(");
+        c_variant_write(delta, "stt", "ay", (uint64_t)n_from, (uint64_t)n_to);
+        c_variant_begin(delta, "a");
+        for (k = 0; k < C_VARIANT_MAX_VECS; ++k) {
+                offset = (k * 13) % (n_from - 9);
+                memcpy(to_data + k * 10, from_data + offset, 9);
+                to_data[k * 10 + 9] = k;
+                c_variant_write(delta, "(tt)", (uint64_t)offset, (uint64_t)9);
+                c_variant_write(delta, "(tt)", (uint64_t)C_VARIANT_DELTA_LITERAL, (uint64_t)1);
+        }
+        c_variant_end(delta, "a");
+        c_variant_begin(delta, "a");
+        for (k = 0; k < C_VARIANT_MAX_VECS; ++k) {
+                c = k;
+                c_variant_write(delta, "y", c);
+        }
+        c_variant_end(delta, "a");
+        c_variant_end(delta, ")");
+        r = c_variant_seal(delta);
+        assert(!r);
+
+        r = c_variant_patch(from, delta, &patched);
+        assert(!r);
+        assert(patched->n_vecs == 1);
+        assert(test_flatten(patched, &data) == n_to);
+        assert(!memcmp(data, to_data, n_to));
+
+        free(data);
+        c_variant_free(patched);
+        c_variant_free(delta);
+        free(to_data);
+        c_variant_free(from);
+        free(vecs);
+        free(from_data);
+}
+
+static void test_delta_random(void) {
+        TestSnapshot s = { 1, 0, TEST_ENTRIES, SIZE_MAX, SIZE_MAX, 16 }, t;
+        CVariant *from, *to;
+        unsigned int i;
+
+        srand(0xdecade);
+
+        from = test_snapshot_new(&s);
+        for (i = 0; i < 64; ++i) {
+                t = (TestSnapshot){
+                        .serial = rand() % 4,
+                        .first_key = rand() % 8,
+                        .n_keys = rand() % (TEST_ENTRIES * 2),
+                        .changed_value = rand() % TEST_ENTRIES,
+                        .changed_struct = rand() % TEST_ENTRIES,
+                        .n_strings = rand() % 64,
+                };
+
+                to = test_snapshot_new(&t);
+                test_roundtrip(from, to);
+                c_variant_free(from);
+                from = to;
+        }
+
+        c_variant_free(from);
+}
+
+static void test_delta_errors(void) {
+        TestSnapshot s = { 1, 0, 16, SIZE_MAX, SIZE_MAX, 4 };
+        CVariant *from, *to, *delta, *patched, *other;
+        int r;
+
+        from = test_snapshot_new(&s);
+        s.n_strings = 8;
+        to = test_snapshot_new(&s);
+
+        r = c_variant_new(&other, "u", 1);
+        assert(!r);
+        r = c_variant_write(other, "u", 1);
+        assert(!r);
+        r = c_variant_seal(other);
+        assert(!r);
+
+        /* types must match */
+        r = c_variant_diff(from, other, &delta);
+        assert(r == -EBADRQC);
+        r = c_variant_patch(from, other, &patched);
+        assert(r == -EBADRQC);
+
+        /* deltas only apply to variants of the same type and size */
+        r = c_variant_diff(from, to, &delta);
+        assert(!r);
+        r = c_variant_patch(to, delta, &patched);
+        assert(r == -EBADMSG);
+
+        c_variant_free(delta);
+        c_variant_free(other);
+        c_variant_free(to);
+        c_variant_free(from);
+}
+
+int main(int argc, char **argv) {
+        test_delta_basic();
+        test_delta_dict();
+        test_delta_vecs();
+        test_delta_linear();
+        test_delta_random();
+        test_delta_errors();
+        return 0;
+}
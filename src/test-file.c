@@ -0,0 +1,234 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for File Segments
+ * This inserts file ranges into variants and verifies that they serialize
+ * exactly like the same data inserted from memory, both when transmitted via
+ * c_variant_transmit(), and when read back locally.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_FILE_SIZE (3 * 4096 + 123)
+#define TEST_FILE_OFFSET (4096 + 17)
+
+static char test_data[TEST_FILE_SIZE];
+
+static int test_file_new(void) {
+        ssize_t l;
+        size_t i;
+        int fd;
+
+        for (i = 0; i < sizeof(test_data); ++i)
+                test_data[i] = i * 7 + i / 256;
+
+        fd = memfd_create("test-file", 0);
+        assert(fd >= 0);
+        l = write(fd, test_data, sizeof(test_data));
+        assert(l == (ssize_t)sizeof(test_data));
+
+        return fd;
+}
+
+static CVariant *test_message_new(int fd, size_t offset, size_t size) {
+        CVariant *cv;
+        int r;
+
+        /* embed the blob into a small envelope */
+        r = c_variant_new(&cv, "(tayt)", 6);
+        assert(r >= 0);
+        r = c_variant_begin(cv, "(");
+        assert(r >= 0);
+        r = c_variant_write(cv, "t", (uint64_t)size);
+        assert(r >= 0);
+
+        if (fd >= 0)
+                r = c_variant_insert_file(cv, "ay", fd, offset, size);
+        else
+                r = c_variant_insert(cv, "ay", &(struct iovec){ test_data + offset, size }, 1);
+        assert(r >= 0);
+
+        r = c_variant_write(cv, "t", UINT64_C(0xdeadbeef));
+        assert(r >= 0);
+        r = c_variant_end(cv, ")");
+        assert(r >= 0);
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_message_verify(CVariant *cv, size_t offset, size_t size) {
+        uint64_t t;
+        uint8_t y;
+        size_t i;
+        int r;
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+        r = c_variant_read(cv, "t", &t);
+        assert(r >= 0 && t == size);
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+        assert(c_variant_peek_count(cv) == size);
+
+        for (i = 0; i < size; ++i) {
+                r = c_variant_read(cv, "y", &y);
+                assert(r >= 0);
+                assert(y == (uint8_t)test_data[offset + i]);
+        }
+
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+        r = c_variant_read(cv, "t", &t);
+        assert(r >= 0 && t == 0xdeadbeef);
+        r = c_variant_exit(cv, ")");
+        assert(r >= 0);
+        assert(!c_variant_return_poison(cv));
+}
+
+static void test_file_basic(void) {
+        static char expected[TEST_FILE_SIZE + 64], got[TEST_FILE_SIZE + 64];
+        size_t n_expected, n_got, offset, size;
+        CVariant *ref, *cv;
+        int r, fd;
+
+        fd = test_file_new();
+
+        for (offset = 0; offset < TEST_FILE_SIZE; offset += TEST_FILE_OFFSET) {
+                for (size = 0; offset + size <= TEST_FILE_SIZE; size += 4093) {
+                        ref = test_message_new(-1, offset, size);
+                        r = c_variant_flatten(ref, 0, expected, sizeof(expected), &n_expected);
+                        assert(!r);
+
+                        /* read back locally, which maps the segment */
+                        cv = test_message_new(fd, offset, size);
+                        test_message_verify(cv, offset, size);
+                        c_variant_free(cv);
+
+                        /* flatten, which maps the segment as well */
+                        cv = test_message_new(fd, offset, size);
+                        r = c_variant_flatten(cv, 0, got, sizeof(got), &n_got);
+                        assert(!r);
+                        assert(n_got == n_expected);
+                        assert(!memcmp(got, expected, n_got));
+                        c_variant_free(cv);
+
+                        c_variant_free(ref);
+                }
+        }
+
+        /* the variant keeps its own reference to the file */
+        cv = test_message_new(fd, TEST_FILE_OFFSET, 100);
+        close(fd);
+        test_message_verify(cv, TEST_FILE_OFFSET, 100);
+        c_variant_free(cv);
+
+        /* invalid file descriptors poison the variant */
+        r = c_variant_new(&cv, "ay", 2);
+        assert(r >= 0);
+        r = c_variant_insert_file(cv, "ay", -1, 0, 16);
+        assert(r == -EBADF);
+        assert(c_variant_return_poison(cv) == -EBADF);
+        c_variant_free(cv);
+}
+
+static void test_file_transmit(void) {
+        static char expected[TEST_FILE_SIZE + 64], got[2 * TEST_FILE_SIZE + 128];
+        size_t n_expected, offset, n;
+        CVariant *ref, *cv;
+        int r, fd, sink, pair[2];
+        ssize_t l;
+
+        fd = test_file_new();
+
+        ref = test_message_new(-1, TEST_FILE_OFFSET, 2 * 4096);
+        r = c_variant_flatten(ref, 0, expected, sizeof(expected), &n_expected);
+        assert(!r);
+
+        /* transmit into a file; the segment is never mapped */
+        sink = memfd_create("test-file-sink", 0);
+        assert(sink >= 0);
+
+        cv = test_message_new(fd, TEST_FILE_OFFSET, 2 * 4096);
+        offset = 0;
+        r = c_variant_transmit(cv, sink, &offset);
+        assert(!r);
+        assert(offset == n_expected);
+        assert(cv->files && !cv->files->map);
+
+        /* transmitting again continues where it stopped */
+        r = c_variant_transmit(cv, sink, &offset);
+        assert(!r);
+        assert(offset == n_expected);
+
+        offset = 0;
+        r = c_variant_transmit(cv, sink, &offset);
+        assert(!r);
+        assert(offset == n_expected);
+
+        l = pread(sink, got, sizeof(got), 0);
+        assert(l == (ssize_t)(2 * n_expected));
+        assert(!memcmp(got, expected, n_expected));
+        assert(!memcmp(got + n_expected, expected, n_expected));
+        close(sink);
+
+        /* transmit through a non-blocking socket, resuming on -EAGAIN */
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+        assert(r >= 0);
+        r = setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &(int){ 4096 }, sizeof(int));
+        assert(r >= 0);
+
+        offset = 0;
+        n = 0;
+        do {
+                r = c_variant_transmit(cv, pair[0], &offset);
+                assert(!r || r == -EAGAIN);
+
+                while ((l = read(pair[1], got + n, sizeof(got) - n)) > 0)
+                        n += l;
+                assert(l < 0 && errno == EAGAIN);
+        } while (r == -EAGAIN);
+
+        assert(offset == n_expected);
+        assert(n == n_expected);
+        assert(!memcmp(got, expected, n_expected));
+
+        close(pair[1]);
+        close(pair[0]);
+        c_variant_free(cv);
+        c_variant_free(ref);
+        close(fd);
+}
+
+int main(int argc, char **argv) {
+        test_file_basic();
+        test_file_transmit();
+        return 0;
+}
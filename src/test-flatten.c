@@ -0,0 +1,418 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Flattening
+ * This verifies that flattening and duplicating variants, or single elements
+ * of them, produces the exact same bytes, regardless how the variant is split
+ * across vectors, and with every CPU implementation.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_TYPE "(tay(us)asv)"
+#define TEST_N_MEMBERS (5)
+
+enum {
+        TEST_LAYOUT_LINEAR,
+        TEST_LAYOUT_ADJACENT,
+        TEST_LAYOUT_SCATTERED,
+        TEST_LAYOUT_EMPTY,
+        _TEST_LAYOUT_N,
+};
+
+typedef struct TestLayout {
+        struct iovec *vecs;
+        size_t n_vecs;
+        char **buffers;
+        size_t n_buffers;
+} TestLayout;
+
+static CVariant *test_new(size_t n_blob, char **blobp) {
+        CVariant *cv;
+        char *blob;
+        size_t i;
+        int r;
+
+        blob = malloc(n_blob ?: 1);
+        assert(blob);
+        for (i = 0; i < n_blob; ++i)
+                blob[i] = i * 7 + i / 251;
+
+        r = c_variant_new(&cv, TEST_TYPE, strlen(TEST_TYPE));
+        assert(!r);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "t", UINT64_C(0xf00f));
+        r = c_variant_insert(cv, "ay", &(struct iovec){ blob, n_blob }, 1);
+        assert(!r);
+        c_variant_write(cv, "(us)", 7, "foo");
+        c_variant_begin(cv, "a");
+        for (i = 0; i < 32; ++i)
+                c_variant_write(cv, "s", i % 2 ? "/org/example" : "");
+        c_variant_end(cv, "a");
+        c_variant_write(cv, "v", "(su)", "bar", 9);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(!r);
+
+        /* the blob is inserted without copying it */
+        *blobp = blob;
+        return cv;
+}
+
+static size_t test_reference(CVariant *cv, char **datap) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        char *data;
+
+        /* the hand-rolled loop the API replaces */
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0, size = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size ?: 1);
+        assert(data);
+
+        for (i = 0, size = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        *datap = data;
+        return size;
+}
+
+static void test_layout_add(TestLayout *l, unsigned int layout, const char *data, size_t size) {
+        if (layout == TEST_LAYOUT_SCATTERED) {
+                /* private buffers, one byte off, are never adjacent */
+                l->buffers[l->n_buffers] = malloc(size + 1);
+                assert(l->buffers[l->n_buffers]);
+                memcpy(l->buffers[l->n_buffers] + 1, data, size);
+                l->vecs[l->n_vecs++] = (struct iovec){ l->buffers[l->n_buffers++] + 1, size };
+        } else {
+                l->vecs[l->n_vecs++] = (struct iovec){ (void *)data, size };
+        }
+
+        if (layout == TEST_LAYOUT_EMPTY)
+                l->vecs[l->n_vecs++] = (struct iovec){ (void *)(data + size), 0 };
+}
+
+static void test_layout_init(TestLayout *l,
+                             unsigned int layout,
+                             const char *data,
+                             size_t size,
+                             size_t start,
+                             size_t end,
+                             size_t chunk) {
+        size_t i, n;
+
+        /* split [@start, @end) into chunks, and keep the rest as is */
+        l->n_vecs = 0;
+        l->n_buffers = 0;
+        l->vecs = calloc((end - start) * 2 / chunk + 6, sizeof(*l->vecs));
+        l->buffers = calloc((end - start) / chunk + 3, sizeof(*l->buffers));
+        assert(l->vecs && l->buffers);
+
+        if (layout == TEST_LAYOUT_LINEAR) {
+                test_layout_add(l, layout, data, size);
+                return;
+        }
+
+        if (start)
+                test_layout_add(l, layout, data, start);
+
+        for (i = start; i < end; i += n) {
+                n = end - i < chunk ? end - i : chunk;
+                test_layout_add(l, layout, data + i, n);
+        }
+
+        if (end < size)
+                test_layout_add(l, layout, data + end, size - end);
+}
+
+static void test_layout_deinit(TestLayout *l) {
+        size_t i;
+
+        for (i = 0; i < l->n_buffers; ++i)
+                free(l->buffers[i]);
+        free(l->buffers);
+        free(l->vecs);
+}
+
+static void test_flatten_whole(CVariant *cv, const char *reference, size_t n_reference) {
+        const struct iovec *vecs;
+        size_t size, n_vecs, n_type;
+        const char *type;
+        CVariant *copy;
+        char *data;
+        int r;
+
+        /* query the size first, then copy to an unaligned buffer */
+        r = c_variant_flatten(cv, 0, NULL, 0, &size);
+        assert(n_reference ? r == -ENOBUFS : !r);
+        assert(size == n_reference);
+
+        data = malloc(size + 1);
+        assert(data);
+        r = c_variant_flatten(cv, 0, data + 1, size, &size);
+        assert(!r);
+        assert(size == n_reference);
+        assert(!memcmp(data + 1, reference, size));
+        free(data);
+
+        /* duplicates are linear, aligned, and readable on their own */
+        r = c_variant_dup(cv, 0, &copy);
+        assert(!r);
+
+        vecs = c_variant_get_vecs(copy, &n_vecs);
+        assert(n_vecs == 1);
+        assert(!((unsigned long)vecs->iov_base % 8));
+        assert(vecs->iov_len == n_reference);
+        assert(!memcmp(vecs->iov_base, reference, n_reference));
+        type = c_variant_peek_type(copy, &n_type);
+        assert(n_type == strlen(TEST_TYPE) && !strncmp(type, TEST_TYPE, n_type));
+
+        c_variant_free(copy);
+}
+
+static void test_flatten_elements(CVariant *cv, CVariant *linear) {
+        const char *type, *copy_type, *s;
+        CVariant *copy, *expected;
+        size_t i, size, n_type, n_copy_type, n_vecs, n_expected_vecs;
+        CVariantType info;
+        const struct iovec *vecs, *expected_vecs;
+        char buffer[8];
+        uint64_t t;
+        uint32_t u;
+        int r;
+
+        r = c_variant_enter(cv, "(");
+        assert(!r);
+        r = c_variant_enter(linear, "(");
+        assert(!r);
+
+        /* too small buffers leave the iterator in place */
+        r = c_variant_flatten(cv, C_VARIANT_FLATTEN_ELEMENT, buffer, 4, &size);
+        assert(r == -ENOBUFS && size == 8);
+        r = c_variant_flatten(cv, C_VARIANT_FLATTEN_ELEMENT, buffer, sizeof(buffer), &size);
+        assert(!r && size == 8);
+        r = c_variant_read(linear, "t", &t);
+        assert(!r);
+        assert(!memcmp(buffer, &t, sizeof(t)));
+
+        /* every element must match the element of the linear variant */
+        for (i = 1; i < TEST_N_MEMBERS; ++i) {
+                type = c_variant_peek_type(cv, &n_type);
+                r = c_variant_signature_next(type, n_type, &info);
+                assert(r == 1);
+
+                r = c_variant_dup(cv, C_VARIANT_FLATTEN_ELEMENT, &copy);
+                assert(!r);
+                r = c_variant_dup(linear, C_VARIANT_FLATTEN_ELEMENT, &expected);
+                assert(!r);
+
+                vecs = c_variant_get_vecs(copy, &n_vecs);
+                expected_vecs = c_variant_get_vecs(expected, &n_expected_vecs);
+                assert(n_vecs == 1 && n_expected_vecs == 1);
+                assert(vecs->iov_len == expected_vecs->iov_len);
+                assert(!memcmp(vecs->iov_base, expected_vecs->iov_base, vecs->iov_len));
+                copy_type = c_variant_peek_type(copy, &n_copy_type);
+                assert(n_copy_type == info.n_type && !strncmp(copy_type, type, n_copy_type));
+
+                if (i == 2) {
+                        r = c_variant_read(copy, "(us)", &u, &s);
+                        assert(!r);
+                        assert(u == 7 && !strcmp(s, "foo"));
+                } else if (i == 4) {
+                        r = c_variant_read(copy, "v", "(su)", &s, &u);
+                        assert(!r);
+                        assert(u == 9 && !strcmp(s, "bar"));
+                }
+
+                c_variant_free(expected);
+                c_variant_free(copy);
+        }
+
+        /* there is nothing left to copy */
+        r = c_variant_dup(cv, C_VARIANT_FLATTEN_ELEMENT, &copy);
+        assert(r == -EBADRQC);
+        assert(c_variant_return_poison(cv) == -EBADRQC);
+
+        c_variant_rewind(linear);
+}
+
+static void test_flatten_nested(CVariant *cv, const char *reference, size_t n_reference) {
+        const char *type;
+        size_t n_type;
+        int r;
+
+        /* whole copies work from any iterator position, and keep it */
+        r = c_variant_enter(cv, "(");
+        assert(!r);
+        r = c_variant_read(cv, "t", NULL);
+        assert(!r);
+        r = c_variant_enter(cv, "a");
+        assert(!r);
+
+        test_flatten_whole(cv, reference, n_reference);
+
+        r = c_variant_exit(cv, "a");
+        assert(!r);
+        type = c_variant_peek_type(cv, &n_type);
+        assert(n_type == 7 && !strncmp(type, "(us)asv", n_type));
+        c_variant_rewind(cv);
+}
+
+static void test_flatten_one(size_t n_blob, size_t chunk) {
+        CVariant *source, *linear, *cv;
+        char *reference, *blob;
+        size_t n_reference;
+        unsigned int layout;
+        TestLayout l;
+        int r;
+
+        source = test_new(n_blob, &blob);
+        n_reference = test_reference(source, &reference);
+
+        r = c_variant_new_from_vecs(&linear, TEST_TYPE, strlen(TEST_TYPE),
+                                    &(struct iovec){ reference, n_reference }, 1);
+        assert(!r);
+
+        test_flatten_whole(source, reference, n_reference);
+        test_flatten_elements(source, linear);
+        c_variant_rewind(source);
+        test_flatten_nested(source, reference, n_reference);
+
+        for (layout = 0; layout < _TEST_LAYOUT_N; ++layout) {
+                /* whole copies do not care where vectors are split */
+                test_layout_init(&l, layout, reference, n_reference, 0, n_reference, chunk);
+
+                r = c_variant_new_from_vecs(&cv, TEST_TYPE, strlen(TEST_TYPE), l.vecs, l.n_vecs);
+                assert(!r);
+
+                test_flatten_whole(cv, reference, n_reference);
+                test_flatten_nested(cv, reference, n_reference);
+
+                c_variant_free(cv);
+                test_layout_deinit(&l);
+
+                /*
+                 * Elements are only accessible to the reader, if their framing
+                 * is not split, so only split the payload of the byte array,
+                 * which follows the leading 't'.
+                 */
+                test_layout_init(&l, layout, reference, n_reference, 8, 8 + n_blob, chunk);
+
+                r = c_variant_new_from_vecs(&cv, TEST_TYPE, strlen(TEST_TYPE), l.vecs, l.n_vecs);
+                assert(!r);
+
+                test_flatten_whole(cv, reference, n_reference);
+                test_flatten_elements(cv, linear);
+
+                c_variant_free(cv);
+                test_layout_deinit(&l);
+        }
+
+        c_variant_free(linear);
+        c_variant_free(source);
+        free(reference);
+        free(blob);
+}
+
+static void test_flatten_null(void) {
+        CVariant *unit, *copy;
+        char buffer[1] = { 0x7f };
+        size_t size, n_reference;
+        char *reference;
+        int r;
+
+        /*
+         * NULL is the unit '()', hence it must flatten to the same
+         * serialization as a unit written by the writer, in both modes.
+         */
+
+        r = c_variant_new(&unit, "()", 2);
+        assert(!r);
+        r = c_variant_seal(unit);
+        assert(!r);
+        n_reference = test_reference(unit, &reference);
+
+        size = 1;
+        r = c_variant_flatten(NULL, 0, NULL, 0, &size);
+        assert(!r && size == n_reference);
+        r = c_variant_flatten(unit, 0, NULL, 0, &size);
+        assert(!r && size == n_reference);
+
+        size = 1;
+        r = c_variant_flatten(NULL, C_VARIANT_FLATTEN_ELEMENT, buffer, sizeof(buffer), &size);
+        assert(!r && size == n_reference);
+        assert(buffer[0] == 0x7f);
+
+        copy = unit;
+        r = c_variant_dup(NULL, 0, &copy);
+        assert(!r && !copy);
+        copy = unit;
+        r = c_variant_dup(NULL, C_VARIANT_FLATTEN_ELEMENT, &copy);
+        assert(!r && !copy);
+
+        /* the copy of NULL is read like NULL itself */
+        assert(c_variant_peek_count(copy) == 1);
+        r = c_variant_read(copy, "()");
+        assert(!r);
+
+        c_variant_free(unit);
+        free(reference);
+}
+
+int main(int argc, char **argv) {
+        const CVariantCpu *cpu = c_variant_cpu;
+        size_t i;
+        int r;
+
+        test_flatten_null();
+
+        test_flatten_one(0, 1);
+        test_flatten_one(100, 1);
+        test_flatten_one(100, 3);
+        test_flatten_one(300, 7);
+        test_flatten_one(70000, 4096);
+
+        /* large variants are streamed, so run them with every implementation */
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                if (!c_variant_cpus[i].supported())
+                        continue;
+
+                r = c_variant_cpu_select(c_variant_cpus[i].name);
+                assert(!r);
+
+                test_flatten_one(C_VARIANT_STREAM_MIN + 333, 65536 + 5);
+        }
+
+        r = c_variant_cpu_select(cpu->name);
+        assert(!r);
+
+        return 0;
+}
@@ -29,6 +29,7 @@
 #include "c-variant.h"
 #include "c-variant-private.h"
 #include "generator.h"
+#include "test-shard.h"
 
 static void n_to_gv(Generator *gen, const char *s) {
         char c;
@@ -47,6 +48,34 @@ static void gv_to_n(Generator *gen, const char *s) {
         generator_print(gen, stdout, 10);
 }
 
+static void test_fold(Generator *gen, const char *seed, const char *type) {
+        CVariantType info;
+        const char *t;
+        size_t n;
+        char *s;
+        FILE *f;
+        int r;
+
+        /* every generated type must fold back into its seed */
+        generator_reset(gen);
+        t = type;
+        do {
+                r = generator_feed(gen, *t);
+                assert(!r);
+        } while (*t++);
+
+        f = open_memstream(&s, &n);
+        assert(f);
+        generator_print(gen, f, 10);
+        fclose(f);
+        assert(!strcmp(s, seed));
+        free(s);
+
+        /* ...and must be a single valid type, unless it exceeds our limits */
+        r = c_variant_signature_one(type, strlen(type), &info);
+        assert(!r || r == -EMSGSIZE || r == -ELOOP);
+}
+
 int main(int argc, char **argv) {
         Generator *gen;
         int r = 0;
@@ -65,8 +94,16 @@ int main(int argc, char **argv) {
         } else if (argc == 3 && !strcmp(argv[1], "unfold")) {
                 n_to_gv(gen, argv[2]);
                 printf("\n");
+        } else if ((argc == 4 || argc == 5) && !strcmp(argv[1], "shard")) {
+                r = test_shard_run(argv[2], strtoull(argv[3], NULL, 10),
+                                   argc == 5 ? argv[4] : NULL, test_fold);
+                if (r < 0)
+                        fprintf(stderr, "sharded run failed: %s\n", strerror(-r));
+                r = r < 0 ? 1 : 0;
         } else {
-                fprintf(stderr, "usage: %s [fold|unfold] <number/type>\n",
+                fprintf(stderr, "usage: %s [fold|unfold] <number/type>\n"
+                                "       %s shard <first> <#seeds> [<checkpoint>]\n",
+                        program_invocation_short_name,
                         program_invocation_short_name);
                 r = 77;
         }
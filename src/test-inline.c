@@ -0,0 +1,253 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Inline Fast Paths
+ * This verifies the inline accessors of c-variant-inline.h produce the same
+ * results as the out-of-line accessors, both on the fast path and whenever
+ * they have to fall back to the library.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-variant.h"
+#include "c-variant-inline.h"
+#include "c-variant-private.h"
+
+static void test_inline_read(void) {
+        static const char data[] = {
+                "\x01\x00\x00\x00"
+                "\x02\x00\x00\x00"
+                "\x03\x00\x00\x00\x00\x00\x00\x00"
+                "\x04\x00"
+                "\x05"
+                "\x00\x00\x00\x00\x00"
+        };
+        const char *type = "(uutqy)";
+        struct iovec vecs[3];
+        unsigned int u1, u2, v1, v2;
+        uint64_t t1;
+        uint16_t q1;
+        uint8_t y1;
+        CVariant *cv;
+        int r;
+
+        /* linear buffer: everything is served inline */
+        r = c_variant_new_from_buffer(&cv, type, strlen(type), data, sizeof(data) - 1);
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+
+        r = c_variant_inline_read(cv, 'u', &u1);
+        assert(r >= 0 && u1 == 1);
+        r = c_variant_inline_read(cv, 'u', &u2);
+        assert(r >= 0 && u2 == 2);
+        r = c_variant_inline_read(cv, 't', &t1);
+        assert(r >= 0 && t1 == 3);
+        r = c_variant_inline_read(cv, 'q', &q1);
+        assert(r >= 0 && q1 == 4);
+        r = c_variant_inline_read(cv, 'y', &y1);
+        assert(r >= 0 && y1 == 5);
+
+        assert(c_variant_inline_peek_count(cv) == 0);
+        r = c_variant_inline_read(cv, 'y', &y1);
+        assert(r == -EBADRQC);
+
+        cv = c_variant_free(cv);
+
+        /* split in the middle of 't': must fall back, but yield the same */
+        vecs[0] = (struct iovec){ .iov_base = (void *)data, .iov_len = 12 };
+        vecs[1] = (struct iovec){ .iov_base = (void *)(data + 12), .iov_len = 6 };
+        vecs[2] = (struct iovec){ .iov_base = (void *)(data + 18), .iov_len = sizeof(data) - 1 - 18 };
+        r = c_variant_new_from_vecs(&cv, type, strlen(type), vecs, 3);
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+
+        r = c_variant_inline_read(cv, 'u', &u1);
+        assert(r >= 0 && u1 == 1);
+        r = c_variant_inline_read(cv, 'u', &u2);
+        assert(r >= 0 && u2 == 2);
+        r = c_variant_inline_read(cv, 't', &t1);
+        assert(r >= 0 && t1 == 0); /* split basic type yields the default */
+        r = c_variant_inline_read(cv, 'q', &q1);
+        assert(r >= 0 && q1 == 4);
+        r = c_variant_inline_read(cv, 'y', &y1);
+        assert(r >= 0 && y1 == 5);
+
+        cv = c_variant_free(cv);
+
+        /* truncated buffer: must behave exactly like c_variant_read() */
+        r = c_variant_new_from_buffer(&cv, type, strlen(type), data, 6);
+        assert(r >= 0);
+
+        u1 = u2 = v1 = v2 = 0xdead;
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+        r = c_variant_read(cv, "uu", &v1, &v2);
+        assert(r >= 0);
+
+        c_variant_rewind(cv);
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+
+        r = c_variant_inline_read(cv, 'u', &u1);
+        assert(r >= 0 && u1 == v1);
+        r = c_variant_inline_read(cv, 'u', &u2);
+        assert(r >= 0 && u2 == v2);
+
+        cv = c_variant_free(cv);
+
+        /* NULL variant is the unit type */
+        r = c_variant_inline_read(NULL, 'u', &u1);
+        assert(r == -EBADRQC && u1 == 0);
+        assert(c_variant_inline_peek_count(NULL) == 1);
+}
+
+static void test_inline_array(void) {
+        const char *type = "at";
+        uint64_t t, values[64];
+        CVariant *cv;
+        size_t i, n;
+        int r;
+
+        /* write enough data to span multiple buffers */
+        r = c_variant_new(&cv, type, strlen(type));
+        assert(r >= 0);
+
+        r = c_variant_begin(cv, "a");
+        assert(r >= 0);
+
+        for (t = 0; t < 2048; ++t) {
+                r = c_variant_inline_write(cv, 't', &t);
+                assert(r >= 0);
+        }
+
+        r = c_variant_end(cv, "a");
+        assert(r >= 0);
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        /* read it back inline, and verify it against the generic reader */
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+
+        n = c_variant_inline_peek_count(cv);
+        assert(n == 2048);
+
+        for (i = 0; i < n; ++i) {
+                r = c_variant_inline_read(cv, 't', &t);
+                assert(r >= 0 && t == i);
+        }
+
+        assert(c_variant_inline_peek_count(cv) == 0);
+
+        c_variant_rewind(cv);
+
+        r = c_variant_read(cv, "at", 64,
+                           &values[0], &values[1], &values[2], &values[3],
+                           &values[4], &values[5], &values[6], &values[7],
+                           &values[8], &values[9], &values[10], &values[11],
+                           &values[12], &values[13], &values[14], &values[15],
+                           &values[16], &values[17], &values[18], &values[19],
+                           &values[20], &values[21], &values[22], &values[23],
+                           &values[24], &values[25], &values[26], &values[27],
+                           &values[28], &values[29], &values[30], &values[31],
+                           &values[32], &values[33], &values[34], &values[35],
+                           &values[36], &values[37], &values[38], &values[39],
+                           &values[40], &values[41], &values[42], &values[43],
+                           &values[44], &values[45], &values[46], &values[47],
+                           &values[48], &values[49], &values[50], &values[51],
+                           &values[52], &values[53], &values[54], &values[55],
+                           &values[56], &values[57], &values[58], &values[59],
+                           &values[60], &values[61], &values[62], &values[63]);
+        assert(r >= 0);
+        for (i = 0; i < 64; ++i)
+                assert(values[i] == i);
+
+        cv = c_variant_free(cv);
+}
+
+static void test_inline_write(void) {
+        const char *type = "(ybqdsu)", *s;
+        uint8_t y = 0xff, b = true;
+        uint16_t q = 0xabcd;
+        double d = 1.5;
+        unsigned int u;
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new(&cv, type, strlen(type));
+        assert(r >= 0);
+
+        r = c_variant_begin(cv, "(");
+        assert(r >= 0);
+
+        r = c_variant_inline_write(cv, 'y', &y);
+        assert(r >= 0);
+        r = c_variant_inline_write(cv, 'b', &b);
+        assert(r >= 0);
+        r = c_variant_inline_write(cv, 'q', &q);
+        assert(r >= 0);
+        r = c_variant_inline_write(cv, 'd', &d);
+        assert(r >= 0);
+        s = "foobar";
+        r = c_variant_inline_write(cv, 's', &s);
+        assert(r >= 0);
+        u = 0xf0f0;
+        r = c_variant_inline_write(cv, 'u', &u);
+        assert(r >= 0);
+
+        /* type mismatch must be rejected and poison the variant */
+        r = c_variant_inline_write(cv, 'u', &u);
+        assert(r == -EBADRQC);
+        assert(c_variant_return_poison(cv) == -EBADRQC);
+
+        r = c_variant_end(cv, ")");
+        assert(r >= 0);
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        y = b = q = u = 0;
+        d = 0;
+        s = NULL;
+        r = c_variant_read(cv, "(ybqdsu)", &y, &b, &q, &d, &s, &u);
+        assert(r >= 0);
+        assert(y == 0xff);
+        assert(b == true);
+        assert(q == 0xabcd);
+        assert(!(d < 1.5) && !(d > 1.5));
+        assert(!strcmp(s, "foobar"));
+        assert(u == 0xf0f0);
+
+        cv = c_variant_free(cv);
+}
+
+int main(int argc, char **argv) {
+        test_inline_read();
+        test_inline_array();
+        test_inline_write();
+        return 0;
+}
@@ -0,0 +1,190 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Batch Decoding Performance Test
+ * This benchmarks decoding streams of small '(stud)' and '(tud)' messages. In
+ * mode 0, each message is decoded via c_variant_new_from_vecs(),
+ * c_variant_read(), and c_variant_free(), in mode 1 via
+ * c_variant_decode_struct() on a variant per message, and in mode 2 via a
+ * single c_variant_decode_batch() call per stream. The result table lists the
+ * type, the mode, and the time spent per message, in nanoseconds. Like
+ * test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "c-variant.h"
+
+#define TEST_MESSAGES (4096)
+
+enum {
+        TEST_MODE_READ,
+        TEST_MODE_STRUCT,
+        TEST_MODE_BATCH,
+        _TEST_MODE_N,
+};
+
+typedef struct TestSample {
+        const char *name;
+        uint64_t t;
+        uint32_t u;
+        double d;
+} TestSample;
+
+static const CVariantField test_sample_fields[] = {
+        { "s", offsetof(TestSample, name) },
+        { "t", offsetof(TestSample, t) },
+        { "u", offsetof(TestSample, u) },
+        { "d", offsetof(TestSample, d) },
+};
+
+static CVariant *test_messages[TEST_MESSAGES];
+static struct iovec test_msgs[TEST_MESSAGES];
+static TestSample test_samples[TEST_MESSAGES];
+static int test_statuses[TEST_MESSAGES];
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void test_batch_prepare(const char *type) {
+        size_t i, n_vecs;
+        int r;
+
+        for (i = 0; i < TEST_MESSAGES; ++i) {
+                r = c_variant_new(&test_messages[i], type, strlen(type));
+                assert(r >= 0);
+
+                if (!strcmp(type, "(stud)"))
+                        r = c_variant_write(test_messages[i], type, "cpu.load", (uint64_t)i, (uint32_t)i, i / 8.0);
+                else
+                        r = c_variant_write(test_messages[i], type, (uint64_t)i, (uint32_t)i, i / 8.0);
+                assert(r >= 0);
+
+                r = c_variant_seal(test_messages[i]);
+                assert(r >= 0);
+
+                test_msgs[i] = *c_variant_get_vecs(test_messages[i], &n_vecs);
+                assert(n_vecs == 1);
+        }
+}
+
+static void test_batch_release(void) {
+        size_t i;
+
+        for (i = 0; i < TEST_MESSAGES; ++i)
+                test_messages[i] = c_variant_free(test_messages[i]);
+}
+
+static void test_batch_run(unsigned int mode, const char *type, const CVariantStruct *desc) {
+        TestSample *s;
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        if (mode == TEST_MODE_BATCH) {
+                r = c_variant_decode_batch(desc, test_msgs, TEST_MESSAGES, test_samples, NULL, test_statuses);
+                assert(r == 0);
+                return;
+        }
+
+        for (i = 0; i < TEST_MESSAGES; ++i) {
+                r = c_variant_new_from_vecs(&cv, type, strlen(type), test_msgs + i, 1);
+                assert(r >= 0);
+
+                s = test_samples + i;
+                if (mode == TEST_MODE_STRUCT)
+                        r = c_variant_decode_struct(cv, desc, s, NULL);
+                else if (!strcmp(type, "(stud)"))
+                        r = c_variant_read(cv, type, &s->name, &s->t, &s->u, &s->d);
+                else
+                        r = c_variant_read(cv, type, &s->t, &s->u, &s->d);
+                assert(r >= 0);
+
+                c_variant_free(cv);
+        }
+}
+
+static void test_batch_one(unsigned int mode, uint64_t times, const char *type) {
+        uint64_t i, start_nsec, end_nsec;
+        CVariantStruct *desc;
+        size_t n_fields;
+        int r;
+
+        fprintf(stderr, "Run: mode:%u times:%" PRIu64 " type:%s\n", mode, times, type);
+
+        /* '(tud)' is '(stud)' without the leading string */
+        n_fields = strlen(type) - 2;
+        r = c_variant_struct_new(&desc, type, strlen(type),
+                                 test_sample_fields + 4 - n_fields, n_fields, sizeof(TestSample));
+        assert(r >= 0);
+
+        test_batch_prepare(type);
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_batch_run(mode, type, desc);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                test_batch_run(mode, type, desc);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        test_batch_release();
+        c_variant_struct_free(desc);
+
+        /* print result table */
+        printf("%s %u %" PRIu64 "\n",
+               type,
+               mode,
+               (end_nsec - start_nsec) / times / TEST_MESSAGES);
+}
+
+int main(int argc, char **argv) {
+        unsigned int mode;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#mode>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        mode = atoi(argv[1]);
+        if (mode >= _TEST_MODE_N) {
+                fprintf(stderr, "Invalid mode (available: %u)\n", _TEST_MODE_N);
+                return 77;
+        }
+
+        test_batch_one(mode, 200, "(stud)");
+        test_batch_one(mode, 200, "(tud)");
+
+        return 0;
+}
@@ -0,0 +1,163 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * CPU Dispatch Performance Test
+ * This benchmarks the CPU specific kernels against each other. The selected
+ * implementation is run on its own (narrowing framing offsets of different
+ * sizes), as well as as part of the writer (serializing string arrays, which
+ * requires one framing offset per entry). Like test-perf, it is only useful
+ * to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void test_narrow_one(size_t wordsize, uint64_t times, size_t n_frames) {
+        uint64_t i, start_nsec, end_nsec, *frames;
+        void *words;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " frames:%zu wordsize:%zu\n", times, n_frames, wordsize);
+
+        frames = calloc(n_frames, sizeof(*frames));
+        words = calloc(n_frames, sizeof(*frames));
+        assert(frames && words);
+
+        for (i = 0; i < n_frames; ++i)
+                frames[i] = i * 7;
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                c_variant_cpu->narrow_frames(words, frames, n_frames, wordsize, i & 1);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                c_variant_cpu->narrow_frames(words, frames, n_frames, wordsize, i & 1);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %zu %" PRIu64 "\n", n_frames, wordsize, end_nsec - start_nsec);
+
+        free(words);
+        free(frames);
+}
+
+static void test_narrow(void) {
+        size_t n, wordsize;
+
+        /* run with growing number of frames, doubling on each iteration */
+        for (wordsize = 0; wordsize < 4; ++wordsize)
+                for (n = 1; n <= 16384; n <<= 1)
+                        test_narrow_one(wordsize, 10UL * 1000UL * 1000UL / n + 1, n);
+}
+
+static void test_writer_run(size_t n_entries) {
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, "as", 2);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n_entries; ++i)
+                c_variant_write(cv, "s", "foobar");
+        r = c_variant_end(cv, "a");
+        assert(r >= 0);
+
+        c_variant_free(cv);
+}
+
+static void test_writer_one(uint64_t times, size_t n_entries) {
+        uint64_t i, start_nsec, end_nsec;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " entries:%zu\n", times, n_entries);
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_writer_run(n_entries);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                test_writer_run(n_entries);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %" PRIu64 "\n", n_entries, end_nsec - start_nsec);
+}
+
+static void test_writer(void) {
+        size_t n;
+
+        /* run with growing number of entries, doubling on each iteration */
+        for (n = 1; n <= 65536; n <<= 1)
+                test_writer_one(1000UL * 1000UL / n + 1, n);
+}
+
+static const struct {
+        const char *name;
+        void (*run) (void);
+} test_benchmarks[] = {
+        { "narrow", test_narrow },
+        { "writer", test_writer },
+};
+
+int main(int argc, char **argv) {
+        unsigned int benchmark;
+        int r;
+
+        if (argc != 3) {
+                fprintf(stderr, "Usage: %s <#benchmark> <cpu>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        benchmark = atoi(argv[1]);
+        if (benchmark >= sizeof(test_benchmarks) / sizeof(*test_benchmarks)) {
+                fprintf(stderr, "Invalid benchmark (available: %zu)\n",
+                        sizeof(test_benchmarks) / sizeof(*test_benchmarks));
+                return 77;
+        }
+
+        r = c_variant_cpu_select(argv[2]);
+        if (r < 0) {
+                fprintf(stderr, "Unavailable CPU implementation: %s\n", argv[2]);
+                return 77;
+        }
+
+        fprintf(stderr, "Benchmark: %s (%s)\n", test_benchmarks[benchmark].name, c_variant_cpu->name);
+        test_benchmarks[benchmark].run();
+        return 0;
+}
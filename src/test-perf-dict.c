@@ -0,0 +1,138 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Dictionary Builder Performance Test
+ * This benchmarks serializing 'a{sv}' dictionaries of different sizes, with
+ * a mix of 'u' and 's' values. In mode 0, each entry is written via the
+ * generic writer (c_variant_write() with "{sv}"), in mode 1 via the
+ * dictionary builder (c_variant_dict_add_u32() and c_variant_dict_add_str()).
+ * The result table lists the number of entries, the mode, and the time spent
+ * per dictionary and per entry, in nanoseconds. Like test-perf, it is only
+ * useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c-variant.h"
+
+#define TEST_KEYS (1000)
+
+enum {
+        TEST_MODE_GENERIC,
+        TEST_MODE_BUILDER,
+        _TEST_MODE_N,
+};
+
+static char test_keys[TEST_KEYS][32];
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void test_dict_run(unsigned int mode, size_t n_entries) {
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, "a{sv}", 5);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "a");
+
+        if (mode == TEST_MODE_GENERIC) {
+                for (i = 0; i < n_entries; ++i) {
+                        if (i % 2)
+                                c_variant_write(cv, "{sv}", test_keys[i], "s", "org.example.value");
+                        else
+                                c_variant_write(cv, "{sv}", test_keys[i], "u", (uint32_t)i);
+                }
+        } else {
+                for (i = 0; i < n_entries; ++i) {
+                        if (i % 2)
+                                c_variant_dict_add_str(cv, test_keys[i], "org.example.value");
+                        else
+                                c_variant_dict_add_u32(cv, test_keys[i], i);
+                }
+        }
+
+        r = c_variant_end(cv, "a");
+        assert(r >= 0);
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        c_variant_free(cv);
+}
+
+static void test_dict_one(unsigned int mode, uint64_t times, size_t n_entries) {
+        uint64_t i, start_nsec, end_nsec;
+
+        fprintf(stderr, "Run: mode:%u times:%" PRIu64 " entries:%zu\n", mode, times, n_entries);
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_dict_run(mode, n_entries);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                test_dict_run(mode, n_entries);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %u %" PRIu64 " %" PRIu64 "\n",
+               n_entries,
+               mode,
+               (end_nsec - start_nsec) / times,
+               (end_nsec - start_nsec) / times / n_entries);
+}
+
+int main(int argc, char **argv) {
+        unsigned int mode;
+        size_t i, n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#mode>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        mode = atoi(argv[1]);
+        if (mode >= _TEST_MODE_N) {
+                fprintf(stderr, "Invalid mode (available: %u)\n", _TEST_MODE_N);
+                return 77;
+        }
+
+        for (i = 0; i < TEST_KEYS; ++i)
+                sprintf(test_keys[i], "org.example.key-%zu", i);
+
+        /* run with growing number of entries, by a factor of 10 each */
+        for (n = 10; n <= TEST_KEYS; n *= 10)
+                test_dict_one(mode, 10UL * 1000UL * 1000UL / n / 10 + 1, n);
+
+        return 0;
+}
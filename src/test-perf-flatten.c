@@ -0,0 +1,158 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Flattening Performance Test
+ * This benchmarks copying 'ay' variants of different sizes, split into 4K
+ * vectors of a single buffer, into contiguous memory. In mode 0, each copy is
+ * done by a loop over c_variant_get_vecs() into a pre-allocated buffer, in
+ * mode 1 via c_variant_flatten() into the same buffer, and in mode 2 via
+ * c_variant_dup(), which allocates the copy. The result table lists the size,
+ * the mode, and the time spent per copy in nanoseconds, as well as the
+ * throughput in MiB/s. Like test-perf, it is only useful to get ballpark
+ * figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "c-variant.h"
+
+#define TEST_CHUNK (4096)
+#define TEST_MAX_SIZE (64UL << 20)
+
+enum {
+        TEST_MODE_LOOP,
+        TEST_MODE_FLATTEN,
+        TEST_MODE_DUP,
+        _TEST_MODE_N,
+};
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static char *test_buffer;
+
+static void test_flatten_run(unsigned int mode, CVariant *cv) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        CVariant *copy;
+        int r;
+
+        switch (mode) {
+        case TEST_MODE_LOOP:
+                vecs = c_variant_get_vecs(cv, &n_vecs);
+                for (i = 0, size = 0; i < n_vecs; ++i) {
+                        memcpy(test_buffer + size, vecs[i].iov_base, vecs[i].iov_len);
+                        size += vecs[i].iov_len;
+                }
+                break;
+        case TEST_MODE_FLATTEN:
+                r = c_variant_flatten(cv, 0, test_buffer, TEST_MAX_SIZE, &size);
+                assert(r >= 0);
+                break;
+        case TEST_MODE_DUP:
+                r = c_variant_dup(cv, 0, &copy);
+                assert(r >= 0);
+                c_variant_free(copy);
+                break;
+        }
+}
+
+static void test_flatten_one(unsigned int mode, uint64_t times, char *blob, size_t size) {
+        uint64_t i, start_nsec, end_nsec, nsec;
+        struct iovec *vecs;
+        size_t n_vecs;
+        CVariant *cv;
+        int r;
+
+        fprintf(stderr, "Run: mode:%u times:%" PRIu64 " size:%zu\n", mode, times, size);
+
+        n_vecs = (size + TEST_CHUNK - 1) / TEST_CHUNK;
+        vecs = calloc(n_vecs, sizeof(*vecs));
+        assert(vecs);
+        for (i = 0; i < n_vecs; ++i)
+                vecs[i] = (struct iovec){ blob + i * TEST_CHUNK,
+                                          i + 1 < n_vecs ? TEST_CHUNK : size - i * TEST_CHUNK };
+
+        r = c_variant_new_from_vecs(&cv, "ay", 2, vecs, n_vecs);
+        assert(r >= 0);
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_flatten_run(mode, cv);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                test_flatten_run(mode, cv);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        c_variant_free(cv);
+        free(vecs);
+
+        /* print result table */
+        nsec = (end_nsec - start_nsec) / times;
+        printf("%zu %u %" PRIu64 " %" PRIu64 "\n",
+               size,
+               mode,
+               nsec,
+               (uint64_t)size * 1000 * 1000 * 1000 / (nsec ?: 1) >> 20);
+}
+
+int main(int argc, char **argv) {
+        unsigned int mode;
+        char *blob;
+        size_t n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#mode>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        mode = atoi(argv[1]);
+        if (mode >= _TEST_MODE_N) {
+                fprintf(stderr, "Invalid mode (available: %u)\n", _TEST_MODE_N);
+                return 77;
+        }
+
+        blob = malloc(TEST_MAX_SIZE);
+        test_buffer = malloc(TEST_MAX_SIZE);
+        assert(blob && test_buffer);
+        memset(blob, 0x5a, TEST_MAX_SIZE);
+        memset(test_buffer, 0, TEST_MAX_SIZE);
+
+        /* run with growing sizes, by a factor of 16 each */
+        for (n = 1024; n <= TEST_MAX_SIZE; n *= 16)
+                test_flatten_one(mode, 4UL * 1024 * 1024 * 1024 / n / 16 + 1, blob, n);
+
+        free(test_buffer);
+        free(blob);
+        return 0;
+}
@@ -0,0 +1,155 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Generator Performance Test
+ * This measures how fast the type generator of the test-suite produces type
+ * corpora, either by unfolding consecutive seeds into types, or by folding the
+ * types back into their seeds. Seeds start at growing powers of two, to cover
+ * seeds that fit into native integers as well as seeds that do not. Like
+ * test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gmp.h>
+#include "generator.h"
+
+#define TEST_TYPES (100000)
+#define TEST_MAX_TYPE (4096)
+
+enum {
+        TEST_DIRECTION_UNFOLD,
+        TEST_DIRECTION_FOLD,
+        _TEST_DIRECTION_N,
+};
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static size_t test_unfold(Generator *gen, const char *seed, char *type) {
+        size_t n = 0;
+        int r;
+
+        r = generator_seed_str(gen, seed, 10);
+        assert(!r);
+        generator_reset(gen);
+
+        do {
+                type[n] = generator_step(gen);
+                assert(n < TEST_MAX_TYPE);
+        } while (type[n++]);
+
+        return n - 1;
+}
+
+static void test_fold(Generator *gen, const char *type) {
+        int r;
+
+        generator_reset(gen);
+        do {
+                r = generator_feed(gen, *type);
+                assert(!r);
+        } while (*type++);
+}
+
+static void test_generator_one(unsigned int direction, unsigned int bits) {
+        uint64_t start_nsec, end_nsec;
+        char **seeds, *types, type[TEST_MAX_TYPE];
+        size_t *offsets, n_chars = 0;
+        Generator *gen;
+        unsigned int i;
+        mpz_t seed;
+
+        fprintf(stderr, "Run: types:%u bits:%u\n", TEST_TYPES, bits);
+
+        gen = generator_new();
+        seeds = calloc(TEST_TYPES, sizeof(*seeds));
+        offsets = calloc(TEST_TYPES + 1, sizeof(*offsets));
+        assert(seeds && offsets);
+
+        /* count the types first, so they can be packed into one buffer */
+        mpz_init(seed);
+        mpz_setbit(seed, bits);
+        for (i = 0; i < TEST_TYPES; ++i) {
+                seeds[i] = mpz_get_str(NULL, 10, seed);
+                mpz_add_ui(seed, seed, 1);
+                offsets[i] = n_chars;
+                n_chars += test_unfold(gen, seeds[i], type) + 1;
+        }
+        offsets[i] = n_chars;
+        mpz_clear(seed);
+
+        types = malloc(n_chars);
+        assert(types);
+        for (i = 0; i < TEST_TYPES; ++i)
+                test_unfold(gen, seeds[i], types + offsets[i]);
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < TEST_TYPES; ++i) {
+                if (direction == TEST_DIRECTION_FOLD)
+                        test_fold(gen, types + offsets[i]);
+                else
+                        test_unfold(gen, seeds[i], type);
+        }
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%u %u %" PRIu64 " %" PRIu64 "\n",
+               bits, direction, (uint64_t)(n_chars / TEST_TYPES - 1), (end_nsec - start_nsec) / TEST_TYPES);
+
+        for (i = 0; i < TEST_TYPES; ++i)
+                free(seeds[i]);
+        free(types);
+        free(offsets);
+        free(seeds);
+        generator_free(gen);
+}
+
+int main(int argc, char **argv) {
+        unsigned int direction, bits;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#direction>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        direction = atoi(argv[1]);
+        if (direction >= _TEST_DIRECTION_N) {
+                fprintf(stderr, "Invalid direction (available: %u)\n", _TEST_DIRECTION_N);
+                return 77;
+        }
+
+        fprintf(stderr, "Direction: %u\n", direction);
+
+        /* run with growing seeds, doubling their width on each iteration */
+        for (bits = 8; bits <= 512; bits <<= 1)
+                test_generator_one(direction, bits);
+
+        return 0;
+}
@@ -0,0 +1,214 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * GLib Bridge Performance Test
+ * This hands messages from c-variant to GLib and back, once by flattening
+ * them into private copies, once via libcvariant-glib. Each message is
+ * converted into a GVariant, and the GVariant is converted back into a
+ * CVariant reader. Messages are either received messages, which are backed by
+ * a single buffer, or freshly written messages, which carry their payload in
+ * a separate iovec. Besides the time, the number of copied bytes is printed.
+ * Like test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "c-variant.h"
+#include "c-variant-glib.h"
+#include "c-variant-private.h"
+
+enum {
+        TEST_BRIDGE_COPY,
+        TEST_BRIDGE_GLIB,
+        _TEST_BRIDGE_N,
+};
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static CVariant *test_message_new(uint64_t id, const void *blob, size_t n_blob) {
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new(&cv, "(tay)", 5);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "t", id);
+        c_variant_insert(cv, "ay", &(struct iovec){ .iov_base = (void *)blob, .iov_len = n_blob }, 1);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static GBytes *test_copy_to_bytes(CVariant *cv, size_t *n_copiedp) {
+        const struct iovec *vecs;
+        size_t n_vecs, i, size;
+        char *data;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = g_malloc(size);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        c_variant_free(cv);
+        *n_copiedp += size;
+        return g_bytes_new_take(data, size);
+}
+
+static CVariant *test_copy_from_gvariant(GVariant *gv, void **datap, size_t *n_copiedp) {
+        CVariant *cv;
+        size_t size;
+        int r;
+
+        size = g_variant_get_size(gv);
+        *datap = g_malloc(size ?: 1);
+        memcpy(*datap, g_variant_get_data(gv), size);
+
+        r = c_variant_new_from_buffer(&cv, "(tay)", 5, *datap, size);
+        assert(r >= 0);
+
+        *n_copiedp += size;
+        return cv;
+}
+
+static void test_bridge_one(unsigned int bridge, bool linear, uint64_t times, size_t n_blob) {
+        uint64_t i, t, start_nsec, end_nsec;
+        size_t n, n_copied = 0, n_buffer = 0;
+        const struct iovec *vecs;
+        void *blob, *buffer, *p;
+        CVariant *cv;
+        GBytes *bytes;
+        GVariant *gv;
+        int r;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " blob:%zu linear:%d\n", times, n_blob, linear);
+
+        blob = malloc(n_blob ?: 1);
+        assert(blob);
+        memset(blob, 0xff, n_blob);
+
+        /* a received message is one linear buffer; keep one around */
+        cv = test_message_new(0, blob, n_blob);
+        vecs = c_variant_get_vecs(cv, &n);
+        buffer = malloc(n_blob + 64);
+        assert(buffer);
+        for (i = 0; i < n; ++i) {
+                memcpy((char *)buffer + n_buffer, vecs[i].iov_base, vecs[i].iov_len);
+                n_buffer += vecs[i].iov_len;
+        }
+        c_variant_free(cv);
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i) {
+                if (linear) {
+                        r = c_variant_new_from_buffer(&cv, "(tay)", 5, buffer, n_buffer);
+                        assert(r >= 0);
+                } else {
+                        cv = test_message_new(0, blob, n_blob);
+                }
+
+                /* CVariant -> GVariant */
+                if (bridge == TEST_BRIDGE_GLIB) {
+                        r = c_variant_glib_to_bytes(cv, &bytes, &n);
+                        assert(r >= 0);
+                        n_copied += n;
+                } else {
+                        bytes = test_copy_to_bytes(cv, &n_copied);
+                }
+
+                gv = g_variant_new_from_bytes(G_VARIANT_TYPE("(tay)"), bytes, TRUE);
+                g_bytes_unref(bytes);
+
+                /* GVariant -> CVariant */
+                p = NULL;
+                if (bridge == TEST_BRIDGE_GLIB) {
+                        r = c_variant_glib_new_from_gvariant(&cv, gv);
+                        assert(r >= 0);
+                } else {
+                        cv = test_copy_from_gvariant(gv, &p, &n_copied);
+                }
+                g_variant_unref(gv);
+
+                r = c_variant_enter(cv, "(");
+                assert(r >= 0);
+                r = c_variant_read(cv, "t", &t);
+                assert(r >= 0 && t == 0);
+
+                c_variant_free(cv);
+                g_free(p);
+        }
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %d %u %" PRIu64 " %zu\n", n_blob, linear, bridge, end_nsec - start_nsec, n_copied);
+
+        free(buffer);
+        free(blob);
+}
+
+int main(int argc, char **argv) {
+        unsigned int bridge;
+        size_t n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#bridge>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        bridge = atoi(argv[1]);
+        if (bridge >= _TEST_BRIDGE_N) {
+                fprintf(stderr, "Invalid bridge (available: %u)\n", _TEST_BRIDGE_N);
+                return 77;
+        }
+
+        fprintf(stderr, "Bridge: %u\n", bridge);
+
+        /* run with growing blob sizes, quadrupling on each iteration */
+        for (n = 1; n <= 65536; n <<= 2) {
+                test_bridge_one(bridge, true, 100000, n);
+                test_bridge_one(bridge, false, 100000, n);
+        }
+
+        return 0;
+}
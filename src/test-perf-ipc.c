@@ -0,0 +1,678 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * IPC Transport Performance Test
+ * This sends messages between two processes, end to end, via one of several
+ * transports: unix stream sockets (length prefixed), unix seqpacket sockets,
+ * pipes fed via vmsplice(2) (length prefixed), sealed memfds passed via
+ * SCM_RIGHTS, and shared memory rings. Both sides serialize their messages
+ * with the writer and parse the received ones with the reader, including the
+ * header dictionary, and touch every page of the payload.
+ *
+ * For each payload size, messages are first streamed to the peer, which
+ * acknowledges the last one, to get the throughput. Then, messages are sent
+ * one at a time and answered by the peer, to get the round-trip latency. The
+ * result table lists payload size, transport, throughput in MB/s, and the
+ * 50th, 99th and 99.9th percentile of the round-trip time in nanoseconds.
+ * Like test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-variant.h"
+
+#define TEST_TYPE "(tsa{sv}ay)"
+#define TEST_PIPE_SIZE (1024 * 1024)
+#define TEST_RING_SIZE (4 * 1024 * 1024)
+#define TEST_SOCKET_SIZE (4 * 1024 * 1024)
+#define TEST_STREAM_BYTES (256ULL * 1024 * 1024)
+#define TEST_STREAM_MAX (100000)
+#define TEST_RTT_MAX (10000)
+#define TEST_BATCH (16)
+#define TEST_PAGE (4096)
+
+enum {
+        TEST_TRANSPORT_STREAM,
+        TEST_TRANSPORT_SEQPACKET,
+        TEST_TRANSPORT_PIPE,
+        TEST_TRANSPORT_MEMFD,
+        TEST_TRANSPORT_SHM,
+        _TEST_TRANSPORT_N,
+};
+
+typedef struct TestPin {
+        CVariant *cv;
+        uint64_t size;
+} TestPin;
+
+typedef struct TestChannel {
+        unsigned int transport;
+        int fd_in;
+        int fd_out;
+        CVariantShm *shm_in;
+        CVariantShm *shm_out;
+
+        /* last received message, and the memory backing it */
+        CVariant *current;
+        void *map;
+        size_t n_map;
+        void *buffer;
+        size_t n_buffer;
+
+        /* scratch space for gather operations */
+        struct iovec *vecs;
+        size_t n_vecs;
+
+        /* messages spliced into the pipe, which must not be freed yet */
+        TestPin *pins;
+        size_t n_pins;
+        size_t i_pin;
+} TestChannel;
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static int test_cmp_u64(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+        return (x > y) - (x < y);
+}
+
+static CVariant *test_message_new(uint64_t id, const void *blob, size_t n_blob) {
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new(&cv, TEST_TYPE, strlen(TEST_TYPE));
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "ts", id, "org.example.Sender");
+
+        c_variant_begin(cv, "a");
+        c_variant_begin(cv, "{");
+        c_variant_write(cv, "s", "size");
+        c_variant_begin(cv, "v", "u");
+        c_variant_write(cv, "u", (uint32_t)n_blob);
+        c_variant_end(cv, "v}");
+        c_variant_begin(cv, "{");
+        c_variant_write(cv, "s", "flags");
+        c_variant_begin(cv, "v", "t");
+        c_variant_write(cv, "t", id ^ UINT64_C(0xff));
+        c_variant_end(cv, "v}");
+        c_variant_end(cv, "a");
+
+        c_variant_insert(cv, "ay", &(struct iovec){ .iov_base = (void *)blob, .iov_len = n_blob }, 1);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static size_t test_message_size(CVariant *cv) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size = 0;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        return size;
+}
+
+static void test_message_parse(CVariant *cv, uint64_t id, size_t n_blob) {
+        const struct iovec *vecs;
+        const char *s, *type;
+        size_t i, j, n_vecs, n_type;
+        volatile uint8_t sink;
+        uint64_t t;
+        uint32_t u;
+        int r;
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+        r = c_variant_read(cv, "ts", &t, &s);
+        assert(r >= 0 && t == id);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+        while (c_variant_peek_count(cv) > 0) {
+                r = c_variant_enter(cv, "{");
+                assert(r >= 0);
+                r = c_variant_read(cv, "s", &s);
+                assert(r >= 0);
+                r = c_variant_enter(cv, "v");
+                assert(r >= 0);
+
+                type = c_variant_peek_type(cv, &n_type);
+                if (*type == 'u') {
+                        r = c_variant_read(cv, "u", &u);
+                        assert(r >= 0 && u == n_blob);
+                } else {
+                        r = c_variant_read(cv, "t", &t);
+                        assert(r >= 0 && t == (id ^ UINT64_C(0xff)));
+                }
+
+                r = c_variant_exit(cv, "v}");
+                assert(r >= 0);
+        }
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+        assert(c_variant_peek_count(cv) == n_blob);
+        r = c_variant_exit(cv, "a)");
+        assert(r >= 0);
+
+        /* touch the payload, like a consumer using it would */
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0; i < n_vecs; ++i)
+                for (j = 0; j < vecs[i].iov_len; j += TEST_PAGE)
+                        sink = ((const uint8_t *)vecs[i].iov_base)[j];
+        (void)sink;
+
+        assert(!c_variant_return_poison(cv));
+}
+
+static void test_write_all(int fd, struct iovec *vecs, size_t n_vecs, bool splice) {
+        ssize_t l;
+
+        while (n_vecs > 0) {
+                l = splice ? vmsplice(fd, vecs, n_vecs, 0) : writev(fd, vecs, n_vecs);
+                assert(l >= 0);
+
+                for ( ; n_vecs > 0 && (size_t)l >= vecs->iov_len; ++vecs, --n_vecs)
+                        l -= vecs->iov_len;
+
+                if (n_vecs > 0) {
+                        vecs->iov_base = (char *)vecs->iov_base + l;
+                        vecs->iov_len -= l;
+                }
+        }
+}
+
+static void test_read_all(int fd, void *data, size_t n_data) {
+        ssize_t l;
+
+        while (n_data > 0) {
+                l = read(fd, data, n_data);
+                assert(l > 0);
+                data = (char *)data + l;
+                n_data -= l;
+        }
+}
+
+static void test_channel_pair(unsigned int transport, size_t n_max, TestChannel *a, TestChannel *b) {
+        int r, sz, fds[2], pipe_ab[2], pipe_ba[2];
+        size_t n_pins;
+
+        memset(a, 0, sizeof(*a));
+        memset(b, 0, sizeof(*b));
+        a->transport = b->transport = transport;
+        a->fd_in = a->fd_out = b->fd_in = b->fd_out = -1;
+
+        switch (transport) {
+        case TEST_TRANSPORT_PIPE:
+                r = pipe2(pipe_ab, O_CLOEXEC);
+                assert(r >= 0);
+                r = pipe2(pipe_ba, O_CLOEXEC);
+                assert(r >= 0);
+
+                a->fd_out = pipe_ab[1];
+                b->fd_in = pipe_ab[0];
+                b->fd_out = pipe_ba[1];
+                a->fd_in = pipe_ba[0];
+
+                fcntl(a->fd_out, F_SETPIPE_SZ, TEST_PIPE_SIZE);
+                fcntl(b->fd_out, F_SETPIPE_SZ, TEST_PIPE_SIZE);
+
+                /*
+                 * vmsplice(2) only references the pages of the sender, so
+                 * messages must stay unmodified until read. Every message
+                 * occupies at least one pipe buffer, hence at most as many
+                 * messages as the pipe has buffers can be in flight.
+                 */
+                sz = fcntl(a->fd_out, F_GETPIPE_SZ);
+                assert(sz > 0);
+                n_pins = sz / TEST_PAGE + 1;
+
+                a->pins = calloc(n_pins, sizeof(*a->pins));
+                b->pins = calloc(n_pins, sizeof(*b->pins));
+                assert(a->pins && b->pins);
+                a->n_pins = b->n_pins = n_pins;
+                break;
+
+        case TEST_TRANSPORT_SHM:
+                fds[0] = memfd_create("test-perf-ipc", MFD_CLOEXEC);
+                assert(fds[0] >= 0);
+                fds[1] = memfd_create("test-perf-ipc", MFD_CLOEXEC);
+                assert(fds[1] >= 0);
+
+                r = c_variant_shm_new(&a->shm_out, fds[0], TEST_RING_SIZE, 0);
+                assert(r >= 0);
+                r = c_variant_shm_new(&b->shm_in, fds[0], 0, 0);
+                assert(r >= 0);
+                r = c_variant_shm_new(&b->shm_out, fds[1], TEST_RING_SIZE, 0);
+                assert(r >= 0);
+                r = c_variant_shm_new(&a->shm_in, fds[1], 0, 0);
+                assert(r >= 0);
+
+                close(fds[1]);
+                close(fds[0]);
+                break;
+
+        default:
+                r = socketpair(AF_UNIX,
+                               (transport == TEST_TRANSPORT_STREAM ? SOCK_STREAM : SOCK_SEQPACKET) | SOCK_CLOEXEC,
+                               0,
+                               fds);
+                assert(r >= 0);
+
+                /* the kernel caps this at the system limit */
+                sz = TEST_SOCKET_SIZE;
+                setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+                setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+
+                a->fd_in = a->fd_out = fds[0];
+                b->fd_in = b->fd_out = fds[1];
+                break;
+        }
+
+        a->n_buffer = b->n_buffer = n_max;
+        a->buffer = malloc(n_max);
+        b->buffer = malloc(n_max);
+        assert(a->buffer && b->buffer);
+}
+
+static bool test_channel_fits(TestChannel *ch, size_t size) {
+        socklen_t n;
+        int r, sz;
+
+        if (ch->transport != TEST_TRANSPORT_SEQPACKET)
+                return true;
+
+        /* datagrams must fit into the send buffer, minus some slack */
+        n = sizeof(sz);
+        r = getsockopt(ch->fd_out, SOL_SOCKET, SO_SNDBUF, &sz, &n);
+        assert(r >= 0);
+
+        return size + 32 <= (size_t)sz;
+}
+
+static void test_channel_recycle(TestChannel *ch) {
+        ch->current = c_variant_free(ch->current);
+
+        if (ch->shm_in)
+                c_variant_shm_release(ch->shm_in);
+
+        if (ch->map) {
+                munmap(ch->map, ch->n_map);
+                ch->map = NULL;
+                ch->n_map = 0;
+        }
+}
+
+static void test_channel_deinit(TestChannel *ch) {
+        size_t i;
+
+        test_channel_recycle(ch);
+
+        for (i = 0; i < ch->n_pins; ++i)
+                c_variant_free(ch->pins[i].cv);
+        free(ch->pins);
+
+        c_variant_shm_free(ch->shm_out);
+        c_variant_shm_free(ch->shm_in);
+
+        if (ch->fd_out >= 0 && ch->fd_out != ch->fd_in)
+                close(ch->fd_out);
+        if (ch->fd_in >= 0)
+                close(ch->fd_in);
+
+        free(ch->vecs);
+        free(ch->buffer);
+        memset(ch, 0, sizeof(*ch));
+        ch->fd_in = ch->fd_out = -1;
+}
+
+/* copy the iovecs of @cv into the scratch space, optionally behind a prefix */
+static struct iovec *test_channel_gather(TestChannel *ch, CVariant *cv, uint64_t *prefix, size_t *n_vecsp, uint64_t *sizep) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, n;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+
+        if (n_vecs + 1 > ch->n_vecs) {
+                ch->n_vecs = n_vecs + 1;
+                ch->vecs = realloc(ch->vecs, ch->n_vecs * sizeof(*ch->vecs));
+                assert(ch->vecs);
+        }
+
+        n = 0;
+        *sizep = 0;
+        if (prefix)
+                ch->vecs[n++] = (struct iovec){ .iov_base = prefix, .iov_len = sizeof(*prefix) };
+
+        for (i = 0; i < n_vecs; ++i) {
+                ch->vecs[n++] = vecs[i];
+                *sizep += vecs[i].iov_len;
+        }
+
+        if (prefix)
+                *prefix = *sizep;
+
+        *n_vecsp = n;
+        return ch->vecs;
+}
+
+static void test_channel_send_memfd(TestChannel *ch, CVariant *cv) {
+        union {
+                struct cmsghdr cmsg;
+                char buffer[CMSG_SPACE(sizeof(int))];
+        } control = {};
+        struct iovec *vecs;
+        struct msghdr msg;
+        uint64_t size;
+        size_t n_vecs;
+        ssize_t l;
+        int r, fd;
+
+        fd = memfd_create("test-perf-ipc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        assert(fd >= 0);
+
+        vecs = test_channel_gather(ch, cv, NULL, &n_vecs, &size);
+        test_write_all(fd, vecs, n_vecs, false);
+
+        r = fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+        assert(r >= 0);
+
+        msg = (struct msghdr){
+                .msg_iov = &(struct iovec){ .iov_base = &size, .iov_len = sizeof(size) },
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        control.cmsg.cmsg_level = SOL_SOCKET;
+        control.cmsg.cmsg_type = SCM_RIGHTS;
+        control.cmsg.cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(&control.cmsg), &fd, sizeof(fd));
+
+        l = sendmsg(ch->fd_out, &msg, 0);
+        assert(l == sizeof(size));
+
+        close(fd);
+}
+
+static void test_channel_send(TestChannel *ch, CVariant *cv, bool flush) {
+        struct iovec *vecs;
+        uint64_t size, prefix;
+        size_t n_vecs;
+        TestPin *pin;
+        ssize_t l;
+        int r;
+
+        switch (ch->transport) {
+        case TEST_TRANSPORT_STREAM:
+                vecs = test_channel_gather(ch, cv, &prefix, &n_vecs, &size);
+                test_write_all(ch->fd_out, vecs, n_vecs, false);
+                break;
+
+        case TEST_TRANSPORT_SEQPACKET:
+                vecs = test_channel_gather(ch, cv, NULL, &n_vecs, &size);
+                l = sendmsg(ch->fd_out, &(struct msghdr){ .msg_iov = vecs, .msg_iovlen = n_vecs }, 0);
+                assert(l >= 0 && (uint64_t)l == size);
+                break;
+
+        case TEST_TRANSPORT_PIPE:
+                pin = &ch->pins[ch->i_pin++ % ch->n_pins];
+                c_variant_free(pin->cv);
+                pin->cv = cv;
+
+                vecs = test_channel_gather(ch, cv, &pin->size, &n_vecs, &size);
+                test_write_all(ch->fd_out, vecs, n_vecs, true);
+                return;
+
+        case TEST_TRANSPORT_MEMFD:
+                test_channel_send_memfd(ch, cv);
+                break;
+
+        case TEST_TRANSPORT_SHM:
+                vecs = test_channel_gather(ch, cv, NULL, &n_vecs, &size);
+                while ((r = c_variant_shm_write(ch->shm_out, cv)) == -EAGAIN) {
+                        r = c_variant_shm_wait_writable(ch->shm_out, size, -1);
+                        assert(r >= 0);
+                }
+                assert(r >= 0);
+
+                if (flush)
+                        c_variant_shm_flush(ch->shm_out);
+                break;
+        }
+
+        c_variant_free(cv);
+}
+
+static void *test_channel_recv_memfd(TestChannel *ch, size_t *sizep) {
+        union {
+                struct cmsghdr cmsg;
+                char buffer[CMSG_SPACE(sizeof(int))];
+        } control = {};
+        struct msghdr msg;
+        uint64_t size;
+        ssize_t l;
+        void *p;
+        int fd;
+
+        msg = (struct msghdr){
+                .msg_iov = &(struct iovec){ .iov_base = &size, .iov_len = sizeof(size) },
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+
+        l = recvmsg(ch->fd_in, &msg, MSG_CMSG_CLOEXEC);
+        assert(l == sizeof(size));
+        assert(control.cmsg.cmsg_level == SOL_SOCKET && control.cmsg.cmsg_type == SCM_RIGHTS);
+        memcpy(&fd, CMSG_DATA(&control.cmsg), sizeof(fd));
+
+        p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        assert(p != MAP_FAILED);
+        close(fd);
+
+        ch->map = p;
+        ch->n_map = size;
+        *sizep = size;
+        return p;
+}
+
+static CVariant *test_channel_recv(TestChannel *ch) {
+        uint64_t size;
+        size_t n_data;
+        void *data;
+        ssize_t l;
+        int r;
+
+        test_channel_recycle(ch);
+
+        switch (ch->transport) {
+        case TEST_TRANSPORT_SEQPACKET:
+                l = recv(ch->fd_in, ch->buffer, ch->n_buffer, MSG_TRUNC);
+                assert(l > 0 && (size_t)l <= ch->n_buffer);
+                data = ch->buffer;
+                n_data = l;
+                break;
+
+        case TEST_TRANSPORT_MEMFD:
+                data = test_channel_recv_memfd(ch, &n_data);
+                break;
+
+        case TEST_TRANSPORT_SHM:
+                while ((r = c_variant_shm_read(ch->shm_in, &ch->current, TEST_TYPE, strlen(TEST_TYPE))) == -EAGAIN) {
+                        r = c_variant_shm_wait_readable(ch->shm_in, -1);
+                        assert(r >= 0);
+                }
+                assert(r >= 0);
+                return ch->current;
+
+        default:
+                test_read_all(ch->fd_in, &size, sizeof(size));
+                assert(size <= ch->n_buffer);
+                test_read_all(ch->fd_in, ch->buffer, size);
+                data = ch->buffer;
+                n_data = size;
+                break;
+        }
+
+        r = c_variant_new_from_buffer(&ch->current, TEST_TYPE, strlen(TEST_TYPE), data, n_data);
+        assert(r >= 0);
+        return ch->current;
+}
+
+static void test_serve(TestChannel *ch, uint64_t n_stream, uint64_t n_rtt, const void *blob, size_t n_blob) {
+        uint64_t i;
+
+        for (i = 0; i < n_stream; ++i)
+                test_message_parse(test_channel_recv(ch), i, n_blob);
+
+        test_channel_send(ch, test_message_new(n_stream, blob, n_blob), true);
+
+        for (i = 0; i < n_rtt; ++i) {
+                test_message_parse(test_channel_recv(ch), i, n_blob);
+                test_channel_send(ch, test_message_new(i, blob, n_blob), true);
+        }
+}
+
+static void test_transport_one(unsigned int transport, size_t n_blob) {
+        uint64_t i, n_stream, n_rtt, n_bytes, start_nsec, end_nsec, *rtts;
+        size_t n_message;
+        TestChannel a, b;
+        CVariant *cv;
+        int status;
+        void *blob;
+        pid_t pid;
+
+        n_stream = TEST_STREAM_BYTES / n_blob;
+        n_stream = n_stream > TEST_STREAM_MAX ? TEST_STREAM_MAX : n_stream;
+        n_rtt = n_stream > TEST_RTT_MAX ? TEST_RTT_MAX : n_stream;
+
+        fprintf(stderr, "Run: stream:%" PRIu64 " rtt:%" PRIu64 " blob:%zu\n", n_stream, n_rtt, n_blob);
+
+        blob = malloc(n_blob);
+        rtts = calloc(n_rtt, sizeof(*rtts));
+        assert(blob && rtts);
+        memset(blob, 0xff, n_blob);
+
+        cv = test_message_new(0, blob, n_blob);
+        n_message = test_message_size(cv);
+        c_variant_free(cv);
+
+        test_channel_pair(transport, n_message, &a, &b);
+        if (!test_channel_fits(&a, n_message)) {
+                fprintf(stderr, "Skip: message of %zu bytes exceeds transport limits\n", n_message);
+                test_channel_deinit(&b);
+                test_channel_deinit(&a);
+                free(rtts);
+                free(blob);
+                return;
+        }
+
+        pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+                test_channel_deinit(&a);
+                test_serve(&b, n_stream, n_rtt, blob, n_blob);
+                test_channel_deinit(&b);
+                _exit(0);
+        }
+
+        test_channel_deinit(&b);
+
+        /* throughput, until the peer acknowledged the last message */
+        start_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+        for (i = 0; i < n_stream; ++i)
+                test_channel_send(&a, test_message_new(i, blob, n_blob), !((i + 1) % TEST_BATCH) || i + 1 == n_stream);
+        test_message_parse(test_channel_recv(&a), n_stream, n_blob);
+        end_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+
+        n_bytes = n_stream * n_message;
+
+        /* round-trips, one message at a time */
+        for (i = 0; i < n_rtt; ++i) {
+                rtts[i] = nsec_from_clock(CLOCK_MONOTONIC);
+                test_channel_send(&a, test_message_new(i, blob, n_blob), true);
+                test_message_parse(test_channel_recv(&a), i, n_blob);
+                rtts[i] = nsec_from_clock(CLOCK_MONOTONIC) - rtts[i];
+        }
+
+        pid = waitpid(pid, &status, 0);
+        assert(pid > 0 && WIFEXITED(status) && !WEXITSTATUS(status));
+
+        qsort(rtts, n_rtt, sizeof(*rtts), test_cmp_u64);
+
+        /* print result table */
+        printf("%zu %u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+               n_blob, transport, n_bytes * 1000 / (end_nsec - start_nsec),
+               rtts[n_rtt / 2], rtts[n_rtt * 99 / 100], rtts[n_rtt * 999 / 1000]);
+
+        test_channel_deinit(&a);
+        free(rtts);
+        free(blob);
+}
+
+int main(int argc, char **argv) {
+        unsigned int transport;
+        size_t n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#transport>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        transport = atoi(argv[1]);
+        if (transport >= _TEST_TRANSPORT_N) {
+                fprintf(stderr, "Invalid transport (available: %u)\n", _TEST_TRANSPORT_N);
+                return 77;
+        }
+
+        fprintf(stderr, "Transport: %u\n", transport);
+
+        /* run with growing payloads, quadrupling on each iteration */
+        for (n = 64; n <= 1024 * 1024; n <<= 2)
+                test_transport_one(transport, n);
+
+        return 0;
+}
@@ -0,0 +1,325 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Memory Footprint Test
+ * This interposes the allocator to account every byte a serialized message
+ * costs while it is queued. There are two modes:
+ *
+ * In mode 0, one message is written and sealed for each shape and size, and
+ * the result table lists shape, number of elements, payload bytes, number of
+ * allocations, bytes allocated while writing, bytes still live after
+ * c_variant_seal(), how many of those are separately allocated data buffers
+ * (including the unused tail share left by the front/tail split), how many
+ * are taken by the variant object itself (its embedded 2k initial buffer,
+ * levels, and iovecs, plus reallocated iovec arrays), and the ratio of live
+ * to payload bytes.
+ *
+ * In mode 1, a queue of random messages is filled and drained repeatedly, and
+ * the result table periodically lists the iteration, number of queued
+ * messages, live bytes, resident set size, and the share of the RSS not used
+ * by live allocations, which approximates heap fragmentation.
+ *
+ * Allocation sizes are accounted via malloc_usable_size(), so they include
+ * the rounding of the allocator, but not its per-chunk headers. Like
+ * test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_CHURN_QUEUE (4096)
+#define TEST_CHURN_ITERATIONS (1000000)
+#define TEST_CHURN_REPORT (50000)
+
+enum {
+        TEST_MODE_SHAPES,
+        TEST_MODE_CHURN,
+        _TEST_MODE_N,
+};
+
+enum {
+        TEST_SHAPE_U32,
+        TEST_SHAPE_STRING,
+        TEST_SHAPE_STRUCT,
+        TEST_SHAPE_DICT,
+        _TEST_SHAPE_N,
+};
+
+static const char *test_shapes[] = {
+        [TEST_SHAPE_U32] = "au",
+        [TEST_SHAPE_STRING] = "as",
+        [TEST_SHAPE_STRUCT] = "a(uts)",
+        [TEST_SHAPE_DICT] = "a{sv}",
+};
+
+/*
+ * Allocator Interposition
+ * The test binary is linked statically against the library, so defining the
+ * allocator entry points here catches all its allocations. They forward to
+ * the glibc implementation, and account live bytes, allocated bytes and the
+ * number of allocations.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+static struct {
+        uint64_t n_allocs;
+        uint64_t n_allocated;
+        uint64_t n_live;
+} test_heap;
+
+static void *test_heap_account(void *p) {
+        size_t n;
+
+        if (p) {
+                n = malloc_usable_size(p);
+                ++test_heap.n_allocs;
+                test_heap.n_allocated += n;
+                test_heap.n_live += n;
+        }
+
+        return p;
+}
+
+void *malloc(size_t size) {
+        return test_heap_account(__libc_malloc(size));
+}
+
+void *calloc(size_t n, size_t size) {
+        return test_heap_account(__libc_calloc(n, size));
+}
+
+void *memalign(size_t align, size_t size) {
+        return test_heap_account(__libc_memalign(align, size));
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+        return test_heap_account(__libc_memalign(align, size));
+}
+
+int posix_memalign(void **pp, size_t align, size_t size) {
+        void *p;
+
+        p = test_heap_account(__libc_memalign(align, size));
+        if (!p)
+                return ENOMEM;
+
+        *pp = p;
+        return 0;
+}
+
+void free(void *p) {
+        if (p)
+                test_heap.n_live -= malloc_usable_size(p);
+        __libc_free(p);
+}
+
+void *realloc(void *p, size_t size) {
+        size_t n;
+
+        n = p ? malloc_usable_size(p) : 0;
+        p = __libc_realloc(p, size);
+        if (p || !size)
+                test_heap.n_live -= n;
+
+        return test_heap_account(p);
+}
+
+static uint64_t test_rss(void) {
+        unsigned long size, resident;
+        FILE *f;
+        int r;
+
+        f = fopen("/proc/self/statm", "re");
+        assert(f);
+        r = fscanf(f, "%lu %lu", &size, &resident);
+        assert(r == 2);
+        fclose(f);
+
+        return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static CVariant *test_message_new(unsigned int shape, size_t n) {
+        const char *type = test_shapes[shape];
+        char key[32];
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, type, strlen(type));
+        assert(r >= 0);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i) {
+                switch (shape) {
+                case TEST_SHAPE_U32:
+                        c_variant_write(cv, "u", (uint32_t)i);
+                        break;
+                case TEST_SHAPE_STRING:
+                        c_variant_write(cv, "s", "org.example.Name");
+                        break;
+                case TEST_SHAPE_STRUCT:
+                        c_variant_write(cv, "(uts)", (uint32_t)i, (uint64_t)i, "foobar");
+                        break;
+                case TEST_SHAPE_DICT:
+                        sprintf(key, "key-%zu", i);
+                        c_variant_begin(cv, "{");
+                        c_variant_write(cv, "s", key);
+                        c_variant_begin(cv, "v", "t");
+                        c_variant_write(cv, "t", (uint64_t)i);
+                        c_variant_end(cv, "v}");
+                        break;
+                }
+        }
+        c_variant_end(cv, "a");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_message_measure(CVariant *cv, uint64_t *payloadp, uint64_t *buffersp) {
+        const struct iovec *vecs;
+        size_t i, n_vecs;
+        const char *owned;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        owned = (const char *)(cv->vecs + cv->n_vecs);
+
+        *payloadp = 0;
+        *buffersp = 0;
+        for (i = 0; i < n_vecs; ++i) {
+                *payloadp += vecs[i].iov_len;
+
+                /* buffers might have been realigned, see c_variant_buffer_free() */
+                if (owned[i])
+                        *buffersp += malloc_usable_size((void *)((unsigned long)vecs[i].iov_base & ~7UL));
+        }
+}
+
+static void test_shapes_one(unsigned int shape, size_t n) {
+        uint64_t n_allocs, n_allocated, n_live, n_payload, n_buffers;
+        CVariant *cv;
+
+        fprintf(stderr, "Run: shape:%s elements:%zu\n", test_shapes[shape], n);
+
+        n_allocs = test_heap.n_allocs;
+        n_allocated = test_heap.n_allocated;
+        n_live = test_heap.n_live;
+
+        cv = test_message_new(shape, n);
+
+        n_allocs = test_heap.n_allocs - n_allocs;
+        n_allocated = test_heap.n_allocated - n_allocated;
+        n_live = test_heap.n_live - n_live;
+        test_message_measure(cv, &n_payload, &n_buffers);
+
+        /* print result table */
+        printf("%s %zu %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %.2f\n",
+               test_shapes[shape], n, n_payload, n_allocs, n_allocated, n_live,
+               n_buffers, n_live - n_buffers, (double)n_live / n_payload);
+
+        c_variant_free(cv);
+}
+
+static void test_churn(void) {
+        CVariant *queue[TEST_CHURN_QUEUE] = {};
+        size_t head = 0, tail = 0;
+        bool filling = true;
+        unsigned int shape;
+        uint64_t i, rss;
+        size_t n;
+
+        fprintf(stderr, "Run: queue:%u iterations:%u\n", TEST_CHURN_QUEUE, TEST_CHURN_ITERATIONS);
+
+        srand(0xdecade);
+
+        for (i = 1; i <= TEST_CHURN_ITERATIONS; ++i) {
+                /* fill the queue up, then drain it to an eighth, repeatedly */
+                if (tail - head >= TEST_CHURN_QUEUE)
+                        filling = false;
+                else if (tail - head <= TEST_CHURN_QUEUE / 8)
+                        filling = true;
+
+                /* mostly follow the current direction, but interleave both */
+                if (tail - head < TEST_CHURN_QUEUE && (tail == head || filling == !!(rand() % 4))) {
+                        shape = rand() % _TEST_SHAPE_N;
+                        n = 1 << (rand() % 11);
+                        queue[tail++ % TEST_CHURN_QUEUE] = test_message_new(shape, n);
+                } else {
+                        c_variant_free(queue[head++ % TEST_CHURN_QUEUE]);
+                }
+
+                if (i % TEST_CHURN_REPORT)
+                        continue;
+
+                rss = test_rss();
+
+                /* print result table */
+                printf("%" PRIu64 " %zu %" PRIu64 " %" PRIu64 " %.2f\n",
+                       i, tail - head, test_heap.n_live, rss,
+                       rss > test_heap.n_live ? (double)(rss - test_heap.n_live) / rss : 0.0);
+        }
+
+        while (tail > head)
+                c_variant_free(queue[head++ % TEST_CHURN_QUEUE]);
+}
+
+int main(int argc, char **argv) {
+        unsigned int mode, shape;
+        size_t n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#mode>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        mode = atoi(argv[1]);
+        if (mode >= _TEST_MODE_N) {
+                fprintf(stderr, "Invalid mode (available: %u)\n", _TEST_MODE_N);
+                return 77;
+        }
+
+        fprintf(stderr, "Mode: %u\n", mode);
+
+        if (mode == TEST_MODE_CHURN) {
+                test_churn();
+                return 0;
+        }
+
+        /* run all shapes with growing sizes, quadrupling on each iteration */
+        for (shape = 0; shape < _TEST_SHAPE_N; ++shape)
+                for (n = 1; n <= 65536; n <<= 2)
+                        test_shapes_one(shape, n);
+
+        return 0;
+}
@@ -0,0 +1,271 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Reader Performance Test
+ * This contains deserialization benchmarks, comparing different internal
+ * strategies of the reader by toggling them on otherwise equal variants. Like
+ * test-perf, it is only useful to get ballpark figures.
+ *
+ * The decode benchmarks parse an array of "(uts)" entries from a single linear
+ * buffer, once via the generic multi-vector engine, once via the linear
+ * engine. The nesting benchmark enters and exits a deeply nested type on a
+ * growing set of concurrent readers.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_NESTING (32)
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void *test_message_new(size_t n_entries, size_t *sizep) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        CVariant *cv;
+        char *data;
+        int r;
+
+        r = c_variant_new(&cv, "a(uts)", 6);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n_entries; ++i)
+                c_variant_write(cv, "(uts)", (uint32_t)i, (uint64_t)i, "foobar");
+        c_variant_end(cv, "a");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        /* flatten into a single linear buffer, as received from the wire */
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size ?: 1);
+        assert(data);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        c_variant_free(cv);
+        *sizep = size;
+        return data;
+}
+
+static void test_message_read(const void *data, size_t size, unsigned int engine, size_t n_entries) {
+        const char *s;
+        uint64_t t;
+        uint32_t u;
+        CVariant *cv;
+        size_t i, n;
+        int r;
+
+        r = c_variant_new_from_buffer(&cv, "a(uts)", 6, data, size);
+        assert(r >= 0);
+
+        cv->linear = engine;
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+
+        n = c_variant_peek_count(cv);
+        assert(n == n_entries);
+
+        for (i = 0; i < n; ++i) {
+                r = c_variant_read(cv, "(uts)", &u, &t, &s);
+                assert(r >= 0 && u == i && t == i);
+        }
+
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+
+        c_variant_free(cv);
+}
+
+static void test_decode_one(unsigned int engine, uint64_t times, size_t n_entries) {
+        uint64_t i, start_nsec, end_nsec;
+        size_t size;
+        void *data;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " entries:%zu\n", times, n_entries);
+
+        data = test_message_new(n_entries, &size);
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_message_read(data, size, engine, n_entries);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                test_message_read(data, size, engine, n_entries);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %u %" PRIu64 "\n", n_entries, engine, end_nsec - start_nsec);
+
+        free(data);
+}
+
+static void test_decode(unsigned int engine) {
+        size_t n;
+
+        /* run with growing number of entries, doubling on each iteration */
+        for (n = 1; n <= 4096; n <<= 1)
+                test_decode_one(engine, 1000UL * 1000UL / n + 1, n);
+}
+
+static void test_decode_generic(void) {
+        test_decode(0);
+}
+
+static void test_decode_linear(void) {
+        test_decode(1);
+}
+
+static void test_nesting_run(CVariant **readers, size_t n_readers, const char *enter, const char *leave) {
+        CVariant *cv;
+        uint32_t u;
+        size_t i;
+        int r;
+
+        for (i = 0; i < n_readers; ++i) {
+                cv = readers[i];
+
+                c_variant_rewind(cv);
+
+                r = c_variant_enter(cv, enter);
+                assert(r >= 0);
+                r = c_variant_read(cv, "u", &u);
+                assert(r >= 0 && u == i);
+                r = c_variant_exit(cv, leave);
+                assert(r >= 0);
+        }
+}
+
+static void test_nesting_one(uint64_t times, size_t n_readers) {
+        char type[TEST_NESTING + TEST_NESTING + 2], enter[TEST_NESTING + 1], leave[TEST_NESTING + 1];
+        uint64_t i, start_nsec, end_nsec;
+        CVariant **readers;
+        uint32_t *data;
+        int r;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " readers:%zu\n", times, n_readers);
+
+        /* type: nested tuples around a single 'u' */
+        memset(type, '(', TEST_NESTING);
+        type[TEST_NESTING] = 'u';
+        memset(type + TEST_NESTING + 1, ')', TEST_NESTING);
+        type[sizeof(type) - 1] = 0;
+        memset(enter, '(', TEST_NESTING);
+        enter[TEST_NESTING] = 0;
+        memset(leave, ')', TEST_NESTING);
+        leave[TEST_NESTING] = 0;
+
+        readers = calloc(n_readers, sizeof(*readers));
+        data = calloc(n_readers, sizeof(*data));
+        assert(readers && data);
+
+        for (i = 0; i < n_readers; ++i) {
+                data[i] = htole32(i);
+                r = c_variant_new_from_buffer(&readers[i], type, strlen(type), &data[i], sizeof(*data));
+                assert(r >= 0);
+        }
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_nesting_run(readers, n_readers, enter, leave);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                test_nesting_run(readers, n_readers, enter, leave);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %" PRIu64 "\n", n_readers, end_nsec - start_nsec);
+
+        for (i = 0; i < n_readers; ++i)
+                c_variant_free(readers[i]);
+        free(data);
+        free(readers);
+}
+
+static void test_nesting(void) {
+        size_t n;
+
+        /*
+         * Iterate a growing set of concurrent readers, each entering and
+         * exiting a deeply nested type. This measures the cache footprint of
+         * the saved parent levels.
+         */
+        for (n = 1; n <= 16384; n <<= 1)
+                test_nesting_one(100UL * 1000UL / n + 1, n);
+}
+
+static const struct {
+        const char *name;
+        void (*run) (void);
+} test_benchmarks[] = {
+        { "decode-generic", test_decode_generic },
+        { "decode-linear", test_decode_linear },
+        { "nesting", test_nesting },
+};
+
+int main(int argc, char **argv) {
+        unsigned int benchmark;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#benchmark>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        benchmark = atoi(argv[1]);
+        if (benchmark >= sizeof(test_benchmarks) / sizeof(*test_benchmarks)) {
+                fprintf(stderr, "Invalid benchmark (available: %zu)\n",
+                        sizeof(test_benchmarks) / sizeof(*test_benchmarks));
+                return 77;
+        }
+
+        fprintf(stderr, "Benchmark: %s\n", test_benchmarks[benchmark].name);
+        test_benchmarks[benchmark].run();
+        return 0;
+}
@@ -0,0 +1,245 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Shared Memory Ring Performance Test
+ * This streams messages from a producer to a consumer process, once via a
+ * shared memory ring, once via a unix socket. The producer serializes each
+ * message and transmits it, the consumer parses the message and reads its
+ * header. For the ring, the consumer parses in place. For the socket, it
+ * receives into a private buffer first. Like test-perf, it is only useful to
+ * get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_RING_SIZE (4 * 1024 * 1024)
+#define TEST_BATCH (16)
+
+enum {
+        TEST_TRANSPORT_SHM,
+        TEST_TRANSPORT_UNIX,
+        _TEST_TRANSPORT_N,
+};
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static CVariant *test_message_new(uint64_t id, const void *blob, size_t n_blob) {
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new(&cv, "(tay)", 5);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "t", id);
+        c_variant_insert(cv, "ay", &(struct iovec){ .iov_base = (void *)blob, .iov_len = n_blob }, 1);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_message_parse(CVariant *cv, uint64_t id) {
+        uint64_t t;
+        int r;
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+        r = c_variant_read(cv, "t", &t);
+        assert(r >= 0 && t == id);
+}
+
+static void test_produce(unsigned int transport, int fd, uint64_t times, size_t n_blob) {
+        const struct iovec *vecs;
+        CVariantShm *shm = NULL;
+        size_t n_vecs;
+        CVariant *cv;
+        uint64_t i;
+        void *blob;
+        int r;
+
+        blob = malloc(n_blob ?: 1);
+        assert(blob);
+        memset(blob, 0xff, n_blob);
+
+        if (transport == TEST_TRANSPORT_SHM) {
+                r = c_variant_shm_new(&shm, fd, 0, 0);
+                assert(r >= 0);
+        }
+
+        for (i = 0; i < times; ++i) {
+                cv = test_message_new(i, blob, n_blob);
+
+                if (transport == TEST_TRANSPORT_SHM) {
+                        while ((r = c_variant_shm_write(shm, cv)) == -EAGAIN) {
+                                r = c_variant_shm_wait_writable(shm, n_blob + 16, -1);
+                                assert(r >= 0);
+                        }
+                        assert(r >= 0);
+
+                        if (!(i % TEST_BATCH))
+                                c_variant_shm_flush(shm);
+                } else {
+                        vecs = c_variant_get_vecs(cv, &n_vecs);
+                        r = sendmsg(fd,
+                                    &(struct msghdr){ .msg_iov = (struct iovec *)vecs, .msg_iovlen = n_vecs },
+                                    0);
+                        assert(r >= 0);
+                }
+
+                c_variant_free(cv);
+        }
+
+        c_variant_shm_free(shm);
+        free(blob);
+}
+
+static void test_consume(unsigned int transport, int fd, uint64_t times, size_t n_blob) {
+        CVariantShm *shm = NULL;
+        size_t n_buffer;
+        void *buffer = NULL;
+        CVariant *cv;
+        uint64_t i;
+        ssize_t l;
+        int r;
+
+        if (transport == TEST_TRANSPORT_SHM) {
+                r = c_variant_shm_new(&shm, fd, 0, 0);
+                assert(r >= 0);
+        } else {
+                n_buffer = n_blob + 64;
+                buffer = malloc(n_buffer);
+                assert(buffer);
+        }
+
+        for (i = 0; i < times; ++i) {
+                if (transport == TEST_TRANSPORT_SHM) {
+                        while ((r = c_variant_shm_read(shm, &cv, "(tay)", 5)) == -EAGAIN) {
+                                r = c_variant_shm_wait_readable(shm, -1);
+                                assert(r >= 0);
+                        }
+                        assert(r >= 0);
+                } else {
+                        l = recv(fd, buffer, n_buffer, 0);
+                        assert(l > 0);
+                        r = c_variant_new_from_buffer(&cv, "(tay)", 5, buffer, l);
+                        assert(r >= 0);
+                }
+
+                test_message_parse(cv, i);
+                c_variant_free(cv);
+
+                if (shm && !(i % TEST_BATCH))
+                        c_variant_shm_release(shm);
+        }
+
+        c_variant_shm_free(shm);
+        free(buffer);
+}
+
+static void test_transport_one(unsigned int transport, uint64_t times, size_t n_blob) {
+        uint64_t start_nsec, end_nsec;
+        int r, fds[2], status;
+        CVariantShm *shm;
+        pid_t pid;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " blob:%zu\n", times, n_blob);
+
+        if (transport == TEST_TRANSPORT_SHM) {
+                fds[0] = memfd_create("test-perf-shm", 0);
+                assert(fds[0] >= 0);
+                fds[1] = dup(fds[0]);
+                assert(fds[1] >= 0);
+
+                r = c_variant_shm_new(&shm, fds[0], TEST_RING_SIZE, 0);
+                assert(r >= 0);
+                c_variant_shm_free(shm);
+        } else {
+                r = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+                assert(r >= 0);
+        }
+
+        start_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+
+        pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+                close(fds[0]);
+                test_consume(transport, fds[1], times, n_blob);
+                _exit(0);
+        }
+
+        close(fds[1]);
+        test_produce(transport, fds[0], times, n_blob);
+
+        pid = waitpid(pid, &status, 0);
+        assert(pid > 0 && WIFEXITED(status) && !WEXITSTATUS(status));
+
+        end_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+
+        /* print result table */
+        printf("%zu %u %" PRIu64 "\n", n_blob, transport, end_nsec - start_nsec);
+
+        close(fds[0]);
+}
+
+int main(int argc, char **argv) {
+        unsigned int transport;
+        size_t n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#transport>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        transport = atoi(argv[1]);
+        if (transport >= _TEST_TRANSPORT_N) {
+                fprintf(stderr, "Invalid transport (available: %u)\n", _TEST_TRANSPORT_N);
+                return 77;
+        }
+
+        fprintf(stderr, "Transport: %u\n", transport);
+
+        /* run with growing blob sizes, quadrupling on each iteration */
+        for (n = 1; n <= 65536; n <<= 2)
+                test_transport_one(transport, 100000, n);
+
+        return 0;
+}
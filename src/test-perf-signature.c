@@ -0,0 +1,159 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Signature Performance Test
+ * This benchmarks validation of single types, as done for 'v' elements and
+ * received variants, with the selected CPU implementation. Each type is
+ * validated via c_variant_signature_one() (with its direct paths and scan),
+ * and via the plain parser (c_variant_signature_next()). The result table
+ * lists the name of the type, its length, and the time spent per validation
+ * in both cases, in nanoseconds. Like test-perf, it is only useful to get
+ * ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static int test_parse(const char *signature, size_t n_signature, CVariantType *infop) {
+        int r;
+
+        r = c_variant_signature_next(signature, n_signature, infop);
+        if (r < 0)
+                return r;
+
+        return (r == 0 || infop->n_type != n_signature) ? -EMEDIUMTYPE : 0;
+}
+
+static uint64_t test_run(int (*fn) (const char *, size_t, CVariantType *),
+                         const char *signature,
+                         size_t n_signature,
+                         uint64_t times,
+                         bool valid) {
+        uint64_t i, start_nsec, end_nsec;
+        CVariantType info;
+        int r;
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i) {
+                r = fn(signature, n_signature, &info);
+                assert(valid ? r == 0 : r < 0);
+        }
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i)
+                fn(signature, n_signature, &info);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        return (end_nsec - start_nsec) / times;
+}
+
+static void test_signature_one(const char *name, const char *signature, size_t n_signature, bool valid) {
+        uint64_t times, nsec_one, nsec_parse;
+
+        times = 100UL * 1000UL * 1000UL / (n_signature * 8 + 16) + 1;
+
+        fprintf(stderr, "Run: %s times:%" PRIu64 " length:%zu\n", name, times, n_signature);
+
+        nsec_one = test_run(c_variant_signature_one, signature, n_signature, times, valid);
+        nsec_parse = test_run(test_parse, signature, n_signature, times, valid);
+
+        /* print result table */
+        printf("%s %zu %" PRIu64 " %" PRIu64 "\n", name, n_signature, nsec_one, nsec_parse);
+}
+
+int main(int argc, char **argv) {
+        static const struct {
+                const char *name;
+                const char *signature;
+        } types[] = {
+                { "basic", "u" },
+                { "variant", "v" },
+                { "flat", "(uuttd)" },
+                { "flat-dynamic", "(susuv)" },
+                { "dict", "a{sv}" },
+                { "nested", "(sa{sv}as)" },
+                { "complex", "a(ua{s(uv)}a(st)m(bs))" },
+        };
+        char *signature;
+        size_t i, n;
+        int r;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <cpu>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        r = c_variant_cpu_select(argv[1]);
+        if (r < 0) {
+                fprintf(stderr, "Unavailable CPU implementation: %s\n", argv[1]);
+                return 77;
+        }
+
+        fprintf(stderr, "Benchmark: signature (%s)\n", c_variant_cpu->name);
+
+        for (i = 0; i < sizeof(types) / sizeof(*types); ++i)
+                test_signature_one(types[i].name, types[i].signature, strlen(types[i].signature), true);
+
+        signature = malloc(C_VARIANT_MAX_SIGNATURE);
+        assert(signature);
+
+        /* long, valid tuple of dictionaries */
+        for (n = 64; n <= 4096; n *= 4) {
+                signature[0] = '(';
+                for (i = 1; i + 5 < n; i += 5)
+                        memcpy(signature + i, "a{sv}", 5);
+                memset(signature + i, 'u', n - i - 1);
+                signature[n - 1] = ')';
+                test_signature_one("long", signature, n, true);
+        }
+
+        /* untrusted types: (excessive) nesting, flat lists, and invalid elements */
+        for (n = 64; n <= 4096; n *= 4) {
+                memset(signature, '(', n / 2);
+                memset(signature + n / 2, ')', n / 2);
+                test_signature_one("deep", signature, n, n / 2 <= C_VARIANT_MAX_LEVEL);
+
+                memset(signature, 'u', n);
+                test_signature_one("flat-invalid", signature, n, false);
+
+                memset(signature, 'a', n - 1);
+                signature[n - 1] = '$';
+                test_signature_one("bound-invalid", signature, n, false);
+        }
+
+        free(signature);
+        return 0;
+}
@@ -0,0 +1,288 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Multi-Core Scaling Test
+ * This runs a workload on a growing number of threads, from one up to the
+ * number of CPUs available, and measures how well it scales. Each thread runs
+ * independent cycles for a fixed wall-clock period, and the result table
+ * lists the number of threads, the workload, the aggregate throughput in
+ * cycles per second, and the efficiency per thread, in percent of the
+ * single-threaded throughput. The workloads are:
+ *
+ *   0: every cycle writes a message, seals it, reads it back, and frees it,
+ *      with all buffers taken from the heap
+ *   1: like 0, but each thread allocates its buffers from a private pool
+ *   2: every cycle parses the same, shared, read-only message
+ *
+ * The first two are dominated by allocations, so they show allocator
+ * contention. The last one only allocates the variant object itself. Like
+ * test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "c-variant.h"
+
+#define TEST_TYPE "(ta{sv}a(uts))"
+#define TEST_ENTRIES (64)
+#define TEST_POOL_SIZE (1024 * 1024)
+#define TEST_DURATION_MSEC (1000)
+
+enum {
+        TEST_WORKLOAD_HEAP,
+        TEST_WORKLOAD_POOL,
+        TEST_WORKLOAD_SHARED,
+        _TEST_WORKLOAD_N,
+};
+
+typedef struct TestThread {
+        pthread_t thread;
+        unsigned int workload;
+        uint64_t n_cycles;
+} __attribute__((__aligned__(64))) TestThread;
+
+static pthread_barrier_t test_barrier;
+static bool test_stop;
+static void *test_shared;
+static size_t test_n_shared;
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static unsigned int test_n_cpus(void) {
+        cpu_set_t cpus;
+        int r;
+
+        r = sched_getaffinity(0, sizeof(cpus), &cpus);
+        if (r < 0 || CPU_COUNT(&cpus) < 1)
+                return 1;
+
+        return CPU_COUNT(&cpus);
+}
+
+static CVariant *test_message_new(CVariantPool *pool, uint64_t id) {
+        char key[32];
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new_with_pool(&cv, TEST_TYPE, strlen(TEST_TYPE), pool);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "t", id);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < TEST_ENTRIES / 4; ++i) {
+                sprintf(key, "key-%zu", i);
+                c_variant_begin(cv, "{");
+                c_variant_write(cv, "s", key);
+                c_variant_begin(cv, "v", "t");
+                c_variant_write(cv, "t", (uint64_t)i);
+                c_variant_end(cv, "v}");
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < TEST_ENTRIES; ++i)
+                c_variant_write(cv, "(uts)", (uint32_t)i, (uint64_t)i, "foobar");
+        c_variant_end(cv, "a");
+
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_message_parse(CVariant *cv, uint64_t id) {
+        const char *s;
+        uint64_t t;
+        uint32_t u;
+        size_t i;
+        int r;
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+        r = c_variant_read(cv, "t", &t);
+        assert(r >= 0 && t == id);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+        for (i = 0; c_variant_peek_count(cv) > 0; ++i) {
+                r = c_variant_read(cv, "{sv}", &s, "t", &t);
+                assert(r >= 0 && t == i);
+        }
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+        for (i = 0; c_variant_peek_count(cv) > 0; ++i) {
+                r = c_variant_read(cv, "(uts)", &u, &t, &s);
+                assert(r >= 0 && u == i && t == i);
+        }
+        r = c_variant_exit(cv, "a)");
+        assert(r >= 0);
+
+        assert(!c_variant_return_poison(cv));
+}
+
+static void *test_thread_fn(void *userdata) {
+        TestThread *thread = userdata;
+        CVariantPool *pool = NULL;
+        CVariant *cv;
+        uint64_t i;
+        int r;
+
+        if (thread->workload == TEST_WORKLOAD_POOL) {
+                r = c_variant_pool_new(&pool, TEST_POOL_SIZE, 0);
+                assert(r >= 0);
+        }
+
+        pthread_barrier_wait(&test_barrier);
+
+        for (i = 0; !__atomic_load_n(&test_stop, __ATOMIC_RELAXED); ++i) {
+                if (thread->workload == TEST_WORKLOAD_SHARED) {
+                        r = c_variant_new_from_buffer(&cv, TEST_TYPE, strlen(TEST_TYPE),
+                                                      test_shared, test_n_shared);
+                        assert(r >= 0);
+                        test_message_parse(cv, 0);
+                } else {
+                        cv = test_message_new(pool, i);
+                        test_message_parse(cv, i);
+                }
+
+                c_variant_free(cv);
+        }
+
+        thread->n_cycles = i;
+        c_variant_pool_free(pool);
+        return NULL;
+}
+
+static uint64_t test_workload_one(unsigned int workload, unsigned int n_threads, uint64_t single) {
+        uint64_t start_nsec, end_nsec, n_cycles, throughput;
+        TestThread *threads;
+        unsigned int i;
+        int r;
+
+        fprintf(stderr, "Run: threads:%u msec:%u\n", n_threads, TEST_DURATION_MSEC);
+
+        threads = aligned_alloc(__alignof(*threads), n_threads * sizeof(*threads));
+        assert(threads);
+        memset(threads, 0, n_threads * sizeof(*threads));
+
+        __atomic_store_n(&test_stop, false, __ATOMIC_RELAXED);
+        r = pthread_barrier_init(&test_barrier, NULL, n_threads + 1);
+        assert(!r);
+
+        for (i = 0; i < n_threads; ++i) {
+                threads[i].workload = workload;
+                r = pthread_create(&threads[i].thread, NULL, test_thread_fn, threads + i);
+                assert(!r);
+        }
+
+        pthread_barrier_wait(&test_barrier);
+        start_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+
+        nanosleep(&(struct timespec){ .tv_sec = TEST_DURATION_MSEC / 1000,
+                                      .tv_nsec = (TEST_DURATION_MSEC % 1000) * 1000000L }, NULL);
+        __atomic_store_n(&test_stop, true, __ATOMIC_RELAXED);
+
+        n_cycles = 0;
+        for (i = 0; i < n_threads; ++i) {
+                r = pthread_join(threads[i].thread, NULL);
+                assert(!r);
+                n_cycles += threads[i].n_cycles;
+        }
+
+        end_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+        pthread_barrier_destroy(&test_barrier);
+
+        throughput = n_cycles * 1000000000 / (end_nsec - start_nsec);
+
+        /* print result table */
+        printf("%u %u %" PRIu64 " %" PRIu64 "\n",
+               n_threads, workload, throughput, single ? throughput * 100 / (single * n_threads) : 100);
+
+        free(threads);
+        return throughput;
+}
+
+int main(int argc, char **argv) {
+        unsigned int workload, n, n_cpus;
+        const struct iovec *vecs;
+        uint64_t single = 0;
+        size_t i, n_vecs;
+        CVariant *cv;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#workload>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        workload = atoi(argv[1]);
+        if (workload >= _TEST_WORKLOAD_N) {
+                fprintf(stderr, "Invalid workload (available: %u)\n", _TEST_WORKLOAD_N);
+                return 77;
+        }
+
+        fprintf(stderr, "Workload: %u\n", workload);
+
+        /* the shared message is flattened once, and never written to */
+        cv = test_message_new(NULL, 0);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0; i < n_vecs; ++i)
+                test_n_shared += vecs[i].iov_len;
+        test_shared = malloc(test_n_shared);
+        assert(test_shared);
+        for (test_n_shared = 0, i = 0; i < n_vecs; ++i) {
+                memcpy((char *)test_shared + test_n_shared, vecs[i].iov_base, vecs[i].iov_len);
+                test_n_shared += vecs[i].iov_len;
+        }
+        c_variant_free(cv);
+
+        /* run with growing thread counts, doubling up to the number of CPUs */
+        n_cpus = test_n_cpus();
+        for (n = 1; n < n_cpus; n <<= 1) {
+                if (n == 1)
+                        single = test_workload_one(workload, n, 0);
+                else
+                        test_workload_one(workload, n, single);
+        }
+        test_workload_one(workload, n_cpus, single);
+
+        free(test_shared);
+        return 0;
+}
@@ -0,0 +1,345 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Training Workload
+ * This is the workload used by "make pgo", both to train the instrumented
+ * build and to compare the optimized builds against each other. It mixes the
+ * hot paths of the other benchmarks: serializing arrays of "(uts)" entries
+ * (like test-perf-reader), reading them back from a linear buffer, parsing
+ * signatures of varying complexity, and writing and reading "a{sv}"
+ * dictionaries, which are dominated by variants. Each workload is run the
+ * given number of rounds, and its CPU time is printed in nanoseconds. Like
+ * test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_ENTRIES (1024)
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void *test_flatten(CVariant *cv, size_t *sizep) {
+        void *data;
+        int r;
+
+        r = c_variant_flatten(cv, 0, NULL, 0, sizep);
+        assert(!r || r == -ENOBUFS);
+
+        data = malloc(*sizep ?: 1);
+        assert(data);
+
+        r = c_variant_flatten(cv, 0, data, *sizep, sizep);
+        assert(!r);
+
+        return data;
+}
+
+static CVariant *test_array_write(void) {
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, "a(uts)", 6);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < TEST_ENTRIES; ++i)
+                c_variant_write(cv, "(uts)", (uint32_t)i, (uint64_t)i, "foobar");
+        c_variant_end(cv, "a");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_array_read(const void *data, size_t size) {
+        const char *s;
+        uint64_t t;
+        uint32_t u;
+        CVariant *cv;
+        size_t i, n;
+        int r;
+
+        r = c_variant_new_from_buffer(&cv, "a(uts)", 6, data, size);
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+
+        n = c_variant_peek_count(cv);
+        assert(n == TEST_ENTRIES);
+
+        for (i = 0; i < n; ++i) {
+                r = c_variant_read(cv, "(uts)", &u, &t, &s);
+                assert(r >= 0 && u == i && t == i);
+        }
+
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+
+        c_variant_free(cv);
+}
+
+static CVariant *test_dict_write(void) {
+        CVariant *cv;
+        char key[32];
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, "a{sv}", 5);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < TEST_ENTRIES; ++i) {
+                sprintf(key, "key-%zu", i);
+
+                c_variant_begin(cv, "{");
+                c_variant_write(cv, "s", key);
+                switch (i % 4) {
+                case 0:
+                        c_variant_begin(cv, "v", "u");
+                        c_variant_write(cv, "u", (uint32_t)i);
+                        break;
+                case 1:
+                        c_variant_begin(cv, "v", "s");
+                        c_variant_write(cv, "s", key);
+                        break;
+                case 2:
+                        c_variant_begin(cv, "v", "(tb)");
+                        c_variant_write(cv, "(tb)", (uint64_t)i, true);
+                        break;
+                default:
+                        c_variant_begin(cv, "v", "v");
+                        c_variant_begin(cv, "v", "as");
+                        c_variant_write(cv, "as", 2, key, key);
+                        c_variant_end(cv, "v");
+                        break;
+                }
+                c_variant_end(cv, "v");
+                c_variant_end(cv, "}");
+        }
+        c_variant_end(cv, "a");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_dict_read(const void *data, size_t size) {
+        const char *key, *type, *s;
+        size_t i, n, n_type;
+        CVariant *cv;
+        uint64_t t;
+        uint32_t u;
+        bool b;
+        int r;
+
+        r = c_variant_new_from_buffer(&cv, "a{sv}", 5, data, size);
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+
+        n = c_variant_peek_count(cv);
+        assert(n == TEST_ENTRIES);
+
+        for (i = 0; i < n; ++i) {
+                r = c_variant_enter(cv, "{");
+                assert(r >= 0);
+                r = c_variant_read(cv, "s", &key);
+                assert(r >= 0);
+
+                type = c_variant_peek_type(cv, &n_type);
+                assert(n_type == 1 && *type == 'v');
+
+                r = c_variant_enter(cv, "v");
+                assert(r >= 0);
+
+                type = c_variant_peek_type(cv, &n_type);
+                switch (*type) {
+                case 'u':
+                        r = c_variant_read(cv, "u", &u);
+                        assert(r >= 0 && u == i);
+                        break;
+                case 's':
+                        r = c_variant_read(cv, "s", &s);
+                        assert(r >= 0 && !strcmp(s, key));
+                        break;
+                case '(':
+                        r = c_variant_read(cv, "(tb)", &t, &b);
+                        assert(r >= 0 && t == i && b);
+                        break;
+                default:
+                        r = c_variant_read(cv, "v", "as", 2, &s, &s);
+                        assert(r >= 0 && !strcmp(s, key));
+                        break;
+                }
+
+                r = c_variant_exit(cv, "v}");
+                assert(r >= 0);
+        }
+
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+
+        c_variant_free(cv);
+}
+
+static uint64_t test_writer(unsigned int rounds) {
+        uint64_t start_nsec, end_nsec;
+        unsigned int i;
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < rounds; ++i) {
+                c_variant_free(test_array_write());
+                c_variant_free(test_dict_write());
+        }
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        return end_nsec - start_nsec;
+}
+
+static uint64_t test_reader(unsigned int rounds) {
+        uint64_t start_nsec, end_nsec;
+        unsigned int i;
+        CVariant *cv;
+        size_t size;
+        void *data;
+
+        cv = test_array_write();
+        data = test_flatten(cv, &size);
+        c_variant_free(cv);
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < rounds; ++i)
+                test_array_read(data, size);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        free(data);
+        return end_nsec - start_nsec;
+}
+
+static uint64_t test_signature(unsigned int rounds) {
+        static const char *types[] = {
+                "u",
+                "(uts)",
+                "a{sv}",
+                "(yyyyuua(yv))",
+                "a{oa{sa{sv}}}",
+                "((((((((u))))))))",
+                "(a(uts)mmvasa{st}(bnqiuxtdsog)v)",
+        };
+        uint64_t start_nsec, end_nsec;
+        const char *type;
+        CVariantType info;
+        unsigned int i, j;
+        size_t n_type;
+        CVariant *cv;
+        int r;
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < rounds * 256; ++i) {
+                for (j = 0; j < sizeof(types) / sizeof(*types); ++j) {
+                        type = types[j];
+                        n_type = strlen(type);
+
+                        while ((r = c_variant_signature_next(type, n_type, &info)) > 0) {
+                                type += info.n_type;
+                                n_type -= info.n_type;
+                        }
+                        assert(!r);
+
+                        r = c_variant_new(&cv, types[j], strlen(types[j]));
+                        assert(r >= 0);
+                        c_variant_free(cv);
+                }
+        }
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        return end_nsec - start_nsec;
+}
+
+static uint64_t test_dict(unsigned int rounds) {
+        uint64_t start_nsec, end_nsec;
+        unsigned int i;
+        CVariant *cv;
+        size_t size;
+        void *data;
+
+        cv = test_dict_write();
+        data = test_flatten(cv, &size);
+        c_variant_free(cv);
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < rounds; ++i)
+                test_dict_read(data, size);
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        free(data);
+        return end_nsec - start_nsec;
+}
+
+static const struct {
+        const char *name;
+        uint64_t (*run) (unsigned int rounds);
+} test_workloads[] = {
+        { "writer", test_writer },
+        { "reader", test_reader },
+        { "signature", test_signature },
+        { "dict", test_dict },
+};
+
+int main(int argc, char **argv) {
+        unsigned int rounds;
+        size_t i;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#rounds>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        rounds = atoi(argv[1]);
+        if (rounds < 1) {
+                fprintf(stderr, "Invalid number of rounds\n");
+                return 77;
+        }
+
+        /* print result table */
+        for (i = 0; i < sizeof(test_workloads) / sizeof(*test_workloads); ++i)
+                printf("%s %" PRIu64 "\n", test_workloads[i].name, test_workloads[i].run(rounds));
+
+        return 0;
+}
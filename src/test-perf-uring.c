@@ -0,0 +1,206 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * io_uring Performance Test
+ * This marshals the message of test-perf and transmits it into a memfd, once
+ * via one pwritev() per message (like test_message_write6() of test-perf),
+ * once via io_uring with TEST_BATCH messages per io_uring_enter(), and once
+ * via io_uring fixed-buffer writes from a registered buffer pool. Like
+ * test-perf, it is only useful to get ballpark figures.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+#include "test-ring.h"
+
+#define TEST_BATCH (32)
+
+enum {
+        TEST_XMIT_PWRITEV,
+        TEST_XMIT_URING_WRITEV,
+        TEST_XMIT_URING_FIXED,
+        _TEST_XMIT_N,
+};
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static CVariant *test_message_new(CVariantPool *pool, const void *blob, size_t n_blob) {
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new_with_pool(&cv, "(uuttay)", 8, pool);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "uutt", 1, 2, (uint64_t)3, (uint64_t)n_blob);
+        c_variant_insert(cv, "ay", &(struct iovec){ .iov_base = (void *)blob, .iov_len = n_blob }, 1);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_xmit_batch(TestRing *ring,
+                            CVariantPool *pool,
+                            unsigned int xmit,
+                            int fd,
+                            const void *blob,
+                            size_t n_blob) {
+        struct io_uring_sqe sqes[TEST_BATCH * 4];
+        CVariant *cvs[TEST_BATCH];
+        struct io_uring_cqe cqe;
+        const struct iovec *vecs;
+        size_t i, n_vecs, n_sqes;
+        int r;
+
+        n_sqes = 0;
+        for (i = 0; i < TEST_BATCH; ++i) {
+                cvs[i] = test_message_new(pool, blob, n_blob);
+
+                switch (xmit) {
+                case TEST_XMIT_PWRITEV:
+                        vecs = c_variant_get_vecs(cvs[i], &n_vecs);
+                        r = pwritev(fd, vecs, n_vecs, 0);
+                        assert(r >= 0);
+                        break;
+                case TEST_XMIT_URING_WRITEV:
+                        r = c_variant_uring_prep_writev(cvs[i], sqes + n_sqes, 4, fd, 0);
+                        assert(r > 0);
+                        n_sqes += r;
+                        break;
+                case TEST_XMIT_URING_FIXED:
+                        r = c_variant_uring_prep_write_fixed(cvs[i], sqes + n_sqes, 4, fd, 0);
+                        assert(r > 0);
+                        n_sqes += r;
+                        break;
+                }
+        }
+
+        if (n_sqes > 0) {
+                r = test_ring_submit(ring, sqes, n_sqes, n_sqes);
+                assert(r == (int)n_sqes);
+
+                for (i = 0; i < n_sqes; ++i) {
+                        r = test_ring_wait(ring, &cqe);
+                        assert(r >= 0 && cqe.res >= 0);
+                }
+        }
+
+        for (i = 0; i < TEST_BATCH; ++i)
+                c_variant_free(cvs[i]);
+}
+
+static void test_xmit_one(TestRing *ring,
+                          CVariantPool *pool,
+                          unsigned int xmit,
+                          uint64_t times,
+                          size_t n_blob) {
+        uint64_t i, start_nsec, end_nsec;
+        void *blob;
+        int fd;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " blob:%zu\n", times, n_blob);
+
+        fd = memfd_create("test-perf-uring", 0);
+        assert(fd >= 0);
+
+        blob = malloc(n_blob);
+        assert(blob);
+        memset(blob, 0xff, n_blob);
+
+        /* do some test runs to initialize caches; don't account them */
+        for (i = 0; i < times / 10; ++i)
+                test_xmit_batch(ring, pool, xmit, fd, blob, n_blob);
+
+        /* do real tests and measure time */
+        start_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+        for (i = 0; i < times; ++i)
+                test_xmit_batch(ring, pool, xmit, fd, blob, n_blob);
+        end_nsec = nsec_from_clock(CLOCK_MONOTONIC);
+
+        /* print result table */
+        printf("%zu %u %" PRIu64 "\n", n_blob, xmit, end_nsec - start_nsec);
+
+        free(blob);
+        close(fd);
+}
+
+int main(int argc, char **argv) {
+        CVariantPool *pool = NULL;
+        unsigned int xmit;
+        TestRing ring;
+        size_t n;
+        int r;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#xmitter>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        xmit = atoi(argv[1]);
+        if (xmit >= _TEST_XMIT_N) {
+                fprintf(stderr, "Invalid xmitter (available: %u)\n", _TEST_XMIT_N);
+                return 77;
+        }
+
+        r = test_ring_init(&ring, TEST_BATCH * 4);
+        if (r < 0) {
+                fprintf(stderr, "Cannot setup io_uring: %s\n", strerror(-r));
+                return 77;
+        }
+
+        if (xmit == TEST_XMIT_URING_FIXED) {
+                r = c_variant_pool_new(&pool, 16 * 1024 * 1024, 0);
+                assert(r >= 0);
+
+                r = test_ring_register(&ring, IORING_REGISTER_BUFFERS, c_variant_pool_get_vec(pool), 1);
+                if (r < 0) {
+                        fprintf(stderr, "Cannot register buffers: %s\n", strerror(-r));
+                        return 77;
+                }
+        }
+
+        fprintf(stderr, "Xmitter: %u\n", xmit);
+
+        /* run with growing blob sizes, quadrupling on each iteration */
+        for (n = 1; n <= 65536; n <<= 2)
+                test_xmit_one(&ring, pool, xmit, 20000 / TEST_BATCH + 1, n);
+
+        test_ring_deinit(&ring);
+        c_variant_pool_free(pool);
+        return 0;
+}
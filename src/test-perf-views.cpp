@@ -0,0 +1,211 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * C++ Views Performance Test
+ * This iterates arrays of type "au", "as", and "a{sv}" of a received message,
+ * once via the vararg C API, reading each element separately, once via the
+ * views of c-variant-views.hpp. Like test-perf, it is only useful to get
+ * ballpark figures.
+ */
+
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+#include "c-variant.h"
+#include "c-variant-views.hpp"
+
+enum {
+        TEST_API_VARARG,
+        TEST_API_VIEWS,
+        _TEST_API_N,
+};
+
+static uint64_t nsec_from_clock(clockid_t clock) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(clock, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static std::vector<char> test_message_new(size_t n) {
+        const struct iovec *vecs;
+        std::vector<char> data;
+        std::string s;
+        size_t i, n_vecs;
+        CVariant *cv;
+        int r;
+
+        r = c_variant_new(&cv, "(auasa{sv})", 11);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i)
+                c_variant_write(cv, "u", (uint32_t)i);
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i) {
+                s = "string-" + std::to_string(i);
+                c_variant_write(cv, "s", s.c_str());
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i) {
+                s = "key-" + std::to_string(i);
+                c_variant_begin(cv, "{");
+                c_variant_write(cv, "s", s.c_str());
+                c_variant_begin(cv, "v", "u");
+                c_variant_write(cv, "u", (uint32_t)i);
+                c_variant_end(cv, "v");
+                c_variant_end(cv, "}");
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0; i < n_vecs; ++i)
+                data.insert(data.end(), (char *)vecs[i].iov_base, (char *)vecs[i].iov_base + vecs[i].iov_len);
+
+        c_variant_free(cv);
+        return data;
+}
+
+static uint64_t test_iterate_vararg(CVariant *cv) {
+        const char *key, *s;
+        uint64_t sum = 0;
+        uint32_t u;
+        int r;
+
+        c_variant_enter(cv, "(a");
+        while (c_variant_peek_count(cv) > 0) {
+                c_variant_read(cv, "u", &u);
+                sum += u;
+        }
+        c_variant_exit(cv, "a");
+
+        c_variant_enter(cv, "a");
+        while (c_variant_peek_count(cv) > 0) {
+                c_variant_read(cv, "s", &s);
+                sum += strlen(s);
+        }
+        c_variant_exit(cv, "a");
+
+        c_variant_enter(cv, "a");
+        while (c_variant_peek_count(cv) > 0) {
+                c_variant_read(cv, "{sv}", &key, "u", &u);
+                sum += strlen(key) + u;
+        }
+        c_variant_exit(cv, "a)");
+
+        r = c_variant_return_poison(cv);
+        assert(!r);
+        return sum;
+}
+
+static uint64_t test_iterate_views(CVariant *cv) {
+        uint64_t sum = 0;
+        int r;
+
+        c_variant_enter(cv, "(");
+
+        for (uint32_t u : cv::array_view<uint32_t>(cv).span())
+                sum += u;
+
+        for (std::string_view s : cv::array_view<std::string_view>(cv))
+                sum += s.size();
+
+        for (auto [key, val] : cv::dict_view<std::string_view, cv::variant_ref>(cv))
+                sum += key.size() + val.get<uint32_t>();
+
+        c_variant_exit(cv, ")");
+
+        r = c_variant_return_poison(cv);
+        assert(!r);
+        return sum;
+}
+
+static void test_api_one(unsigned int api, uint64_t times, size_t n) {
+        uint64_t i, sum, expected = 0, start_nsec, end_nsec;
+        std::vector<char> data;
+        CVariant *cv;
+        int r;
+
+        fprintf(stderr, "Run: times:%" PRIu64 " elements:%zu\n", times, n);
+
+        data = test_message_new(n);
+
+        start_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+        for (i = 0; i < times; ++i) {
+                r = c_variant_new_from_buffer(&cv, "(auasa{sv})", 11, data.data(), data.size());
+                assert(r >= 0);
+
+                if (api == TEST_API_VIEWS)
+                        sum = test_iterate_views(cv);
+                else
+                        sum = test_iterate_vararg(cv);
+
+                assert(!i || sum == expected);
+                expected = sum;
+
+                c_variant_free(cv);
+        }
+        end_nsec = nsec_from_clock(CLOCK_THREAD_CPUTIME_ID);
+
+        /* print result table */
+        printf("%zu %u %" PRIu64 "\n", n, api, (end_nsec - start_nsec) / times);
+}
+
+int main(int argc, char **argv) {
+        unsigned int api;
+        size_t n;
+
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <#api>\n", program_invocation_short_name);
+                return 77;
+        }
+
+        api = atoi(argv[1]);
+        if (api >= _TEST_API_N) {
+                fprintf(stderr, "Invalid API (available: %u)\n", _TEST_API_N);
+                return 77;
+        }
+
+        fprintf(stderr, "API: %u\n", api);
+
+        /* run with growing arrays, quadrupling on each iteration */
+        for (n = 1; n <= 16384; n <<= 2)
+                test_api_one(api, 1 + 1000000 / n, n);
+
+        return 0;
+}
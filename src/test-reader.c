@@ -23,12 +23,34 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include "c-variant.h"
 #include "c-variant-private.h"
 
+static bool test_linear;
+
+static int test_new_from_buffer(CVariant **cvp, const char *type, const void *data, size_t n_data) {
+        int r;
+
+        /*
+         * Variants backed by a single buffer use the linear reader engine. To
+         * run all tests against the generic engine as well, we clear the flag
+         * again, if requested by the caller.
+         */
+
+        r = c_variant_new_from_buffer(cvp, type, strlen(type), data, n_data);
+        if (r >= 0 && !test_linear) {
+                assert((*cvp)->linear);
+                (*cvp)->linear = false;
+        }
+
+        return r;
+}
+
 static void test_reader_basic(void) {
         const char *type;
         unsigned int u1;
@@ -37,8 +59,7 @@ static void test_reader_basic(void) {
 
         /* simple 'u' type */
         type = "u";
-        r = c_variant_new_from_buffer(&cv, type, strlen(type),
-                                      "\xff\x00\xff\x00", 4);
+        r = test_new_from_buffer(&cv, type, "\xff\x00\xff\x00", 4);
         assert(r >= 0);
 
         u1 = 0;
@@ -62,8 +83,7 @@ static void test_reader_basic(void) {
 
         /* compound '(u)' type */
         type = "(u)";
-        r = c_variant_new_from_buffer(&cv, type, strlen(type),
-                                      "\xff\x00\xff\x00", 4);
+        r = test_new_from_buffer(&cv, type, "\xff\x00\xff\x00", 4);
         assert(r >= 0);
 
         u1 = 0;
@@ -78,8 +98,7 @@ static void test_reader_basic(void) {
 
         /* trivial array 'au' */
         type = "au";
-        r = c_variant_new_from_buffer(&cv, type, strlen(type),
-                                      "\xff\x00\xff\x00", 4);
+        r = test_new_from_buffer(&cv, type, "\xff\x00\xff\x00", 4);
         assert(r >= 0);
 
         u1 = 0;
@@ -97,8 +116,7 @@ static void test_reader_basic(void) {
 
         /* trivial maybe 'mu' */
         type = "mu";
-        r = c_variant_new_from_buffer(&cv, type, strlen(type),
-                                      "\xff\x00\xff\x00", 4);
+        r = test_new_from_buffer(&cv, type, "\xff\x00\xff\x00", 4);
         assert(r >= 0);
 
         u1 = 0;
@@ -113,8 +131,7 @@ static void test_reader_basic(void) {
 
         /* trivial variant 'v', 'u' */
         type = "v";
-        r = c_variant_new_from_buffer(&cv, type, strlen(type),
-                                      "\xff\x00\xff\x00\0u", 6);
+        r = test_new_from_buffer(&cv, type, "\xff\x00\xff\x00\0u", 6);
         assert(r >= 0);
 
         u1 = 0;
@@ -147,7 +164,7 @@ static void test_reader_compound(void) {
 
         /* allocate variant and read each entry sequentially */
 
-        r = c_variant_new_from_buffer(&cv, type, strlen(type), data, sizeof(data) - 1);
+        r = test_new_from_buffer(&cv, type, data, sizeof(data) - 1);
         assert(r >= 0);
 
         r = c_variant_enter(cv, "(");
@@ -196,8 +213,169 @@ static void test_reader_compound(void) {
         assert(!cv);
 }
 
+static void test_reader_fixed(void) {
+        struct header {
+                uint32_t a;
+                uint32_t b;
+                uint64_t c;
+                uint64_t d;
+                double e;
+        } h = { 1, 2, 3, 4, 5.5 }, zero = {}, buffer;
+        const struct header *p;
+        uint64_t data[9];
+        struct iovec vecs[2];
+        unsigned int u1;
+        CVariant *cv;
+        int r;
+
+        /* aligned, linear data is returned in place */
+        memcpy(data, &h, sizeof(h));
+        r = test_new_from_buffer(&cv, "(uuttd)", data, sizeof(h));
+        assert(r >= 0);
+
+        r = c_variant_peek_fixed(cv, "(uuttd)", (const void **)&p, &buffer);
+        assert(r >= 0);
+        assert(p == (const void *)data);
+        assert(!memcmp(p, &h, sizeof(h)));
+        assert(c_variant_peek_count(cv) == 0);
+
+        cv = c_variant_free(cv);
+
+        /* misaligned data is copied */
+        memcpy((char *)data + 1, &h, sizeof(h));
+        r = test_new_from_buffer(&cv, "(uuttd)", (char *)data + 1, sizeof(h));
+        assert(r >= 0);
+
+        r = c_variant_peek_fixed(cv, "(uuttd)", (const void **)&p, &buffer);
+        assert(r >= 0);
+        assert(p == &buffer);
+        assert(!memcmp(p, &h, sizeof(h)));
+
+        cv = c_variant_free(cv);
+
+        /* data spanning multiple vectors is gathered */
+        memcpy(data, &h, sizeof(h));
+        memcpy(data + 4, "\xff\x00\xff\x00", 4);
+        vecs[0] = (struct iovec){ data, 13 };
+        vecs[1] = (struct iovec){ (char *)data + 13, sizeof(h) + 8 - 13 };
+        r = c_variant_new_from_vecs(&cv, "((uuttd)u)", 10, vecs, 2);
+        assert(r >= 0);
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+
+        r = c_variant_peek_fixed(cv, "(uuttd)", (const void **)&p, &buffer);
+        assert(r >= 0);
+        assert(p == &buffer);
+        assert(!memcmp(p, &h, sizeof(h)));
+
+        u1 = 0;
+        r = c_variant_read(cv, "u", &u1);
+        assert(r >= 0);
+        assert(u1 == 0x00ff00ff);
+
+        cv = c_variant_free(cv);
+
+        /* truncated data yields the default value */
+        r = test_new_from_buffer(&cv, "(uuttd)", data, 16);
+        assert(r >= 0);
+
+        memset(&buffer, 0xff, sizeof(buffer));
+        r = c_variant_peek_fixed(cv, "(uuttd)", (const void **)&p, &buffer);
+        assert(r >= 0);
+        assert(p == &buffer);
+        assert(!memcmp(p, &zero, sizeof(zero)));
+
+        cv = c_variant_free(cv);
+
+        /* mismatching types yield the default value, invalid types fail */
+        r = test_new_from_buffer(&cv, "(uuttd)", data, sizeof(h));
+        assert(r >= 0);
+
+        r = c_variant_peek_fixed(cv, "(uutts)", (const void **)&p, &buffer);
+        assert(r == -EMEDIUMTYPE);
+        r = c_variant_peek_fixed(cv, "(uu", (const void **)&p, &buffer);
+        assert(r == -EMEDIUMTYPE);
+
+        memset(&buffer, 0xff, sizeof(buffer));
+        r = c_variant_peek_fixed(cv, "(uutdt)", (const void **)&p, &buffer);
+        assert(r == -EBADRQC);
+        assert(p == &buffer);
+        assert(!memcmp(p, &zero, sizeof(zero)));
+
+        cv = c_variant_free(cv);
+
+        r = c_variant_peek_fixed(NULL, "()", (const void **)&p, &buffer);
+        assert(r >= 0);
+        r = c_variant_peek_fixed(NULL, "u", (const void **)&p, &buffer);
+        assert(r == -EBADRQC);
+}
+
+static void test_reader_nested(void) {
+        const char *type;
+        unsigned int u1;
+        CVariant *cv;
+        size_t i, n;
+        int r;
+
+        /*
+         * Nest variants deeper than the pre-allocated levels, so parent
+         * levels must be saved across multiple states. Then read it back.
+         */
+
+        r = c_variant_new(&cv, "v", 1);
+        assert(r >= 0);
+
+        for (i = 0; i < 128; ++i) {
+                r = c_variant_begin(cv, "v", (i < 127) ? "v" : "u");
+                assert(r >= 0);
+        }
+
+        r = c_variant_write(cv, "u", 0xabcdU);
+        assert(r >= 0);
+
+        for (i = 0; i < 128; ++i) {
+                r = c_variant_end(cv, "v");
+                assert(r >= 0);
+        }
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        for (n = 0; n < 128; ++n) {
+                r = c_variant_enter(cv, "v");
+                assert(r >= 0);
+        }
+
+        type = c_variant_peek_type(cv, &n);
+        assert(n == 1 && *type == 'u');
+
+        u1 = 0;
+        r = c_variant_read(cv, "u", &u1);
+        assert(r >= 0);
+        assert(u1 == 0xabcdU);
+
+        for (n = 0; n < 128; ++n) {
+                r = c_variant_exit(cv, "v");
+                assert(r >= 0);
+        }
+
+        assert(c_variant_peek_count(cv) == 0);
+
+        cv = c_variant_free(cv);
+}
+
 int main(int argc, char **argv) {
-        test_reader_basic();
-        test_reader_compound();
+        unsigned int i;
+
+        /* run everything on the generic and the linear engine */
+        for (i = 0; i < 2; ++i) {
+                test_linear = i;
+                test_reader_basic();
+                test_reader_compound();
+                test_reader_fixed();
+        }
+
+        test_reader_nested();
+
         return 0;
 }
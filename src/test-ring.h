@@ -0,0 +1,177 @@
+#pragma once
+
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Minimal io_uring Instance
+ * The io_uring tests and benchmarks must not depend on liburing, so this
+ * provides a tiny ring implementation on top of the raw syscalls. It only
+ * supports what the tests need: copying prepared SQEs into the ring,
+ * submitting them, and reaping completions.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct TestRing {
+        int fd;
+        unsigned int n_sqes;
+        unsigned int n_cqes;
+        unsigned int *sq_head;
+        unsigned int *sq_tail;
+        unsigned int *sq_array;
+        unsigned int *cq_head;
+        unsigned int *cq_tail;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        void *sq_map;
+        void *cq_map;
+        size_t n_sq_map;
+        size_t n_cq_map;
+} TestRing;
+
+static inline void test_ring_deinit(TestRing *ring) {
+        if (ring->sqes)
+                munmap(ring->sqes, ring->n_sqes * sizeof(*ring->sqes));
+        if (ring->cq_map && ring->cq_map != ring->sq_map)
+                munmap(ring->cq_map, ring->n_cq_map);
+        if (ring->sq_map)
+                munmap(ring->sq_map, ring->n_sq_map);
+        if (ring->fd >= 0)
+                close(ring->fd);
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = -1;
+}
+
+static inline int test_ring_init(TestRing *ring, unsigned int n_entries) {
+        struct io_uring_params params = {};
+        unsigned int i;
+        void *p;
+
+        memset(ring, 0, sizeof(*ring));
+
+        ring->fd = syscall(__NR_io_uring_setup, n_entries, &params);
+        if (ring->fd < 0)
+                return -errno;
+
+        ring->n_sqes = params.sq_entries;
+        ring->n_cqes = params.cq_entries;
+        ring->n_sq_map = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        ring->n_cq_map = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                if (ring->n_cq_map > ring->n_sq_map)
+                        ring->n_sq_map = ring->n_cq_map;
+                ring->n_cq_map = ring->n_sq_map;
+        }
+
+        p = mmap(NULL, ring->n_sq_map, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 ring->fd, IORING_OFF_SQ_RING);
+        if (p == MAP_FAILED)
+                goto error;
+        ring->sq_map = p;
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                ring->cq_map = ring->sq_map;
+        } else {
+                p = mmap(NULL, ring->n_cq_map, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_CQ_RING);
+                if (p == MAP_FAILED)
+                        goto error;
+                ring->cq_map = p;
+        }
+
+        p = mmap(NULL, ring->n_sqes * sizeof(*ring->sqes), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+        if (p == MAP_FAILED)
+                goto error;
+        ring->sqes = p;
+
+        ring->sq_head = (void *)((char *)ring->sq_map + params.sq_off.head);
+        ring->sq_tail = (void *)((char *)ring->sq_map + params.sq_off.tail);
+        ring->sq_array = (void *)((char *)ring->sq_map + params.sq_off.array);
+        ring->cq_head = (void *)((char *)ring->cq_map + params.cq_off.head);
+        ring->cq_tail = (void *)((char *)ring->cq_map + params.cq_off.tail);
+        ring->cqes = (void *)((char *)ring->cq_map + params.cq_off.cqes);
+
+        /* SQE slots are used in order, so the index array is static */
+        for (i = 0; i < ring->n_sqes; ++i)
+                ring->sq_array[i] = i;
+
+        return 0;
+
+error:
+        test_ring_deinit(ring);
+        return -ENOMEM;
+}
+
+static inline int test_ring_register(TestRing *ring, unsigned int opcode, const void *arg, unsigned int n_args) {
+        int r;
+
+        r = syscall(__NR_io_uring_register, ring->fd, opcode, arg, n_args);
+        return r < 0 ? -errno : r;
+}
+
+static inline int test_ring_submit(TestRing *ring, const struct io_uring_sqe *sqes, size_t n_sqes, size_t n_wait) {
+        unsigned int i, tail;
+        int r;
+
+        tail = *ring->sq_tail;
+        assert(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) + n_sqes <= ring->n_sqes);
+
+        for (i = 0; i < n_sqes; ++i)
+                ring->sqes[(tail + i) & (ring->n_sqes - 1)] = sqes[i];
+
+        __atomic_store_n(ring->sq_tail, tail + n_sqes, __ATOMIC_RELEASE);
+
+        r = syscall(__NR_io_uring_enter, ring->fd, n_sqes, n_wait,
+                    n_wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        return r < 0 ? -errno : r;
+}
+
+static inline bool test_ring_reap(TestRing *ring, struct io_uring_cqe *cqe) {
+        unsigned int head;
+
+        head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+                return false;
+
+        *cqe = ring->cqes[head & (ring->n_cqes - 1)];
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+}
+
+static inline int test_ring_wait(TestRing *ring, struct io_uring_cqe *cqe) {
+        int r;
+
+        while (!test_ring_reap(ring, cqe)) {
+                r = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                if (r < 0 && errno != EINTR)
+                        return -errno;
+        }
+
+        return 0;
+}
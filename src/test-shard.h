@@ -0,0 +1,352 @@
+#pragma once
+
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Sharded Seed Runner
+ * The generator enumerates the type space by seed. This runs a test callback
+ * on the types of a range of seeds, sharded across one worker process per
+ * CPU, each with its own Generator. Seeds are split into chunks of
+ * TEST_SHARD_CHUNK, which are interleaved between the workers, so each worker
+ * only publishes the number of chunks it completed. From those, the parent
+ * derives the first seed not tested yet, which it periodically saves as
+ * checkpoint, together with the throughput so far. A run with the same range
+ * and checkpoint file resumes from there.
+ *
+ * Workers are processes rather than threads, since the test callbacks are
+ * assertion based and neither thread-safe nor allocation-free. If a worker
+ * fails, the remaining workers are stopped, the checkpoint is saved, and the
+ * seed the worker was testing is reported.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "generator.h"
+
+#define TEST_SHARD_CHUNK (64)
+#define TEST_SHARD_TICK_MSEC (10)
+#define TEST_SHARD_REPORT_TICKS (100)
+
+typedef void (*TestShardFn) (Generator *gen, const char *seed, const char *type);
+
+typedef struct TestShardWorker {
+        pid_t pid;
+        uint64_t n_chunks;
+        uint64_t n_types;
+        uint64_t current;
+} TestShardWorker;
+
+static inline uint64_t test_shard_nsec(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static inline unsigned int test_shard_n_cpus(void) {
+        cpu_set_t cpus;
+        int r;
+
+        r = sched_getaffinity(0, sizeof(cpus), &cpus);
+        if (r < 0 || CPU_COUNT(&cpus) < 1)
+                return 1;
+
+        return CPU_COUNT(&cpus);
+}
+
+static inline char *test_shard_seed(mpz_t first, uint64_t offset) {
+        mpz_t seed;
+        char *s;
+
+        mpz_init_set_ui(seed, offset >> 32);
+        mpz_mul_2exp(seed, seed, 32);
+        mpz_add_ui(seed, seed, offset & UINT32_MAX);
+        mpz_add(seed, seed, first);
+        s = mpz_get_str(NULL, 10, seed);
+        assert(s);
+        mpz_clear(seed);
+
+        return s;
+}
+
+static inline char *test_shard_type(Generator *gen, const char *seed) {
+        size_t i = 0, n = 0;
+        char c, *s = NULL;
+        int r;
+
+        r = generator_seed_str(gen, seed, 10);
+        assert(!r);
+        generator_reset(gen);
+
+        do {
+                c = generator_step(gen);
+                if (i >= n) {
+                        n = n ? (n * 2) : 128;
+                        s = realloc(s, n);
+                        assert(s);
+                }
+                s[i++] = c;
+        } while (c);
+
+        return s;
+}
+
+static inline _Noreturn void test_shard_work(TestShardWorker *worker,
+                                             unsigned int index,
+                                             unsigned int n_workers,
+                                             mpz_t first,
+                                             uint64_t count,
+                                             TestShardFn fn) {
+        uint64_t chunk, i, end;
+        Generator *gen;
+        char *seed, *type;
+
+        gen = generator_new();
+
+        for (chunk = index; chunk * TEST_SHARD_CHUNK < count; chunk += n_workers) {
+                end = (chunk + 1) * TEST_SHARD_CHUNK;
+                if (end > count)
+                        end = count;
+
+                for (i = chunk * TEST_SHARD_CHUNK; i < end; ++i) {
+                        __atomic_store_n(&worker->current, i, __ATOMIC_RELAXED);
+
+                        seed = test_shard_seed(first, i);
+                        type = test_shard_type(gen, seed);
+                        fn(gen, seed, type);
+                        free(type);
+                        free(seed);
+
+                        __atomic_fetch_add(&worker->n_types, 1, __ATOMIC_RELAXED);
+                }
+
+                __atomic_fetch_add(&worker->n_chunks, 1, __ATOMIC_RELEASE);
+        }
+
+        generator_free(gen);
+        _exit(0);
+}
+
+static inline uint64_t test_shard_done(TestShardWorker *workers, unsigned int n_workers, uint64_t count) {
+        uint64_t chunk, min = UINT64_MAX;
+        unsigned int i;
+
+        /* the first chunk not completed by worker i is n_chunks * n + i */
+        for (i = 0; i < n_workers; ++i) {
+                chunk = __atomic_load_n(&workers[i].n_chunks, __ATOMIC_ACQUIRE) * n_workers + i;
+                if (chunk < min)
+                        min = chunk;
+        }
+
+        if (min >= (count + TEST_SHARD_CHUNK - 1) / TEST_SHARD_CHUNK)
+                return count;
+
+        return min * TEST_SHARD_CHUNK;
+}
+
+static inline int test_shard_load(const char *path, const char *first, uint64_t count, uint64_t *donep) {
+        uint64_t saved_count, done;
+        char saved_first[4096];
+        FILE *f;
+        int r;
+
+        f = fopen(path, "re");
+        if (!f)
+                return errno == ENOENT ? 0 : -errno;
+
+        r = fscanf(f, "%4095s %" SCNu64 " %" SCNu64, saved_first, &saved_count, &done);
+        fclose(f);
+
+        if (r != 3 || strcmp(saved_first, first) || saved_count != count || done > count)
+                return -EINVAL;
+
+        *donep = done;
+        return 0;
+}
+
+static inline int test_shard_save(const char *path, const char *first, uint64_t count, uint64_t done) {
+        char tmp[4096];
+        FILE *f;
+        int r;
+
+        r = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        if (r < 0 || (size_t)r >= sizeof(tmp))
+                return -ENAMETOOLONG;
+
+        f = fopen(tmp, "we");
+        if (!f)
+                return -errno;
+
+        fprintf(f, "%s %" PRIu64 " %" PRIu64 "\n", first, count, done);
+        r = fclose(f);
+        if (r < 0 || rename(tmp, path) < 0)
+                return -errno;
+
+        return 0;
+}
+
+static inline void test_shard_report(FILE *f, uint64_t resumed, uint64_t done, uint64_t count,
+                                     uint64_t n_types, uint64_t nsec) {
+        fprintf(f, "%" PRIu64 "/%" PRIu64 " seeds done, %" PRIu64 " types in %" PRIu64 " msec, %" PRIu64 " types/sec\n",
+                resumed + done, resumed + count, n_types, nsec / 1000000,
+                nsec >= 1000000 ? n_types * 1000 / (nsec / 1000000) : 0);
+}
+
+/**
+ * test_shard_run() - run test callback on a range of seeds, in parallel
+ * @first:              first seed, in decimal representation
+ * @count:              number of seeds to test
+ * @checkpoint:         path to the checkpoint file, or NULL
+ * @fn:                 test callback
+ *
+ * This invokes @fn on the types of all seeds in [@first, @first + @count), in
+ * parallel on all CPUs. @fn is called with the generator of the worker, which
+ * it is free to reset and reuse. If @checkpoint is given, progress is saved to
+ * it, and seeds already covered by it are skipped.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static inline int test_shard_run(const char *first, uint64_t count, const char *checkpoint, TestShardFn fn) {
+        uint64_t start_nsec, resumed = 0, done, n_types;
+        unsigned int i, n_workers, n_running, tick = 0;
+        TestShardWorker *workers, *failed = NULL;
+        int r, status;
+        mpz_t base;
+        pid_t pid, parent;
+        char *seed;
+
+        if (mpz_init_set_str(base, first, 10) < 0) {
+                mpz_clear(base);
+                return -EINVAL;
+        }
+
+        if (checkpoint) {
+                r = test_shard_load(checkpoint, first, count, &resumed);
+                if (r < 0) {
+                        mpz_clear(base);
+                        return r;
+                }
+        }
+
+        /* continue behind the checkpoint */
+        seed = test_shard_seed(base, resumed);
+        mpz_set_str(base, seed, 10);
+        free(seed);
+        count -= resumed;
+
+        n_workers = test_shard_n_cpus();
+        workers = mmap(NULL, n_workers * sizeof(*workers), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        assert(workers != MAP_FAILED);
+
+        fprintf(stderr, "Testing %" PRIu64 " seeds from %s, skipping %" PRIu64 ", on %u workers\n",
+                resumed + count, first, resumed, n_workers);
+        fflush(NULL);
+
+        start_nsec = test_shard_nsec();
+        parent = getpid();
+
+        for (i = 0; i < n_workers; ++i) {
+                pid = fork();
+                assert(pid >= 0);
+                if (!pid) {
+                        /* do not outlive the parent if it is killed */
+                        r = prctl(PR_SET_PDEATHSIG, SIGKILL);
+                        assert(r >= 0);
+                        if (getppid() != parent)
+                                _exit(1);
+
+                        test_shard_work(workers + i, i, n_workers, base, count, fn);
+                }
+
+                workers[i].pid = pid;
+        }
+
+        for (n_running = n_workers; n_running > 0; ) {
+                pid = waitpid(-1, &status, WNOHANG);
+                assert(pid >= 0);
+
+                if (pid > 0) {
+                        --n_running;
+                        for (i = 0; i < n_workers; ++i) {
+                                if (workers[i].pid != pid)
+                                        continue;
+
+                                workers[i].pid = 0;
+                                if (!failed && (!WIFEXITED(status) || WEXITSTATUS(status)))
+                                        failed = workers + i;
+                        }
+
+                        /* stop all other workers on failure */
+                        for (i = 0; failed && i < n_workers; ++i)
+                                if (workers[i].pid > 0)
+                                        kill(workers[i].pid, SIGTERM);
+
+                        continue;
+                }
+
+                nanosleep(&(struct timespec){ .tv_nsec = TEST_SHARD_TICK_MSEC * 1000000L }, NULL);
+                if (++tick % TEST_SHARD_REPORT_TICKS)
+                        continue;
+
+                done = test_shard_done(workers, n_workers, count);
+                n_types = 0;
+                for (i = 0; i < n_workers; ++i)
+                        n_types += __atomic_load_n(&workers[i].n_types, __ATOMIC_RELAXED);
+
+                test_shard_report(stderr, resumed, done, count, n_types, test_shard_nsec() - start_nsec);
+                if (checkpoint && !failed)
+                        test_shard_save(checkpoint, first, resumed + count, resumed + done);
+        }
+
+        done = test_shard_done(workers, n_workers, count);
+        n_types = 0;
+        for (i = 0; i < n_workers; ++i)
+                n_types += workers[i].n_types;
+
+        test_shard_report(stdout, resumed, done, count, n_types, test_shard_nsec() - start_nsec);
+
+        r = 0;
+        if (checkpoint)
+                r = test_shard_save(checkpoint, first, resumed + count, resumed + done);
+
+        if (failed) {
+                seed = test_shard_seed(base, failed->current);
+                fprintf(stderr, "FAILED: seed %s\n", seed);
+                free(seed);
+                r = -ECHILD;
+        }
+
+        munmap(workers, n_workers * sizeof(*workers));
+        mpz_clear(base);
+        return r;
+}
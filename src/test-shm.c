@@ -0,0 +1,310 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Shared Memory Rings
+ * This runs producers and consumers on shared memory rings, both within a
+ * single process and across processes, and verifies that every message
+ * arrives exactly once, in order, and unmodified.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_RING_SIZE (4096)
+#define TEST_N_MESSAGES (20000)
+#define TEST_N_PRODUCERS (3)
+
+static CVariant *test_message_new(uint64_t id) {
+        char str[512];
+        CVariant *cv;
+        size_t n;
+        int r;
+
+        /* vary the size, so messages wrap at different positions */
+        n = (id * 7) % sizeof(str);
+        memset(str, 'a' + id % 26, n);
+        str[n] = 0;
+
+        r = c_variant_new(&cv, "(ts)", 4);
+        assert(r >= 0);
+        r = c_variant_write(cv, "(ts)", id, str);
+        assert(r >= 0);
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static uint64_t test_message_verify(CVariant *cv) {
+        const char *str;
+        uint64_t id;
+        size_t i, n;
+        int r;
+
+        r = c_variant_read(cv, "(ts)", &id, &str);
+        assert(r >= 0);
+
+        n = strlen(str);
+        assert(n == (id * 7) % 512);
+        for (i = 0; i < n; ++i)
+                assert(str[i] == (char)('a' + id % 26));
+
+        return id;
+}
+
+static int test_memfd(void) {
+        int fd;
+
+        fd = memfd_create("test-shm", 0);
+        assert(fd >= 0);
+        return fd;
+}
+
+static void test_shm_basic(void) {
+        CVariantShm *producer, *consumer;
+        uint64_t i, j, id, pos, n_split;
+        CVariant *cv;
+        long n_page;
+        int r, fd;
+
+        fd = test_memfd();
+
+        r = c_variant_shm_new(&producer, fd, TEST_RING_SIZE, 0);
+        assert(r >= 0);
+        r = c_variant_shm_new(&consumer, fd, 0, 0);
+        assert(r >= 0);
+
+        /* the layout is page aligned and shared by both sides */
+        n_page = sysconf(_SC_PAGESIZE);
+        assert(producer->header >= sizeof(*producer->shared));
+        assert(!(producer->header % n_page));
+        assert(producer->size >= TEST_RING_SIZE && !(producer->size % n_page));
+        assert(producer->shared->header == producer->header);
+        assert(consumer->header == producer->header);
+        assert(consumer->size == producer->size);
+
+        /* empty ring */
+        r = c_variant_shm_read(consumer, &cv, "(ts)", 4);
+        assert(r == -EAGAIN);
+        r = c_variant_shm_wait_readable(consumer, 1000 * 1000);
+        assert(r == -ETIMEDOUT);
+
+        /* messages are invisible until flushed */
+        cv = test_message_new(1);
+        r = c_variant_shm_write(producer, cv);
+        assert(r >= 0);
+        c_variant_free(cv);
+
+        r = c_variant_shm_read(consumer, &cv, "(ts)", 4);
+        assert(r == -EAGAIN);
+
+        c_variant_shm_flush(producer);
+        r = c_variant_shm_wait_readable(consumer, 0);
+        assert(r >= 0);
+        r = c_variant_shm_read(consumer, &cv, "(ts)", 4);
+        assert(r >= 0);
+        assert(test_message_verify(cv) == 1);
+        c_variant_free(cv);
+        c_variant_shm_release(consumer);
+
+        /* stream messages through, batching on both sides */
+        n_split = 0;
+        for (i = 0, j = 0; i < TEST_N_MESSAGES; ) {
+                for ( ; i < TEST_N_MESSAGES; ++i) {
+                        cv = test_message_new(i);
+                        r = c_variant_shm_write(producer, cv);
+                        c_variant_free(cv);
+                        if (r == -EAGAIN)
+                                break;
+                        assert(r >= 0);
+                }
+
+                c_variant_shm_flush(producer);
+
+                for (;;) {
+                        pos = consumer->read;
+                        r = c_variant_shm_read(consumer, &cv, "(ts)", 4);
+                        if (r < 0)
+                                break;
+
+                        id = test_message_verify(cv);
+                        assert(id == j++);
+
+                        /* count messages that wrap around the ring end */
+                        n_split += (pos / consumer->size != (consumer->read - 1) / consumer->size);
+                        c_variant_free(cv);
+                }
+                assert(r == -EAGAIN);
+
+                c_variant_shm_release(consumer);
+        }
+
+        assert(j == TEST_N_MESSAGES);
+        assert(n_split > 0);
+
+        /* oversized messages are rejected */
+        r = c_variant_new(&cv, "ay", 2);
+        assert(r >= 0);
+        r = c_variant_insert(cv, "ay", &(struct iovec){ producer->data, producer->size - 7 }, 1);
+        assert(r >= 0);
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+        r = c_variant_shm_write(producer, cv);
+        assert(r == -EMSGSIZE);
+        r = c_variant_shm_wait_writable(producer, producer->size, 0);
+        assert(r == -EMSGSIZE);
+        c_variant_free(cv);
+
+        /* corrupted length fields are caught */
+        cv = test_message_new(7);
+        r = c_variant_shm_write(producer, cv);
+        assert(r >= 0);
+        c_variant_free(cv);
+        c_variant_shm_flush(producer);
+
+        memset(consumer->data + (consumer->read & (consumer->size - 1)), 0xff, 8);
+        r = c_variant_shm_read(consumer, &cv, "(ts)", 4);
+        assert(r == -EBADMSG);
+
+        c_variant_shm_free(consumer);
+        c_variant_shm_free(producer);
+        close(fd);
+
+        /* only initialized rings can be attached to */
+        fd = test_memfd();
+        r = c_variant_shm_new(&consumer, fd, 0, 0);
+        assert(r == -EBADMSG);
+        r = ftruncate(fd, n_page + TEST_RING_SIZE);
+        assert(r >= 0);
+        r = c_variant_shm_new(&consumer, fd, 0, 0);
+        assert(r == -EBADMSG);
+        close(fd);
+
+        /* rings with a header that is not page aligned are rejected */
+        fd = test_memfd();
+        r = c_variant_shm_new(&producer, fd, TEST_RING_SIZE, 0);
+        assert(r >= 0);
+        producer->shared->header = n_page / 2;
+        r = c_variant_shm_new(&consumer, fd, 0, 0);
+        assert(r == -EBADMSG);
+        producer->shared->header = n_page;
+        r = c_variant_shm_new(&consumer, fd, 0, 0);
+        assert(r >= 0);
+        c_variant_shm_free(consumer);
+        c_variant_shm_free(producer);
+        close(fd);
+}
+
+static void test_shm_produce(int fd, uint64_t producer, uint64_t n_messages) {
+        CVariantShm *shm;
+        CVariant *cv;
+        uint64_t i;
+        int r;
+
+        r = c_variant_shm_new(&shm, fd, 0, 0);
+        assert(r >= 0);
+
+        for (i = 0; i < n_messages; ++i) {
+                cv = test_message_new(producer << 32 | i);
+
+                while ((r = c_variant_shm_write(shm, cv)) == -EAGAIN) {
+                        r = c_variant_shm_wait_writable(shm, 512 + 16, -1);
+                        assert(r >= 0);
+                }
+                assert(r >= 0);
+
+                c_variant_free(cv);
+
+                /* flush in batches */
+                if (!(i % 16))
+                        c_variant_shm_flush(shm);
+        }
+
+        c_variant_shm_flush(shm);
+        c_variant_shm_free(shm);
+}
+
+static void test_shm_ipc(unsigned int flags, uint64_t n_producers) {
+        uint64_t i, id, seq[TEST_N_PRODUCERS] = {};
+        CVariantShm *consumer;
+        CVariant *cv;
+        pid_t pid;
+        int r, fd, status;
+
+        fd = test_memfd();
+
+        r = c_variant_shm_new(&consumer, fd, TEST_RING_SIZE, flags);
+        assert(r >= 0);
+
+        for (i = 0; i < n_producers; ++i) {
+                pid = fork();
+                assert(pid >= 0);
+                if (pid == 0) {
+                        test_shm_produce(fd, i, TEST_N_MESSAGES);
+                        _exit(0);
+                }
+        }
+
+        for (i = 0; i < n_producers * TEST_N_MESSAGES; ++i) {
+                while ((r = c_variant_shm_read(consumer, &cv, "(ts)", 4)) == -EAGAIN) {
+                        r = c_variant_shm_wait_readable(consumer, -1);
+                        assert(r >= 0);
+                }
+                assert(r >= 0);
+
+                /* messages of each producer must arrive in order */
+                id = test_message_verify(cv);
+                assert(id >> 32 < n_producers);
+                assert((id & UINT32_MAX) == seq[id >> 32]++);
+
+                c_variant_free(cv);
+
+                if (!(i % 8))
+                        c_variant_shm_release(consumer);
+        }
+
+        c_variant_shm_release(consumer);
+
+        for (i = 0; i < n_producers; ++i) {
+                pid = wait(&status);
+                assert(pid > 0);
+                assert(WIFEXITED(status) && !WEXITSTATUS(status));
+        }
+
+        r = c_variant_shm_read(consumer, &cv, "(ts)", 4);
+        assert(r == -EAGAIN);
+
+        c_variant_shm_free(consumer);
+        close(fd);
+}
+
+int main(int argc, char **argv) {
+        test_shm_basic();
+        test_shm_ipc(0, 1);
+        test_shm_ipc(C_VARIANT_SHM_MPSC, TEST_N_PRODUCERS);
+        return 0;
+}
@@ -536,10 +536,135 @@ static void test_signature_invalid(void) {
         }
 }
 
+static void test_signature_scan_one(const char *signature, size_t n_signature) {
+        CVariantSignatureScan reference = {}, scan;
+        size_t i;
+        int r;
+
+        r = c_variant_cpu_select("scalar");
+        assert(r >= 0);
+        c_variant_cpu->scan_signature(signature, n_signature, &reference);
+
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                r = c_variant_cpu_select(c_variant_cpus[i].name);
+                if (r == -EOPNOTSUPP)
+                        continue;
+                assert(r >= 0);
+
+                scan = (CVariantSignatureScan){};
+                c_variant_cpu->scan_signature(signature, n_signature, &scan);
+                assert(scan.depth == reference.depth);
+                assert(scan.max_depth == reference.max_depth);
+                assert(scan.min_depth == reference.min_depth);
+                assert(scan.bound == reference.bound);
+                assert(scan.invalid == reference.invalid);
+        }
+}
+
+static void test_signature_scan(void) {
+        static const char elements[] = "bynqiuxthdsogvam(){}";
+        char signature[512];
+        size_t i, j, n;
+
+        /*
+         * The vector implementations of the scan must match the scalar one.
+         * Verify every byte value is classified equally, in every position of
+         * a block, and then run random signatures with many brackets.
+         */
+
+        for (i = 0; i < 256; ++i) {
+                for (j = 0; j < 64; ++j) {
+                        memset(signature, 'u', 64);
+                        signature[j] = i;
+                        test_signature_scan_one(signature, 64);
+                }
+        }
+
+        srand(0xcafe);
+
+        for (i = 0; i < 4096; ++i) {
+                n = rand() % sizeof(signature);
+                for (j = 0; j < n; ++j)
+                        signature[j] = (rand() % 2) ? "((({{)))}}"[rand() % 10] : elements[rand() % 20];
+                test_signature_scan_one(signature, n);
+        }
+
+        c_variant_cpu_select("scalar");
+}
+
+static void test_signature_one(void) {
+        static const char *flat[] = { "()", "(u)", "(yt)", "(uuttd)", "(bynqiuxthd)", "(sv)", "(uyv)", "(ys)" };
+        char signature[1024];
+        CVariantType t, u;
+        size_t i;
+        int r;
+
+        /*
+         * Flat tuples are parsed directly. They must yield the same results
+         * as the parser, which is used if the tuple is followed by another
+         * type.
+         */
+
+        for (i = 0; i < sizeof(flat) / sizeof(*flat); ++i) {
+                r = c_variant_signature_one(flat[i], strlen(flat[i]), &t);
+                assert(!r);
+
+                sprintf(signature, "%su", flat[i]);
+                r = c_variant_signature_next(signature, strlen(signature), &u);
+                assert(r == 1);
+
+                assert(t.alignment == u.alignment);
+                assert(t.size == u.size);
+                assert(t.bound_size == u.bound_size);
+                assert(t.n_levels == u.n_levels);
+                assert(t.n_type == u.n_type);
+        }
+
+        /* long signatures are scanned before they are parsed */
+        memset(signature, '(', 512);
+        memset(signature + 512, ')', 512);
+        r = c_variant_signature_one(signature, 1024, &t);
+        assert(r == -ELOOP);
+
+        memset(signature, '(', 128);
+        memset(signature + 128, ')', 128);
+        r = c_variant_signature_one(signature, 255, &t);
+        assert(r == -EMEDIUMTYPE);
+
+        r = c_variant_signature_one(signature + 1, 255, &t);
+        assert(r == -EMEDIUMTYPE);
+
+        memset(signature, 'u', 64);
+        r = c_variant_signature_one(signature, 64, &t);
+        assert(r == -EMEDIUMTYPE);
+
+        signature[0] = '(';
+        signature[63] = ')';
+        r = c_variant_signature_one(signature, 64, &t);
+        assert(!r);
+        assert(t.size == 62 * 4 && t.n_type == 64);
+
+        signature[62] = '$';
+        r = c_variant_signature_one(signature, 64, &t);
+        assert(r == -EMEDIUMTYPE);
+
+        memcpy(signature, "(a{sv}", 6);
+        signature[62] = 'u';
+        r = c_variant_signature_one(signature, 64, &t);
+        assert(!r);
+        assert(t.size == 0 && t.alignment == 3 && t.n_levels == 3);
+
+        signature[5] = ')';
+        r = c_variant_signature_one(signature, 64, &t);
+        assert(r == -EMEDIUMTYPE);
+}
+
 int main(int argc, char **argv) {
         test_signature_api();
         test_signature_basic();
         test_signature_containers();
         test_signature_invalid();
+        test_signature_scan();
+        test_signature_one();
         return 0;
 }
@@ -0,0 +1,714 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Struct Descriptors
+ * This verifies that struct descriptors are validated when compiled, and that
+ * decoding and encoding via descriptors matches the vararg API, regardless
+ * whether the serialized data is linear or not. Batches of messages must
+ * decode just like each message on its own.
+ */
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+
+#define TEST_TYPE "(tsb(ii)a(ii)a(us)aauy)"
+#define TEST_BATCH (200)
+
+typedef struct TestPoint {
+        int32_t x;
+        int32_t y;
+} TestPoint;
+
+typedef struct TestEntry {
+        uint32_t id;
+        const char *name;
+} TestEntry;
+
+typedef struct TestMessage {
+        uint64_t serial;
+        const char *path;
+        bool flag;
+        TestPoint origin;
+        CVariantArray points;
+        CVariantArray entries;
+        CVariantArray matrix;
+        uint8_t level;
+} TestMessage;
+
+static const CVariantField test_point_fields[] = {
+        { "i", offsetof(TestPoint, x) },
+        { "i", offsetof(TestPoint, y) },
+};
+
+static const CVariantField test_entry_fields[] = {
+        { "u", offsetof(TestEntry, id) },
+        { "s", offsetof(TestEntry, name) },
+};
+
+static const CVariantField test_matrix_fields[] = {
+        { "au", 0, sizeof(uint32_t) },
+};
+
+static const CVariantField test_message_fields[] = {
+        { "t", offsetof(TestMessage, serial) },
+        { "s", offsetof(TestMessage, path) },
+        { "b", offsetof(TestMessage, flag) },
+        { "(ii)", offsetof(TestMessage, origin), sizeof(TestPoint), test_point_fields, 2 },
+        { "a(ii)", offsetof(TestMessage, points), sizeof(TestPoint), test_point_fields, 2 },
+        { "a(us)", offsetof(TestMessage, entries), sizeof(TestEntry), test_entry_fields, 2 },
+        { "aau", offsetof(TestMessage, matrix), sizeof(CVariantArray), test_matrix_fields, 1 },
+        { "y", offsetof(TestMessage, level) },
+};
+
+static CVariantStruct *test_message_struct(void) {
+        CVariantStruct *desc;
+        int r;
+
+        r = c_variant_struct_new(&desc, TEST_TYPE, strlen(TEST_TYPE),
+                                 test_message_fields, 8, sizeof(TestMessage));
+        assert(r >= 0);
+
+        return desc;
+}
+
+static CVariant *test_message_write(void) {
+        CVariant *cv;
+        size_t i, j;
+        int r;
+
+        r = c_variant_new(&cv, TEST_TYPE, strlen(TEST_TYPE));
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+        c_variant_write(cv, "tsb(ii)", UINT64_C(0xf0f0f0f0f0f0), "/org/example", true, -1, 7);
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < 16; ++i)
+                c_variant_write(cv, "(ii)", (int32_t)i, -(int32_t)i);
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < 4; ++i)
+                c_variant_write(cv, "(us)", (uint32_t)i * 3, i % 2 ? "odd" : "");
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < 3; ++i) {
+                c_variant_begin(cv, "a");
+                for (j = 0; j < i; ++j)
+                        c_variant_write(cv, "u", (uint32_t)(i * 10 + j));
+                c_variant_end(cv, "a");
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_write(cv, "y", 0x7f);
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_message_verify(const TestMessage *m) {
+        const TestPoint *points = m->points.elements;
+        const TestEntry *entries = m->entries.elements;
+        const CVariantArray *matrix = m->matrix.elements;
+        size_t i, j;
+
+        assert(m->serial == UINT64_C(0xf0f0f0f0f0f0));
+        assert(!strcmp(m->path, "/org/example"));
+        assert(m->flag);
+        assert(m->origin.x == -1 && m->origin.y == 7);
+
+        assert(m->points.n_elements == 16);
+        for (i = 0; i < 16; ++i)
+                assert(points[i].x == (int32_t)i && points[i].y == -(int32_t)i);
+
+        assert(m->entries.n_elements == 4);
+        for (i = 0; i < 4; ++i) {
+                assert(entries[i].id == i * 3);
+                assert(!strcmp(entries[i].name, i % 2 ? "odd" : ""));
+        }
+
+        assert(m->matrix.n_elements == 3);
+        for (i = 0; i < 3; ++i) {
+                assert(matrix[i].n_elements == i);
+                assert(!i == !matrix[i].elements);
+                for (j = 0; j < i; ++j)
+                        assert(((const uint32_t *)matrix[i].elements)[j] == i * 10 + j);
+        }
+
+        assert(m->level == 0x7f);
+}
+
+static void test_compile(void) {
+        CVariantField fields[2];
+        CVariantStruct *desc;
+        int r;
+
+        /* verify which parts are copied as a whole */
+        desc = test_message_struct();
+        assert(desc->n_ops == 19);
+        assert(desc->has_arrays);
+        assert(!desc->ops[0].copy && desc->ops[0].n_ops == 18);
+        assert(desc->ops[1].copy && desc->ops[1].kind == C_VARIANT_STRUCT_OP_BASIC);
+        assert(desc->ops[2].kind == C_VARIANT_STRUCT_OP_STRING);
+        assert(!desc->ops[3].copy && desc->ops[3].dense);
+        assert(desc->ops[4].copy && desc->ops[4].dense && desc->ops[4].n_ops == 2);
+        assert(desc->ops[7].copy && desc->ops[7].dense && desc->ops[7].n_ops == 3);
+        assert(!desc->ops[11].copy && desc->ops[11].n_ops == 3);
+        assert(!desc->ops[12].copy && !desc->ops[12].dense);
+        assert(!desc->ops[15].copy && desc->ops[15].n_ops == 2);
+        assert(desc->ops[16].copy && desc->ops[16].dense);
+        c_variant_struct_free(desc);
+
+        /* padded C layouts are copied, but not encoded, as a whole */
+        fields[0] = (CVariantField){ "y", 0 };
+        fields[1] = (CVariantField){ "u", 4 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(!r);
+        assert(desc->ops[0].copy && !desc->ops[0].dense);
+        c_variant_struct_free(desc);
+
+        /* layouts that differ from the serialization are not copied */
+        fields[0] = (CVariantField){ "y", 4 };
+        fields[1] = (CVariantField){ "u", 0 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(!r);
+        assert(!desc->ops[0].copy && !desc->ops[0].dense);
+        c_variant_struct_free(desc);
+
+        /* field types must match */
+        fields[0] = (CVariantField){ "u", 0 };
+        fields[1] = (CVariantField){ "u", 4 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(r == -EBADRQC);
+        fields[0] = (CVariantField){ NULL, 0 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(r == -EBADRQC);
+
+        /* field count must match */
+        fields[0] = (CVariantField){ "y", 0 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 1, 8);
+        assert(r == -EBADRQC);
+        r = c_variant_struct_new(&desc, "(y)", 3, fields, 2, 8);
+        assert(r == -EBADRQC);
+
+        /* fields must be aligned and within the struct */
+        fields[1] = (CVariantField){ "u", 2 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(r == -EINVAL);
+        fields[1] = (CVariantField){ "u", 8 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(r == -EINVAL);
+        fields[1] = (CVariantField){ "u", SIZE_MAX - 3 };
+        r = c_variant_struct_new(&desc, "(yu)", 4, fields, 2, 8);
+        assert(r == -EINVAL);
+        fields[0] = (CVariantField){ "ay", 0, 0 };
+        r = c_variant_struct_new(&desc, "(ay)", 4, fields, 1, sizeof(CVariantArray));
+        assert(r == -EINVAL);
+
+        /* only tuples and dict entries can be described */
+        r = c_variant_struct_new(&desc, "u", 1, NULL, 0, 4);
+        assert(r == -EMEDIUMTYPE);
+        r = c_variant_struct_new(&desc, "(u", 2, NULL, 0, 4);
+        assert(r == -EMEDIUMTYPE);
+        fields[0] = (CVariantField){ "v", 0 };
+        r = c_variant_struct_new(&desc, "(v)", 3, fields, 1, 16);
+        assert(r == -EMEDIUMTYPE);
+        fields[0] = (CVariantField){ "mu", 0 };
+        r = c_variant_struct_new(&desc, "(mu)", 4, fields, 1, 16);
+        assert(r == -EMEDIUMTYPE);
+}
+
+static void test_roundtrip(void) {
+        TestPoint points[16];
+        TestEntry entries[4];
+        CVariantArray matrix[3];
+        uint32_t rows[] = { 10, 20, 21 };
+        const struct iovec *vecs1, *vecs2;
+        size_t i, n_vecs1, n_vecs2;
+        CVariantArena *arena;
+        CVariantStruct *desc;
+        TestMessage m = {};
+        CVariant *cv1, *cv2;
+        int r;
+
+        desc = test_message_struct();
+        r = c_variant_arena_new(&arena, 64);
+        assert(!r);
+
+        /* decode a message written via the vararg API */
+        cv1 = test_message_write();
+        r = c_variant_decode_struct(cv1, desc, &m, arena);
+        assert(!r);
+        test_message_verify(&m);
+
+        /* encode it again and verify the serialization is identical */
+        r = c_variant_new(&cv2, TEST_TYPE, strlen(TEST_TYPE));
+        assert(!r);
+        r = c_variant_encode_struct(cv2, desc, &m);
+        assert(!r);
+        r = c_variant_seal(cv2);
+        assert(!r);
+
+        vecs1 = c_variant_get_vecs(cv1, &n_vecs1);
+        vecs2 = c_variant_get_vecs(cv2, &n_vecs2);
+        assert(n_vecs1 == 1 && n_vecs2 == 1);
+        assert(vecs1->iov_len == vecs2->iov_len);
+        assert(!memcmp(vecs1->iov_base, vecs2->iov_base, vecs1->iov_len));
+
+        c_variant_free(cv2);
+        c_variant_free(cv1);
+        c_variant_arena_reset(arena);
+
+        /* encode a native struct, and decode it again */
+        for (i = 0; i < 16; ++i)
+                points[i] = (TestPoint){ i, -(int32_t)i };
+        for (i = 0; i < 4; ++i)
+                entries[i] = (TestEntry){ i * 3, i % 2 ? "odd" : NULL };
+        matrix[0] = (CVariantArray){ NULL, 0 };
+        matrix[1] = (CVariantArray){ rows, 1 };
+        matrix[2] = (CVariantArray){ rows + 1, 2 };
+
+        m = (TestMessage){
+                .serial = UINT64_C(0xf0f0f0f0f0f0),
+                .path = "/org/example",
+                .flag = true,
+                .origin = { -1, 7 },
+                .points = { points, 16 },
+                .entries = { entries, 4 },
+                .matrix = { matrix, 3 },
+                .level = 0x7f,
+        };
+
+        r = c_variant_new(&cv1, TEST_TYPE, strlen(TEST_TYPE));
+        assert(!r);
+        r = c_variant_encode_struct(cv1, desc, &m);
+        assert(!r);
+        r = c_variant_seal(cv1);
+        assert(!r);
+
+        memset(&m, 0, sizeof(m));
+        r = c_variant_decode_struct(cv1, desc, &m, arena);
+        assert(!r);
+        test_message_verify(&m);
+
+        c_variant_free(cv1);
+        c_variant_arena_free(arena);
+        c_variant_struct_free(desc);
+}
+
+static void test_fallback(void) {
+        struct iovec *chunks;
+        const struct iovec *vecs;
+        size_t i, n_vecs, n_chunks;
+        CVariantArena *arena;
+        CVariantStruct *desc;
+        TestMessage m = {};
+        CVariant *cv, *chunked;
+        const TestPoint *points;
+        const char *s;
+        int32_t x, y;
+        uint64_t t;
+        bool b;
+        int r;
+
+        desc = test_message_struct();
+        r = c_variant_arena_new(&arena, 0);
+        assert(!r);
+
+        /*
+         * Split the message into 3-byte chunks, so no container is in linear
+         * memory, and decoding has to fall back to the individual members.
+         * Members that span chunks are read as default values, just like the
+         * vararg API does, so compare against it.
+         */
+
+        cv = test_message_write();
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        assert(n_vecs == 1);
+
+        n_chunks = (vecs->iov_len + 2) / 3;
+        chunks = calloc(n_chunks, sizeof(*chunks));
+        assert(chunks);
+        for (i = 0; i < n_chunks; ++i) {
+                chunks[i].iov_base = (char *)vecs->iov_base + i * 3;
+                chunks[i].iov_len = i + 1 < n_chunks ? 3 : vecs->iov_len - i * 3;
+        }
+
+        r = c_variant_new_from_vecs(&chunked, TEST_TYPE, strlen(TEST_TYPE), chunks, n_chunks);
+        assert(!r);
+        r = c_variant_decode_struct(chunked, desc, &m, arena);
+        assert(!r);
+        c_variant_free(chunked);
+
+        r = c_variant_new_from_vecs(&chunked, TEST_TYPE, strlen(TEST_TYPE), chunks, n_chunks);
+        assert(!r);
+        r = c_variant_enter(chunked, "(");
+        assert(!r);
+        c_variant_read(chunked, "tsb(ii)", &t, &s, &b, &x, &y);
+        assert(m.serial == t && !strcmp(m.path, s) && m.flag == b);
+        assert(m.origin.x == x && m.origin.y == y);
+
+        points = m.points.elements;
+        r = c_variant_enter(chunked, "a");
+        assert(!r);
+        assert(m.points.n_elements == c_variant_peek_count(chunked));
+        for (i = 0; i < m.points.n_elements; ++i) {
+                c_variant_read(chunked, "(ii)", &x, &y);
+                assert(points[i].x == x && points[i].y == y);
+        }
+        r = c_variant_exit(chunked, "a");
+        assert(!r);
+        assert(!c_variant_return_poison(chunked));
+        c_variant_free(chunked);
+
+        free(chunks);
+        c_variant_free(cv);
+        c_variant_arena_free(arena);
+        c_variant_struct_free(desc);
+}
+
+static bool test_double_equal(double a, double b) {
+        /* compare bitwise, decoding must reproduce doubles exactly */
+        return !memcmp(&a, &b, sizeof(a));
+}
+
+typedef struct TestSample {
+        const char *name;
+        uint64_t t;
+        uint32_t u;
+        double d;
+} TestSample;
+
+typedef struct TestFixed {
+        uint64_t t;
+        uint32_t u;
+        double d;
+} TestFixed;
+
+typedef struct TestFlag {
+        uint32_t u;
+        bool b;
+} TestFlag;
+
+static const CVariantField test_sample_fields[] = {
+        { "s", offsetof(TestSample, name) },
+        { "t", offsetof(TestSample, t) },
+        { "u", offsetof(TestSample, u) },
+        { "d", offsetof(TestSample, d) },
+};
+
+static const CVariantField test_fixed_fields[] = {
+        { "t", offsetof(TestFixed, t) },
+        { "u", offsetof(TestFixed, u) },
+        { "d", offsetof(TestFixed, d) },
+};
+
+static const CVariantField test_flag_fields[] = {
+        { "u", offsetof(TestFlag, u) },
+        { "b", offsetof(TestFlag, b) },
+};
+
+static void test_batch_direct(void) {
+        TestSample samples[TEST_BATCH], expected;
+        struct iovec msgs[TEST_BATCH];
+        CVariant *cvs[TEST_BATCH], *cv;
+        int statuses[TEST_BATCH];
+        CVariantStruct *desc;
+        const struct iovec *vecs;
+        char name[512];
+        size_t i, n_vecs;
+        int r;
+
+        r = c_variant_struct_new(&desc, "(stud)", 6, test_sample_fields, 4, sizeof(TestSample));
+        assert(!r);
+
+        /* names of growing length switch the framing to wider words */
+        for (i = 0; i < TEST_BATCH; ++i) {
+                memset(name, 'a' + i % 26, i * 2);
+                name[i * 2] = 0;
+
+                r = c_variant_new(&cvs[i], "(stud)", 6);
+                assert(!r);
+                r = c_variant_write(cvs[i], "(stud)", name, (uint64_t)i << 40, (uint32_t)i, i / 4.0);
+                assert(!r);
+                r = c_variant_seal(cvs[i]);
+                assert(!r);
+
+                vecs = c_variant_get_vecs(cvs[i], &n_vecs);
+                assert(n_vecs == 1);
+                msgs[i] = *vecs;
+        }
+
+        /* the direct path must match decoding each message on its own */
+        r = c_variant_decode_batch(desc, msgs, TEST_BATCH, samples, NULL, statuses);
+        assert(!r);
+
+        for (i = 0; i < TEST_BATCH; ++i) {
+                assert(!statuses[i]);
+
+                r = c_variant_new_from_vecs(&cv, "(stud)", 6, msgs + i, 1);
+                assert(!r);
+                r = c_variant_decode_struct(cv, desc, &expected, NULL);
+                assert(!r);
+                c_variant_free(cv);
+
+                assert(samples[i].name == expected.name);
+                assert(samples[i].t == expected.t && samples[i].t == (uint64_t)i << 40);
+                assert(samples[i].u == expected.u && samples[i].u == i);
+                assert(test_double_equal(samples[i].d, expected.d));
+                assert(test_double_equal(samples[i].d, i / 4.0));
+        }
+
+        /* invalid messages fail on their own, with default values */
+        msgs[1].iov_len = 0;
+        msgs[2].iov_len -= 1;
+        ((char *)msgs[3].iov_base)[msgs[3].iov_len - 1] = 0xff;
+
+        r = c_variant_decode_batch(desc, msgs, 5, samples, NULL, statuses);
+        assert(r == 3);
+        assert(!statuses[0] && !statuses[4]);
+        for (i = 1; i < 4; ++i) {
+                assert(statuses[i] == -EBADMSG);
+                assert(!strcmp(samples[i].name, ""));
+                assert(!samples[i].t && !samples[i].u && test_double_equal(samples[i].d, 0));
+        }
+
+        r = c_variant_decode_batch(desc, msgs, 5, samples, NULL, NULL);
+        assert(r == 3);
+
+        for (i = 0; i < TEST_BATCH; ++i)
+                c_variant_free(cvs[i]);
+        c_variant_struct_free(desc);
+}
+
+static void test_batch_fixed(void) {
+        TestFixed fixed[TEST_BATCH];
+        TestFlag flags[TEST_BATCH];
+        struct iovec msgs[TEST_BATCH];
+        int statuses[TEST_BATCH];
+        CVariantStruct *desc;
+        uint8_t data[TEST_BATCH][24];
+        uint64_t t;
+        uint32_t u;
+        double d;
+        size_t i;
+        int r;
+
+        /* tuples matching the C layout are copied as a whole */
+        r = c_variant_struct_new(&desc, "(tud)", 5, test_fixed_fields, 3, sizeof(TestFixed));
+        assert(!r);
+        assert(desc->ops->copy);
+
+        for (i = 0; i < TEST_BATCH; ++i) {
+                t = htole64(i * 3);
+                u = htole32(i * 5);
+                d = i * 7.0;
+                memset(data[i], 0, sizeof(data[i]));
+                memcpy(data[i], &t, sizeof(t));
+                memcpy(data[i] + 8, &u, sizeof(u));
+                memcpy(data[i] + 16, &d, sizeof(d));
+                msgs[i] = (struct iovec){ data[i], sizeof(data[i]) };
+        }
+        msgs[7].iov_len = 16;
+
+        r = c_variant_decode_batch(desc, msgs, TEST_BATCH, fixed, NULL, statuses);
+        assert(r == 1);
+        for (i = 0; i < TEST_BATCH; ++i) {
+                if (i == 7) {
+                        assert(statuses[i] == -EBADMSG);
+                        assert(!fixed[i].t && !fixed[i].u && test_double_equal(fixed[i].d, 0));
+                } else {
+                        assert(!statuses[i]);
+                        assert(fixed[i].t == i * 3 && fixed[i].u == i * 5 && test_double_equal(fixed[i].d, i * 7.0));
+                }
+        }
+
+        c_variant_struct_free(desc);
+
+        /* bools are decoded member by member */
+        r = c_variant_struct_new(&desc, "(ub)", 4, test_flag_fields, 2, sizeof(TestFlag));
+        assert(!r);
+        assert(!desc->ops->copy);
+
+        for (i = 0; i < TEST_BATCH; ++i) {
+                memcpy(data[i], &(uint32_t){ htole32(i) }, sizeof(uint32_t));
+                data[i][4] = i % 3;
+                data[i][5] = data[i][6] = data[i][7] = 0;
+                msgs[i] = (struct iovec){ data[i], 8 };
+        }
+
+        r = c_variant_decode_batch(desc, msgs, TEST_BATCH, flags, NULL, statuses);
+        assert(!r);
+        for (i = 0; i < TEST_BATCH; ++i) {
+                assert(!statuses[i]);
+                assert(flags[i].u == i && flags[i].b == !!(i % 3));
+        }
+
+        c_variant_struct_free(desc);
+}
+
+static void test_batch_fallback(void) {
+        TestMessage messages[4];
+        struct iovec msgs[4];
+        CVariantArena *arena;
+        CVariantStruct *desc;
+        char data[1024], *odd;
+        int statuses[4];
+        size_t i, n_vecs, n_data;
+        CVariant *cv;
+        int r;
+
+        desc = test_message_struct();
+        r = c_variant_arena_new(&arena, 0);
+        assert(!r);
+
+        /* arrays need a variant per message, and an arena */
+        cv = test_message_write();
+        for (i = 0; i < 4; ++i)
+                msgs[i] = *c_variant_get_vecs(cv, &n_vecs);
+
+        r = c_variant_decode_batch(desc, msgs, 4, messages, NULL, statuses);
+        assert(r == -EINVAL);
+
+        r = c_variant_decode_batch(desc, msgs, 4, messages, arena, statuses);
+        assert(!r);
+        for (i = 0; i < 4; ++i) {
+                assert(!statuses[i]);
+                test_message_verify(messages + i);
+        }
+
+        /* invalid framing is reported just like on the direct path */
+        r = c_variant_flatten(cv, 0, data, sizeof(data), &n_data);
+        assert(!r);
+        odd = memmem(data, n_data, "odd", sizeof("odd"));
+        assert(odd);
+        odd[3] = 'x';
+
+        msgs[1].iov_len = 0;
+        msgs[2] = (struct iovec){ data, n_data };
+
+        r = c_variant_decode_batch(desc, msgs, 4, messages, arena, statuses);
+        assert(r == 2);
+        assert(!statuses[0] && !statuses[3]);
+        test_message_verify(messages + 0);
+        test_message_verify(messages + 3);
+        for (i = 1; i < 3; ++i) {
+                assert(statuses[i] == -EBADMSG);
+                assert(!messages[i].serial && !strcmp(messages[i].path, "") && !messages[i].flag);
+                assert(!messages[i].points.n_elements && !messages[i].entries.n_elements);
+                assert(!messages[i].matrix.n_elements && !messages[i].level);
+        }
+
+        c_variant_free(cv);
+        c_variant_arena_free(arena);
+        c_variant_struct_free(desc);
+}
+
+static void test_errors(void) {
+        CVariantField field = { "u", 0 };
+        CVariantStruct *desc, *unit;
+        TestMessage m = {};
+        uint32_t u = 0;
+        CVariant *cv;
+        int r;
+
+        r = c_variant_struct_new(&desc, "(u)", 3, &field, 1, sizeof(u));
+        assert(!r);
+        r = c_variant_struct_new(&unit, "()", 2, NULL, 0, 0);
+        assert(!r);
+
+        /* NULL variants are unit types */
+        r = c_variant_decode_struct(NULL, unit, NULL, NULL);
+        assert(!r);
+        r = c_variant_decode_struct(NULL, desc, &u, NULL);
+        assert(r == -EBADRQC);
+        r = c_variant_encode_struct(NULL, desc, &u);
+        assert(r == -EBADRQC);
+
+        /* type mismatches poison the variant */
+        r = c_variant_new(&cv, "(t)", 3);
+        assert(!r);
+        r = c_variant_encode_struct(cv, desc, &u);
+        assert(r == -EBADRQC);
+        assert(c_variant_return_poison(cv) == -EBADRQC);
+        c_variant_free(cv);
+
+        /* arrays require an arena */
+        cv = test_message_write();
+        c_variant_struct_free(desc);
+        desc = test_message_struct();
+        r = c_variant_decode_struct(cv, desc, &m, NULL);
+        assert(r == -EINVAL);
+        assert(!c_variant_return_poison(cv));
+        c_variant_free(cv);
+
+        c_variant_struct_free(unit);
+        c_variant_struct_free(desc);
+}
+
+static void test_arena(void) {
+        CVariantArena *arena;
+        void *p;
+        size_t i;
+        int r;
+
+        r = c_variant_arena_new(&arena, 16);
+        assert(!r);
+
+        /* allocations are aligned and writable, regardless of their size */
+        for (i = 1; i < 4096; i += i / 2 + 1) {
+                p = c_variant_arena_alloc(arena, i);
+                assert(p);
+                assert(!((unsigned long)p % __alignof(max_align_t)));
+                memset(p, 0xff, i);
+        }
+
+        assert(!c_variant_arena_alloc(arena, SIZE_MAX));
+
+        /* only the newest block survives a reset */
+        c_variant_arena_reset(arena);
+        assert(arena->blocks && !arena->blocks->next && !arena->blocks->used);
+        c_variant_arena_reset(arena);
+
+        c_variant_arena_free(arena);
+        c_variant_arena_free(NULL);
+}
+
+int main(int argc, char **argv) {
+        test_compile();
+        test_roundtrip();
+        test_fallback();
+        test_batch_direct();
+        test_batch_fixed();
+        test_batch_fallback();
+        test_errors();
+        test_arena();
+        return 0;
+}
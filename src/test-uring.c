@@ -0,0 +1,556 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for Buffer Pools and io_uring Helpers
+ * This verifies that writers allocate from buffer pools, that the prepared
+ * io_uring requests describe the serialized variant exactly, and, if the
+ * kernel allows it, runs them on a real ring.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "c-variant.h"
+#include "c-variant-private.h"
+#include "test-ring.h"
+
+static CVariant *test_message_new(CVariantPool *pool, size_t n_entries, size_t n_inserts) {
+        static const char blob[] = "foobar";
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        /*
+         * Create a message with @n_entries tuples followed by @n_inserts
+         * byte-arrays inserted as external vectors. Each insertion adds
+         * vectors, so this can be used to exceed IOV_MAX.
+         */
+
+        r = c_variant_new_with_pool(&cv, "(a(uts)aay)", 11, pool);
+        assert(r >= 0);
+
+        r = c_variant_begin(cv, "(a");
+        assert(r >= 0);
+        for (i = 0; i < n_entries; ++i) {
+                r = c_variant_write(cv, "(uts)", (uint32_t)i, (uint64_t)i, "foobar");
+                assert(r >= 0);
+        }
+        r = c_variant_end(cv, "a");
+        assert(r >= 0);
+
+        r = c_variant_begin(cv, "a");
+        assert(r >= 0);
+        for (i = 0; i < n_inserts; ++i) {
+                r = c_variant_insert(cv, "ay", &(struct iovec){ (void *)blob, 1 + i % 6 }, 1);
+                assert(r >= 0);
+        }
+        r = c_variant_end(cv, "a)");
+        assert(r >= 0);
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_message_verify(CVariant *cv, size_t n_entries, size_t n_inserts) {
+        const char *s;
+        uint64_t t;
+        uint32_t u;
+        size_t i;
+        int r;
+
+        r = c_variant_enter(cv, "(a");
+        assert(r >= 0);
+        assert(c_variant_peek_count(cv) == n_entries);
+        for (i = 0; i < n_entries; ++i) {
+                r = c_variant_read(cv, "(uts)", &u, &t, &s);
+                assert(r >= 0);
+                assert(u == i && t == i && !strcmp(s, "foobar"));
+        }
+        r = c_variant_exit(cv, "a");
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, "a");
+        assert(r >= 0);
+        assert(c_variant_peek_count(cv) == n_inserts);
+        r = c_variant_exit(cv, "a)");
+        assert(r >= 0);
+}
+
+static void *test_message_flatten(CVariant *cv, size_t *sizep) {
+        void *data;
+        int r;
+
+        r = c_variant_flatten(cv, 0, NULL, 0, sizep);
+        assert(!r || r == -ENOBUFS);
+
+        data = malloc(*sizep ?: 1);
+        assert(data);
+
+        r = c_variant_flatten(cv, 0, data, *sizep, sizep);
+        assert(!r);
+
+        return data;
+}
+
+static void test_pool_alloc(void) {
+        CVariantPool *pool;
+        void *p[8];
+        size_t n;
+        int r;
+
+        r = c_variant_pool_new(&pool, 8 * C_VARIANT_POOL_CHUNK, 0);
+        assert(r >= 0);
+        assert(c_variant_pool_get_vec(pool)->iov_len == 8 * C_VARIANT_POOL_CHUNK);
+
+        /* allocations are rounded up to full chunks */
+        n = 1;
+        p[0] = c_variant_pool_alloc(pool, &n);
+        assert(p[0] && n == C_VARIANT_POOL_CHUNK);
+        assert(p[0] == c_variant_pool_get_vec(pool)->iov_base);
+
+        n = 3 * C_VARIANT_POOL_CHUNK;
+        p[1] = c_variant_pool_alloc(pool, &n);
+        assert(p[1] && n == 3 * C_VARIANT_POOL_CHUNK);
+
+        n = 4 * C_VARIANT_POOL_CHUNK + 1;
+        assert(!c_variant_pool_alloc(pool, &n));
+
+        n = 4 * C_VARIANT_POOL_CHUNK;
+        p[2] = c_variant_pool_alloc(pool, &n);
+        assert(p[2]);
+        assert(pool->n_allocated == pool->n_chunks);
+
+        /* fragmented space must not be handed out as one run */
+        c_variant_pool_release(pool, p[0]);
+        c_variant_pool_release(pool, p[2]);
+        n = 5 * C_VARIANT_POOL_CHUNK;
+        assert(!c_variant_pool_alloc(pool, &n));
+
+        /* search must wrap around */
+        n = 4 * C_VARIANT_POOL_CHUNK;
+        p[2] = c_variant_pool_alloc(pool, &n);
+        assert(p[2]);
+        n = C_VARIANT_POOL_CHUNK;
+        p[0] = c_variant_pool_alloc(pool, &n);
+        assert(p[0] == c_variant_pool_get_vec(pool)->iov_base);
+
+        c_variant_pool_release(pool, p[0]);
+        c_variant_pool_release(pool, p[1]);
+        c_variant_pool_release(pool, p[2]);
+        assert(!pool->n_allocated);
+
+        pool = c_variant_pool_free(pool);
+        assert(!pool);
+}
+
+static void test_pool_writer(void) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size, n_reference;
+        CVariantPool *pool;
+        void *data, *reference;
+        CVariant *cv;
+        int r;
+
+        /* reference message, serialized without pool */
+        cv = test_message_new(NULL, 4096, 0);
+        reference = test_message_flatten(cv, &n_reference);
+        cv = c_variant_free(cv);
+
+        /* all buffers must be taken from the pool, if it is big enough */
+        r = c_variant_pool_new(&pool, 16 * 1024 * 1024, 0);
+        assert(r >= 0);
+
+        cv = test_message_new(pool, 4096, 0);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0; i < n_vecs; ++i)
+                assert(!vecs[i].iov_len || c_variant_pool_owns(pool, vecs[i].iov_base));
+
+        data = test_message_flatten(cv, &size);
+        assert(size == n_reference && !memcmp(data, reference, size));
+        free(data);
+
+        test_message_verify(cv, 4096, 0);
+        cv = c_variant_free(cv);
+        assert(!pool->n_allocated);
+        pool = c_variant_pool_free(pool);
+
+        /* exhausted pools fall back to heap memory */
+        r = c_variant_pool_new(&pool, 1, 0);
+        assert(r >= 0);
+
+        cv = test_message_new(pool, 4096, 0);
+        data = test_message_flatten(cv, &size);
+        assert(size == n_reference && !memcmp(data, reference, size));
+        free(data);
+
+        cv = c_variant_free(cv);
+        assert(!pool->n_allocated);
+        pool = c_variant_pool_free(pool);
+
+        free(reference);
+}
+
+static void test_prep(void) {
+        struct io_uring_sqe sqes[64];
+        struct msghdr msgs[64];
+        const struct iovec *vecs;
+        size_t i, j, n_vecs, size, n_data;
+        CVariantPool *pool;
+        void *data;
+        CVariant *cv;
+        char *file;
+        int r, n, fd;
+
+        r = c_variant_pool_new(&pool, 1024 * 1024, 7);
+        assert(r >= 0);
+
+        /* more than IOV_MAX vectors, so chains are needed */
+        cv = test_message_new(pool, 128, IOV_MAX + 17);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        assert(n_vecs > IOV_MAX);
+        data = test_message_flatten(cv, &n_data);
+
+        fd = memfd_create("test-uring", 0);
+        assert(fd >= 0);
+
+        /* writev */
+        n = c_variant_uring_prep_writev(cv, NULL, 0, fd, 0);
+        assert(n == (int)((n_vecs + IOV_MAX - 1) / IOV_MAX) && n > 1);
+        r = c_variant_uring_prep_writev(cv, sqes, n - 1, fd, 0);
+        assert(r == -ENOBUFS);
+        r = c_variant_uring_prep_writev(cv, sqes, 64, fd, 0);
+        assert(r == n);
+
+        for (i = 0, size = 0; i < (size_t)n; ++i) {
+                assert(sqes[i].opcode == IORING_OP_WRITEV);
+                assert(sqes[i].fd == fd);
+                assert(sqes[i].off == size);
+                assert(!!(sqes[i].flags & IOSQE_IO_LINK) == (i + 1 < (size_t)n));
+
+                r = pwritev(fd, (const struct iovec *)(unsigned long)sqes[i].addr, sqes[i].len, sqes[i].off);
+                assert(r >= 0);
+                size += r;
+        }
+        assert(size == n_data);
+
+        file = mmap(NULL, n_data, PROT_READ, MAP_SHARED, fd, 0);
+        assert(file != MAP_FAILED);
+        assert(!memcmp(file, data, n_data));
+        munmap(file, n_data);
+
+        /* one request per vector does not fit */
+        n = c_variant_uring_prep_write_fixed(cv, NULL, 0, fd, 8);
+        assert(n > 64 && (size_t)n <= n_vecs);
+        r = c_variant_uring_prep_write_fixed(cv, sqes, 64, fd, 8);
+        assert(r == -ENOBUFS);
+
+        c_variant_free(cv);
+        free(data);
+
+        /* small message, which fits into the SQE array */
+        cv = test_message_new(pool, 128, 3);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        data = test_message_flatten(cv, &n_data);
+
+        /* write-fixed, at an offset */
+        r = ftruncate(fd, 0);
+        assert(r >= 0);
+
+        n = c_variant_uring_prep_write_fixed(cv, sqes, 64, fd, 8);
+        assert(n > 0);
+
+        for (i = 0, j = 0, size = 0; i < (size_t)n; ++i) {
+                while (!vecs[j].iov_len)
+                        ++j;
+
+                assert(sqes[i].addr == (unsigned long)vecs[j].iov_base);
+                assert(sqes[i].len == vecs[j].iov_len);
+                assert(sqes[i].off == 8 + size);
+                assert(!!(sqes[i].flags & IOSQE_IO_LINK) == (i + 1 < (size_t)n));
+                if (c_variant_pool_owns(pool, vecs[j].iov_base)) {
+                        assert(sqes[i].opcode == IORING_OP_WRITE_FIXED);
+                        assert(sqes[i].buf_index == 7);
+                } else {
+                        assert(sqes[i].opcode == IORING_OP_WRITE);
+                }
+
+                r = pwrite(fd, (const void *)(unsigned long)sqes[i].addr, sqes[i].len, sqes[i].off);
+                assert(r == (int)sqes[i].len);
+                size += r;
+                ++j;
+        }
+        assert(size == n_data);
+
+        file = mmap(NULL, n_data + 8, PROT_READ, MAP_SHARED, fd, 0);
+        assert(file != MAP_FAILED);
+        assert(!memcmp(file + 8, data, n_data));
+        munmap(file, n_data + 8);
+
+        /* sendmsg */
+        n = c_variant_uring_prep_sendmsg(cv, sqes, msgs, 64, fd, MSG_NOSIGNAL);
+        assert(n == 1);
+        assert(sqes[0].opcode == IORING_OP_SENDMSG);
+        assert(sqes[0].addr == (unsigned long)&msgs[0]);
+        assert(sqes[0].msg_flags == MSG_NOSIGNAL);
+        assert(msgs[0].msg_iov == vecs && msgs[0].msg_iovlen == n_vecs);
+
+        /* send-zc */
+        n = c_variant_uring_prep_send_zc(cv, sqes, 64, fd, 0);
+        if (n != -EOPNOTSUPP) {
+                assert(n == c_variant_uring_prep_write_fixed(cv, NULL, 0, fd, 0));
+                for (i = 0; i < (size_t)n; ++i) {
+                        assert(sqes[i].opcode == IORING_OP_SEND_ZC);
+                        assert(!!(sqes[i].msg_flags & MSG_MORE) == (i + 1 < (size_t)n));
+                        if (c_variant_pool_owns(pool, (void *)(unsigned long)sqes[i].addr))
+                                assert(sqes[i].ioprio == IORING_RECVSEND_FIXED_BUF &&
+                                       sqes[i].buf_index == 7);
+                        else
+                                assert(!sqes[i].ioprio);
+                }
+        }
+
+        /* NULL variant transmits nothing */
+        assert(!c_variant_uring_prep_writev(NULL, sqes, 64, fd, 0));
+        assert(!c_variant_uring_prep_write_fixed(NULL, sqes, 64, fd, 0));
+
+        close(fd);
+        c_variant_free(cv);
+        free(data);
+        pool = c_variant_pool_free(pool);
+}
+
+static void test_ring_run(TestRing *ring, const struct io_uring_sqe *sqes, size_t n_sqes, size_t n_data) {
+        struct io_uring_cqe cqe;
+        size_t i, size;
+        int r;
+
+        r = test_ring_submit(ring, sqes, n_sqes, n_sqes);
+        assert(r == (int)n_sqes);
+
+        for (i = 0, size = 0; i < n_sqes; ++i) {
+                r = test_ring_wait(ring, &cqe);
+                assert(r >= 0);
+                assert(cqe.res >= 0);
+                size += cqe.res;
+        }
+
+        assert(size == n_data);
+}
+
+static void test_prep_poisoned(void) {
+        struct io_uring_sqe sqes[4];
+        struct msghdr msgs[4];
+        char path[64];
+        int r, fd, wfd;
+        CVariant *cv;
+
+        /* file segments that cannot be mapped poison the variant */
+        fd = memfd_create("test-uring", 0);
+        assert(fd >= 0);
+        r = ftruncate(fd, 4096);
+        assert(!r);
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        wfd = open(path, O_WRONLY | O_CLOEXEC);
+        assert(wfd >= 0);
+
+        r = c_variant_new(&cv, "ay", 2);
+        assert(!r);
+        r = c_variant_insert_file(cv, "ay", wfd, 0, 4096);
+        assert(!r);
+        r = c_variant_seal(cv);
+        assert(!r);
+
+        r = c_variant_uring_prep_writev(cv, sqes, 4, fd, 0);
+        assert(r == -EACCES);
+        r = c_variant_uring_prep_sendmsg(cv, sqes, msgs, 4, fd, 0);
+        assert(r == -EACCES);
+        r = c_variant_uring_prep_write_fixed(cv, NULL, 0, fd, 0);
+        assert(r == -EACCES);
+        r = c_variant_uring_prep_send_zc(cv, NULL, 0, fd, 0);
+        assert(r == -EACCES || r == -EOPNOTSUPP);
+
+        c_variant_free(cv);
+        close(wfd);
+        close(fd);
+}
+
+static void test_from_uring(void) {
+        struct io_uring_cqe cqe = {};
+        static char buffers[4][64];
+        const struct iovec *vecs;
+        size_t n_vecs;
+        uint16_t bid;
+        CVariant *cv;
+        int r;
+
+        /* the buffer ID is returned even if the completion is rejected */
+        cqe.flags = IORING_CQE_F_BUFFER | (2 << IORING_CQE_BUFFER_SHIFT);
+        cqe.res = sizeof(buffers[0]) + 1;
+        bid = 0;
+        r = c_variant_new_from_uring(&cv, "ay", 2, &cqe, buffers, sizeof(buffers[0]), &bid);
+        assert(r == -EBADMSG);
+        assert(bid == 2);
+
+        cqe.res = 8;
+        r = c_variant_new_from_uring(&cv, "ay", 2, &cqe, buffers, sizeof(buffers[0]), &bid);
+        assert(!r);
+        assert(bid == 2);
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        assert(n_vecs == 1 && vecs[0].iov_base == buffers[2]);
+        c_variant_free(cv);
+}
+
+static void test_ring_xmit(void) {
+        struct io_uring_sqe sqes[64], sqe;
+        struct io_uring_cqe cqe;
+        const struct iovec *vec;
+        size_t n_data, n_buffers;
+        CVariantPool *pool;
+        void *data, *buffers;
+        CVariant *cv, *rcv;
+        TestRing ring;
+        uint16_t bid;
+        char *file;
+        int r, n, fd, fds[2];
+
+        r = test_ring_init(&ring, 64);
+        if (r < 0) {
+                fprintf(stderr, "Skipping io_uring tests: %s\n", strerror(-r));
+                return;
+        }
+
+        r = c_variant_pool_new(&pool, 1024 * 1024, 0);
+        assert(r >= 0);
+
+        vec = c_variant_pool_get_vec(pool);
+        r = test_ring_register(&ring, IORING_REGISTER_BUFFERS, vec, 1);
+        if (r < 0) {
+                fprintf(stderr, "Skipping io_uring tests: %s\n", strerror(-r));
+                goto exit;
+        }
+
+        fd = memfd_create("test-uring", 0);
+        assert(fd >= 0);
+
+        cv = test_message_new(pool, 1024, 3);
+        data = test_message_flatten(cv, &n_data);
+
+        /* fixed-buffer writes from registered pool memory */
+        n = c_variant_uring_prep_write_fixed(cv, sqes, 64, fd, 0);
+        assert(n > 0);
+        test_ring_run(&ring, sqes, n, n_data);
+
+        file = mmap(NULL, n_data, PROT_READ, MAP_SHARED, fd, 0);
+        assert(file != MAP_FAILED);
+        assert(!memcmp(file, data, n_data));
+        munmap(file, n_data);
+
+        /* vectored writes */
+        r = ftruncate(fd, 0);
+        assert(r >= 0);
+
+        n = c_variant_uring_prep_writev(cv, sqes, 64, fd, 0);
+        assert(n == 1);
+        test_ring_run(&ring, sqes, n, n_data);
+
+        file = mmap(NULL, n_data, PROT_READ, MAP_SHARED, fd, 0);
+        assert(file != MAP_FAILED);
+        assert(!memcmp(file, data, n_data));
+        munmap(file, n_data);
+
+        close(fd);
+
+        /* receive into provided buffers and parse in place */
+        r = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+        assert(r >= 0);
+
+        n_buffers = 4;
+        buffers = malloc(n_buffers * n_data);
+        assert(buffers);
+
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe.fd = n_buffers;
+        sqe.addr = (unsigned long)buffers;
+        sqe.len = n_data;
+        sqe.buf_group = 1;
+        r = test_ring_submit(&ring, &sqe, 1, 1);
+        assert(r == 1);
+        r = test_ring_wait(&ring, &cqe);
+        assert(r >= 0);
+
+        if (cqe.res < 0) {
+                fprintf(stderr, "Skipping io_uring receive tests: %s\n", strerror(-cqe.res));
+        } else {
+                r = send(fds[0], data, n_data, 0);
+                assert(r == (int)n_data);
+
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_RECV;
+                sqe.fd = fds[1];
+                sqe.len = n_data;
+                sqe.flags = IOSQE_BUFFER_SELECT;
+                sqe.buf_group = 1;
+                r = test_ring_submit(&ring, &sqe, 1, 1);
+                assert(r == 1);
+                r = test_ring_wait(&ring, &cqe);
+                assert(r >= 0);
+                assert(cqe.res == (int)n_data);
+
+                r = c_variant_new_from_uring(&rcv, "(a(uts)aay)", 11, &cqe, buffers, n_data, &bid);
+                assert(r >= 0);
+                assert(bid < n_buffers);
+                test_message_verify(rcv, 1024, 3);
+                c_variant_free(rcv);
+
+                /* completions without buffer are rejected */
+                cqe.flags = 0;
+                r = c_variant_new_from_uring(&rcv, "(a(uts)aay)", 11, &cqe, buffers, n_data, &bid);
+                assert(r == -ENODATA);
+        }
+
+        free(buffers);
+        close(fds[1]);
+        close(fds[0]);
+        c_variant_free(cv);
+        free(data);
+
+exit:
+        test_ring_deinit(&ring);
+        c_variant_pool_free(pool);
+}
+
+int main(int argc, char **argv) {
+        test_pool_alloc();
+        test_pool_writer();
+        test_prep();
+        test_prep_poisoned();
+        test_from_uring();
+        test_ring_xmit();
+        return 0;
+}
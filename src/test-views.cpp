@@ -0,0 +1,313 @@
+/***
+  This file is part of c-variant. See COPYING for details.
+
+  c-variant is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  c-variant is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with c-variant; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Tests for C++ Views
+ * This writes containers via the C API, and verifies the views of
+ * c-variant-views.hpp decode the same elements as the reader, both for
+ * well-formed data and for corrupted framing offsets.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ranges>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+#include "c-variant.h"
+#include "c-variant-views.hpp"
+
+static_assert(std::random_access_iterator<cv::array_view<uint32_t>::iterator>);
+static_assert(std::random_access_iterator<cv::array_view<std::string_view>::iterator>);
+static_assert(std::ranges::random_access_range<cv::dict_view<std::string_view, cv::variant_ref>>);
+
+static std::vector<char> test_flatten(CVariant *cv) {
+        const struct iovec *vecs;
+        std::vector<char> data;
+        size_t i, n_vecs;
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+        for (i = 0; i < n_vecs; ++i)
+                data.insert(data.end(), (char *)vecs[i].iov_base, (char *)vecs[i].iov_base + vecs[i].iov_len);
+
+        return data;
+}
+
+static CVariant *test_message_new(size_t n) {
+        std::string s;
+        CVariant *cv;
+        size_t i;
+        int r;
+
+        r = c_variant_new(&cv, "(auasa{sv}t)", 12);
+        assert(r >= 0);
+
+        c_variant_begin(cv, "(");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i)
+                c_variant_write(cv, "u", (uint32_t)(i * 3));
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i) {
+                s = "string-" + std::to_string(i);
+                c_variant_write(cv, "s", s.c_str());
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_begin(cv, "a");
+        for (i = 0; i < n; ++i) {
+                s = "key-" + std::to_string(i);
+                c_variant_begin(cv, "{");
+                c_variant_write(cv, "s", s.c_str());
+                if (i % 3 == 0) {
+                        c_variant_begin(cv, "v", "t");
+                        c_variant_write(cv, "t", (uint64_t)i);
+                } else if (i % 3 == 1) {
+                        c_variant_begin(cv, "v", "s");
+                        c_variant_write(cv, "s", s.c_str());
+                } else {
+                        c_variant_begin(cv, "v", "aq");
+                        c_variant_write(cv, "aq", 2, (uint16_t)i, (uint16_t)(i + 1));
+                }
+                c_variant_end(cv, "v");
+                c_variant_end(cv, "}");
+        }
+        c_variant_end(cv, "a");
+
+        c_variant_write(cv, "t", UINT64_C(0xdeadbeef));
+        c_variant_end(cv, ")");
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        return cv;
+}
+
+static void test_views_fixed(CVariant *cv, size_t n, bool linear) {
+        cv::array_view<uint32_t> view(cv);
+        size_t i;
+
+        /* fixed-size array, via span, indices and iterators */
+        assert(view.error() >= 0 || (!linear && view.error() == -EFAULT && view.empty()));
+        if (view.error() < 0)
+                return;
+
+        assert(view.size() == n);
+        assert(view.span().size() == n);
+
+        for (i = 0; i < n; ++i) {
+                assert(view.span()[i] == i * 3);
+                assert(view[i] == i * 3);
+        }
+
+        i = 0;
+        for (uint32_t u : view)
+                assert(u == i++ * 3);
+        assert(i == n);
+
+        if (n > 2) {
+                assert(*(view.begin() + 2) == 6);
+                assert(view.end() - view.begin() == (ptrdiff_t)n);
+                assert(std::ranges::is_sorted(view));
+        }
+}
+
+static void test_views_dynamic(CVariant *cv, size_t n, bool linear) {
+        cv::array_view<std::string_view> view(cv);
+        size_t i;
+
+        /* dynamic-size array, with random access */
+        assert(view.error() >= 0 || (!linear && view.error() == -EFAULT && view.empty()));
+        if (view.error() < 0)
+                return;
+
+        assert(view.size() == n);
+
+        for (i = n; i-- > 0; )
+                assert(view[i] == "string-" + std::to_string(i));
+
+        i = 0;
+        for (std::string_view s : view)
+                assert(s == "string-" + std::to_string(i++));
+        assert(i == n);
+
+        if (n > 0)
+                assert(std::ranges::find(view, "string-0") == view.begin());
+}
+
+static void test_views_dict(CVariant *cv, size_t n, bool linear) {
+        cv::dict_view<std::string_view, cv::variant_ref> view(cv);
+        size_t i;
+
+        /* dictionary of variants, via structured bindings */
+        assert(view.error() >= 0 || (!linear && view.error() == -EFAULT && view.empty()));
+        if (view.error() < 0)
+                return;
+
+        assert(view.size() == n);
+
+        i = 0;
+        for (auto [key, val] : view) {
+                assert(key == "key-" + std::to_string(i));
+
+                if (i % 3 == 0) {
+                        assert(val.type() == "t");
+                        assert(val.get<uint64_t>() == i);
+                } else if (i % 3 == 1) {
+                        assert(val.type() == "s");
+                        assert(val.get<std::string_view>() == key);
+                } else {
+                        cv::array_view<uint16_t> inner(val);
+                        assert(val.type() == "aq");
+                        assert(inner.size() == 2);
+                        assert(inner[0] == i && inner[1] == i + 1);
+                        assert(val.get<uint64_t>() == 0);
+                }
+
+                ++i;
+        }
+        assert(i == n);
+}
+
+static void test_views_verify(CVariant *cv, size_t n, bool linear) {
+        uint64_t t;
+        int r;
+
+        /*
+         * Writer output might spread containers across iovecs, in which case
+         * views skip them. Either way, the reader continues behind them.
+         */
+
+        r = c_variant_enter(cv, "(");
+        assert(r >= 0);
+
+        test_views_fixed(cv, n, linear);
+        test_views_dynamic(cv, n, linear);
+        test_views_dict(cv, n, linear);
+
+        r = c_variant_read(cv, "t", &t);
+        assert(r >= 0 && t == 0xdeadbeef);
+        r = c_variant_exit(cv, ")");
+        assert(r >= 0);
+        assert(!c_variant_return_poison(cv));
+}
+
+static void test_views_basic(void) {
+        static const size_t sizes[] = { 0, 1, 2, 3, 100, 300, 30000 };
+        std::vector<char> data;
+        CVariant *cv, *lcv;
+        int r;
+
+        for (size_t n : sizes) {
+                cv = test_message_new(n);
+                data = test_flatten(cv);
+
+                /* writer output, which is spread across iovecs */
+                test_views_verify(cv, n, false);
+
+                /* linear buffer, as received from the wire */
+                r = c_variant_new_from_buffer(&lcv, "(auasa{sv}t)", 12, data.data(), data.size());
+                assert(r >= 0);
+                test_views_verify(lcv, n, true);
+                c_variant_free(lcv);
+
+                c_variant_free(cv);
+        }
+}
+
+static void test_views_mismatch(void) {
+        CVariant *cv;
+        uint32_t u;
+        int r;
+
+        r = c_variant_new(&cv, "(auu)", 5);
+        assert(r >= 0);
+        c_variant_write(cv, "(auu)", 2, 7, 8, 9);
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        /* views of the wrong type do not consume anything */
+        {
+                r = c_variant_enter(cv, "(");
+                assert(r >= 0);
+
+                cv::array_view<uint64_t> wrong(cv);
+                assert(wrong.error() == -EBADRQC && wrong.empty());
+
+                cv::dict_view<std::string_view, uint32_t> dict(cv);
+                assert(dict.error() == -EBADRQC && dict.empty());
+
+                cv::array_view<uint32_t> view(cv);
+                assert(view.error() >= 0 && view.size() == 2);
+                assert(view[0] == 7 && view[1] == 8);
+
+                cv::array_view<uint32_t> none(cv);
+                assert(none.error() == -EBADRQC);
+
+                r = c_variant_read(cv, "u", &u);
+                assert(r >= 0 && u == 9);
+        }
+
+        /* the NULL variant is the unit type */
+        {
+                cv::array_view<uint32_t> view(nullptr);
+                assert(view.error() == -EBADRQC);
+        }
+
+        c_variant_free(cv);
+}
+
+static void test_views_corrupt(void) {
+        /* "as" with elements "a", "bc" and "", with the second frame corrupted */
+        static const char data[] = "a\0bc\0\x02\x09\x05";
+        cv::array_view<std::string_view> view(cv::variant_ref("as", data, sizeof(data) - 1));
+
+        assert(view.error() >= 0);
+        assert(view.size() == 3);
+        assert(view[0] == "a");
+        assert(view[1] == "");
+        assert(view[2] == "");
+
+        /* arrays with invalid trailing frames are empty */
+        cv::array_view<std::string_view> view1(cv::variant_ref("as", "a\0\x09", 3));
+        assert(view1.size() == 0);
+
+        /* unterminated strings read as empty */
+        cv::array_view<std::string_view> view2(cv::variant_ref("as", "ab\x02", 3));
+        assert(view2.size() == 1 && view2[0] == "");
+
+        /* fixed-size arrays of invalid size are empty */
+        cv::array_view<uint32_t> view3(cv::variant_ref("au", "\0\0\0\0\0", 5));
+        assert(view3.size() == 0);
+
+        /* variants without valid type read as unit */
+        cv::array_view<cv::variant_ref> view4(cv::variant_ref("av", "\x01\x00(\x03", 4));
+        assert(view4.size() == 1 && view4[0].type() == "()");
+}
+
+int main(int argc, char **argv) {
+        test_views_basic();
+        test_views_mismatch();
+        test_views_corrupt();
+        return 0;
+}
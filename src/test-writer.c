@@ -183,8 +183,315 @@ static void test_writer_compound(void) {
         assert(!cv);
 }
 
+static void *test_writer_frames_one(const char *type, size_t n, size_t *sizep) {
+        const struct iovec *vecs;
+        size_t i, n_vecs, size;
+        const char *s;
+        CVariant *cv;
+        char *data;
+        int r;
+
+        /*
+         * Write @n strings into either an array or tuple (as given by @type),
+         * verify it can be read back, and return it as linear buffer.
+         */
+
+        r = c_variant_new(&cv, type, strlen(type));
+        assert(r >= 0);
+
+        r = c_variant_begin(cv, NULL);
+        assert(r >= 0);
+
+        for (i = 0; i < n; ++i) {
+                r = c_variant_write(cv, "s", (i % 3) ? "foo" : "foobar");
+                assert(r >= 0);
+        }
+
+        r = c_variant_end(cv, NULL);
+        assert(r >= 0);
+
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        r = c_variant_enter(cv, NULL);
+        assert(r >= 0);
+
+        for (i = 0; i < n; ++i) {
+                r = c_variant_read(cv, "s", &s);
+                assert(r >= 0);
+                assert(!strcmp(s, (i % 3) ? "foo" : "foobar"));
+        }
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size);
+        assert(data);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        cv = c_variant_free(cv);
+        *sizep = size;
+        return data;
+}
+
+static void test_writer_frames(void) {
+        static const size_t n_strings[] = { 1, 2, 5, 17, 64, 255, 4096, 40000 };
+        char type[128], *data, *reference;
+        size_t i, j, k, size, n_reference;
+        int r;
+
+        /*
+         * Framing offsets are serialized via the selected CPU kernel. Verify
+         * each implementation produces the exact same output as the scalar
+         * one, for all word sizes, for arrays (forward) as well as tuples
+         * (reverse).
+         */
+
+        for (i = 0; i < sizeof(n_strings) / sizeof(*n_strings); ++i) {
+                for (j = 0; j < 2; ++j) {
+                        if (j == 0) {
+                                strcpy(type, "as");
+                        } else {
+                                if (n_strings[i] + 2 >= sizeof(type))
+                                        continue;
+
+                                type[0] = '(';
+                                memset(type + 1, 's', n_strings[i]);
+                                type[n_strings[i] + 1] = ')';
+                                type[n_strings[i] + 2] = 0;
+                        }
+
+                        r = c_variant_cpu_select("scalar");
+                        assert(r >= 0);
+
+                        reference = test_writer_frames_one(type, n_strings[i], &n_reference);
+
+                        for (k = 0; k < c_variant_n_cpus; ++k) {
+                                r = c_variant_cpu_select(c_variant_cpus[k].name);
+                                if (r == -EOPNOTSUPP)
+                                        continue;
+                                assert(r >= 0);
+
+                                data = test_writer_frames_one(type, n_strings[i], &size);
+                                assert(size == n_reference);
+                                assert(!memcmp(data, reference, size));
+                                free(data);
+                        }
+
+                        free(reference);
+                }
+        }
+}
+
+static void *test_writer_dict_one(bool builder, const char *long_key, size_t *sizep) {
+        static const char *const keys[] = { "a", "bb", "ccc" };
+        static const char *const strings[] = { "foo", "", "foobar" };
+        static const uint64_t u64s[] = { 1, 0xffffffffffULL, 3 };
+        static const uint32_t u32s[] = { 7, 8, 9 };
+        static const uint8_t bools[] = { 1, 0, 0xff };
+        const struct iovec *vecs;
+        CVariant *cv, *value;
+        size_t i, n_vecs, size;
+        char *data;
+        int r;
+
+        /*
+         * Write an 'a{sv}' dictionary with a mix of entries, either via the
+         * dictionary builder, or via the generic writer, and return it as
+         * linear buffer.
+         */
+
+        r = c_variant_new(&value, "(sau)", 5);
+        assert(r >= 0);
+        r = c_variant_begin(value, "(");
+        assert(r >= 0);
+        r = c_variant_write(value, "s", "nested");
+        assert(r >= 0);
+        r = c_variant_begin(value, "a");
+        assert(r >= 0);
+        for (i = 0; i < 3; ++i) {
+                r = c_variant_write(value, "u", u32s[i]);
+                assert(r >= 0);
+        }
+        r = c_variant_end(value, "a)");
+        assert(r >= 0);
+        r = c_variant_seal(value);
+        assert(r >= 0);
+
+        r = c_variant_new(&cv, "a{sv}", 5);
+        assert(r >= 0);
+        r = c_variant_begin(cv, "a");
+        assert(r >= 0);
+
+        if (builder) {
+                r = c_variant_dict_add_u32(cv, "u32", 0xdeadbeef);
+                assert(r >= 0);
+                r = c_variant_dict_add_str(cv, "str", "string value");
+                assert(r >= 0);
+                r = c_variant_dict_add_variant(cv, "nested", value);
+                assert(r >= 0);
+                r = c_variant_dict_add_variant(cv, "unit", NULL);
+                assert(r >= 0);
+                r = c_variant_dict_add_str(cv, long_key, long_key);
+                assert(r >= 0);
+                r = c_variant_dict_add_array(cv, "u", keys, u32s, 3);
+                assert(r >= 0);
+                r = c_variant_dict_add_array(cv, "t", keys, u64s, 3);
+                assert(r >= 0);
+                r = c_variant_dict_add_array(cv, "s", keys, strings, 3);
+                assert(r >= 0);
+                r = c_variant_dict_add_array(cv, "b", keys, bools, 3);
+                assert(r >= 0);
+        } else {
+                r = c_variant_write(cv, "{sv}", "u32", "u", 0xdeadbeef);
+                assert(r >= 0);
+                r = c_variant_write(cv, "{sv}", "str", "s", "string value");
+                assert(r >= 0);
+                r = c_variant_begin(cv, "{");
+                assert(r >= 0);
+                r = c_variant_write(cv, "s", "nested");
+                assert(r >= 0);
+                r = c_variant_begin(cv, "v", "(sau)");
+                assert(r >= 0);
+                r = c_variant_begin(cv, "(");
+                assert(r >= 0);
+                r = c_variant_write(cv, "s", "nested");
+                assert(r >= 0);
+                r = c_variant_begin(cv, "a");
+                assert(r >= 0);
+                for (i = 0; i < 3; ++i) {
+                        r = c_variant_write(cv, "u", u32s[i]);
+                        assert(r >= 0);
+                }
+                r = c_variant_end(cv, "a)v}");
+                assert(r >= 0);
+                r = c_variant_begin(cv, "{");
+                assert(r >= 0);
+                r = c_variant_write(cv, "s", "unit");
+                assert(r >= 0);
+                r = c_variant_begin(cv, "v(", "()");
+                assert(r >= 0);
+                r = c_variant_end(cv, ")v}");
+                assert(r >= 0);
+                r = c_variant_write(cv, "{sv}", long_key, "s", long_key);
+                assert(r >= 0);
+                for (i = 0; i < 3; ++i) {
+                        r = c_variant_write(cv, "{sv}", keys[i], "u", u32s[i]);
+                        assert(r >= 0);
+                }
+                for (i = 0; i < 3; ++i) {
+                        r = c_variant_write(cv, "{sv}", keys[i], "t", u64s[i]);
+                        assert(r >= 0);
+                }
+                for (i = 0; i < 3; ++i) {
+                        r = c_variant_write(cv, "{sv}", keys[i], "s", strings[i]);
+                        assert(r >= 0);
+                }
+                for (i = 0; i < 3; ++i) {
+                        r = c_variant_write(cv, "{sv}", keys[i], "b", !!bools[i]);
+                        assert(r >= 0);
+                }
+        }
+
+        r = c_variant_end(cv, "a");
+        assert(r >= 0);
+        r = c_variant_seal(cv);
+        assert(r >= 0);
+
+        vecs = c_variant_get_vecs(cv, &n_vecs);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i)
+                size += vecs[i].iov_len;
+
+        data = malloc(size);
+        assert(data);
+
+        size = 0;
+        for (i = 0; i < n_vecs; ++i) {
+                memcpy(data + size, vecs[i].iov_base, vecs[i].iov_len);
+                size += vecs[i].iov_len;
+        }
+
+        c_variant_free(value);
+        c_variant_free(cv);
+        *sizep = size;
+        return data;
+}
+
+static void test_writer_dict(void) {
+        static const size_t n_keys[] = { 1, 200, 300, 70000 };
+        size_t i, size, n_reference;
+        char *key, *data, *reference;
+        CVariant *cv;
+        int r;
+
+        /*
+         * The dictionary builder must produce the exact same serialization
+         * as the generic writer, for all word sizes of the entries.
+         */
+
+        for (i = 0; i < sizeof(n_keys) / sizeof(*n_keys); ++i) {
+                key = malloc(n_keys[i] + 1);
+                assert(key);
+                memset(key, 'k', n_keys[i]);
+                key[n_keys[i]] = 0;
+
+                reference = test_writer_dict_one(false, key, &n_reference);
+                data = test_writer_dict_one(true, key, &size);
+                assert(size == n_reference);
+                assert(!memcmp(data, reference, size));
+
+                free(reference);
+                free(data);
+                free(key);
+        }
+
+        /* the builder only operates on 'a{sv}' */
+        r = c_variant_new(&cv, "a{su}", 5);
+        assert(r >= 0);
+        r = c_variant_begin(cv, "a");
+        assert(r >= 0);
+        r = c_variant_dict_add_u32(cv, "foo", 1);
+        assert(r == -EBADRQC);
+        cv = c_variant_free(cv);
+
+        r = c_variant_new(&cv, "a{sv}", 5);
+        assert(r >= 0);
+        r = c_variant_begin(cv, "a");
+        assert(r >= 0);
+        r = c_variant_dict_add_array(cv, "as", NULL, NULL, 0);
+        assert(r == -EMEDIUMTYPE);
+        cv = c_variant_free(cv);
+}
+
 int main(int argc, char **argv) {
-        test_writer_basic();
-        test_writer_compound();
+        size_t i;
+        int r;
+
+        /* run everything on all CPU implementations supported by this machine */
+        for (i = 0; i < c_variant_n_cpus; ++i) {
+                r = c_variant_cpu_select(c_variant_cpus[i].name);
+                if (r == -EOPNOTSUPP) {
+                        fprintf(stderr, "Skipping unsupported CPU implementation: %s\n",
+                                c_variant_cpus[i].name);
+                        continue;
+                }
+                assert(r >= 0);
+
+                test_writer_basic();
+                test_writer_compound();
+        }
+
+        test_writer_frames();
+        test_writer_dict();
         return 0;
 }